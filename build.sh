@@ -1 +1 @@
-g++ -std=c++17 ./src/main.cpp -o NohEval -lboost_program_options
+g++ -std=c++17 -pthread ./src/main.cpp -o NohEval -lboost_program_options
@@ -0,0 +1,547 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "aot_runtime_noh.hpp"
+#include "ast_noh.hpp"
+#include "infer_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+#include "walk_noh.hpp"
+
+namespace Noh {
+namespace aot {
+
+// Translates a linked ModuleAst into a standalone C++ program (the runtime is pasted in front).
+// Variables, parameters and results that type inference finds to be Num become std::int64_t,
+// everything else a noh::Value checked at run time. Calls are C++ calls; a function's tail
+// calls to itself become a jump back to its start.
+class Translator {
+	EvalOption option;
+	infer::TypeInfer types;
+	std::unordered_set<ast::FuncAst*> memoized;
+	std::vector<std::string> errors;
+
+	// state of the function being translated
+	struct Var {
+		std::string Name;
+		bool Num;
+	};
+	ast::FuncAst* cur = nullptr;
+	std::vector<std::unordered_map<std::string, Var>> scopes;
+	std::ostringstream body;
+	int depth = 0, fresh = 0, loops = 0;
+	bool tailCalls = false;
+
+	// a translated expression; Num: its C++ type is std::int64_t, otherwise noh::Value
+	struct Code {
+		std::string Text;
+		bool Num;
+		bool Calls; // evaluating it may have side effects
+	};
+
+	void error(const std::string& msg)
+	{
+		errors.push_back("in fn " + cur->getName() + ": " + msg);
+	}
+
+	void line(const std::string& text)
+	{
+		for (int i{}; i < depth; i++) { body << '\t'; }
+		body << text << '\n';
+	}
+
+	static std::string FuncName(ast::FuncAst* func) { return "f_" + func->getName(); }
+	static std::string CType(bool num) { return num ? "std::int64_t" : "noh::Value"; }
+	bool numParam(ast::FuncAst* func, std::size_t idx) { return types.getParamType(func, idx) == ast::ValType::Num; }
+	bool numReturn(ast::FuncAst* func) { return types.getReturnType(func) == ast::ValType::Num; }
+
+	static std::string AsNum(const Code& code) { return code.Num ? code.Text : "noh::AsNum(" + code.Text + ")"; }
+	static std::string AsValue(const Code& code) { return code.Num ? "noh::Value(" + code.Text + ")" : code.Text; }
+	static std::string As(bool num, const Code& code) { return num ? AsNum(code) : AsValue(code); }
+
+	static std::string Quote(const std::string& str)
+	{
+		static const char* hex = "0123456789abcdef";
+		std::string res = "std::string(\"";
+		for (const auto& c : str)
+		{
+			const auto u = static_cast<unsigned char>(c);
+			if (c == '"' or c == '\\') { res += '\\'; res += c; }
+			else if (u >= 0x20 and u < 0x7f) { res += c; }
+			else
+			{
+				// closing the literal keeps a following hex digit out of the escape
+				res += "\\x"; res += hex[u >> 4]; res += hex[u & 15]; res += "\" \"";
+			}
+		}
+		return res + "\", " + std::to_string(str.size()) + ")";
+	}
+
+	// ================
+	//      scope
+	// ================
+
+	void pushScope() { scopes.emplace_back(); }
+	void popScope() { scopes.pop_back(); }
+
+	// every declaration gets its own C++ name, so shadowing never clashes
+	std::string declare(const std::string& name, bool num)
+	{
+		auto cname = "v" + std::to_string(fresh++) + "_" + name;
+		scopes.back()[name] = Var{cname, num};
+		return cname;
+	}
+
+	const Var* lookup(const std::string& name)
+	{
+		for (auto itr = scopes.rbegin(); itr != scopes.rend(); itr++)
+		{
+			if (auto found = itr->find(name); found != std::end(*itr)) { return &found->second; }
+		}
+		error("unknown ident '" + name + "'");
+		return nullptr;
+	}
+
+	// ================
+	//       expr
+	// ================
+
+	Code translateExpr(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+		{
+			const auto val = static_cast<ast::NumberAst*>(ast)->getVal();
+			// typed literals: `50000 * 100000` must not be computed in int
+			if (val == INT64_MIN) { return Code{"INT64_MIN", true, false}; }
+			return Code{val < 0 ? "(-INT64_C(" + std::to_string(-val) + "))" : "INT64_C(" + std::to_string(val) + ")", true, false};
+		}
+		case ast::StringID:
+			return Code{"noh::Value(" + Quote(static_cast<ast::StringAst*>(ast)->getVal()) + ")", false, false};
+		case ast::TupleID:
+		{
+			std::string text = "noh::Value(noh::Tuple{";
+			bool calls = false;
+			auto& ary = static_cast<ast::TupleAst*>(ast)->Ary;
+			for (std::size_t i{}; i < ary.size(); i++)
+			{
+				const auto elm = translateExpr(ary[i]);
+				text += (i ? ", " : "") + AsValue(elm);
+				calls = calls or elm.Calls;
+			}
+			return Code{text + "})", false, calls};
+		}
+		case ast::IdentID:
+		{
+			auto var = lookup(static_cast<ast::IdentAst*>(ast)->getIdent());
+			if (not var) { return Code{"0", true, false}; }
+			return Code{var->Name, var->Num, false};
+		}
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			const auto lhs = translateExpr(mono->getLhs());
+			const auto& op = mono->getOp();
+			if (op == "!") { return Code{"static_cast<std::int64_t>(!" + AsNum(lhs) + ")", true, lhs.Calls}; }
+			return Code{"(" + op + AsNum(lhs) + ")", true, lhs.Calls};
+		}
+		case ast::BinaryExpID:
+			return translateBinary(static_cast<ast::BinaryExpAst*>(ast));
+		case ast::CallID:
+			return translateCall(static_cast<ast::CallAst*>(ast));
+		default:
+			error("illegal expression");
+			return Code{"0", true, false};
+		}
+	}
+
+	Code translateBinary(ast::BinaryExpAst* ast)
+	{
+		const auto lhs = translateExpr(ast->getLhs());
+		const auto rhs = translateExpr(ast->getRhs());
+		const auto& op = ast->getOp();
+		const bool calls = lhs.Calls or rhs.Calls;
+		if (op == "IdxAt") { return Code{"noh::At(" + AsValue(lhs) + ", " + AsNum(rhs) + ")", false, calls}; }
+
+		if (op == "&&" or op == "||")
+		{
+			// C++'s && and || already evaluate lhs first and skip rhs when lhs decides
+			return Code{"static_cast<std::int64_t>((" + AsNum(lhs) + " != 0) " + op + " (" + AsNum(rhs) + " != 0))", true, calls};
+		}
+
+		// C++ leaves the order of operands unspecified; Noh evaluates lhs first
+		std::string l = AsNum(lhs), r = AsNum(rhs), pre{};
+		if (lhs.Calls and rhs.Calls)
+		{
+			pre = "[&] { const std::int64_t lhs_ = " + l + "; return ";
+			l = "lhs_";
+		}
+		std::string text{};
+		if (op == "+" or op == "-" or op == "*") { text = "(" + l + " " + op + " " + r + ")"; }
+		else if (op == "/") { text = "noh::Div(" + l + ", " + r + ")"; }
+		else if (op == "%") { text = "noh::Mod(" + l + ", " + r + ")"; }
+		else if (op == "==" or op == "!=" or op == "<" or op == ">" or op == "<=" or op == ">=")
+		{
+			text = "static_cast<std::int64_t>(" + l + " " + op + " " + r + ")";
+		}
+		else
+		{
+			error("unknown operator '" + op + "'");
+			text = "0";
+		}
+		if (not pre.empty()) { text = pre + text + "; }()"; }
+		return Code{text, true, calls};
+	}
+
+	Code translateCall(ast::CallAst* ast)
+	{
+		auto callee = ast->getCallee();
+		if (not callee)
+		{
+			error("unlinked call to '" + ast->getFuncName() + "'");
+			return Code{"0", true, false};
+		}
+		auto& params = ast->getParams();
+		std::vector<std::string> args{};
+		int withCalls = 0;
+		for (std::size_t i{}; i < params.size(); i++)
+		{
+			const auto arg = translateExpr(params[i]);
+			args.push_back(As(numParam(callee, i), arg));
+			withCalls += arg.Calls;
+		}
+
+		std::string text = FuncName(callee) + "(";
+		if (withCalls >= 2)
+		{
+			// keep the arguments in Noh's left-to-right order
+			std::string pre = "[&] { ";
+			for (std::size_t i{}; i < args.size(); i++)
+			{
+				pre += "auto arg" + std::to_string(i) + "_ = " + args[i] + "; ";
+				text += (i ? ", " : "") + std::string("std::move(arg") + std::to_string(i) + "_)";
+			}
+			return Code{pre + "return " + text + "); }()", numReturn(callee), true};
+		}
+		for (std::size_t i{}; i < args.size(); i++) { text += (i ? ", " : "") + args[i]; }
+		return Code{text + ")", numReturn(callee), true};
+	}
+
+	// ================
+	//       stmt
+	// ================
+
+	void translateBlock(std::vector<ast::BaseAst*>& stmts)
+	{
+		pushScope();
+		depth++;
+		for (auto& stmt : stmts) { translateStmt(stmt); }
+		depth--;
+		popScope();
+	}
+
+	void translateStmt(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+			translateBuiltin(static_cast<ast::BuiltinAst*>(ast));
+			break;
+		case ast::AssignID:
+		{
+			auto assign = static_cast<ast::AssignAst*>(ast);
+			const auto val = translateExpr(assign->getVal());
+			line(CType(val.Num) + " " + declare(assign->getName(), val.Num) + " = " + val.Text + ";");
+			break;
+		}
+		case ast::ReAssignID:
+		{
+			auto assign = static_cast<ast::ReAssignAst*>(ast);
+			const auto val = translateExpr(assign->getVal());
+			auto var = lookup(assign->getName());
+			if (not var) { break; }
+			if (var->Num) { line(var->Name + " = " + AsNum(val) + ";"); }
+			else { line("noh::Assign(" + var->Name + ", " + AsValue(val) + ");"); }
+			break;
+		}
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			line("if (" + AsNum(translateExpr(stmt->getCond())) + " != 0)");
+			line("{");
+			translateBlock(stmt->getThenStmt());
+			line("}");
+			if (not stmt->getElseStmt().empty())
+			{
+				line("else");
+				line("{");
+				translateBlock(stmt->getElseStmt());
+				line("}");
+			}
+			break;
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			line("while (" + AsNum(translateExpr(stmt->getCond())) + " != 0)");
+			line("{");
+			loops++;
+			translateBlock(stmt->getLoopStmt());
+			loops--;
+			line("}");
+			break;
+		}
+		case ast::ForStmtID:
+			translateFor(static_cast<ast::ForStmtAst*>(ast));
+			break;
+		case ast::CallID:
+			line(translateExpr(ast).Text + ";");
+			break;
+		default:
+			error("illegal statement");
+		}
+	}
+
+	void translateFor(ast::ForStmtAst* ast)
+	{
+		// the counter is hidden, so the body may overwrite the loop variable
+		const auto id = std::to_string(fresh++);
+		const auto from = AsNum(translateExpr(ast->getRange()->getFrom()));
+		const auto to = AsNum(translateExpr(ast->getRange()->getTo()));
+		line("for (std::int64_t i" + id + "_ = " + from + ", e" + id + "_ = " + to + "; i" + id + "_ < e" + id + "_; i" + id + "_++)");
+		line("{");
+		pushScope();
+		depth++;
+		line("std::int64_t " + declare(ast->getIdent(), true) + " = i" + id + "_;");
+		loops++;
+		for (auto& stmt : ast->getStmts()) { translateStmt(stmt); }
+		loops--;
+		depth--;
+		popScope();
+		line("}");
+	}
+
+	void translateBuiltin(ast::BuiltinAst* ast)
+	{
+		const auto& name = ast->getName();
+		auto& args = ast->getArgs();
+		if (name == "break" or name == "continue")
+		{
+			if (loops == 0)
+			{
+				error("'" + name + "' outside of a loop");
+				return;
+			}
+			line(name + ";");
+		}
+		else if (name == "exit")
+		{
+			line("noh::Exit();");
+		}
+		else if (name == "return")
+		{
+			auto val = args.front();
+			if (val->getID() == ast::CallID and static_cast<ast::CallAst*>(val)->getCallee() == cur and not memoized.count(cur))
+			{
+				translateTailCall(static_cast<ast::CallAst*>(val));
+				return;
+			}
+			line("return " + As(numReturn(cur), translateExpr(val)) + ";");
+		}
+		else if (name == "print")
+		{
+			for (auto& arg : args) { line("noh::Print(" + translateExpr(arg).Text + ");"); }
+		}
+		else if (name == "scanNum" or name == "scanStr")
+		{
+			for (auto& arg : args)
+			{
+				auto var = lookup(static_cast<ast::IdentAst*>(arg)->getIdent());
+				if (var) { line(std::string(name == "scanNum" ? "noh::ScanNum(" : "noh::ScanStr(") + var->Name + ");"); }
+			}
+		}
+		else
+		{
+			error("unknown builtin '" + name + "'");
+		}
+	}
+
+	// `return f(...)` inside f: rebind the parameters and start over
+	void translateTailCall(ast::CallAst* call)
+	{
+		auto& params = call->getParams();
+		line("{");
+		depth++;
+		for (std::size_t i{}; i < params.size(); i++)
+		{
+			line("auto arg" + std::to_string(i) + "_ = " + As(numParam(cur, i), translateExpr(params[i])) + ";");
+		}
+		for (std::size_t i{}; i < params.size(); i++)
+		{
+			line("p_" + cur->getParamNames()[i] + " = std::move(arg" + std::to_string(i) + "_);");
+		}
+		line("goto tail_;");
+		depth--;
+		line("}");
+		tailCalls = true;
+	}
+
+	// ================
+	//       func
+	// ================
+
+	std::string signature(ast::FuncAst* func, const std::string& name)
+	{
+		std::string res = CType(numReturn(func)) + " " + name + "(";
+		for (std::size_t i{}; i < func->getParamNames().size(); i++)
+		{
+			res += (i ? ", " : "") + CType(numParam(func, i)) + " p_" + func->getParamNames()[i];
+		}
+		return res + ")";
+	}
+
+	void translateFunc(ast::FuncAst* func, std::ostream& out)
+	{
+		cur = func;
+		scopes.clear();
+		body.str("");
+		depth = 1;
+		loops = 0;
+		tailCalls = false;
+
+		pushScope();
+		for (std::size_t i{}; i < func->getParamNames().size(); i++)
+		{
+			scopes.back()[func->getParamNames()[i]] = Var{"p_" + func->getParamNames()[i], numParam(func, i)};
+		}
+		for (auto& stmt : func->getInst()) { translateStmt(stmt); }
+		line(std::string("return ") + (numReturn(func) ? "0" : "noh::Value(0)") + ";");
+		popScope();
+
+		const bool memo = memoized.count(func);
+		out << "static " << signature(func, memo ? "b_" + func->getName() : FuncName(func)) << "\n{\n";
+		if (tailCalls) { out << "tail_:\n"; }
+		out << body.str() << "}\n\n";
+		if (not memo) { return; }
+
+		// the memoized entry point wraps the body
+		out << "static noh::MemoTable m_" << func->getName() << "(" << option.MemoCapacity << ");\n\n";
+		out << "static " << signature(func, FuncName(func)) << "\n{\n";
+		out << "\tstd::string key{};\n";
+		for (std::size_t i{}; i < func->getParamNames().size(); i++)
+		{
+			out << "\tnoh::AppendKey(key, noh::Value(p_" << func->getParamNames()[i] << "));\n";
+		}
+		out << "\tif (auto hit = m_" << func->getName() << ".find(key)) { return " << (numReturn(func) ? "hit->Num" : "*hit") << "; }\n";
+		out << "\tauto ret = b_" << func->getName() << "(";
+		for (std::size_t i{}; i < func->getParamNames().size(); i++)
+		{
+			out << (i ? ", " : "") << "p_" << func->getParamNames()[i];
+		}
+		out << ");\n";
+		out << "\tm_" << func->getName() << ".insert(key, noh::Value(ret));\n";
+		out << "\treturn ret;\n}\n\n";
+	}
+
+public:
+	Translator(const EvalOption& option = EvalOption{}) : option(option), types(), memoized(), errors(), scopes(), body() {}
+
+	// Writes the C++ program for `ast`, which must be linked (link_noh.hpp).
+	bool translate(ast::ModuleAst* ast, const std::string& source, std::ostream& out)
+	{
+		types.run(ast);
+
+		std::unordered_map<std::string, ast::FuncAst*> funcs;
+		for (auto& func : ast->getFuncs()) { funcs[func->getName()] = func; }
+		memo::Purity purity(funcs);
+		for (auto& func : ast->getFuncs())
+		{
+			if (not func->getIsMemo() and not option.MemoAll) { continue; }
+			if (purity.isPure(func))
+			{
+				memoized.insert(func);
+			}
+			else if (func->getIsMemo())
+			{
+				std::cerr << "warning: '" << func->getName() << "' is not pure and will not be memoized" << std::endl;
+			}
+		}
+
+		out << "// translated from " << source << " by NohEval --emit-cpp\n";
+		out << Runtime << '\n';
+		for (auto& func : ast->getFuncs()) { out << "static " << signature(func, FuncName(func)) << ";\n"; }
+		out << '\n';
+		for (auto& func : ast->getFuncs()) { translateFunc(func, out); }
+
+		ast::FuncAst* entry = funcs.count("main") ? funcs.at("main") : nullptr;
+		if (not entry)
+		{
+			for (auto& func : ast->getFuncs())
+			{
+				if (func->getParamNames().empty())
+				{
+					entry = func;
+					break;
+				}
+			}
+		}
+		// fn main(state) takes the result of fn init()
+		ast::FuncAst* init = funcs.count("init") ? funcs.at("init") : nullptr;
+		if (init and not init->getParamNames().empty()) { init = nullptr; }
+		std::string state{};
+		if (entry and entry->getParamNames().size() == 1 and init)
+		{
+			state = As(numParam(entry, 0), Code{FuncName(init) + "()", numReturn(init), true});
+		}
+		else if (entry and not entry->getParamNames().empty())
+		{
+			errors.push_back("fn main must not take parameters, or take only the result of fn init()");
+		}
+		if (entry)
+		{
+			out << "static void entry() { " << FuncName(entry) << "(" << state << "); }\n\n";
+			out << "int main() { return noh::Run(entry); }\n";
+		}
+		else
+		{
+			out << "int main() { return 0; }\n";
+		}
+		return errors.empty();
+	}
+
+	const std::vector<std::string>& getErrors() const { return errors; }
+};
+
+// Quotes `str` for /bin/sh.
+inline std::string ShellQuote(const std::string& str)
+{
+	std::string res = "'";
+	for (const auto& c : str)
+	{
+		if (c == '\'') { res += "'\\''"; }
+		else { res += c; }
+	}
+	return res + "'";
+}
+
+// Compiles a translated program with the host C++ compiler ($CXX, or g++).
+// Returns the compiler's exit status.
+inline int Build(const std::string& cppPath, const std::string& exePath)
+{
+	const char* cxx = std::getenv("CXX");
+	const std::string cmd = std::string(cxx and *cxx ? cxx : "g++") + " -std=c++17 -O2 -pthread "
+		+ ShellQuote(cppPath) + " -o " + ShellQuote(exePath);
+	const int status = std::system(cmd.c_str());
+	return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace aot
+} // namespace Noh
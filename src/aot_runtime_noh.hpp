@@ -0,0 +1,207 @@
+#pragma once
+
+namespace Noh {
+namespace aot {
+
+// The runtime every translated program starts with (see aot_noh.hpp).
+// It is pasted into the generated C++ so that the output compiles on its own.
+inline constexpr const char* Runtime = R"NOH(#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#if defined(__unix__)
+#include <pthread.h>
+#endif
+
+namespace noh {
+
+enum class Type : std::uint8_t { Num, Str, Tpl };
+
+struct Value;
+using Tuple = std::vector<Value>;
+
+// A variable whose type is not known statically. Num variables are plain std::int64_t.
+struct Value {
+	Type T;
+	std::int64_t Num;
+	std::shared_ptr<const std::string> Str;
+	std::shared_ptr<const Tuple> Tpl;
+
+	Value(std::int64_t num = 0) : T(Type::Num), Num(num), Str(), Tpl() {}
+	Value(std::string str) : T(Type::Str), Num(0), Str(std::make_shared<const std::string>(std::move(str))), Tpl() {}
+	Value(Tuple tpl) : T(Type::Tpl), Num(0), Str(), Tpl(std::make_shared<const Tuple>(std::move(tpl))) {}
+};
+
+inline const char* TypeName(Type type)
+{
+	return type == Type::Num ? "Num" : type == Type::Str ? "Str" : "Tuple";
+}
+
+[[noreturn]] inline void Fail(const std::string& msg)
+{
+	std::cout << std::flush;
+	std::cerr << "runtime error: " << msg << std::endl;
+	std::exit(EXIT_FAILURE);
+}
+
+[[noreturn]] inline void Exit()
+{
+	std::cout << std::flush;
+	std::exit(EXIT_SUCCESS);
+}
+
+inline std::int64_t AsNum(std::int64_t num) { return num; }
+inline std::int64_t AsNum(const Value& val)
+{
+	if (val.T != Type::Num) { Fail(std::string("expected a Num, got ") + TypeName(val.T)); }
+	return val.Num;
+}
+
+inline std::int64_t Div(std::int64_t lhs, std::int64_t rhs)
+{
+	if (rhs == 0) { Fail("division by zero"); }
+	return lhs / rhs;
+}
+
+inline std::int64_t Mod(std::int64_t lhs, std::int64_t rhs)
+{
+	if (rhs == 0) { Fail("division by zero"); }
+	return lhs % rhs;
+}
+
+inline Value At(const Value& tpl, std::int64_t idx)
+{
+	if (tpl.T != Type::Tpl) { Fail(std::string("cannot index ") + TypeName(tpl.T) + " with Num"); }
+	if (idx < 0 or static_cast<std::size_t>(idx) >= tpl.Tpl->size())
+	{
+		Fail("tuple index " + std::to_string(idx) + " out of range");
+	}
+	return (*tpl.Tpl)[idx];
+}
+
+// Reassignment keeps the type the variable was declared with.
+inline void Assign(Value& var, Value val)
+{
+	if (var.T != val.T)
+	{
+		Fail(std::string("cannot assign ") + TypeName(val.T) + " to a " + TypeName(var.T) + " variable");
+	}
+	var = std::move(val);
+}
+
+inline void Print(std::int64_t num) { std::cout << num << '\n'; }
+inline void Print(const Value& val)
+{
+	if (val.T == Type::Num) { std::cout << val.Num << '\n'; }
+	else if (val.T == Type::Str) { std::cout << *val.Str << '\n'; }
+	else { Fail("cannot print a Tuple"); }
+}
+
+inline void ScanNum(std::int64_t& var) { std::cin >> var; }
+inline void ScanNum(Value& var)
+{
+	if (var.T != Type::Num) { Fail("scanNum expects a Num variable"); }
+	std::cin >> var.Num;
+}
+
+inline void ScanStr(std::int64_t&) { Fail("scanStr expects a Str variable"); }
+inline void ScanStr(Value& var)
+{
+	if (var.T != Type::Str) { Fail("scanStr expects a Str variable"); }
+	std::string tmp;
+	std::cin >> tmp;
+	var.Str = std::make_shared<const std::string>(std::move(tmp));
+}
+
+// ================
+//       memo
+// ================
+
+inline void AppendKey(std::string& key, const Value& val)
+{
+	switch (val.T) {
+	case Type::Num:
+	{
+		char buf[sizeof(val.Num)];
+		std::memcpy(buf, &val.Num, sizeof(val.Num));
+		key += 'n';
+		key.append(buf, sizeof(val.Num));
+		break;
+	}
+	case Type::Str:
+		key += 's';
+		key += std::to_string(val.Str->size());
+		key += ':';
+		key += *val.Str;
+		break;
+	case Type::Tpl:
+		key += 't';
+		key += std::to_string(val.Tpl->size());
+		key += ':';
+		for (const auto& elm : *val.Tpl) { AppendKey(key, elm); }
+		break;
+	}
+}
+
+// Bounded argument -> result cache; the oldest entry is evicted first.
+class MemoTable {
+	std::size_t capacity;
+	std::unordered_map<std::string, Value> table;
+	std::deque<std::string> order;
+public:
+	MemoTable(std::size_t capacity) : capacity(capacity), table(), order() {}
+
+	const Value* find(const std::string& key) const
+	{
+		auto itr = table.find(key);
+		return itr == std::end(table) ? nullptr : &itr->second;
+	}
+
+	void insert(const std::string& key, const Value& val)
+	{
+		if (capacity == 0 or table.find(key) != std::end(table)) { return; }
+		if (table.size() >= capacity)
+		{
+			table.erase(order.front());
+			order.pop_front();
+		}
+		table.emplace(key, val);
+		order.push_back(key);
+	}
+};
+
+// ================
+//       run
+// ================
+
+// Runs the program on a thread with a large stack: Noh recursion is C++ recursion here.
+inline int Run(void (*entry)())
+{
+#if defined(__unix__)
+	pthread_attr_t attr;
+	pthread_t thread;
+	if (pthread_attr_init(&attr) == 0 and pthread_attr_setstacksize(&attr, std::size_t(1) << 30) == 0
+		and pthread_create(&thread, &attr, [](void* arg) -> void* { reinterpret_cast<void (*)()>(arg)(); return nullptr; },
+			reinterpret_cast<void*>(entry)) == 0)
+	{
+		pthread_join(thread, nullptr);
+		pthread_attr_destroy(&attr);
+		std::cout << std::flush;
+		return EXIT_SUCCESS;
+	}
+#endif
+	entry();
+	std::cout << std::flush;
+	return EXIT_SUCCESS;
+}
+
+} // namespace noh
+)NOH";
+
+} // namespace aot
+} // namespace Noh
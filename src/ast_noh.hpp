@@ -29,16 +29,48 @@ enum AstID {
 	RangeID,
 	ForStmtID,
 	TupleID,
+	TaskID,
 
 	NoneID,
 };
 
+// Value type of an expression as found by type inference (infer_noh.hpp).
+// None: not inferred, Any: may hold different types at run time.
+enum class ValType : std::uint8_t {
+	None,
+	Num,
+	Str,
+	Tpl,
+	Any,
+};
+
+// Operator of a MonoExpAst / BinaryExpAst, decoded from its Op string when first evaluated.
+enum class OpKind : std::uint8_t {
+	None,
+	Add, Sub, Mul, Div, Mod,
+	Eq, Ne, Lt, Gt, Le, Ge,
+	And, Or,
+	IdxAt,
+	Not, Neg, BitNot,
+};
+
+// Run-time feedback state of a self-specializing node. Cold nodes take the generic path and
+// count how often their operands had the expected types; warm ones switch to Fast, and a
+// Fast node whose guard fails falls back to Generic for good.
+enum class Spec : std::uint8_t {
+	Cold,
+	Fast,
+	Generic,
+};
+
 class BaseAst {
 	AstID id;
+	ValType type = ValType::None;
 public:
 	BaseAst(AstID x) : id(x) {}
 	virtual ~BaseAst() {}
 	AstID getID() const { return this->id; }
+	ValType& getType() { return this->type; }
 };
 
 class VoidAst : public BaseAst {
@@ -50,7 +82,13 @@ public:
 	std::string Name;
 	std::vector<std::string> ParamNames;
 	std::vector<BaseAst*> Inst;
-	BaseAst* RetValue;
+	bool IsMemo = false;
+	BaseAst* RetValue = nullptr;
+	// JIT tier (jit_noh.hpp): Cold while counting calls, Fast once Native holds compiled code,
+	// Generic when the function cannot be compiled
+	Spec Tier = Spec::Cold;
+	std::uint32_t Calls = 0;
+	void* Native = nullptr;
 
 	FuncAst(const std::string& name) : BaseAst(AstID::FuncID), Name(name)
 	{
@@ -65,6 +103,7 @@ public:
 	std::string& getName() { return this->Name; }
 	std::vector<std::string>& getParamNames() { return this->ParamNames; }
 	std::vector<BaseAst*>& getInst() { return this->Inst; }
+	bool& getIsMemo() { return this->IsMemo; }
 	BaseAst*& getRetValue() { return this->RetValue; }
 };
 
@@ -72,6 +111,9 @@ class CallAst : public BaseAst {
 public:
 	std::string FuncName;
 	std::vector<BaseAst*> Params;
+	FuncAst* Callee = nullptr; // bound when the module is linked
+	Spec State = Spec::Cold;   // Fast: every argument is a Num
+	std::uint8_t Hits = 0;
 
 	CallAst(const std::string& name) : BaseAst(AstID::CallID), FuncName(name)
 	{
@@ -80,11 +122,13 @@ public:
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::CallID; }
 	std::string& getFuncName() { return this->FuncName; }
 	std::vector<BaseAst*>& getParams() { return this->Params; }
+	FuncAst*& getCallee() { return this->Callee; }
 };
 
 class ModuleAst : public BaseAst {
 public:
 	std::vector<FuncAst*> Funcs;
+	std::vector<std::string> Imports; // paths as written; import_noh.hpp links them in
 
 	ModuleAst() : BaseAst(AstID::ModuleID)
 	{
@@ -93,6 +137,7 @@ public:
 	~ModuleAst() { for(auto& p : this->Funcs) { delete p; } }
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::ModuleID; }
 	std::vector<FuncAst*>& getFuncs() { return this->Funcs; }
+	std::vector<std::string>& getImports() { return this->Imports; }
 };
 
 class NumberAst : public BaseAst {
@@ -131,12 +176,16 @@ public:
 		}
 	}
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::StringID; }
-	std::string getVal() { return this->Val; }
+	std::string& getVal() { return this->Val; }
 };
 
 class IdentAst : public BaseAst {
 	std::string Ident;
 public:
+	// the variable this identifier resolved to, valid while the evaluator's scope epoch is CacheEpoch
+	std::uint_fast64_t CacheEpoch = 0;
+	BaseAst* CacheVal = nullptr;
+
 	IdentAst(const std::string& ident) : BaseAst(AstID::IdentID), Ident(ident)
 	{
 		if constexpr (isDebug) { std::cerr << "IdentAst(" << this << ") " << Ident << std::endl; }
@@ -146,9 +195,11 @@ public:
 };
 
 class MonoExpAst : public BaseAst {
+public:
 	std::string Op;
 	BaseAst* Lhs;
-public:
+	OpKind Kind = OpKind::None;
+
 	MonoExpAst(const std::string& op, BaseAst* lhs) : BaseAst(AstID::MonoExpID), Op(op), Lhs(lhs)
 	{
 		if constexpr (isDebug) { std::cerr << "MonoExpAst(" << this << ") " << op << ' ' << lhs << std::endl; }
@@ -156,13 +207,16 @@ public:
 	~MonoExpAst() { delete this->Lhs; }
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::MonoExpID; }
 	std::string& getOp() { return this->Op; }
-	BaseAst* getLhs() { return this->Lhs; }
+	BaseAst*& getLhs() { return this->Lhs; }
 };
 
 class BinaryExpAst : public BaseAst {
 public:
 	std::string Op;
 	BaseAst* Lhs, * Rhs;
+	OpKind Kind = OpKind::None;
+	Spec State = Spec::Cold; // Fast: both operands are Num, or for IdxAt the tuple is a variable
+	std::uint8_t Hits = 0;
 
 	BinaryExpAst(const std::string& op, BaseAst* lhs, BaseAst* rhs)
 		: BaseAst(AstID::BinaryExpID), Op(op), Lhs(lhs), Rhs(rhs)
@@ -177,8 +231,8 @@ public:
 	~BinaryExpAst() { delete this->Lhs; delete this->Rhs; }
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::BinaryExpID; }
 	std::string& getOp() { return this->Op; }
-	BaseAst* getLhs() { return this->Lhs; }
-	BaseAst* getRhs() { return this->Rhs; }
+	BaseAst*& getLhs() { return this->Lhs; }
+	BaseAst*& getRhs() { return this->Rhs; }
 };
 
 class BuiltinAst : public BaseAst {
@@ -243,7 +297,7 @@ public:
 		for(auto& s : this->ElseStmt) { delete s; }
 	}
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::IfStmtID; }
-	BaseAst* getCond() { return this->Cond; }
+	BaseAst*& getCond() { return this->Cond; }
 	std::vector<BaseAst*>& getThenStmt() { return this->ThenStmt; }
 	std::vector<BaseAst*>& getElseStmt() { return this->ElseStmt; }
 };
@@ -263,7 +317,7 @@ public:
 		for(auto& s : this->LoopStmt) { delete s; }
 	}
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::WhileStmtID; }
-	BaseAst* getCond() { return this->Cond; }
+	BaseAst*& getCond() { return this->Cond; }
 	std::vector<BaseAst*>& getLoopStmt() { return this->LoopStmt; }
 };
 
@@ -282,8 +336,8 @@ public:
 		delete this->To;
 	}
 	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::RangeID; }
-	BaseAst* getFrom() { return this->From; }
-	BaseAst* getTo() { return this->To; }
+	BaseAst*& getFrom() { return this->From; }
+	BaseAst*& getTo() { return this->To; }
 };
 
 class ForStmtAst : public BaseAst {
@@ -323,6 +377,23 @@ public:
 	std::vector<BaseAst*> getAry() { return this->Ary; }
 };
 
+// A task or channel operation: `spawn f(x)` (Args: the CallAst), `await h`, `chan(n)`,
+// `recv(c)` and `send(c, v)`. Only the bytecode machine runs them.
+class TaskAst : public BaseAst {
+public:
+	std::string Op;
+	std::vector<BaseAst*> Args;
+
+	TaskAst(const std::string& op, BaseAst* arg) : BaseAst(AstID::TaskID), Op(op), Args{arg}
+	{
+		if constexpr (isDebug) { std::cerr << "TaskAst(" << this << ") " << op << std::endl; }
+	}
+	~TaskAst() { for(auto& arg : this->Args) { delete arg; } }
+	static inline bool classOf(const BaseAst* base) { return base->getID() == AstID::TaskID; }
+	std::string& getOp() { return this->Op; }
+	std::vector<BaseAst*>& getArgs() { return this->Args; }
+};
+
 } // namespace ast
 } // namespace Noh
 
@@ -330,12 +401,14 @@ public:
 BOOST_FUSION_ADAPT_STRUCT(
 	Noh::ast::ModuleAst,
 	(std::vector<Noh::ast::FuncAst*>, Funcs)
+	(std::vector<std::string>, Imports)
 )
 BOOST_FUSION_ADAPT_STRUCT(
 	Noh::ast::FuncAst,
 	(std::string, Name)
 	(std::vector<std::string>, ParamNames)
 	(std::vector<Noh::ast::BaseAst*>, Inst)
+	(bool, IsMemo)
 )
 BOOST_FUSION_ADAPT_STRUCT(
 	Noh::ast::CallAst,
@@ -385,6 +458,11 @@ BOOST_FUSION_ADAPT_STRUCT(
 	(Noh::ast::BaseAst*, Lhs)
 	(Noh::ast::BaseAst*, Rhs)
 )
+BOOST_FUSION_ADAPT_STRUCT(
+	Noh::ast::TaskAst,
+	(std::string, Op)
+	(std::vector<Noh::ast::BaseAst*>, Args)
+)
 BOOST_FUSION_ADAPT_STRUCT(
 	Noh::ast::TupleAst,
 	(std::vector<Noh::ast::BaseAst*>, Ary)
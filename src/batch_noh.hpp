@@ -0,0 +1,169 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache_noh.hpp"
+#include "option_noh.hpp"
+#include "par_noh.hpp"
+#include "vm_noh.hpp"
+
+namespace Noh {
+namespace batch {
+
+// Reads one script path per line; blank lines and lines starting with # are skipped.
+inline bool ReadManifest(const std::string& path, std::vector<std::string>& scripts)
+{
+	std::ifstream fIn(path);
+	if (not fIn.is_open()) { return false; }
+	std::string line{};
+	while (std::getline(fIn, line))
+	{
+		if (line.empty() or line[0] == '#') { continue; }
+		scripts.push_back(line);
+	}
+	return true;
+}
+
+// --batch / --manifest: runs many scripts in one process, each on a fresh bytecode machine
+// with its own output buffers, and writes their output in the order given. Identical
+// scripts are compiled once. A timing summary goes to standard error at the end.
+class Runner {
+	using Clock = std::chrono::steady_clock;
+
+	struct Job {
+		std::string Path;
+		int Code = EXIT_SUCCESS;
+		bool Cached = false;
+		double CompileMs = 0;
+		double RunMs = 0;
+		std::ostringstream Out;
+		std::ostringstream Err;
+	};
+
+	const std::vector<std::string>& scripts;
+	int level;
+	EvalOption option;
+	cache::ModuleCache cache;
+	imports::ParseCache parsed; // modules, so a library imported by many scripts is parsed once
+	std::vector<Job> jobs;
+
+	static double millis(Clock::time_point from, Clock::time_point to)
+	{
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+
+	void runOne(Job& job)
+	{
+		const auto start = Clock::now();
+		std::string source{}, errors{};
+		std::vector<imports::Unit> units{};
+		if (not imports::ReadScript(job.Path, source, errors)
+			or not imports::Resolve(job.Path, std::move(source), units, errors))
+		{
+			job.Err << errors << '\n';
+			job.Code = EXIT_FAILURE;
+			return;
+		}
+		const auto key = imports::Key(units);
+		auto prog = cache.find(key);
+		job.Cached = prog != nullptr;
+		if (not prog)
+		{
+			prog = cache::Compile(units, level, option, &parsed, errors);
+			if (not prog)
+			{
+				job.Err << errors;
+				job.Code = EXIT_FAILURE;
+				job.CompileMs = millis(start, Clock::now());
+				return;
+			}
+			cache.insert(key, prog);
+		}
+		const auto compiled = Clock::now();
+
+		// scripts read nothing: standard input is not split between them
+		std::istringstream in{};
+		vm::Machine machine(*prog, option);
+		machine.setInput(in);
+		machine.setOutput(job.Out);
+		machine.setErrors(job.Err);
+		job.Code = machine.run();
+		job.CompileMs = millis(start, compiled);
+		job.RunMs = millis(compiled, Clock::now());
+	}
+
+	static void write(const Job& job)
+	{
+		std::cout << job.Out.str() << std::flush;
+		std::cerr << job.Err.str() << std::flush;
+	}
+
+	void summary(double totalMs) const
+	{
+		std::size_t failed = 0;
+		std::cerr << " exit    compile        run  script\n" << std::fixed << std::setprecision(3);
+		for (const auto& job : jobs)
+		{
+			if (job.Code != EXIT_SUCCESS) { failed++; }
+			std::cerr << std::setw(5) << job.Code << "  ";
+			if (job.Cached) { std::cerr << std::setw(9) << "(cached)"; }
+			else { std::cerr << std::setw(7) << job.CompileMs << "ms"; }
+			std::cerr << "  " << std::setw(7) << job.RunMs << "ms  " << job.Path << '\n';
+		}
+		std::cerr << jobs.size() << " scripts, " << failed << " failed, " << totalMs << "ms in all" << std::endl;
+	}
+
+public:
+	Runner(const std::vector<std::string>& scripts, int level, const EvalOption& option)
+		: scripts(scripts), level(level), option(option), cache(option.CacheSize), parsed(option.CacheSize),
+		jobs(scripts.size())
+	{
+		for (std::size_t i{}; i < scripts.size(); i++) { jobs[i].Path = scripts[i]; }
+	}
+
+	// EXIT_FAILURE if any script failed.
+	int run()
+	{
+		const auto start = Clock::now();
+		std::size_t threads = option.BatchThreads ? option.BatchThreads : std::thread::hardware_concurrency();
+		if (threads <= 1)
+		{
+			for (auto& job : jobs)
+			{
+				runOne(job);
+				write(job);
+			}
+		}
+		else
+		{
+			// every script is a task; waiting for them in order runs the others meanwhile
+			par::Pool pool(threads);
+			std::vector<std::shared_ptr<par::Pool::Task>> tasks{};
+			for (auto& job : jobs) { tasks.push_back(pool.spawn([&](std::size_t) { runOne(job); })); }
+			for (std::size_t i{}; i < jobs.size(); i++)
+			{
+				pool.join(*tasks[i]);
+				write(jobs[i]);
+			}
+		}
+		summary(millis(start, Clock::now()));
+		for (const auto& job : jobs)
+		{
+			if (job.Code != EXIT_SUCCESS) { return EXIT_FAILURE; }
+		}
+		return EXIT_SUCCESS;
+	}
+};
+
+} // namespace batch
+} // namespace Noh
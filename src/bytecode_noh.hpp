@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Noh {
+namespace vm {
+
+// ================
+//      value
+// ================
+
+enum class ValueType : std::uint8_t {
+	Num,
+	Str,
+	Tpl,
+	Task,
+	Chan,
+};
+
+struct Value;
+using Tuple = std::vector<Value>;
+struct Object; // a task handle or a channel (sched_noh.hpp)
+
+struct Value {
+	ValueType Type = ValueType::Num;
+	std::int_fast64_t Num = 0;
+	std::shared_ptr<const std::string> Str;
+	std::shared_ptr<const Tuple> Tpl;
+	std::shared_ptr<Object> Obj;
+
+	Value() = default;
+	Value(std::int_fast64_t num) : Type(ValueType::Num), Num(num) {}
+	Value(std::shared_ptr<const std::string> str) : Type(ValueType::Str), Str(std::move(str)) {}
+	Value(std::shared_ptr<const Tuple> tpl) : Type(ValueType::Tpl), Tpl(std::move(tpl)) {}
+	Value(ValueType type, std::shared_ptr<Object> obj) : Type(type), Obj(std::move(obj)) {}
+};
+
+inline const char* TypeName(ValueType type)
+{
+	switch (type) {
+	case ValueType::Num: return "Num";
+	case ValueType::Str: return "Str";
+	case ValueType::Tpl: return "Tuple";
+	case ValueType::Task: return "Task";
+	case ValueType::Chan: return "Chan";
+	}
+	return "?";
+}
+
+// Appends a value to a memo key; same layout as memo::AppendKey.
+inline void AppendKey(std::string& key, const Value& val)
+{
+	switch (val.Type) {
+	case ValueType::Num:
+	{
+		char buf[sizeof(val.Num)];
+		std::memcpy(buf, &val.Num, sizeof(val.Num));
+		key += 'n';
+		key.append(buf, sizeof(val.Num));
+		break;
+	}
+	case ValueType::Str:
+		key += 's';
+		key += std::to_string(val.Str->size());
+		key += ':';
+		key += *val.Str;
+		break;
+	case ValueType::Tpl:
+		key += 't';
+		key += std::to_string(val.Tpl->size());
+		key += ':';
+		for (const auto& elm : *val.Tpl) { AppendKey(key, elm); }
+		break;
+	case ValueType::Task:
+	case ValueType::Chan:
+	{
+		// handles are equal only when they are the same object
+		const auto addr = reinterpret_cast<std::uintptr_t>(val.Obj.get());
+		char buf[sizeof(addr)];
+		std::memcpy(buf, &addr, sizeof(addr));
+		key += 'o';
+		key.append(buf, sizeof(addr));
+		break;
+	}
+	}
+}
+
+// ================
+//     bytecode
+// ================
+
+enum class OpCode : std::uint8_t {
+	PushNum,     // push Nums[A]
+	PushStr,     // push Strs[A]
+	MakeTuple,   // pop A values, push them as a tuple
+	Load,        // push local A
+	Store,       // pop into local A (declaration)
+	ReStore,     // pop into local A, which must keep its type
+	Pop,
+
+	Add, Sub, Mul, Div, Mod,
+	Eq, Ne, Lt, Gt, Le, Ge,
+	And, Or,
+	Not, Neg, BitNot,
+	IdxAt,
+
+	Jump,        // pc = A
+	JumpIfFalse, // pop, pc = A if zero
+	JumpIfTrue,  // pop, pc = A if not zero
+
+	Call,        // call Funcs[A] with B arguments
+	TailCall,    // same, reusing the current frame
+	Ret,
+
+	Print,
+	ScanNum,     // read into local A
+	ScanStr,     // read into local A
+	Exit,
+
+	// tasks and channels (sched_noh.hpp); a blocked one runs again when its task resumes
+	Spawn,       // start Funcs[A] with B arguments as a task, push its handle
+	Await,       // pop a task handle, push the task's result once it has finished
+	MakeChan,    // pop a capacity, push a new channel
+	Send,        // pop a value and a channel, enqueue the value once there is room, push 0
+	Recv,        // pop a channel, push its oldest value once there is one
+
+	// superinstructions (fuse_noh.hpp); Sub is the fused operator
+	BinLL,       // push local A Sub local B
+	BinLK,       // push local A Sub Nums[B]
+	StoreLL,     // local C = local A Sub local B (declaration)
+	StoreLK,     // local C = local A Sub Nums[B] (declaration)
+	ReStoreLL,   // local C = local A Sub local B; local C must be a Num
+	ReStoreLK,   // local C = local A Sub Nums[B]; local C must be a Num
+	CmpJump,     // pop two, pc = A unless they compare true under Sub
+	CmpJumpLL,   // pc = C unless local A Sub local B
+	CmpJumpLK,   // pc = C unless local A Sub Nums[B]
+};
+
+inline constexpr bool IsBinaryOp(OpCode op) { return op >= OpCode::Add and op <= OpCode::Or; }
+inline constexpr bool IsCompareOp(OpCode op) { return op >= OpCode::Eq and op <= OpCode::Ge; }
+
+// the comparison that holds exactly when `op` does not
+inline constexpr OpCode NegateCompare(OpCode op)
+{
+	switch (op) {
+	case OpCode::Eq: return OpCode::Ne;
+	case OpCode::Ne: return OpCode::Eq;
+	case OpCode::Lt: return OpCode::Ge;
+	case OpCode::Ge: return OpCode::Lt;
+	case OpCode::Gt: return OpCode::Le;
+	case OpCode::Le: return OpCode::Gt;
+	default: return op;
+	}
+}
+
+inline const char* OpName(OpCode op)
+{
+	switch (op) {
+	case OpCode::PushNum: return "PushNum";
+	case OpCode::PushStr: return "PushStr";
+	case OpCode::MakeTuple: return "MakeTuple";
+	case OpCode::Load: return "Load";
+	case OpCode::Store: return "Store";
+	case OpCode::ReStore: return "ReStore";
+	case OpCode::Pop: return "Pop";
+	case OpCode::Add: return "Add";
+	case OpCode::Sub: return "Sub";
+	case OpCode::Mul: return "Mul";
+	case OpCode::Div: return "Div";
+	case OpCode::Mod: return "Mod";
+	case OpCode::Eq: return "Eq";
+	case OpCode::Ne: return "Ne";
+	case OpCode::Lt: return "Lt";
+	case OpCode::Gt: return "Gt";
+	case OpCode::Le: return "Le";
+	case OpCode::Ge: return "Ge";
+	case OpCode::And: return "And";
+	case OpCode::Or: return "Or";
+	case OpCode::Not: return "Not";
+	case OpCode::Neg: return "Neg";
+	case OpCode::BitNot: return "BitNot";
+	case OpCode::IdxAt: return "IdxAt";
+	case OpCode::Jump: return "Jump";
+	case OpCode::JumpIfFalse: return "JumpIfFalse";
+	case OpCode::JumpIfTrue: return "JumpIfTrue";
+	case OpCode::Call: return "Call";
+	case OpCode::TailCall: return "TailCall";
+	case OpCode::Ret: return "Ret";
+	case OpCode::Print: return "Print";
+	case OpCode::ScanNum: return "ScanNum";
+	case OpCode::ScanStr: return "ScanStr";
+	case OpCode::Exit: return "Exit";
+	case OpCode::Spawn: return "Spawn";
+	case OpCode::Await: return "Await";
+	case OpCode::MakeChan: return "MakeChan";
+	case OpCode::Send: return "Send";
+	case OpCode::Recv: return "Recv";
+	case OpCode::BinLL: return "BinLL";
+	case OpCode::BinLK: return "BinLK";
+	case OpCode::StoreLL: return "StoreLL";
+	case OpCode::StoreLK: return "StoreLK";
+	case OpCode::ReStoreLL: return "ReStoreLL";
+	case OpCode::ReStoreLK: return "ReStoreLK";
+	case OpCode::CmpJump: return "CmpJump";
+	case OpCode::CmpJumpLL: return "CmpJumpLL";
+	case OpCode::CmpJumpLK: return "CmpJumpLK";
+	}
+	return "?";
+}
+
+struct Instr {
+	OpCode Op;
+	OpCode Sub = OpCode::Add;
+	std::int32_t A = 0, B = 0, C = 0;
+};
+
+struct FuncCode {
+	std::string Name;
+	std::uint32_t NumParams = 0;
+	std::uint32_t NumSlots = 0;
+	bool Memo = false;
+	std::vector<Instr> Code;
+};
+
+struct Program {
+	std::vector<FuncCode> Funcs;
+	std::vector<std::int_fast64_t> Nums;
+	std::vector<std::shared_ptr<const std::string>> Strs;
+	std::int32_t Entry = -1;
+	std::int32_t Init = -1; // fn init, run first when main takes its result
+	bool UsesTasks = false; // runs on the task scheduler
+};
+
+} // namespace vm
+} // namespace Noh
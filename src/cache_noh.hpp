@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "import_noh.hpp"
+#include "link_noh.hpp"
+#include "lru_noh.hpp"
+#include "opt_noh.hpp"
+#include "compile_noh.hpp"
+#include "fuse_noh.hpp"
+#include "option_noh.hpp"
+#include "bytecode_noh.hpp"
+
+namespace Noh {
+namespace cache {
+
+// Parses and links the modules, optimizes and compiles them for the bytecode machine; nullptr
+// with `errors` set if they do not parse, link or compile.
+inline std::shared_ptr<const vm::Program> Compile(const std::vector<imports::Unit>& units, int level,
+	const EvalOption& option, imports::ParseCache* parsed, std::string& errors)
+{
+	ast::ModuleAst* res = imports::Link(units, option, parsed, errors);
+	if (not res)
+	{
+		if (errors.empty()) { errors = "parse failed\n"; }
+		return nullptr;
+	}
+	opt::Optimizer(level, option).run(res);
+	link::Linker linker{};
+	if (not linker.run(res))
+	{
+		for (const auto& err : linker.getErrors()) { errors += "link error: " + err + "\n"; }
+		delete res;
+		return nullptr;
+	}
+	auto prog = std::make_shared<vm::Program>();
+	vm::Compiler compiler(*prog, option);
+	const bool ok = compiler.compile(res);
+	delete res;
+	if (not ok)
+	{
+		for (const auto& err : compiler.getErrors()) { errors += "compile error: " + err + "\n"; }
+		return nullptr;
+	}
+	if (option.Fuse) { vm::Fuse(*prog); }
+	return prog;
+}
+
+// Compiled programs keyed by the sources they were compiled from (imports::Key).
+using ModuleCache = Lru<std::shared_ptr<const vm::Program>>;
+
+} // namespace cache
+} // namespace Noh
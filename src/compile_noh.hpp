@@ -0,0 +1,529 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast_noh.hpp"
+#include "bytecode_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+
+namespace Noh {
+namespace vm {
+
+// Translates a linked ModuleAst (link_noh.hpp) into a Program for the stackless machine.
+// Variables are resolved to frame slots here, so the machine never looks a name up.
+class Compiler {
+	Program& prog;
+	EvalOption option;
+	std::unordered_map<std::string, std::int32_t> funcIdx;
+	std::vector<std::string> errors;
+
+	// state of the function being compiled
+	FuncCode* cur = nullptr;
+	std::vector<std::unordered_map<std::string, std::int32_t>> scopes;
+	std::int32_t nextSlot = 0;
+
+	struct Loop {
+		std::vector<std::size_t> Breaks;
+		std::vector<std::size_t> Continues;
+	};
+	std::vector<Loop> loops;
+
+	void error(const std::string& msg)
+	{
+		errors.push_back("in fn " + cur->Name + ": " + msg);
+	}
+
+	std::size_t emit(OpCode op, std::int32_t a = 0, std::int32_t b = 0)
+	{
+		cur->Code.push_back(Instr{op, OpCode::Add, a, b});
+		return cur->Code.size() - 1;
+	}
+
+	std::int32_t here() const { return static_cast<std::int32_t>(cur->Code.size()); }
+	void patch(std::size_t at, std::int32_t target) { cur->Code[at].A = target; }
+
+	std::int32_t numConst(std::int_fast64_t val)
+	{
+		prog.Nums.push_back(val);
+		return static_cast<std::int32_t>(prog.Nums.size() - 1);
+	}
+
+	std::int32_t strConst(const std::string& val)
+	{
+		prog.Strs.push_back(std::make_shared<const std::string>(val));
+		return static_cast<std::int32_t>(prog.Strs.size() - 1);
+	}
+
+	void pushScope() { scopes.emplace_back(); }
+	void popScope()
+	{
+		nextSlot -= static_cast<std::int32_t>(scopes.back().size());
+		scopes.pop_back();
+	}
+
+	std::int32_t newSlot()
+	{
+		const auto slot = nextSlot++;
+		if (static_cast<std::uint32_t>(nextSlot) > cur->NumSlots) { cur->NumSlots = nextSlot; }
+		return slot;
+	}
+
+	std::int32_t declare(const std::string& name)
+	{
+		if (scopes.back().find(name) != std::end(scopes.back()))
+		{
+			error("redefinition of variable '" + name + "'");
+			return 0;
+		}
+		const auto slot = newSlot();
+		scopes.back()[name] = slot;
+		return slot;
+	}
+
+	// a slot nobody can name, e.g. the counter of a for loop
+	std::int32_t hiddenSlot()
+	{
+		const auto slot = newSlot();
+		scopes.back()[" " + std::to_string(slot)] = slot;
+		return slot;
+	}
+
+	std::int32_t lookup(const std::string& name)
+	{
+		for (auto itr = scopes.rbegin(); itr != scopes.rend(); itr++)
+		{
+			if (auto found = itr->find(name); found != std::end(*itr)) { return found->second; }
+		}
+		error("unknown ident '" + name + "'");
+		return 0;
+	}
+
+	// ================
+	//       expr
+	// ================
+
+	void compileExpr(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+			emit(OpCode::PushNum, numConst(static_cast<ast::NumberAst*>(ast)->getVal()));
+			break;
+		case ast::StringID:
+			emit(OpCode::PushStr, strConst(static_cast<ast::StringAst*>(ast)->getVal()));
+			break;
+		case ast::IdentID:
+			emit(OpCode::Load, lookup(static_cast<ast::IdentAst*>(ast)->getIdent()));
+			break;
+		case ast::TupleID:
+		{
+			auto& ary = static_cast<ast::TupleAst*>(ast)->Ary;
+			for (auto& elm : ary) { compileExpr(elm); }
+			emit(OpCode::MakeTuple, static_cast<std::int32_t>(ary.size()));
+			break;
+		}
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			compileExpr(mono->getLhs());
+			const auto& op = mono->getOp();
+			if (op == "!") { emit(OpCode::Not); }
+			else if (op == "-") { emit(OpCode::Neg); }
+			else if (op == "~") { emit(OpCode::BitNot); }
+			else { error("unknown operator '" + op + "'"); }
+			break;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			if (bin->getOp() == "&&" or bin->getOp() == "||")
+			{
+				// short-circuit: branch on the operands, then materialize 0 or 1
+				std::vector<std::size_t> toFalse{};
+				compileBranch(ast, false, toFalse);
+				emit(OpCode::PushNum, numConst(1));
+				const auto toEnd = emit(OpCode::Jump);
+				for (auto& at : toFalse) { patch(at, here()); }
+				emit(OpCode::PushNum, numConst(0));
+				patch(toEnd, here());
+				break;
+			}
+			compileExpr(bin->getLhs());
+			compileExpr(bin->getRhs());
+			emit(binaryOp(bin->getOp()));
+			break;
+		}
+		case ast::CallID:
+			compileCall(static_cast<ast::CallAst*>(ast), false);
+			break;
+		case ast::TaskID:
+			compileTask(static_cast<ast::TaskAst*>(ast));
+			break;
+		default:
+			error("illegal expression");
+		}
+	}
+
+	// Emits a chain of branches that jumps when `ast` is `when` and falls through otherwise;
+	// the jumps are left in `jumps` for the caller to patch. The rhs of && and || only runs
+	// when the lhs does not decide the result.
+	void compileBranch(ast::BaseAst* ast, bool when, std::vector<std::size_t>& jumps)
+	{
+		if (ast->getID() == ast::MonoExpID and static_cast<ast::MonoExpAst*>(ast)->getOp() == "!")
+		{
+			compileBranch(static_cast<ast::MonoExpAst*>(ast)->getLhs(), not when, jumps);
+			return;
+		}
+		if (ast->getID() == ast::BinaryExpID)
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			const auto& op = bin->getOp();
+			if (op == "&&" or op == "||")
+			{
+				// the lhs decides the result when it is false for &&, true for ||
+				const bool decides = op == "||";
+				if (when == decides)
+				{
+					compileBranch(bin->getLhs(), when, jumps);
+					compileBranch(bin->getRhs(), when, jumps);
+					return;
+				}
+				std::vector<std::size_t> skip{};
+				compileBranch(bin->getLhs(), decides, skip);
+				compileBranch(bin->getRhs(), when, jumps);
+				for (auto& at : skip) { patch(at, here()); }
+				return;
+			}
+			const auto cmp = binaryOp(op);
+			if (IsCompareOp(cmp))
+			{
+				// jump on the negated comparison so the pair fuses into CmpJump
+				compileExpr(bin->getLhs());
+				compileExpr(bin->getRhs());
+				emit(when ? NegateCompare(cmp) : cmp);
+				jumps.push_back(emit(OpCode::JumpIfFalse));
+				return;
+			}
+		}
+		compileExpr(ast);
+		jumps.push_back(emit(when ? OpCode::JumpIfTrue : OpCode::JumpIfFalse));
+	}
+
+	OpCode binaryOp(const std::string& op)
+	{
+		if (op == "+") { return OpCode::Add; }
+		else if (op == "-") { return OpCode::Sub; }
+		else if (op == "*") { return OpCode::Mul; }
+		else if (op == "/") { return OpCode::Div; }
+		else if (op == "%") { return OpCode::Mod; }
+		else if (op == "==") { return OpCode::Eq; }
+		else if (op == "!=") { return OpCode::Ne; }
+		else if (op == "<") { return OpCode::Lt; }
+		else if (op == ">") { return OpCode::Gt; }
+		else if (op == "<=") { return OpCode::Le; }
+		else if (op == ">=") { return OpCode::Ge; }
+		else if (op == "&&") { return OpCode::And; }
+		else if (op == "||") { return OpCode::Or; }
+		else if (op == "IdxAt") { return OpCode::IdxAt; }
+		error("unknown operator '" + op + "'");
+		return OpCode::Add;
+	}
+
+	void compileCall(ast::CallAst* ast, bool tail)
+	{
+		auto& params = ast->getParams();
+		if (not ast->getCallee())
+		{
+			error("unlinked call to '" + ast->getFuncName() + "'");
+			return;
+		}
+		for (auto& param : params) { compileExpr(param); }
+		emit(tail ? OpCode::TailCall : OpCode::Call, funcIdx.at(ast->getCallee()->getName()), static_cast<std::int32_t>(params.size()));
+		// a tail call from a memoized frame runs as a normal call, so a Ret still follows
+		if (tail) { emit(OpCode::Ret); }
+	}
+
+	void compileTask(ast::TaskAst* ast)
+	{
+		const auto& op = ast->getOp();
+		auto& args = ast->getArgs();
+		prog.UsesTasks = true;
+		if (op == "spawn")
+		{
+			auto call = args.front();
+			if (call->getID() != ast::CallID or not static_cast<ast::CallAst*>(call)->getCallee())
+			{
+				error("spawn of something that is not a function call");
+				return;
+			}
+			auto& params = static_cast<ast::CallAst*>(call)->getParams();
+			for (auto& param : params) { compileExpr(param); }
+			emit(OpCode::Spawn, funcIdx.at(static_cast<ast::CallAst*>(call)->getCallee()->getName()), static_cast<std::int32_t>(params.size()));
+			return;
+		}
+		for (auto& arg : args) { compileExpr(arg); }
+		if (op == "await") { emit(OpCode::Await); }
+		else if (op == "chan") { emit(OpCode::MakeChan); }
+		else if (op == "send") { emit(OpCode::Send); }
+		else if (op == "recv") { emit(OpCode::Recv); }
+		else { error("unknown task operation '" + op + "'"); }
+	}
+
+	// ================
+	//       stmt
+	// ================
+
+	void compileBlock(std::vector<ast::BaseAst*>& stmts)
+	{
+		pushScope();
+		for (auto& stmt : stmts) { compileStmt(stmt); }
+		popScope();
+	}
+
+	void compileStmt(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+			compileBuiltin(static_cast<ast::BuiltinAst*>(ast));
+			break;
+		case ast::AssignID:
+		{
+			auto assign = static_cast<ast::AssignAst*>(ast);
+			compileExpr(assign->getVal());
+			emit(OpCode::Store, declare(assign->getName()));
+			break;
+		}
+		case ast::ReAssignID:
+		{
+			auto assign = static_cast<ast::ReAssignAst*>(ast);
+			compileExpr(assign->getVal());
+			emit(OpCode::ReStore, lookup(assign->getName()));
+			break;
+		}
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			std::vector<std::size_t> toElse{};
+			compileBranch(stmt->getCond(), false, toElse);
+			compileBlock(stmt->getThenStmt());
+			if (stmt->getElseStmt().empty())
+			{
+				for (auto& at : toElse) { patch(at, here()); }
+				break;
+			}
+			const auto toEnd = emit(OpCode::Jump);
+			for (auto& at : toElse) { patch(at, here()); }
+			compileBlock(stmt->getElseStmt());
+			patch(toEnd, here());
+			break;
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			const auto top = here();
+			std::vector<std::size_t> toEnd{};
+			compileBranch(stmt->getCond(), false, toEnd);
+			loops.emplace_back();
+			compileBlock(stmt->getLoopStmt());
+			emit(OpCode::Jump, top);
+			for (auto& at : toEnd) { patch(at, here()); }
+			for (auto& at : loops.back().Breaks) { patch(at, here()); }
+			for (auto& at : loops.back().Continues) { patch(at, top); }
+			loops.pop_back();
+			break;
+		}
+		case ast::ForStmtID:
+			compileFor(static_cast<ast::ForStmtAst*>(ast));
+			break;
+		case ast::CallID:
+			compileCall(static_cast<ast::CallAst*>(ast), false);
+			emit(OpCode::Pop);
+			break;
+		case ast::TaskID:
+			compileTask(static_cast<ast::TaskAst*>(ast));
+			emit(OpCode::Pop);
+			break;
+		default:
+			error("illegal statement");
+		}
+	}
+
+	void compileFor(ast::ForStmtAst* ast)
+	{
+		pushScope();
+		compileExpr(ast->getRange()->getFrom());
+		const auto counter = hiddenSlot();
+		emit(OpCode::Store, counter);
+		compileExpr(ast->getRange()->getTo());
+		const auto limit = hiddenSlot();
+		emit(OpCode::Store, limit);
+
+		const auto top = here();
+		emit(OpCode::Load, counter);
+		emit(OpCode::Load, limit);
+		emit(OpCode::Lt);
+		const auto toEnd = emit(OpCode::JumpIfFalse);
+
+		loops.emplace_back();
+		pushScope();
+		// the loop variable is a copy of the counter, so the body may overwrite it
+		emit(OpCode::Load, counter);
+		emit(OpCode::Store, declare(ast->getIdent()));
+		for (auto& stmt : ast->getStmts()) { compileStmt(stmt); }
+		popScope();
+
+		const auto next = here();
+		emit(OpCode::Load, counter);
+		emit(OpCode::PushNum, numConst(1));
+		emit(OpCode::Add);
+		emit(OpCode::Store, counter);
+		emit(OpCode::Jump, top);
+		patch(toEnd, here());
+		for (auto& at : loops.back().Breaks) { patch(at, here()); }
+		for (auto& at : loops.back().Continues) { patch(at, next); }
+		loops.pop_back();
+		popScope();
+	}
+
+	void compileBuiltin(ast::BuiltinAst* ast)
+	{
+		const auto& name = ast->getName();
+		auto& args = ast->getArgs();
+		if (name == "break" or name == "continue")
+		{
+			if (loops.empty())
+			{
+				error("'" + name + "' outside of a loop");
+				return;
+			}
+			const auto at = emit(OpCode::Jump);
+			(name == "break" ? loops.back().Breaks : loops.back().Continues).push_back(at);
+		}
+		else if (name == "exit")
+		{
+			emit(OpCode::Exit);
+		}
+		else if (name == "return")
+		{
+			auto val = args.front();
+			if (val->getID() == ast::CallID)
+			{
+				compileCall(static_cast<ast::CallAst*>(val), true);
+				return;
+			}
+			compileExpr(val);
+			emit(OpCode::Ret);
+		}
+		else if (name == "print")
+		{
+			for (auto& arg : args)
+			{
+				compileExpr(arg);
+				emit(OpCode::Print);
+			}
+		}
+		else if (name == "scanNum" or name == "scanStr")
+		{
+			for (auto& arg : args)
+			{
+				const auto slot = lookup(static_cast<ast::IdentAst*>(arg)->getIdent());
+				emit(name == "scanNum" ? OpCode::ScanNum : OpCode::ScanStr, slot);
+			}
+		}
+		else
+		{
+			error("unknown builtin '" + name + "'");
+		}
+	}
+
+	void compileFunc(ast::FuncAst* ast, FuncCode& code)
+	{
+		cur = &code;
+		scopes.clear();
+		loops.clear();
+		nextSlot = 0;
+		pushScope();
+		for (auto& param : ast->getParamNames()) { declare(param); }
+		for (auto& stmt : ast->getInst()) { compileStmt(stmt); }
+		emit(OpCode::PushNum, numConst(0));
+		emit(OpCode::Ret);
+		popScope();
+		cur = nullptr;
+	}
+
+public:
+	Compiler(Program& prog, const EvalOption& option = EvalOption{}) : prog(prog), option(option) {}
+
+	bool compile(ast::ModuleAst* ast)
+	{
+		std::unordered_map<std::string, ast::FuncAst*> funcs;
+		for (auto& func : ast->getFuncs())
+		{
+			if (funcs.find(func->getName()) != std::end(funcs))
+			{
+				errors.push_back("redefinition of fn " + func->getName());
+				continue;
+			}
+			funcs[func->getName()] = func;
+			funcIdx[func->getName()] = static_cast<std::int32_t>(prog.Funcs.size());
+			FuncCode code{};
+			code.Name = func->getName();
+			code.NumParams = static_cast<std::uint32_t>(func->getParamNames().size());
+			prog.Funcs.push_back(std::move(code));
+		}
+
+		memo::Purity purity(funcs);
+		for (auto& [name, idx] : funcIdx)
+		{
+			auto func = funcs.at(name);
+			if (not func->getIsMemo() and not option.MemoAll) { continue; }
+			if (purity.isPure(func))
+			{
+				prog.Funcs[idx].Memo = true;
+			}
+			else if (func->getIsMemo())
+			{
+				std::cerr << "warning: '" << name << "' is not pure and will not be memoized" << std::endl;
+			}
+		}
+
+		for (auto& [name, idx] : funcIdx)
+		{
+			compileFunc(funcs.at(name), prog.Funcs[idx]);
+		}
+
+		if (auto itr = funcIdx.find("main"); itr != std::end(funcIdx))
+		{
+			// fn main(state) takes the result of fn init()
+			const auto init = funcIdx.find("init");
+			const bool hasInit = init != std::end(funcIdx) and prog.Funcs[init->second].NumParams == 0;
+			if (prog.Funcs[itr->second].NumParams == 1 and hasInit) { prog.Init = init->second; }
+			else if (prog.Funcs[itr->second].NumParams != 0)
+			{
+				errors.push_back("fn main must not take parameters, or take only the result of fn init()");
+			}
+			prog.Entry = itr->second;
+		}
+		else
+		{
+			for (auto& func : ast->getFuncs())
+			{
+				if (func->getParamNames().empty())
+				{
+					prog.Entry = funcIdx.at(func->getName());
+					break;
+				}
+			}
+		}
+		return errors.empty();
+	}
+
+	const std::vector<std::string>& getErrors() const { return errors; }
+};
+
+} // namespace vm
+} // namespace Noh
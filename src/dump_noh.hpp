@@ -0,0 +1,262 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ast_noh.hpp"
+
+namespace Noh {
+namespace dump {
+
+// Prints a ModuleAst back as Noh source, e.g. to inspect what the optimizer did.
+class Dumper {
+	std::ostream& out;
+
+	void indent(int depth)
+	{
+		for (int i{}; i < depth; i++) { out << '\t'; }
+	}
+
+	void dumpString(const std::string& str)
+	{
+		out << '"';
+		for (const auto& c : str)
+		{
+			switch (c) {
+			case '\n': out << "\\n"; break;
+			case '\t': out << "\\t"; break;
+			case '\r': out << "\\r"; break;
+			case '\a': out << "\\a"; break;
+			case '\b': out << "\\b"; break;
+			case '\f': out << "\\f"; break;
+			case '\v': out << "\\v"; break;
+			case '\\': out << "\\\\"; break;
+			case '"': out << "\\\""; break;
+			default: out << c;
+			}
+		}
+		out << '"';
+	}
+
+	void dumpList(std::vector<ast::BaseAst*>& exprs)
+	{
+		for (std::size_t i{}; i < exprs.size(); i++)
+		{
+			if (i) { out << ", "; }
+			dumpExpr(exprs[i]);
+		}
+	}
+
+	// operands of an operator are parenthesized unless they are atoms
+	void dumpOperand(ast::BaseAst* ast)
+	{
+		const bool paren = ast->getID() == ast::BinaryExpID
+			and static_cast<ast::BinaryExpAst*>(ast)->getOp() != "IdxAt";
+		if (paren) { out << '('; }
+		dumpExpr(ast);
+		if (paren) { out << ')'; }
+	}
+
+public:
+	Dumper(std::ostream& out = std::cout) : out(out) {}
+
+	void dumpExpr(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+			out << static_cast<ast::NumberAst*>(ast)->getVal();
+			break;
+		case ast::StringID:
+			dumpString(static_cast<ast::StringAst*>(ast)->getVal());
+			break;
+		case ast::IdentID:
+			out << static_cast<ast::IdentAst*>(ast)->getIdent();
+			break;
+		case ast::TupleID:
+			out << '[';
+			dumpList(static_cast<ast::TupleAst*>(ast)->Ary);
+			out << ']';
+			break;
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			out << mono->getOp();
+			const bool paren = mono->getLhs()->getID() == ast::MonoExpID or mono->getLhs()->getID() == ast::BinaryExpID;
+			if (paren) { out << '('; }
+			dumpExpr(mono->getLhs());
+			if (paren) { out << ')'; }
+			break;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			if (bin->getOp() == "IdxAt")
+			{
+				dumpExpr(bin->getLhs());
+				out << '(';
+				dumpExpr(bin->getRhs());
+				out << ')';
+				break;
+			}
+			dumpOperand(bin->getLhs());
+			out << ' ' << bin->getOp() << ' ';
+			dumpOperand(bin->getRhs());
+			break;
+		}
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			out << call->getFuncName() << '(';
+			dumpList(call->getParams());
+			out << ')';
+			break;
+		}
+		case ast::TaskID:
+		{
+			auto task = static_cast<ast::TaskAst*>(ast);
+			if (task->getOp() == "spawn" or task->getOp() == "await")
+			{
+				// the operand of await is a factor
+				out << task->getOp() << ' ';
+				const auto id = task->getArgs().front()->getID();
+				const bool paren = id == ast::MonoExpID or id == ast::BinaryExpID;
+				if (paren) { out << '('; }
+				dumpExpr(task->getArgs().front());
+				if (paren) { out << ')'; }
+				break;
+			}
+			out << task->getOp() << '(';
+			dumpList(task->getArgs());
+			out << ')';
+			break;
+		}
+		default:
+			out << "<?>";
+		}
+	}
+
+	void dumpStmts(std::vector<ast::BaseAst*>& stmts, int depth)
+	{
+		for (auto& stmt : stmts) { dumpStmt(stmt, depth); }
+	}
+
+	void dumpStmt(ast::BaseAst* ast, int depth)
+	{
+		indent(depth);
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+		{
+			auto builtin = static_cast<ast::BuiltinAst*>(ast);
+			const auto& name = builtin->getName();
+			if (name == "return")
+			{
+				out << "return ";
+				dumpExpr(builtin->getArgs().front());
+			}
+			else if (builtin->getArgs().empty())
+			{
+				out << name;
+			}
+			else
+			{
+				out << name << '(';
+				dumpList(builtin->getArgs());
+				out << ')';
+			}
+			out << ";\n";
+			break;
+		}
+		case ast::AssignID:
+		{
+			auto assign = static_cast<ast::AssignAst*>(ast);
+			out << "var " << assign->getName() << " = ";
+			dumpExpr(assign->getVal());
+			out << ";\n";
+			break;
+		}
+		case ast::ReAssignID:
+		{
+			auto assign = static_cast<ast::ReAssignAst*>(ast);
+			out << assign->getName() << " = ";
+			dumpExpr(assign->getVal());
+			out << ";\n";
+			break;
+		}
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			out << "if ";
+			dumpExpr(stmt->getCond());
+			out << " {\n";
+			dumpStmts(stmt->getThenStmt(), depth + 1);
+			if (not stmt->getElseStmt().empty())
+			{
+				indent(depth);
+				out << "} else {\n";
+				dumpStmts(stmt->getElseStmt(), depth + 1);
+			}
+			indent(depth);
+			out << "}\n";
+			break;
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			out << "while ";
+			dumpExpr(stmt->getCond());
+			out << " {\n";
+			dumpStmts(stmt->getLoopStmt(), depth + 1);
+			indent(depth);
+			out << "}\n";
+			break;
+		}
+		case ast::ForStmtID:
+		{
+			auto stmt = static_cast<ast::ForStmtAst*>(ast);
+			out << "for " << stmt->getIdent() << " in ";
+			dumpExpr(stmt->getRange()->getFrom());
+			out << "..";
+			dumpExpr(stmt->getRange()->getTo());
+			out << " {\n";
+			dumpStmts(stmt->getStmts(), depth + 1);
+			indent(depth);
+			out << "}\n";
+			break;
+		}
+		case ast::CallID:
+		case ast::TaskID:
+			dumpExpr(ast);
+			out << ";\n";
+			break;
+		default:
+			out << "<?>\n";
+		}
+	}
+
+	void dumpFunc(ast::FuncAst* ast)
+	{
+		if (ast->getIsMemo()) { out << "memo "; }
+		out << "fn " << ast->getName() << '(';
+		for (std::size_t i{}; i < ast->getParamNames().size(); i++)
+		{
+			if (i) { out << ", "; }
+			out << ast->getParamNames()[i];
+		}
+		out << ") {\n";
+		dumpStmts(ast->getInst(), 1);
+		out << "}\n";
+	}
+
+	void dumpModule(ast::ModuleAst* ast)
+	{
+		for (std::size_t i{}; i < ast->getFuncs().size(); i++)
+		{
+			if (i) { out << '\n'; }
+			dumpFunc(ast->getFuncs()[i]);
+		}
+	}
+};
+
+} // namespace dump
+} // namespace Noh
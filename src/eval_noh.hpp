@@ -2,25 +2,49 @@
 
 #include <cassert>
 #include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <utility>
 #include <unordered_set>
 #include <unordered_map>
-#include <deque>
 
 #include "ast_noh.hpp"
+#include "infer_noh.hpp"
+#include "jit_noh.hpp"
+#include "limit_noh.hpp"
+#include "link_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+#include "walk_noh.hpp"
 
 namespace Noh {
 namespace eval {
 
+// An error of the running program that its types or values only show at run time, such as a
+// tuple index out of range. It unwinds to evalModuleAst, or to --repl, which goes on with the next input.
+struct RuntimeError : std::runtime_error {
+	using std::runtime_error::runtime_error;
+};
+
 struct AstEval {
+	int ExitCode = EXIT_SUCCESS;
 	bool ExitFlag = false;
 	bool ReturnFlag = false;
 	ast::BaseAst* ReturnValue = nullptr;
+	ast::FuncAst* TailCallee = nullptr;
+	std::vector<ast::BaseAst*> TailArgs;
 	bool BreakFlag = false;
 	bool ContinueFlag = false;
-	std::int_fast32_t valsSize, FuncRecSize, curLower;
+	// index in vars of the current function's first variable; lookups stop there
+	std::size_t curLower;
+	// bumped whenever variables can start resolving differently; IdentAst caches check it
+	std::uint_fast64_t ScopeEpoch = 1;
+	// evaluations a self-specializing node runs generically before it switches to its fast path
+	static constexpr std::uint8_t WarmUp = 8;
 
 	std::unordered_set<std::string> builtin = {
 		"break",
@@ -35,6 +59,7 @@ struct AstEval {
 		"num",
 		"str",
 		"fn",
+		"memo",
 		"if",
 		"then",
 		"else",
@@ -43,18 +68,38 @@ struct AstEval {
 		"for"
 	};
 
-	std::deque<std::unordered_map<std::string, ast::BaseAst*>> vals;
+	// Every live variable, innermost last. A block scope is only the index in vars where
+	// it starts, so entering a block or running a loop iteration allocates nothing.
+	struct Var {
+		const std::string* Name;
+		ast::BaseAst* Val;
+	};
+	std::vector<Var> vars;
+	std::vector<std::size_t> scopeMarks;
 	std::unordered_map<std::string, ast::FuncAst*> funcs;
+	std::unordered_map<ast::FuncAst*, memo::MemoTable<ast::BaseAst*>> memos;
+	jit::Jit jit;
+	EvalOption option;
+	limit::Fuel fuel;
 
-	AstEval(ast::ModuleAst*& ast) : valsSize(0), FuncRecSize(0), curLower(0)
+	AstEval(ast::ModuleAst*& ast, const EvalOption& option = EvalOption{}) : AstEval(option)
 	{
 		evalModuleAst(ast);
 	}
+	// with no program yet; --repl adds functions and runs statements one input at a time
+	explicit AstEval(const EvalOption& option)
+		: curLower(0), jit(), option(option), fuel(option)
+	{
+		// compiled functions do not tick
+		if (limit::Limited(option)) { this->option.Jit = false; }
+	}
 	~AstEval()
 	{
 		builtin.clear();
-		vals.clear();
+		for (auto& var : vars) { delete var.Val; }
+		vars.clear();
 		funcs.clear();
+		memos.clear();
 	}
 
 	bool CanCastInNum(ast::BaseAst* ast)
@@ -155,17 +200,7 @@ struct AstEval {
 
 	ast::AstID TypeOfIdentAst(ast::IdentAst* ast)
 	{
-		const auto& name = ast->getIdent();
-		assert(valsSize >= 1);
-		for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-		{
-			if (vals[i].find(name) != std::end(vals[i]))
-			{
-				const auto& id = vals[i].at(name)->getID();
-				return id;
-			}
-		}
-		assert(0);
+		return readIdent(ast)->getID();
 	}
 
 	ast::AstID TypeOfIdentAst(ast::BaseAst* ast)
@@ -174,17 +209,124 @@ struct AstEval {
 		{
 			return ast::NoneID;
 		}
-		const auto& name = dynamic_cast<ast::IdentAst*>(ast)->getIdent();
-		assert(valsSize >= 1);
-		for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
+		return readIdent(static_cast<ast::IdentAst*>(ast))->getID();
+	}
+
+	// The value type of an identifier: the inferred one when there is one, otherwise looked up.
+	ast::AstID TypeOfIdent(ast::BaseAst* ast)
+	{
+		switch (ast->getType()) {
+		case ast::ValType::Num:
+			return ast::NumberID;
+		case ast::ValType::Str:
+			return ast::StringID;
+		case ast::ValType::Tpl:
+			return ast::TupleID;
+		default:
+			return TypeOfIdentAst(ast);
+		}
+	}
+
+	static const char* KindName(ast::BaseAst* val)
+	{
+		return val->getID() == ast::StringID ? "Str" : val->getID() == ast::TupleID ? "Tuple" : "Num";
+	}
+
+	// Throws unless `ok`, which says whether the value `val` has the type `want`.
+	static void expect(bool ok, const char* want, ast::BaseAst* val)
+	{
+		if (not ok) { throw RuntimeError(std::string("expected a ") + want + ", got a " + KindName(val)); }
+	}
+
+	static ast::BaseAst* elementAt(const std::vector<ast::BaseAst*>& ary, std::int_fast64_t idx)
+	{
+		if (idx < 0 or static_cast<std::size_t>(idx) >= ary.size())
 		{
-			if (vals[i].find(name) != std::end(vals[i]))
-			{
-				const auto& id = vals[i].at(name)->getID();
-				return id;
-			}
+			throw RuntimeError("tuple index " + std::to_string(idx) + " out of range");
+		}
+		return ary[idx];
+	}
+
+	ast::BaseAst* findVal(const std::string& name)
+	{
+		for (auto i = vars.size(); i-- > curLower;)
+		{
+			if (*vars[i].Name == name) { return vars[i].Val; }
 		}
-		assert(0);
+		assert(0 && "unknown ident");
+		return nullptr;
+	}
+
+	bool declaredInScope(const std::string& name) const
+	{
+		for (auto i = scopeMarks.back(); i < vars.size(); i++)
+		{
+			if (*vars[i].Name == name) { return true; }
+		}
+		return false;
+	}
+
+	// The value an identifier refers to. The resolved node is cached on the IdentAst until
+	// a variable is declared or dropped, or another function frame becomes current.
+	ast::BaseAst* readIdent(ast::IdentAst* ast)
+	{
+		if (ast->CacheEpoch != ScopeEpoch)
+		{
+			ast->CacheVal = findVal(ast->getIdent());
+			ast->CacheEpoch = ScopeEpoch;
+		}
+		return ast->CacheVal;
+	}
+
+	// ================
+	//      scope
+	// ================
+
+	void pushScope() { scopeMarks.push_back(vars.size()); }
+
+	void popScope()
+	{
+		truncateScope(scopeMarks.back());
+		scopeMarks.pop_back();
+	}
+
+	// Drops (and frees) the variables from vars[size] on, e.g. those a loop body declared.
+	void truncateScope(std::size_t size)
+	{
+		if (vars.size() == size) { return; }
+		for (auto i = size; i < vars.size(); i++) { delete vars[i].Val; }
+		vars.resize(size);
+		ScopeEpoch++;
+	}
+
+	// Where the evaluator was, to go back to once a RuntimeError has unwound part of the way.
+	struct Mark {
+		std::size_t Vars;
+		std::size_t Scopes;
+		std::size_t Lower;
+	};
+
+	Mark mark() const { return Mark{vars.size(), scopeMarks.size(), curLower}; }
+
+	void rewind(const Mark& at)
+	{
+		truncateScope(at.Vars);
+		scopeMarks.resize(at.Scopes);
+		curLower = at.Lower;
+		ScopeEpoch++;
+		delete ReturnValue;
+		ReturnValue = nullptr;
+		for (auto& arg : TailArgs) { delete arg; }
+		TailArgs.clear();
+		TailCallee = nullptr;
+		ReturnFlag = BreakFlag = ContinueFlag = false;
+	}
+
+	// The scope takes over `val`.
+	void declare(const std::string& name, ast::BaseAst* val)
+	{
+		vars.push_back(Var{&name, val});
+		ScopeEpoch++;
 	}
 
 	// ================
@@ -200,10 +342,54 @@ struct AstEval {
 			assert(builtin.find(funcName) == std::end(builtin));
 			funcs[funcName] = func;
 		}
+		link::Linker linker{};
+		if (not linker.run(ast))
+		{
+			for (auto& err : linker.getErrors()) { std::cerr << "link error: " << err << std::endl; }
+			ExitCode = EXIT_FAILURE;
+			return;
+		}
+		infer::TypeInfer().run(ast);
+
+		memo::Purity purity(funcs);
+		for (auto& func : ast->getFuncs()) { addMemo(purity, func); }
+
+		try { evalEntry(ast); }
+		catch (const RuntimeError& err)
+		{
+			// once a limit stopped the run, what fails in the expression it was in is not reported
+			if (ExitFlag) { return; }
+			ExitFlag = true;
+			ExitCode = EXIT_FAILURE;
+			std::cout << std::flush;
+			std::cerr << "runtime error: " << err.what() << std::endl;
+		}
+	}
+
+	// Runs main, or without one the first function that takes no arguments.
+	void evalEntry(ast::ModuleAst* ast)
+	{
 		if (funcs.find(std::string("main")) != std::end(funcs))
 		{
-			assert(funcs.at("main")->getParamNames().size() == 0);
-			evalFuncAst(funcs.at("main"), std::vector<ast::BaseAst*>{});
+			// fn main(state) takes the result of fn init()
+			std::vector<ast::BaseAst*> args{};
+			const auto init = funcs.find("init");
+			const bool hasInit = init != std::end(funcs) and init->second->getParamNames().empty();
+			const auto numParams = funcs.at("main")->getParamNames().size();
+			if (numParams != 0 and not (numParams == 1 and hasInit))
+			{
+				// as the other engines report it before running
+				std::cerr << "compile error: fn main must not take parameters, or take only the result of fn init()" << std::endl;
+				ExitCode = EXIT_FAILURE;
+				return;
+			}
+			if (numParams == 1)
+			{
+				auto state = evalFuncAst(init->second, std::vector<ast::BaseAst*>{});
+				if (ExitFlag or not state) { return; }
+				args.push_back(state);
+			}
+			evalFuncAst(funcs.at("main"), args);
 		}
 		else
 		{
@@ -218,114 +404,251 @@ struct AstEval {
 		}
 	}
 
+	// Gives `func` a memo table if it is declared memo (or --memo is on) and pure.
+	void addMemo(memo::Purity& purity, ast::FuncAst* func)
+	{
+		if (not func->getIsMemo() and not option.MemoAll) { return; }
+		if (purity.isPure(func))
+		{
+			memos.emplace(func, memo::MemoTable<ast::BaseAst*>(option.MemoCapacity));
+			// every call has to go through the memo table
+			func->Tier = ast::Spec::Generic;
+		}
+		else if (func->getIsMemo())
+		{
+			std::cerr << "warning: '" << func->getName() << "' is not pure and will not be memoized" << std::endl;
+		}
+	}
+
+	// Stops the program like exit, with the exit code of the limit that was exceeded.
+	void outOfFuel()
+	{
+		if (ExitFlag) { return; }
+		ExitFlag = true;
+		ExitCode = fuel.exitCode();
+		std::cout << std::flush;
+		std::cerr << "runtime error: " << fuel.message() << std::endl;
+	}
+
 	// ================
 	//       func
 	// ================
 
-	ast::BaseAst* evalFuncAst(ast::FuncAst*& ast, std::vector<ast::BaseAst*> params)
+	// `params` are evaluated argument values; the callee's frame takes them over.
+	ast::BaseAst* evalFuncAst(ast::FuncAst* ast, std::vector<ast::BaseAst*> params)
 	{
-		if (ExitFlag) { return nullptr; }
-		const auto& siz = params.size();
-		assert(siz == ast->getParamNames().size());
-		auto paramNames = ast->getParamNames();
+		// memo tables of the frames that were replaced by a tail call
+		std::vector<std::pair<memo::MemoTable<ast::BaseAst*>*, std::string>> pendingMemos{};
 
-		vals.emplace_back(std::unordered_map<std::string, ast::BaseAst*>{});
-		valsSize++;
-
-		for (size_t i{}; i < siz; i++)
+		while (true)
 		{
-			auto tmp = new ast::AssignAst{paramNames[i]};
-			if (params[i]->getID() == ast::CallID)
+			if (ExitFlag) { return nullptr; }
+			if (not fuel.tick() or not fuel.enter())
+			{
+				outOfFuel();
+				return nullptr;
+			}
+			const auto& siz = params.size();
+			assert(siz == ast->getParamNames().size());
+			const auto& paramNames = ast->getParamNames();
+
+			if (option.Jit and ast->Tier != ast::Spec::Generic)
 			{
-				while (params[i]->getID() == ast::CallID)
+				if (ast->Tier == ast::Spec::Cold and ++ast->Calls >= option.JitThreshold) { jit.compile(ast); }
+				if (auto Ret = ast->Tier == ast::Spec::Fast ? evalNative(ast, params) : nullptr)
 				{
-					params[i] = evalCallAst(dynamic_cast<ast::CallAst*>(params[i]));
+					remember(pendingMemos, Ret);
+					return Ret;
 				}
+				if (ExitFlag) { return nullptr; }
 			}
-			tmp->Val = params[i];
-			evalAssignAst(tmp);
-		}
 
-		auto tmpLower = curLower;
-		curLower = valsSize - 1;
+			pushScope();
+			for (size_t i{}; i < siz; i++)
+			{
+				declare(paramNames[i], params[i]);
+			}
+			params.clear();
 
+			if (auto itr = memos.find(ast); itr != std::end(memos))
+			{
+				std::string memoKey{};
+				for (auto i = scopeMarks.back(); i < vars.size(); i++)
+				{
+					memo::AppendKey(memoKey, vars[i].Val);
+				}
+				if (auto hit = itr->second.find(memoKey))
+				{
+					popScope();
+					// copied first: caching it for the replaced frames can evict *hit
+					auto Ret = evalValue(*hit);
+					remember(pendingMemos, Ret);
+					return Ret;
+				}
+				pendingMemos.emplace_back(&itr->second, std::move(memoKey));
+			}
 
-		ast::BaseAst* Ret = new ast::NumberAst(0);
+			auto tmpLower = curLower;
+			curLower = scopeMarks.back();
+			ScopeEpoch++;
+
+			ast::BaseAst* Ret = nullptr;
 
-		{
 			for (auto& stmts : ast->getInst())
 			{
 				evalStmts(stmts);
-				if (ExitFlag) { return nullptr; }
+				if (ExitFlag) { break; }
 				if (ReturnFlag)
 				{
-					if (ReturnValue)
-					{
-						Ret = ReturnValue;
-						ReturnValue = nullptr;
-					}
+					Ret = ReturnValue;
+					ReturnValue = nullptr;
 					ReturnFlag = false;
 					break;
 				}
 			}
+
+			popScope();
+			curLower = tmpLower;
+			ScopeEpoch++;
+			if (ExitFlag) { return nullptr; }
+
+			if (TailCallee)
+			{
+				// `return f(...)`: reuse this C++ frame instead of recursing
+				ast = TailCallee;
+				params = std::move(TailArgs);
+				TailCallee = nullptr;
+				TailArgs.clear();
+				continue;
+			}
+
+			if (not Ret) { Ret = new ast::NumberAst(0); }
+			remember(pendingMemos, Ret);
+			return Ret;
 		}
+	}
+
+	// Caches a copy of `val` in each table that keeps it.
+	void remember(std::vector<std::pair<memo::MemoTable<ast::BaseAst*>*, std::string>>& pendingMemos, ast::BaseAst* val)
+	{
+		for (auto& [table, key] : pendingMemos)
+		{
+			if (table->keeps(key)) { table->insert(key, evalValue(val)); }
+		}
+	}
 
-		if (Ret->getID() == ast::IdentID)
+	// Runs the compiled code of `ast` if every argument is a Num; nullptr when it has to be interpreted.
+	ast::BaseAst* evalNative(ast::FuncAst* ast, std::vector<ast::BaseAst*>& params)
+	{
+		std::vector<std::int64_t> args{};
+		args.reserve(params.size());
+		for (auto& param : params)
 		{
-			if (TypeOfIdentAst(Ret) == ast::NumberID)
+			if (param->getID() != ast::NumberID) { return nullptr; }
+			args.push_back(static_cast<ast::NumberAst*>(param)->getVal());
+		}
+		for (auto& param : params) { delete param; }
+		params.clear();
+		std::int_fast64_t res;
+		switch (jit.invoke(ast, args, res)) {
+		case jit::Fault::None: break;
+		case jit::Fault::Stack:
+			fuel.stop(limit::Reason::Stack);
+			outOfFuel();
+			return nullptr;
+		case jit::Fault::DivZero:
+			throw RuntimeError("division by zero");
+		}
+		return new ast::NumberAst(res);
+	}
+
+	// Evaluates an expression into a fresh NumberAst / StringAst / TupleAst.
+	ast::BaseAst* evalValue(ast::BaseAst* ast)
+	{
+		if (ast->getID() == ast::IdentID)
+		{
+			const auto type = TypeOfIdent(ast);
+			if (type == ast::NumberID)
 			{
-				Ret = new ast::NumberAst(evalNumExpr(Ret));
+				return new ast::NumberAst(evalNumExpr(ast));
 			}
-			else if (TypeOfIdentAst(Ret) == ast::StringID)
+			else if (type == ast::StringID)
 			{
-				Ret = new ast::StringAst(evalStrExpr(Ret));
+				return new ast::StringAst(evalStrExpr(ast));
 			}
-			else if (TypeOfIdentAst(Ret) == ast::TupleID)
+			else if (type == ast::TupleID)
 			{
-				Ret = new ast::TupleAst(evalTplExpr(Ret));
+				return new ast::TupleAst(evalTplExpr(ast));
 			}
 			else assert(0 && "unknown type");
 		}
 		else
 		{
-			if (CanCastInNum(Ret))
+			if (isIdxAt(ast))
+			{
+				return evalValue(readElement(static_cast<ast::BinaryExpAst*>(ast)));
+			}
+			if (CanCastInNum(ast))
 			{
-				Ret = new ast::NumberAst(evalNumExpr(Ret));
+				return new ast::NumberAst(evalNumExpr(ast));
 			}
-			else if (CanCastInStr(Ret))
+			else if (CanCastInStr(ast))
 			{
-				Ret = new ast::StringAst(evalStrExpr(Ret));
+				return new ast::StringAst(evalStrExpr(ast));
 			}
-			else if (CanCastInTpl(Ret))
+			else if (CanCastInTpl(ast))
 			{
-				Ret = new ast::TupleAst(evalTplExpr(Ret));
+				return new ast::TupleAst(evalTplExpr(ast));
 			}
-			else if (Ret->getID() == ast::CallID)
+			else if (ast->getID() == ast::CallID)
 			{
-				Ret = evalCallAst(dynamic_cast<ast::CallAst*>(Ret));
+				return evalCallAst(static_cast<ast::CallAst*>(ast));
 			}
 			else assert(0 && "unknown type");
 		}
-
-		vals.back().clear();
-		vals.pop_back();
-		valsSize--;
-		curLower = tmpLower;
-		return Ret;
+		return nullptr;
 	}
 
+	// After exit the caller still finishes the expression it is in; it gets a 0 to work with.
 	ast::BaseAst* evalCallAst(ast::CallAst* ast)
 	{
-		if (ExitFlag) { return nullptr; }
-		const auto& fnName = ast->getFuncName();
-		if (funcs.find(fnName) == std::end(funcs) and ast->getParams().size() == 1)
+		if (ExitFlag) { return new ast::NumberAst(0); }
+		assert(ast->getCallee() && "unlinked call");
+		auto res = evalFuncAst(ast->getCallee(), evalArgs(ast));
+		return res ? res : new ast::NumberAst(0);
+	}
+
+	// Evaluates the arguments of a call in the caller's scope.
+	// A call site that kept passing only Nums reads them without the generic type dispatch.
+	std::vector<ast::BaseAst*> evalArgs(ast::CallAst* ast)
+	{
+		auto& params = ast->getParams();
+		std::vector<ast::BaseAst*> res{};
+		res.reserve(params.size());
+		if (ast->State == ast::Spec::Fast)
+		{
+			bool guard = true;
+			for (auto& param : params) { guard = guard and isNumOperand(param); }
+			if (guard)
+			{
+				for (auto& param : params) { res.push_back(new ast::NumberAst(evalNumOperand(param))); }
+				return res;
+			}
+			ast->State = ast::Spec::Generic;
+		}
+		bool allNum = true;
+		for (auto& param : params)
 		{
-			return new ast::NumberAst(evalNumBinaryExpAst(new ast::BinaryExpAst(
-					std::string("IdxAt"),
-					new ast::IdentAst(ast->getFuncName()),
-					ast->getParams().front())));
+			res.push_back(evalValue(param));
+			// an element can be a Num on one call and a Str on the next
+			allNum = allNum and param->getID() != ast::CallID and not isIdxAt(param) and res.back() and res.back()->getID() == ast::NumberID;
 		}
-		return evalFuncAst(funcs[fnName], ast->getParams());
+		if (ast->State == ast::Spec::Cold)
+		{
+			if (not allNum) { ast->State = ast::Spec::Generic; }
+			else if (++ast->Hits >= WarmUp) { ast->State = ast::Spec::Fast; }
+		}
+		return res;
 	}
 
 	// ================
@@ -337,31 +660,32 @@ struct AstEval {
 		if (ExitFlag) { return; }
 		if (ast->getID() == ast::BuiltinID)
 		{
-			evalBuiltinAst(dynamic_cast<ast::BuiltinAst*>(ast));
+			evalBuiltinAst(static_cast<ast::BuiltinAst*>(ast));
 		}
 		else if (ast->getID() == ast::AssignID)
 		{
-			evalAssignAst(dynamic_cast<ast::AssignAst*>(ast));
+			evalAssignAst(static_cast<ast::AssignAst*>(ast));
 		}
 		else if (ast->getID() == ast::ReAssignID)
 		{
-			evalReAssignAst(dynamic_cast<ast::ReAssignAst*>(ast));
+			evalReAssignAst(static_cast<ast::ReAssignAst*>(ast));
 		}
 		else if (ast->getID() == ast::IfStmtID)
 		{
-			evalIfStmtAst(dynamic_cast<ast::IfStmtAst*>(ast));
+			evalIfStmtAst(static_cast<ast::IfStmtAst*>(ast));
 		}
 		else if (ast->getID() == ast::WhileStmtID)
 		{
-			evalWhileStmtAst(dynamic_cast<ast::WhileStmtAst*>(ast));
+			evalWhileStmtAst(static_cast<ast::WhileStmtAst*>(ast));
 		}
 		else if (ast->getID() == ast::ForStmtID)
 		{
-			evalForStmtAst(dynamic_cast<ast::ForStmtAst*>(ast));
+			evalForStmtAst(static_cast<ast::ForStmtAst*>(ast));
 		}
 		else if (ast->getID() == ast::CallID)
 		{
-			evalCallAst(dynamic_cast<ast::CallAst*>(ast));
+			// the result of a call statement is dropped
+			delete evalCallAst(static_cast<ast::CallAst*>(ast));
 		}
 		else
 		{
@@ -391,38 +715,61 @@ struct AstEval {
 		}
 		else if (builtinName == "return")
 		{
+			auto retAst = ast->getArgs().front();
+			if (retAst->getID() == ast::CallID)
+			{
+				auto call = static_cast<ast::CallAst*>(retAst);
+				// tail call: evaluate the arguments here and let evalFuncAst run the callee
+				std::vector<ast::BaseAst*> args{};
+				for (auto& param : call->getParams())
+				{
+					args.push_back(evalValue(param));
+				}
+				TailArgs = std::move(args);
+				TailCallee = call->getCallee();
+				ReturnFlag = true;
+				return;
+			}
+			ReturnValue = evalValue(retAst);
 			ReturnFlag = true;
-			ReturnValue = ast->getArgs().front();
 		}
 		else if (builtinName == "print")
 		{
 			for (auto arg : ast->Args)
 			{
-				if (arg->getID() == ast::CallID)
+				// the result of a call or the copy of an element, freed once it is printed
+				std::unique_ptr<ast::BaseAst> result{};
+				if (arg->getID() == ast::CallID or isIdxAt(arg))
 				{
-					arg = evalCallAst(dynamic_cast<ast::CallAst*>(arg));
+					result.reset(evalValue(arg));
+					arg = result.get();
+					if (ExitFlag) { return; }
 				}
 				
 				if (arg->getID() == ast::IdentID)
 				{
-					if (TypeOfIdentAst(arg) == ast::NumberID)
+					const auto type = TypeOfIdent(arg);
+					if (type == ast::NumberID)
 					{
 						std::cout << evalNumExpr(arg) << std::endl;
 					}
-					else if (TypeOfIdentAst(arg) == ast::StringID)
+					else if (type == ast::StringID)
 					{
 						std::cout << evalStrExpr(arg) << std::endl;
 					}
 					else
 					{
-						assert(0 && "unknown type");
+						throw RuntimeError("cannot print a Tuple");
 					}
 				}
 				else
 				{
 					if (CanCastInNum(arg))
 					{
-						std::cout << evalNumExpr(arg) << std::endl;
+						// a call in the expression may run exit
+						const auto val = evalNumExpr(arg);
+						if (ExitFlag) { return; }
+						std::cout << val << std::endl;
 					}
 					else if (CanCastInStr(arg))
 					{
@@ -430,7 +777,7 @@ struct AstEval {
 					}
 					else
 					{
-						assert(0 && "unknown type");
+						throw RuntimeError("cannot print a Tuple");
 					}
 				}
 			}
@@ -440,26 +787,13 @@ struct AstEval {
 			if (ExitFlag) { return; }
 			for (auto& arg : ast->Args)
 			{
-				const auto& ident = dynamic_cast<ast::IdentAst*>(arg)->getIdent();
+				const auto& ident = static_cast<ast::IdentAst*>(arg)->getIdent();
 
-				bool flg = true;
-				assert(valsSize >= 1);
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ident) != std::end(vals[i]))
-					{
-						if (CanCastInNum(vals[i].at(ident)))
-						{
-							std::int_fast64_t tmp;
-							std::cin >> tmp;
-							dynamic_cast<ast::NumberAst*>(vals[i].at(ident))->getVal() = tmp;
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if (flg) { assert(0 && "unknown ident"); }
+				auto var = findVal(ident);
+				expect(CanCastInNum(var), "Num", var);
+				std::int_fast64_t tmp;
+				std::cin >> tmp;
+				static_cast<ast::NumberAst*>(var)->getVal() = tmp;
 			}
 		}
 		else if (builtinName == "scanStr")
@@ -467,26 +801,12 @@ struct AstEval {
 			if (ExitFlag) { return; }
 			for (auto& arg : ast->Args)
 			{
-				const auto& ident = dynamic_cast<ast::IdentAst*>(arg)->getIdent();
-	
-				assert(valsSize >= 1);
-				bool flg = true;
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ident) != std::end(vals[i]))
-					{
-						if (CanCastInStr(vals[i].at(ident)))
-						{
-							std::string tmp;
-							std::cin >> tmp;
-							dynamic_cast<ast::StringAst*>(vals[i].at(ident))->getVal() = tmp;
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if(flg) { assert(0 && "unknown ident"); }
+				const auto& ident = static_cast<ast::IdentAst*>(arg)->getIdent();
+				auto var = findVal(ident);
+				expect(CanCastInStr(var), "Str", var);
+				std::string tmp;
+				std::cin >> tmp;
+				static_cast<ast::StringAst*>(var)->getVal() = tmp;
 			}
 		}
 	}
@@ -499,41 +819,45 @@ struct AstEval {
 	{
 		if (ExitFlag) { return; }
 		assert(builtin.find(ast->getName()) == std::end(builtin));
-		if (ast->getVal()->getID() == ast::CallID)
+		auto valAst = ast->getVal();
+		assert(not scopeMarks.empty());
+
+		if (valAst->getID() == ast::CallID or isIdxAt(valAst))
 		{
-			while (ast->getVal()->getID() == ast::CallID)
+			// the result of a call, or the copy of an element, is a fresh value; the variable takes it over
+			auto val = evalValue(valAst);
+			if (declaredInScope(ast->getName()))
 			{
-				ast->getVal() = evalCallAst(dynamic_cast<ast::CallAst*>(ast->getVal()));
+				assert(0 && "redefinition of variable is not allowed");
 			}
+			declare(ast->getName(), val);
 		}
-		const auto& valAst = ast->getVal();
-		assert(not vals.empty());
-
-		if (valAst->getID() == ast::IdentID)
+		else if (valAst->getID() == ast::IdentID)
 		{
-			if (TypeOfIdentAst(valAst) == ast::NumberID)
+			const auto type = TypeOfIdent(valAst);
+			if (type == ast::NumberID)
 			{
-				if (vals.back().find(ast->getName()) != std::end(vals.back()))
+				if (declaredInScope(ast->getName()))
 				{
 					assert(0 && "redefinition of variable is not allowed");
 				}
-				vals.back()[ast->getName()] = new ast::NumberAst(evalNumExpr(valAst));
+				declare(ast->getName(), new ast::NumberAst(evalNumExpr(valAst)));
 			}
-			else if (TypeOfIdentAst(valAst) == ast::StringID)
+			else if (type == ast::StringID)
 			{
-				if (vals.back().find(ast->getName()) != std::end(vals.back()))
+				if (declaredInScope(ast->getName()))
 				{
 					assert(0 && "redefinition of variable is not allowed");
 				}
-				vals.back()[ast->getName()] = new ast::StringAst(evalStrExpr(valAst));
+				declare(ast->getName(), new ast::StringAst(evalStrExpr(valAst)));
 			}
-			else if (TypeOfIdentAst(valAst) == ast::TupleID)
+			else if (type == ast::TupleID)
 			{
-				if (vals.back().find(ast->getName()) != std::end(vals.back()))
+				if (declaredInScope(ast->getName()))
 				{
 					assert(0 && "redefinition of variable is not allowed");
 				}
-				vals.back()[ast->getName()] = new ast::TupleAst(evalTplExpr(valAst));
+				declare(ast->getName(), new ast::TupleAst(evalTplExpr(valAst)));
 			}
 			else
 			{
@@ -544,27 +868,27 @@ struct AstEval {
 		{
 			if (CanCastInNum(valAst))
 			{
-				if (vals.back().find(ast->getName()) != std::end(vals.back()))
+				if (declaredInScope(ast->getName()))
 				{
 					assert(0 && "redefinition of variable is not allowed");
 				}
-				vals.back()[ast->getName()] = new ast::NumberAst(evalNumExpr(valAst));
+				declare(ast->getName(), new ast::NumberAst(evalNumExpr(valAst)));
 			}
 			else if (CanCastInStr(valAst))
 			{
-				if (vals.back().find(ast->getName()) != std::end(vals.back()))
+				if (declaredInScope(ast->getName()))
 				{
 					assert(0 && "redefinition of variable is not allowed");
 				}
-				vals.back()[ast->getName()] = new ast::StringAst(evalStrExpr(valAst));
+				declare(ast->getName(), new ast::StringAst(evalStrExpr(valAst)));
 			}
 			else if (CanCastInTpl(valAst))
 			{
-				if (vals.back().find(ast->getName()) != std::end(vals.back()))
+				if (declaredInScope(ast->getName()))
 				{
 					assert(0 && "redefinition of variable is not allowed");
 				}
-				vals.back()[ast->getName()] = new ast::TupleAst(evalTplExpr(valAst));
+				declare(ast->getName(), new ast::TupleAst(evalTplExpr(valAst)));
 			}
 			else
 			{
@@ -577,80 +901,36 @@ struct AstEval {
 	{
 		if (ExitFlag) { return; }
 		assert(builtin.find(ast->getName()) == std::end(builtin));
-		if (ast->getVal()->getID() == ast::CallID)
+		auto valAst = ast->getVal();
+		// the result of a call or the copy of an element, freed once it is copied into the variable
+		std::unique_ptr<ast::BaseAst> result{};
+		if (valAst->getID() == ast::CallID or isIdxAt(valAst))
 		{
-			while (ast->getVal()->getID() == ast::CallID)
-			{
-				ast->getVal() = evalCallAst(dynamic_cast<ast::CallAst*>(ast->getVal()));
-			}
+			result.reset(evalValue(valAst));
+			valAst = result.get();
 		}
-		const auto& valAst = ast->getVal();
-		assert(not vals.empty());
+		assert(not scopeMarks.empty());
 
 		if (valAst->getID() == ast::IdentID)
 		{
-			if (TypeOfIdentAst(valAst) == ast::NumberID)
+			const auto type = TypeOfIdent(valAst);
+			if (type == ast::NumberID)
 			{
-				bool flg = true;
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ast->getName()) != std::end(vals[i]))
-					{
-						if (CanCastInNum(vals[i].at(ast->getName())))
-						{
-							dynamic_cast<ast::NumberAst*>(vals[i].at(ast->getName()))->getVal() = evalNumExpr(valAst);
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if (flg)
-				{
-					assert(0 && "unknown ident");
-				}
+				auto var = findVal(ast->getName());
+				expect(CanCastInNum(var), "Num", var);
+				static_cast<ast::NumberAst*>(var)->getVal() = evalNumExpr(valAst);
 			}
-			else if (TypeOfIdentAst(valAst) == ast::StringID)
+			else if (type == ast::StringID)
 			{
-				bool flg = true;
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ast->getName()) != std::end(vals[i]))
-					{
-						if (CanCastInStr(vals[i].at(ast->getName())))
-						{
-							dynamic_cast<ast::StringAst*>(vals[i].at(ast->getName()))->getVal() = evalStrExpr(valAst);
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if (flg)
-				{
-					assert(0 && "unknown ident");
-				}
+				auto var = findVal(ast->getName());
+				expect(CanCastInStr(var), "Str", var);
+				static_cast<ast::StringAst*>(var)->getVal() = evalStrExpr(valAst);
 			}
-			else if (TypeOfIdentAst(valAst) == ast::TupleID)
+			else if (type == ast::TupleID)
 			{
-				bool flg = true;
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ast->getName()) != std::end(vals[i]))
-					{
-						if (CanCastInStr(vals[i].at(ast->getName())))
-						{
-							dynamic_cast<ast::TupleAst*>(vals[i].at(ast->getName()))->getAry() = evalTplExpr(valAst);
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if (flg)
-				{
-					assert(0 && "unknown ident");
-				}
+				auto var = findVal(ast->getName());
+				expect(CanCastInTpl(var), "Tuple", var);
+				assignTpl(var, evalTplExpr(valAst));
 			}
 			else
 			{
@@ -661,45 +941,21 @@ struct AstEval {
 		{
 			if (CanCastInNum(valAst))
 			{
-				bool flg = true;
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ast->getName()) != std::end(vals[i]))
-					{
-						if (CanCastInNum(vals[i].at(ast->getName())))
-						{
-							dynamic_cast<ast::NumberAst*>(vals[i].at(ast->getName()))->getVal() = evalNumExpr(valAst);
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if (flg)
-				{
-					assert(0 && "unknown ident");
-				}
+				auto var = findVal(ast->getName());
+				expect(CanCastInNum(var), "Num", var);
+				static_cast<ast::NumberAst*>(var)->getVal() = evalNumExpr(valAst);
 			}
 			else if (CanCastInStr(valAst))
 			{
-				bool flg = true;
-				for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-				{
-					if (vals[i].find(ast->getName()) != std::end(vals[i]))
-					{
-						if (CanCastInStr(vals[i].at(ast->getName())))
-						{
-							dynamic_cast<ast::StringAst*>(vals[i].at(ast->getName()))->getVal() = evalStrExpr(valAst);
-							flg = false;
-							break;
-						}
-						else assert(0 && "different type");
-					}
-				}
-				if (flg)
-				{
-					assert(0 && "unknown ident");
-				}
+				auto var = findVal(ast->getName());
+				expect(CanCastInStr(var), "Str", var);
+				static_cast<ast::StringAst*>(var)->getVal() = evalStrExpr(valAst);
+			}
+			else if (CanCastInTpl(valAst))
+			{
+				auto var = findVal(ast->getName());
+				expect(CanCastInTpl(var), "Tuple", var);
+				assignTpl(var, evalTplExpr(valAst));
 			}
 			else
 			{
@@ -708,6 +964,14 @@ struct AstEval {
 		}
 	}
 
+	// Replaces the elements of the tuple variable `var`; `ary` is evaluated first, so it may read them.
+	void assignTpl(ast::BaseAst* var, std::vector<ast::BaseAst*> ary)
+	{
+		auto tpl = static_cast<ast::TupleAst*>(var);
+		for (auto& elm : tpl->Ary) { delete elm; }
+		tpl->Ary = std::move(ary);
+	}
+
 	// ================
 	//        if
 	// ================
@@ -717,15 +981,14 @@ struct AstEval {
 		if (ExitFlag) { return; }
 		assert(CanCastInNum(ast->Cond));
 
-		vals.emplace_back(std::unordered_map<std::string, ast::BaseAst*>{});
-		valsSize++;
+		pushScope();
 
-		const auto CondEval = evalNumExpr(ast->Cond);
-		if (CondEval)
+		if (evalCond(ast->Cond))
 		{
 			for (auto& stmt : ast->getThenStmt())
 			{
 				evalStmts(stmt);
+				if (BreakFlag or ContinueFlag or ReturnFlag or ExitFlag) { break; }
 			}
 		}
 		else
@@ -735,13 +998,12 @@ struct AstEval {
 				for (auto& stmt : ast->getElseStmt())
 				{
 					evalStmts(stmt);
+					if (BreakFlag or ContinueFlag or ReturnFlag or ExitFlag) { break; }
 				}
 			}
 		}
 
-		vals.back().clear();
-		vals.pop_back();
-		valsSize--;
+		popScope();
 	}
 
 	// ================
@@ -753,34 +1015,38 @@ struct AstEval {
 		if (ExitFlag) { return; }
 		assert(CanCastInNum(ast->getCond()));
 
-		vals.emplace_back(std::unordered_map<std::string, ast::BaseAst*>{});
-		valsSize++;
+		pushScope();
+		const auto mark = scopeMarks.back();
 
 		while (true)
 		{
-			const auto CondEval = evalNumExpr(ast->getCond());
-			if (not CondEval) { break; }
+			if (not fuel.tick())
+			{
+				outOfFuel();
+				break;
+			}
+			if (not evalCond(ast->getCond())) { break; }
 			for (auto& stmt : ast->getLoopStmt())
 			{
 				evalStmts(stmt);
-				if (BreakFlag)
-				{
-					BreakFlag = false;
-					return;
-				}
+				if (BreakFlag) { break; }
 				if (ContinueFlag)
 				{
 					ContinueFlag = false;
 					break;
 				}
-				if (ExitFlag) { return; }
+				if (ExitFlag or ReturnFlag) { break; }
 			}
-			vals.back().clear();
+			if (BreakFlag)
+			{
+				BreakFlag = false;
+				break;
+			}
+			if (ExitFlag or ReturnFlag) { break; }
+			truncateScope(mark);
 		}
 
-		vals.back().clear();
-		vals.pop_back();
-		valsSize--;
+		popScope();
 	}
 
 	// ================
@@ -792,42 +1058,57 @@ struct AstEval {
 		if (ExitFlag) { return; }
 		const auto& name = ast->getIdent();
 		assert(builtin.find(name) == std::end(builtin));
-		assert(CanCastInNum(ast->getRange()->getFrom()) or CanCastInNum(TypeOfIdentAst(ast->getRange()->getFrom())));
-		assert(CanCastInNum(ast->getRange()->getTo()) or CanCastInNum(TypeOfIdentAst(ast->getRange()->getTo())));
+		auto isNumBound = [&](ast::BaseAst* bound)
+		{
+			return bound->getID() == ast::CallID or CanCastInNum(bound) or CanCastInNum(TypeOfIdent(bound));
+		};
+		assert(isNumBound(ast->getRange()->getFrom()));
+		assert(isNumBound(ast->getRange()->getTo()));
 
-		vals.emplace_back(std::unordered_map<std::string, ast::BaseAst*>{});
-		valsSize++;
-		const auto fromEval = evalNumExpr(ast->getRange()->getFrom());
-		const auto toEval = evalNumExpr(ast->getRange()->getTo());
+		// a bound may be a call, e.g. `for i in 0..len(t)`
+		const auto fromEval = evalNumOrCall(ast->getRange()->getFrom());
+		if (ExitFlag) { return; }
+		const auto toEval = evalNumOrCall(ast->getRange()->getTo());
+		if (ExitFlag) { return; }
+		pushScope();
 
+		// the induction variable is a single node bumped in place; tmpItr stays authoritative
+		// even if the body reassigns the variable
 		auto tmpItr = fromEval;
-		vals.back()[name] = new ast::NumberAst(fromEval);
+		auto counter = new ast::NumberAst(fromEval);
+		declare(name, counter);
 
 		for (; tmpItr < toEval;)
 		{
+			if (not fuel.tick())
+			{
+				outOfFuel();
+				break;
+			}
 			for (auto& stmt : ast->getStmts())
 			{
 				evalStmts(stmt);
-				if (BreakFlag)
-				{
-					BreakFlag = false;
-					return;
-				}
+				if (BreakFlag) { break; }
 				if (ContinueFlag)
 				{
 					ContinueFlag = false;
 					break;
 				}
-				if (ExitFlag) { return; }
+				if (ExitFlag or ReturnFlag) { break; }
+			}
+			if (BreakFlag)
+			{
+				BreakFlag = false;
+				break;
 			}
+			if (ExitFlag or ReturnFlag) { break; }
 
-			vals.back().clear();
-			vals.back()[name] = new ast::NumberAst(++tmpItr);
+			// drop the variables the body declared, keep the counter
+			truncateScope(scopeMarks.back() + 1);
+			counter->getVal() = ++tmpItr;
 		}
 
-		vals.back().clear();
-		vals.pop_back();
-		valsSize--;
+		popScope();
 	}
 
 	// ================
@@ -838,28 +1119,13 @@ struct AstEval {
 	{
 		if (ast->getID() == ast::StringID)
 		{
-			return evalStringAst(dynamic_cast<ast::StringAst*>(ast));
+			return evalStringAst(static_cast<ast::StringAst*>(ast));
 		}
 		else if (ast->getID() == ast::IdentID)
 		{
-			const auto& name = dynamic_cast<ast::IdentAst*>(ast)->getIdent();
-
-			assert(valsSize >= 1);
-			for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-			{
-				if (vals[i].find(name) != std::end(vals[i]))
-				{
-					if (CanCastInStr(vals[i].at(name)))
-					{
-						return evalStrExpr(vals[i].at(name));
-					}
-					else
-					{
-						assert(0);
-					}
-				}
-			}
-			assert(0 && "unknown ident");
+			auto val = readIdent(static_cast<ast::IdentAst*>(ast));
+			expect(CanCastInStr(val), "Str", val);
+			return evalStrExpr(val);
 		}
 		else // otherwise
 		{
@@ -881,37 +1147,21 @@ struct AstEval {
 	{
 		if (ast->getID() == ast::NumberID)
 		{
-			return evalNumberAst(dynamic_cast<ast::NumberAst*>(ast));
+			return evalNumberAst(static_cast<ast::NumberAst*>(ast));
 		}
 		else if (ast->getID() == ast::IdentID)
 		{
-			const auto& name = dynamic_cast<ast::IdentAst*>(ast)->getIdent();
-
-			assert(valsSize >= 1);
-			for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-			{
-				if (vals[i].find(name) != std::end(vals[i]))
-				{
-					if (CanCastInNum(vals[i].at(name)))
-					{
-						return evalNumExpr(vals[i].at(name));
-					}
-					else
-					{
-						assert(0);
-					}
-				}
-			}
-
-			assert(0 && "unknown ident");
+			auto val = readIdent(static_cast<ast::IdentAst*>(ast));
+			expect(CanCastInNum(val), "Num", val);
+			return evalNumExpr(val);
 		}
 		else if (ast->getID() == ast::BinaryExpID)
 		{
-			return evalNumBinaryExpAst(dynamic_cast<ast::BinaryExpAst*>(ast));
+			return evalNumBinaryExpAst(static_cast<ast::BinaryExpAst*>(ast));
 		}
 		else if (ast->getID() == ast::MonoExpID)
 		{
-			return evalNumMonoExpAst(dynamic_cast<ast::MonoExpAst*>(ast));
+			return evalNumMonoExpAst(static_cast<ast::MonoExpAst*>(ast));
 		}
 		else // otherwize
 		{
@@ -925,105 +1175,221 @@ struct AstEval {
 		return ast->getVal();
 	}
 
+	// An operand of an arithmetic node; unlike evalNumExpr it may be a call.
+	std::int_fast64_t evalNumOrCall(ast::BaseAst* ast)
+	{
+		if (ast->getID() == ast::CallID)
+		{
+			std::unique_ptr<ast::BaseAst> res(evalCallAst(static_cast<ast::CallAst*>(ast)));
+			return evalNumExpr(res.get());
+		}
+		return evalNumExpr(ast);
+	}
+
+	// Evaluates a condition as a chain of branches: the rhs of && and || runs only when the lhs
+	// does not decide the result, and every operand runs at most once.
+	bool evalCond(ast::BaseAst* ast)
+	{
+		if (ast->getID() == ast::BinaryExpID)
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			if (bin->Kind == ast::OpKind::None) { bin->Kind = DecodeOp(bin->getOp(), false); }
+			if (bin->Kind == ast::OpKind::And) { return evalCond(bin->getLhs()) and evalCond(bin->getRhs()); }
+			if (bin->Kind == ast::OpKind::Or) { return evalCond(bin->getLhs()) or evalCond(bin->getRhs()); }
+		}
+		else if (ast->getID() == ast::MonoExpID)
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			if (mono->Kind == ast::OpKind::None) { mono->Kind = DecodeOp(mono->getOp(), true); }
+			if (mono->Kind == ast::OpKind::Not) { return not evalCond(mono->getLhs()); }
+		}
+		return evalNumOrCall(ast) != 0;
+	}
+
+	static ast::OpKind DecodeOp(const std::string& op, bool mono)
+	{
+		if (mono) { return op == "!" ? ast::OpKind::Not : op == "-" ? ast::OpKind::Neg : ast::OpKind::BitNot; }
+		if (op == "+") { return ast::OpKind::Add; }
+		else if (op == "-") { return ast::OpKind::Sub; }
+		else if (op == "*") { return ast::OpKind::Mul; }
+		else if (op == "/") { return ast::OpKind::Div; }
+		else if (op == "%") { return ast::OpKind::Mod; }
+		else if (op == "==") { return ast::OpKind::Eq; }
+		else if (op == "!=") { return ast::OpKind::Ne; }
+		else if (op == "<") { return ast::OpKind::Lt; }
+		else if (op == ">") { return ast::OpKind::Gt; }
+		else if (op == "<=") { return ast::OpKind::Le; }
+		else if (op == ">=") { return ast::OpKind::Ge; }
+		else if (op == "&&") { return ast::OpKind::And; }
+		else if (op == "||") { return ast::OpKind::Or; }
+		else if (op == "IdxAt") { return ast::OpKind::IdxAt; }
+		assert(0 && "no match");
+		return ast::OpKind::None;
+	}
+
+	static std::int_fast64_t applyBinary(ast::OpKind kind, std::int_fast64_t lhs, std::int_fast64_t rhs)
+	{
+		switch (kind) {
+		case ast::OpKind::Add: return lhs + rhs;
+		case ast::OpKind::Sub: return lhs - rhs;
+		case ast::OpKind::Mul: return lhs * rhs;
+		case ast::OpKind::Div:
+			if (rhs == 0) { throw RuntimeError("division by zero"); }
+			return lhs / rhs;
+		case ast::OpKind::Mod:
+			if (rhs == 0) { throw RuntimeError("division by zero"); }
+			return lhs % rhs;
+		case ast::OpKind::Eq: return static_cast<std::int_fast64_t>(lhs == rhs);
+		case ast::OpKind::Ne: return static_cast<std::int_fast64_t>(lhs != rhs);
+		case ast::OpKind::Lt: return static_cast<std::int_fast64_t>(lhs < rhs);
+		case ast::OpKind::Gt: return static_cast<std::int_fast64_t>(lhs > rhs);
+		case ast::OpKind::Le: return static_cast<std::int_fast64_t>(lhs <= rhs);
+		case ast::OpKind::Ge: return static_cast<std::int_fast64_t>(lhs >= rhs);
+		case ast::OpKind::And: return static_cast<std::int_fast64_t>(lhs && rhs);
+		case ast::OpKind::Or: return static_cast<std::int_fast64_t>(lhs || rhs);
+		default:
+			assert(0 && "no match");
+		}
+		return 0;
+	}
+
+	// Whether the fast paths may read `ast` as a Num: no call, and a variable that holds a Num.
+	bool isNumOperand(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+		case ast::BinaryExpID:
+		case ast::MonoExpID:
+			return true;
+		case ast::IdentID:
+			return readIdent(static_cast<ast::IdentAst*>(ast))->getID() == ast::NumberID;
+		default:
+			return false;
+		}
+	}
+
+	// Reads an operand that passed isNumOperand.
+	std::int_fast64_t evalNumOperand(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+			return static_cast<ast::NumberAst*>(ast)->getVal();
+		case ast::IdentID:
+			return static_cast<ast::NumberAst*>(readIdent(static_cast<ast::IdentAst*>(ast)))->getVal();
+		case ast::BinaryExpID:
+			return evalNumBinaryExpAst(static_cast<ast::BinaryExpAst*>(ast));
+		default:
+			return evalNumMonoExpAst(static_cast<ast::MonoExpAst*>(ast));
+		}
+	}
+
 	std::int_fast64_t evalNumBinaryExpAst(ast::BinaryExpAst* ast)
 	{
-		if (CanCastInTpl(ast->getLhs()) or CanCastInTpl(TypeOfIdentAst(ast->getLhs())))
+		if (ast->Kind == ast::OpKind::None) { ast->Kind = DecodeOp(ast->getOp(), false); }
+		if (ast->Kind == ast::OpKind::And or ast->Kind == ast::OpKind::Or)
+		{
+			return static_cast<std::int_fast64_t>(evalCond(ast));
+		}
+		if (ast->State == ast::Spec::Fast)
+		{
+			// guards: the operand types this node specialized on
+			if (ast->Kind == ast::OpKind::IdxAt)
+			{
+				if (CanCastInTpl(readIdent(static_cast<ast::IdentAst*>(ast->getLhs())))) { return evalIdxAtAst(ast); }
+			}
+			else if (isNumOperand(ast->getLhs()) and isNumOperand(ast->getRhs()))
+			{
+				const auto lhs = evalNumOperand(ast->getLhs());
+				return applyBinary(ast->Kind, lhs, evalNumOperand(ast->getRhs()));
+			}
+			ast->State = ast::Spec::Generic;
+		}
+		else if (ast->State == ast::Spec::Cold) { feedback(ast); }
+
+		if (ast->Kind == ast::OpKind::IdxAt and ast->getLhs()->getType() == ast::ValType::Tpl and ast->getLhs()->getID() == ast::IdentID)
+		{
+			return evalIdxAtAst(ast);
+		}
+		// operands inferred as Num cannot take the tuple path
+		const bool lhsIsNum = ast->getLhs()->getType() == ast::ValType::Num;
+		if (not lhsIsNum and (CanCastInTpl(ast->getLhs()) or CanCastInTpl(TypeOfIdent(ast->getLhs()))))
 		{
 			const auto LhsEval = evalTplExpr(ast->getLhs());
-			if (CanCastInNum(ast->getRhs()) or CanCastInNum(TypeOfIdentAst(ast->getRhs())))
+			if (CanCastInNum(ast->getRhs()) or CanCastInNum(TypeOfIdent(ast->getRhs())))
 			{
-				assert(CanCastInNum(ast->getRhs()) or CanCastInNum(TypeOfIdentAst(ast->getRhs())));
+				assert(CanCastInNum(ast->getRhs()) or CanCastInNum(TypeOfIdent(ast->getRhs())));
 				const auto RhsEval = evalNumExpr(ast->getRhs());
 				if (ast->getOp() == "IdxAt")
 				{
-					const auto res = LhsEval.at(RhsEval);
+					const auto res = elementAt(LhsEval, RhsEval);
 					if (CanCastInNum(res))
 					{
-						return dynamic_cast<ast::NumberAst*>(res)->getVal();
+						return static_cast<ast::NumberAst*>(res)->getVal();
 					}
+					expect(false, "Num", res);
 				}
 			}
-			assert(0 && "something wrong");
-		}
-		bool isLhsNumber = ast->getLhs()->getID() == ast::NumberID,
-			 isRhsNumber = ast->getRhs()->getID() == ast::NumberID,
-			 isLhsMonoExp = ast->getLhs()->getID() == ast::MonoExpID,
-			 isRhsMonoExp = ast->getRhs()->getID() == ast::MonoExpID,
-			 isLhsBinExp = ast->getLhs()->getID() == ast::BinaryExpID,
-			 isRhsBinExp = ast->getRhs()->getID() == ast::BinaryExpID,
-			 isLhsCall = ast->getLhs()->getID() == ast::CallID,
-			 isRhsCall = ast->getRhs()->getID() == ast::CallID,
-			 isLhsIdent = ast->getLhs()->getID() == ast::IdentID,
-			 isRhsIdent = ast->getRhs()->getID() == ast::IdentID;
-
-		
-		if (isLhsCall)
-		{
-			auto lhseval = evalCallAst(dynamic_cast<ast::CallAst*>(ast->getLhs()));
-			assert(CanCastInNum(lhseval));
-		}
-		if (isRhsCall)
-		{
-			auto rhseval = evalCallAst(dynamic_cast<ast::CallAst*>(ast->getRhs()));
-			assert(CanCastInNum(rhseval));
-		}
-
-		const auto LhsEval =
-			isLhsNumber ? evalNumberAst(dynamic_cast<ast::NumberAst*>(ast->getLhs())) : \
-			isLhsMonoExp ? evalNumMonoExpAst(dynamic_cast<ast::MonoExpAst*>(ast->getLhs())) : \
-			isLhsBinExp ? evalNumBinaryExpAst(dynamic_cast<ast::BinaryExpAst*>(ast->getLhs())) : \
-			isLhsIdent ? evalNumExpr(dynamic_cast<ast::IdentAst*>(ast->getLhs())) : \
-			isLhsCall ? evalNumExpr(evalCallAst(dynamic_cast<ast::CallAst*>(ast->getLhs()))) : \
-			-1; // dummy
-		const auto RhsEval =
-			isRhsNumber ? evalNumberAst(dynamic_cast<ast::NumberAst*>(ast->getRhs())) : \
-			isRhsMonoExp ? evalNumMonoExpAst(dynamic_cast<ast::MonoExpAst*>(ast->getRhs())) : \
-			isRhsBinExp ? evalNumBinaryExpAst(dynamic_cast<ast::BinaryExpAst*>(ast->getRhs())) : \
-			isRhsIdent ? evalNumExpr(dynamic_cast<ast::IdentAst*>(ast->getRhs())) : \
-			isRhsCall ? evalNumExpr(evalCallAst(dynamic_cast<ast::CallAst*>(ast->getRhs()))) : \
-			-1; // dummy
-		if (ast->getOp() == "+") { return LhsEval + RhsEval; }
-		else if (ast->getOp() == "-") { return LhsEval - RhsEval; }
-		else if (ast->getOp() == "*") { return LhsEval * RhsEval; }
-		else if (ast->getOp() == "/") { return LhsEval / RhsEval; }
-		else if (ast->getOp() == "%") { return LhsEval % RhsEval; }
-		else if (ast->getOp() == "==") { return static_cast<std::int_fast64_t>(LhsEval == RhsEval); }
-		else if (ast->getOp() == "!=") { return static_cast<std::int_fast64_t>(LhsEval != RhsEval); }
-		else if (ast->getOp() == "<") { return static_cast<std::int_fast64_t>(LhsEval < RhsEval); }
-		else if (ast->getOp() == ">") { return static_cast<std::int_fast64_t>(LhsEval > RhsEval); }
-		else if (ast->getOp() == "<=") { return static_cast<std::int_fast64_t>(LhsEval <= RhsEval); }
-		else if (ast->getOp() == ">=") { return static_cast<std::int_fast64_t>(LhsEval >= RhsEval); }
-		else if (ast->getOp() == "&&") { return static_cast<std::int_fast64_t>(LhsEval && RhsEval); }
-		else if (ast->getOp() == "||") { return static_cast<std::int_fast64_t>(LhsEval || RhsEval); }
-		else // otherwize
+			throw RuntimeError("a tuple index must be a Num");
+		}
+		// each operand is evaluated exactly once, lhs first
+		const auto LhsEval = evalNumOrCall(ast->getLhs());
+		const auto RhsEval = evalNumOrCall(ast->getRhs());
+		return applyBinary(ast->Kind, LhsEval, RhsEval);
+	}
+
+	// Counts the evaluations of a cold BinaryExpAst whose operands had the types of its fast path.
+	// Operands with calls stay generic: their evaluation order belongs to the generic path.
+	void feedback(ast::BinaryExpAst* ast)
+	{
+		bool expected = false;
+		if (ast->Kind == ast::OpKind::IdxAt)
 		{
-			assert(0 && "no match");
+			expected = ast->getLhs()->getID() == ast::IdentID and CanCastInTpl(readIdent(static_cast<ast::IdentAst*>(ast->getLhs())));
 		}
-		return 0;
+		else
+		{
+			expected = isNumOperand(ast->getLhs()) and isNumOperand(ast->getRhs());
+		}
+		if (not expected) { ast->State = ast::Spec::Generic; }
+		else if (++ast->Hits >= WarmUp) { ast->State = ast::Spec::Fast; }
+	}
+
+	// x(i) on a variable inferred as Tuple: reads the element in place instead of copying the tuple
+	std::int_fast64_t evalIdxAtAst(ast::BinaryExpAst* ast)
+	{
+		const auto elm = readElement(ast);
+		expect(CanCastInNum(elm), "Num", elm);
+		return static_cast<ast::NumberAst*>(elm)->getVal();
+	}
+
+	// Whether `ast` is x(i) on a variable, which the linker makes of every tuple index.
+	bool isIdxAt(ast::BaseAst* ast)
+	{
+		if (ast->getID() != ast::BinaryExpID) { return false; }
+		auto bin = static_cast<ast::BinaryExpAst*>(ast);
+		if (bin->Kind == ast::OpKind::None) { bin->Kind = DecodeOp(bin->getOp(), false); }
+		return bin->Kind == ast::OpKind::IdxAt and bin->getLhs()->getID() == ast::IdentID;
+	}
+
+	// The element x(i) refers to, of any type, in place.
+	ast::BaseAst* readElement(ast::BinaryExpAst* ast)
+	{
+		auto tpl = readIdent(static_cast<ast::IdentAst*>(ast->getLhs()));
+		expect(CanCastInTpl(tpl), "Tuple", tpl);
+		const auto idx = evalNumOrCall(ast->getRhs());
+		return elementAt(static_cast<ast::TupleAst*>(tpl)->Ary, idx);
 	}
 
 	std::int_fast64_t evalNumMonoExpAst(ast::MonoExpAst* ast)
 	{
-		bool isLhsNumber = ast->getLhs()->getID() == ast::NumberID,
-			 isLhsMonoExp = ast->getLhs()->getID() == ast::MonoExpID,
-			 isLhsCall = ast->getLhs()->getID() == ast::CallID,
-			 isLhsBinExp = ast->getLhs()->getID() == ast::BinaryExpID,
-			 isLhsIdent = ast->getLhs()->getID() == ast::IdentID;
-			 
-		const auto LhsEval =
-			isLhsNumber ? evalNumberAst(dynamic_cast<ast::NumberAst*>(ast->getLhs())) : \
-			isLhsMonoExp ? evalNumMonoExpAst(dynamic_cast<ast::MonoExpAst*>(ast->getLhs())) : \
-			isLhsBinExp ? evalNumBinaryExpAst(dynamic_cast<ast::BinaryExpAst*>(ast->getLhs())) : \
-			isLhsIdent ? evalNumExpr(dynamic_cast<ast::IdentAst*>(ast->getLhs())) : \
-			-1; // dummy
-		if (ast->getOp() == "!") { return static_cast<std::int_fast64_t>(! LhsEval); }
-		else if (ast->getOp() == "-") { return -LhsEval; }
-		else if (ast->getOp() == "~") { return ~LhsEval; }
-		else // otherwize
-		{
-			assert(0 && "no match");
+		// `-f(x)` in the source, or left by -O1 folding `-(f(x) + 0)`
+		const auto LhsEval = evalNumOrCall(ast->getLhs());
+		if (ast->Kind == ast::OpKind::None) { ast->Kind = DecodeOp(ast->getOp(), true); }
+		switch (ast->Kind) {
+		case ast::OpKind::Not: return static_cast<std::int_fast64_t>(! LhsEval);
+		case ast::OpKind::Neg: return -LhsEval;
+		default: return ~LhsEval;
 		}
-		return 0;
 	}
 
 	// ================
@@ -1033,55 +1399,35 @@ struct AstEval {
 	std::vector<ast::BaseAst*> evalTplExpr(ast::BaseAst* ast)
 	{
 		std::vector<ast::BaseAst*> res{};
-		std::vector<ast::BaseAst*> Ary{};
 
 		if (ast->getID() == ast::IdentID)
 		{
-			const auto& name = dynamic_cast<ast::IdentAst*>(ast)->getIdent();
-			bool flg = true;
-
-			assert(valsSize >= 1);
-			for (std::int_fast32_t i = valsSize - 1; i >= curLower; i--)
-			{
-				if (vals[i].find(name) != std::end(vals[i]))
-				{
-					if (CanCastInTpl(vals[i].at(name)))
-					{
-						Ary = evalTplExpr(vals[i].at(name));
-						flg = false;
-						break;
-					}
-					else
-					{
-						assert(0);
-					}
-				}
-			}
-
-			if (flg)
-			{
-				assert(0 && "unknown ident");
-			}
+			auto val = readIdent(static_cast<ast::IdentAst*>(ast));
+			expect(CanCastInTpl(val), "Tuple", val);
+			return evalTplExpr(val);
 		}
-		else
+		const auto& Ary = static_cast<ast::TupleAst*>(ast)->Ary;
+
+		// a few calls can copy a lot: `return f([x, t, t]);` doubles t on each
+		if (not fuel.alloc(Ary.size()))
 		{
-			Ary = dynamic_cast<ast::TupleAst*>(ast)->getAry();
+			outOfFuel();
+			return res;
 		}
-
-		assert(not Ary.empty());
 		for (const auto& elm : Ary)
 		{
 			if (elm->getID() == ast::IdentID)
 			{
-				if (TypeOfIdentAst(elm) == ast::NumberID)
+				const auto type = TypeOfIdent(elm);
+				if (type == ast::NumberID)
 				{
 					res.push_back(new ast::NumberAst(evalNumExpr(elm)));
 				}
-				else if (TypeOfIdentAst(elm) == ast::StringID)
+				else if (type == ast::StringID)
 				{
 					res.push_back(new ast::StringAst(evalStrExpr(elm)));
 				}
-				else if (TypeOfIdentAst(elm) == ast::TupleID)
+				else if (type == ast::TupleID)
 				{
 					res.push_back(new ast::TupleAst(evalTplExpr(elm)));
 				}
@@ -1089,7 +1435,12 @@ struct AstEval {
 			}
 			else
 			{
-				if (CanCastInNum(elm))
+				if (elm->getID() == ast::CallID or isIdxAt(elm))
+				{
+					// the result of a call, or the copy of an element, is a fresh value; the tuple takes it over
+					res.push_back(evalValue(elm));
+				}
+				else if (CanCastInNum(elm))
 				{
 					res.push_back(new ast::NumberAst(evalNumExpr(elm)));
 				}
@@ -0,0 +1,492 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+
+namespace Noh {
+namespace flat {
+
+// ================
+//      layout
+// ================
+
+// Node kinds of a flat tree; the comments say what A, B and C hold.
+// Child nodes and lists are indices into Tree::Nodes and Tree::Lists.
+enum class Kind : std::uint8_t {
+	// expressions
+	Num,      // Nums[A]
+	Str,      // Strs[A]
+	Tuple,    // elements Lists[A, A + B)
+	Load,     // local A
+	Mono,     // Op node A
+	Binary,   // node A Op node B
+	Call,     // Funcs[A] with arguments Lists[B, B + C)
+
+	// statements
+	Block,    // statements Lists[A, A + B)
+	Decl,     // local A = node B
+	Assign,   // local A = node B; the local keeps its type
+	If,       // if node A then block B else block C (or NoNode)
+	While,    // while node A do block B
+	Range,    // node A .. node B
+	For,      // for local C in Range node A do block B
+	Return,   // return node A
+	TailCall, // return Funcs[A] with arguments Lists[B, B + C)
+	Break,
+	Continue,
+	Exit,
+	Print,    // node A
+	ScanNum,  // into local A
+	ScanStr,  // into local A
+};
+
+inline constexpr std::uint32_t NoNode = UINT32_MAX;
+
+struct Node {
+	Kind K;
+	ast::OpKind Op = ast::OpKind::None;
+	std::uint32_t A = 0, B = 0, C = 0;
+};
+static_assert(sizeof(Node) == 16, "a flat node should stay four words");
+
+struct Func {
+	std::string Name;
+	std::uint32_t NumParams = 0;
+	std::uint32_t NumSlots = 0;
+	std::uint32_t Body = NoNode; // a Block node
+	bool Memo = false;
+	bool Pure = false;  // see memo::Purity
+	bool Heavy = false; // loops, recurses, is large or calls such a function: worth a task of its own
+};
+
+// A whole module as plain arrays: no pointers, no virtual calls.
+struct Tree {
+	std::vector<Node> Nodes;
+	std::vector<std::uint32_t> Lists;
+	std::vector<std::int_fast64_t> Nums;
+	std::vector<std::shared_ptr<const std::string>> Strs;
+	std::vector<Func> Funcs;
+	std::int32_t Entry = -1;
+	std::int32_t Init = -1; // fn init, run first when main takes its result
+};
+
+// ================
+//     flatten
+// ================
+
+// Lays a linked ModuleAst (link_noh.hpp) out as a Tree.
+// Variables are resolved to frame slots here, so the evaluator never looks a name up.
+class Flattener {
+	Tree& tree;
+	EvalOption option;
+	std::unordered_map<ast::FuncAst*, std::uint32_t> funcIdx;
+	std::vector<std::string> errors;
+
+	// per function, for Func::Heavy
+	std::vector<std::vector<std::uint32_t>> callees;
+	std::vector<bool> ownCost;
+
+	// state of the function being flattened
+	Func* cur = nullptr;
+	std::uint32_t curIdx = 0;
+	std::vector<std::unordered_map<std::string, std::uint32_t>> scopes;
+	std::uint32_t nextSlot = 0;
+	int loops = 0;
+
+	void error(const std::string& msg)
+	{
+		errors.push_back("in fn " + cur->Name + ": " + msg);
+	}
+
+	std::uint32_t node(Kind kind, std::uint32_t a = 0, std::uint32_t b = 0, std::uint32_t c = 0)
+	{
+		tree.Nodes.push_back(Node{kind, ast::OpKind::None, a, b, c});
+		return static_cast<std::uint32_t>(tree.Nodes.size() - 1);
+	}
+
+	// the children are flattened first, so that the list itself is contiguous
+	std::uint32_t list(const std::vector<std::uint32_t>& items)
+	{
+		const auto at = static_cast<std::uint32_t>(tree.Lists.size());
+		tree.Lists.insert(std::end(tree.Lists), std::begin(items), std::end(items));
+		return at;
+	}
+
+	void pushScope() { scopes.emplace_back(); }
+	void popScope()
+	{
+		nextSlot -= static_cast<std::uint32_t>(scopes.back().size());
+		scopes.pop_back();
+	}
+
+	std::uint32_t declare(const std::string& name)
+	{
+		if (scopes.back().find(name) != std::end(scopes.back()))
+		{
+			error("redefinition of variable '" + name + "'");
+			return 0;
+		}
+		const auto slot = nextSlot++;
+		if (nextSlot > cur->NumSlots) { cur->NumSlots = nextSlot; }
+		scopes.back()[name] = slot;
+		return slot;
+	}
+
+	std::uint32_t lookup(const std::string& name)
+	{
+		for (auto itr = scopes.rbegin(); itr != scopes.rend(); itr++)
+		{
+			if (auto found = itr->find(name); found != std::end(*itr)) { return found->second; }
+		}
+		error("unknown ident '" + name + "'");
+		return 0;
+	}
+
+	static ast::OpKind opKind(const std::string& op, bool mono)
+	{
+		if (mono) { return op == "!" ? ast::OpKind::Not : op == "-" ? ast::OpKind::Neg : ast::OpKind::BitNot; }
+		if (op == "+") { return ast::OpKind::Add; }
+		else if (op == "-") { return ast::OpKind::Sub; }
+		else if (op == "*") { return ast::OpKind::Mul; }
+		else if (op == "/") { return ast::OpKind::Div; }
+		else if (op == "%") { return ast::OpKind::Mod; }
+		else if (op == "==") { return ast::OpKind::Eq; }
+		else if (op == "!=") { return ast::OpKind::Ne; }
+		else if (op == "<") { return ast::OpKind::Lt; }
+		else if (op == ">") { return ast::OpKind::Gt; }
+		else if (op == "<=") { return ast::OpKind::Le; }
+		else if (op == ">=") { return ast::OpKind::Ge; }
+		else if (op == "&&") { return ast::OpKind::And; }
+		else if (op == "||") { return ast::OpKind::Or; }
+		else if (op == "IdxAt") { return ast::OpKind::IdxAt; }
+		return ast::OpKind::None;
+	}
+
+	// ================
+	//       expr
+	// ================
+
+	std::uint32_t flattenExpr(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+			tree.Nums.push_back(static_cast<ast::NumberAst*>(ast)->getVal());
+			return node(Kind::Num, static_cast<std::uint32_t>(tree.Nums.size() - 1));
+		case ast::StringID:
+			tree.Strs.push_back(std::make_shared<const std::string>(static_cast<ast::StringAst*>(ast)->getVal()));
+			return node(Kind::Str, static_cast<std::uint32_t>(tree.Strs.size() - 1));
+		case ast::IdentID:
+			return node(Kind::Load, lookup(static_cast<ast::IdentAst*>(ast)->getIdent()));
+		case ast::TupleID:
+		{
+			auto elms = flattenList(static_cast<ast::TupleAst*>(ast)->Ary);
+			return node(Kind::Tuple, list(elms), static_cast<std::uint32_t>(elms.size()));
+		}
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			const auto lhs = flattenExpr(mono->getLhs());
+			const auto at = node(Kind::Mono, lhs);
+			tree.Nodes[at].Op = opKind(mono->getOp(), true);
+			return at;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			const auto lhs = flattenExpr(bin->getLhs());
+			const auto rhs = flattenExpr(bin->getRhs());
+			const auto at = node(Kind::Binary, lhs, rhs);
+			tree.Nodes[at].Op = opKind(bin->getOp(), false);
+			if (tree.Nodes[at].Op == ast::OpKind::None) { error("unknown operator '" + bin->getOp() + "'"); }
+			return at;
+		}
+		case ast::CallID:
+			return flattenCall(static_cast<ast::CallAst*>(ast), Kind::Call);
+		default:
+			error("illegal expression");
+			return node(Kind::Num, 0);
+		}
+	}
+
+	std::vector<std::uint32_t> flattenList(std::vector<ast::BaseAst*>& exprs)
+	{
+		std::vector<std::uint32_t> res{};
+		for (auto& expr : exprs) { res.push_back(flattenExpr(expr)); }
+		return res;
+	}
+
+	std::uint32_t flattenCall(ast::CallAst* ast, Kind kind)
+	{
+		if (not ast->getCallee())
+		{
+			error("unlinked call to '" + ast->getFuncName() + "'");
+			return node(Kind::Num, 0);
+		}
+		auto args = flattenList(ast->getParams());
+		callees[curIdx].push_back(funcIdx.at(ast->getCallee()));
+		return node(kind, funcIdx.at(ast->getCallee()), list(args), static_cast<std::uint32_t>(args.size()));
+	}
+
+	// ================
+	//       stmt
+	// ================
+
+	std::uint32_t flattenBlock(std::vector<ast::BaseAst*>& stmts)
+	{
+		pushScope();
+		std::vector<std::uint32_t> items{};
+		for (auto& stmt : stmts) { flattenStmt(stmt, items); }
+		popScope();
+		return node(Kind::Block, list(items), static_cast<std::uint32_t>(items.size()));
+	}
+
+	void flattenStmt(ast::BaseAst* ast, std::vector<std::uint32_t>& out)
+	{
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+			flattenBuiltin(static_cast<ast::BuiltinAst*>(ast), out);
+			break;
+		case ast::AssignID:
+		{
+			auto assign = static_cast<ast::AssignAst*>(ast);
+			const auto val = flattenExpr(assign->getVal());
+			out.push_back(node(Kind::Decl, declare(assign->getName()), val));
+			break;
+		}
+		case ast::ReAssignID:
+		{
+			auto assign = static_cast<ast::ReAssignAst*>(ast);
+			const auto val = flattenExpr(assign->getVal());
+			out.push_back(node(Kind::Assign, lookup(assign->getName()), val));
+			break;
+		}
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			const auto cond = flattenExpr(stmt->getCond());
+			const auto then = flattenBlock(stmt->getThenStmt());
+			const auto other = stmt->getElseStmt().empty() ? NoNode : flattenBlock(stmt->getElseStmt());
+			out.push_back(node(Kind::If, cond, then, other));
+			break;
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			const auto cond = flattenExpr(stmt->getCond());
+			loops++;
+			const auto body = flattenBlock(stmt->getLoopStmt());
+			loops--;
+			out.push_back(node(Kind::While, cond, body));
+			break;
+		}
+		case ast::ForStmtID:
+		{
+			auto stmt = static_cast<ast::ForStmtAst*>(ast);
+			const auto from = flattenExpr(stmt->getRange()->getFrom());
+			const auto to = flattenExpr(stmt->getRange()->getTo());
+			const auto range = node(Kind::Range, from, to);
+			// the loop variable is a copy of the evaluator's counter, so the body may overwrite it
+			pushScope();
+			const auto var = declare(stmt->getIdent());
+			std::vector<std::uint32_t> items{};
+			loops++;
+			for (auto& inner : stmt->getStmts()) { flattenStmt(inner, items); }
+			loops--;
+			popScope();
+			const auto body = node(Kind::Block, list(items), static_cast<std::uint32_t>(items.size()));
+			out.push_back(node(Kind::For, range, body, var));
+			break;
+		}
+		case ast::CallID:
+			out.push_back(flattenCall(static_cast<ast::CallAst*>(ast), Kind::Call));
+			break;
+		default:
+			error("illegal statement");
+		}
+	}
+
+	void flattenBuiltin(ast::BuiltinAst* ast, std::vector<std::uint32_t>& out)
+	{
+		const auto& name = ast->getName();
+		auto& args = ast->getArgs();
+		if (name == "break" or name == "continue")
+		{
+			if (loops == 0)
+			{
+				error("'" + name + "' outside of a loop");
+				return;
+			}
+			out.push_back(node(name == "break" ? Kind::Break : Kind::Continue));
+		}
+		else if (name == "exit")
+		{
+			out.push_back(node(Kind::Exit));
+		}
+		else if (name == "return")
+		{
+			auto val = args.front();
+			if (val->getID() == ast::CallID and static_cast<ast::CallAst*>(val)->getCallee())
+			{
+				out.push_back(flattenCall(static_cast<ast::CallAst*>(val), Kind::TailCall));
+				return;
+			}
+			out.push_back(node(Kind::Return, flattenExpr(val)));
+		}
+		else if (name == "print")
+		{
+			for (auto& arg : args) { out.push_back(node(Kind::Print, flattenExpr(arg))); }
+		}
+		else if (name == "scanNum" or name == "scanStr")
+		{
+			for (auto& arg : args)
+			{
+				const auto slot = lookup(static_cast<ast::IdentAst*>(arg)->getIdent());
+				out.push_back(node(name == "scanNum" ? Kind::ScanNum : Kind::ScanStr, slot));
+			}
+		}
+		else
+		{
+			error("unknown builtin '" + name + "'");
+		}
+	}
+
+	void flattenFunc(ast::FuncAst* ast, std::uint32_t idx)
+	{
+		cur = &tree.Funcs[idx];
+		curIdx = idx;
+		const auto first = tree.Nodes.size();
+		scopes.clear();
+		nextSlot = 0;
+		loops = 0;
+		pushScope();
+		for (auto& param : ast->getParamNames()) { declare(param); }
+		const auto body = flattenBlock(ast->getInst());
+		popScope();
+		tree.Funcs[idx].Body = body;
+		cur = nullptr;
+
+		bool loop = false;
+		for (auto i = first; i < tree.Nodes.size(); i++)
+		{
+			loop = loop or tree.Nodes[i].K == Kind::While or tree.Nodes[i].K == Kind::For;
+		}
+		ownCost[idx] = loop or tree.Nodes.size() - first >= option.ParThreshold;
+	}
+
+	// A function is heavy when it loops, is large or recurses, or when it calls a heavy function.
+	void markHeavy()
+	{
+		const auto size = tree.Funcs.size();
+		// reach[f][g]: f calls g through one or more calls
+		std::vector<std::vector<bool>> reach(size, std::vector<bool>(size, false));
+		for (std::size_t root{}; root < size; root++)
+		{
+			std::vector<std::uint32_t> todo(std::begin(callees[root]), std::end(callees[root]));
+			while (not todo.empty())
+			{
+				const auto func = todo.back();
+				todo.pop_back();
+				if (reach[root][func]) { continue; }
+				reach[root][func] = true;
+				todo.insert(std::end(todo), std::begin(callees[func]), std::end(callees[func]));
+			}
+		}
+		auto costly = [&](std::size_t func) { return ownCost[func] or reach[func][func]; };
+		for (std::size_t root{}; root < size; root++)
+		{
+			bool heavy = costly(root);
+			for (std::size_t func{}; func < size and not heavy; func++)
+			{
+				heavy = reach[root][func] and costly(func);
+			}
+			tree.Funcs[root].Heavy = heavy;
+		}
+	}
+
+public:
+	Flattener(Tree& tree, const EvalOption& option = EvalOption{}) : tree(tree), option(option) {}
+
+	bool flatten(ast::ModuleAst* ast)
+	{
+		std::unordered_map<std::string, ast::FuncAst*> funcs;
+		for (auto& func : ast->getFuncs())
+		{
+			if (funcs.find(func->getName()) != std::end(funcs))
+			{
+				errors.push_back("redefinition of fn " + func->getName());
+				continue;
+			}
+			funcs[func->getName()] = func;
+			funcIdx[func] = static_cast<std::uint32_t>(tree.Funcs.size());
+			Func code{};
+			code.Name = func->getName();
+			code.NumParams = static_cast<std::uint32_t>(func->getParamNames().size());
+			tree.Funcs.push_back(std::move(code));
+		}
+
+		callees.resize(tree.Funcs.size());
+		ownCost.resize(tree.Funcs.size(), false);
+
+		memo::Purity purity(funcs);
+		for (auto& [func, idx] : funcIdx)
+		{
+			tree.Funcs[idx].Pure = purity.isPure(func);
+			if (not func->getIsMemo() and not option.MemoAll) { continue; }
+			if (purity.isPure(func))
+			{
+				tree.Funcs[idx].Memo = true;
+			}
+			else if (func->getIsMemo())
+			{
+				std::cerr << "warning: '" << func->getName() << "' is not pure and will not be memoized" << std::endl;
+			}
+		}
+
+		for (auto& func : ast->getFuncs())
+		{
+			if (funcIdx.count(func)) { flattenFunc(func, funcIdx.at(func)); }
+		}
+		markHeavy();
+
+		if (auto itr = funcs.find("main"); itr != std::end(funcs))
+		{
+			// fn main(state) takes the result of fn init()
+			const auto init = funcs.find("init");
+			const bool hasInit = init != std::end(funcs) and init->second->getParamNames().empty();
+			if (itr->second->getParamNames().size() == 1 and hasInit)
+			{
+				tree.Init = static_cast<std::int32_t>(funcIdx.at(init->second));
+			}
+			else if (not itr->second->getParamNames().empty())
+			{
+				errors.push_back("fn main must not take parameters, or take only the result of fn init()");
+			}
+			tree.Entry = static_cast<std::int32_t>(funcIdx.at(itr->second));
+		}
+		else
+		{
+			for (auto& func : ast->getFuncs())
+			{
+				if (func->getParamNames().empty())
+				{
+					tree.Entry = static_cast<std::int32_t>(funcIdx.at(func));
+					break;
+				}
+			}
+		}
+		return errors.empty();
+	}
+
+	const std::vector<std::string>& getErrors() const { return errors; }
+};
+
+} // namespace flat
+} // namespace Noh
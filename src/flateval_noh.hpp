@@ -0,0 +1,579 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bytecode_noh.hpp"
+#include "flat_noh.hpp"
+#include "limit_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+#include "par_noh.hpp"
+
+namespace Noh {
+namespace flat {
+
+// How a statement finished.
+enum class Flow : std::uint8_t {
+	Next,
+	Break,
+	Continue,
+	Return,   // the result is in `ret`
+	TailCall, // the callee and its arguments are in `tailFunc` and `tailArgs`
+	Exit,
+	Error,
+};
+
+inline const char* OpName(ast::OpKind op)
+{
+	switch (op) {
+	case ast::OpKind::Add: return "+";
+	case ast::OpKind::Sub: return "-";
+	case ast::OpKind::Mul: return "*";
+	case ast::OpKind::Div: return "/";
+	case ast::OpKind::Mod: return "%";
+	case ast::OpKind::Eq: return "==";
+	case ast::OpKind::Ne: return "!=";
+	case ast::OpKind::Lt: return "<";
+	case ast::OpKind::Gt: return ">";
+	case ast::OpKind::Le: return "<=";
+	case ast::OpKind::Ge: return ">=";
+	case ast::OpKind::And: return "&&";
+	case ast::OpKind::Or: return "||";
+	case ast::OpKind::IdxAt: return "IdxAt";
+	case ast::OpKind::Not: return "!";
+	case ast::OpKind::Neg: return "-";
+	case ast::OpKind::BitNot: return "~";
+	default: return "?";
+	}
+}
+
+// Walks a flat Tree. Every node is reached by index and dispatched on its Kind tag,
+// and the locals of all active calls share one array, `base` being the current frame.
+class Eval {
+	using Value = vm::Value;
+
+	const Tree& tree;
+	EvalOption option;
+	std::vector<Value> locals;
+	std::uint32_t base = 0;
+	std::vector<memo::MemoTable<Value>> memos;
+	Value ret;
+	std::uint32_t tailFunc = 0;
+	std::vector<Value> tailArgs;
+	bool exited = false;
+	std::string errorMsg;
+	limit::Fuel fuel;
+
+	// --auto-par: the pool and one evaluator per pool thread, Evals[0] being the one that owns it
+	struct Par {
+		std::vector<bool> Fork; // per node: a Binary whose rhs call can run as a task
+		std::size_t MaxDepth = 0; // forks nested deeper than this run sequentially
+		std::vector<std::unique_ptr<Eval>> Workers;
+		std::vector<Eval*> Evals;
+		par::Pool Pool; // last, so its threads stop before the evaluators go away
+		Par(std::size_t threads) : Fork(), Workers(), Evals(), Pool(threads) {}
+	};
+	std::unique_ptr<Par> ownPar;
+	Par* par = nullptr;
+	std::size_t forkDepth = 0; // forks enclosing what this evaluator is running
+
+	bool fail(const std::string& msg)
+	{
+		errorMsg = msg;
+		return false;
+	}
+
+	// what a statement reports when an expression in it did not produce a value
+	Flow halt() const { return exited ? Flow::Exit : Flow::Error; }
+
+	static bool isTrue(const Value& val) { return val.Type != vm::ValueType::Num or val.Num != 0; }
+
+	const Node& at(std::uint32_t idx) const { return tree.Nodes[idx]; }
+	std::uint32_t item(std::uint32_t list, std::uint32_t idx) const { return tree.Lists[list + idx]; }
+
+	// ================
+	//       expr
+	// ================
+
+	bool eval(std::uint32_t idx, Value& out)
+	{
+		const auto& node = at(idx);
+		switch (node.K) {
+		case Kind::Num:
+			out = Value(tree.Nums[node.A]);
+			return true;
+		case Kind::Str:
+			out = Value(tree.Strs[node.A]);
+			return true;
+		case Kind::Tuple:
+		{
+			auto tpl = std::make_shared<vm::Tuple>(node.B);
+			for (std::uint32_t i{}; i < node.B; i++)
+			{
+				if (not eval(item(node.A, i), (*tpl)[i])) { return false; }
+			}
+			out = Value(std::shared_ptr<const vm::Tuple>(std::move(tpl)));
+			return true;
+		}
+		case Kind::Load:
+			out = locals[base + node.A];
+			return true;
+		case Kind::Mono:
+		{
+			if (not eval(node.A, out)) { return false; }
+			if (out.Type != vm::ValueType::Num)
+			{
+				return fail(std::string("operator ") + OpName(node.Op) + " expects Num, got " + vm::TypeName(out.Type));
+			}
+			out.Num = node.Op == ast::OpKind::Not ? static_cast<std::int_fast64_t>(not out.Num)
+				: node.Op == ast::OpKind::Neg ? -out.Num : ~out.Num;
+			return true;
+		}
+		case Kind::Binary:
+			if (par and par->Fork[idx]) { return evalForked(node, out); }
+			return evalBinary(node, out);
+		case Kind::Call:
+		{
+			std::vector<Value> args(node.C);
+			for (std::uint32_t i{}; i < node.C; i++)
+			{
+				if (not eval(item(node.B, i), args[i])) { return false; }
+			}
+			return call(node.A, std::move(args), out);
+		}
+		default:
+			return fail("illegal expression");
+		}
+	}
+
+	// An expression without calls to impure functions.
+	bool isPureExpr(std::uint32_t idx) const
+	{
+		const auto& node = at(idx);
+		switch (node.K) {
+		case Kind::Num:
+		case Kind::Str:
+		case Kind::Load:
+			return true;
+		case Kind::Mono:
+			return isPureExpr(node.A);
+		case Kind::Binary:
+			return isPureExpr(node.A) and isPureExpr(node.B);
+		case Kind::Tuple:
+			for (std::uint32_t i{}; i < node.B; i++)
+			{
+				if (not isPureExpr(item(node.A, i))) { return false; }
+			}
+			return true;
+		case Kind::Call:
+			if (not tree.Funcs[node.A].Pure) { return false; }
+			for (std::uint32_t i{}; i < node.C; i++)
+			{
+				if (not isPureExpr(item(node.B, i))) { return false; }
+			}
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	// `f(x) op g(y)` where both sides are pure and g is heavy enough to pay for a task.
+	// Memoized functions stay sequential: their tables belong to one evaluator.
+	bool isForkable(const Node& node) const
+	{
+		if (node.K != Kind::Binary or node.Op == ast::OpKind::And or node.Op == ast::OpKind::Or
+			or node.Op == ast::OpKind::IdxAt)
+		{
+			return false;
+		}
+		const auto& lhs = at(node.A);
+		const auto& rhs = at(node.B);
+		if (lhs.K != Kind::Call or rhs.K != Kind::Call) { return false; }
+		const auto& callee = tree.Funcs[rhs.A];
+		return callee.Pure and callee.Heavy and not callee.Memo and isPureExpr(node.A) and isPureExpr(node.B);
+	}
+
+	// Runs the rhs call as a task while this thread evaluates the lhs, and joins at the operator.
+	// Both sides are pure, so running them at the same time cannot be observed.
+	bool evalForked(const Node& node, Value& out)
+	{
+		auto& pool = par->Pool;
+		// deep enough to keep every thread busy, or tasks are already waiting for a thread:
+		// splitting further only adds overhead
+		if (forkDepth >= par->MaxDepth or pool.pending() >= pool.size()) { return evalBinary(node, out); }
+
+		const auto& call = at(node.B);
+		std::vector<Value> args(call.C);
+		for (std::uint32_t i{}; i < call.C; i++)
+		{
+			if (not eval(item(call.B, i), args[i])) { return false; }
+		}
+		struct Result {
+			Value Val;
+			bool Ok = false;
+			std::string Error;
+		};
+		auto res = std::make_shared<Result>();
+		const auto depth = forkDepth + 1;
+		auto task = pool.spawn([evals = &par->Evals, res, depth, func = call.A, args = std::move(args)](std::size_t self) mutable
+		{
+			// the thread may be in the middle of another task on the same evaluator
+			auto& eval = *(*evals)[self];
+			const auto saved = eval.forkDepth;
+			eval.forkDepth = depth;
+			res->Ok = eval.call(func, std::move(args), res->Val);
+			if (not res->Ok) { res->Error = eval.errorMsg; }
+			eval.forkDepth = saved;
+		});
+		forkDepth = depth;
+		const bool ok = eval(node.A, out);
+		forkDepth = depth - 1;
+		pool.join(*task);
+		if (not ok) { return false; }
+		if (not res->Ok) { return fail(res->Error); }
+		return combine(node, out, res->Val);
+	}
+
+	bool evalBinary(const Node& node, Value& out)
+	{
+		if (node.Op == ast::OpKind::And or node.Op == ast::OpKind::Or)
+		{
+			// short-circuit: the rhs runs only when the lhs does not decide the result
+			auto operand = [&](std::uint32_t at)
+			{
+				if (not eval(at, out)) { return false; }
+				if (out.Type == vm::ValueType::Num) { return true; }
+				return fail(std::string("operator ") + OpName(node.Op) + " expects Num, got " + vm::TypeName(out.Type));
+			};
+			if (not operand(node.A)) { return false; }
+			const bool decided = (out.Num != 0) == (node.Op == ast::OpKind::Or);
+			if (not decided and not operand(node.B)) { return false; }
+			out.Num = out.Num != 0;
+			return true;
+		}
+		Value rhs{};
+		if (not eval(node.A, out) or not eval(node.B, rhs)) { return false; }
+		return combine(node, out, rhs);
+	}
+
+	// out = out Op rhs
+	bool combine(const Node& node, Value& out, const Value& rhs)
+	{
+		if (node.Op == ast::OpKind::IdxAt)
+		{
+			if (out.Type != vm::ValueType::Tpl or rhs.Type != vm::ValueType::Num)
+			{
+				return fail(std::string("cannot index ") + vm::TypeName(out.Type) + " with " + vm::TypeName(rhs.Type));
+			}
+			if (rhs.Num < 0 or static_cast<std::size_t>(rhs.Num) >= out.Tpl->size())
+			{
+				return fail("tuple index " + std::to_string(rhs.Num) + " out of range");
+			}
+			Value elm = (*out.Tpl)[rhs.Num];
+			out = std::move(elm);
+			return true;
+		}
+		if (out.Type != vm::ValueType::Num or rhs.Type != vm::ValueType::Num)
+		{
+			return fail(std::string("operator ") + OpName(node.Op) + " expects Num, got "
+				+ vm::TypeName(out.Type) + " and " + vm::TypeName(rhs.Type));
+		}
+		const auto l = out.Num, r = rhs.Num;
+		switch (node.Op) {
+		case ast::OpKind::Add: out.Num = l + r; break;
+		case ast::OpKind::Sub: out.Num = l - r; break;
+		case ast::OpKind::Mul: out.Num = l * r; break;
+		case ast::OpKind::Div:
+			if (r == 0) { return fail("division by zero"); }
+			out.Num = l / r;
+			break;
+		case ast::OpKind::Mod:
+			if (r == 0) { return fail("division by zero"); }
+			out.Num = l % r;
+			break;
+		case ast::OpKind::Eq: out.Num = l == r; break;
+		case ast::OpKind::Ne: out.Num = l != r; break;
+		case ast::OpKind::Lt: out.Num = l < r; break;
+		case ast::OpKind::Gt: out.Num = l > r; break;
+		case ast::OpKind::Le: out.Num = l <= r; break;
+		case ast::OpKind::Ge: out.Num = l >= r; break;
+		default: return fail("unknown operator");
+		}
+		return true;
+	}
+
+	// ================
+	//       call
+	// ================
+
+	// Runs Funcs[func] in a new frame. Tail calls reuse it, except from a memoized frame,
+	// whose result still has to be cached.
+	bool call(std::uint32_t func, std::vector<Value> args, Value& out)
+	{
+		const auto saved = base;
+		base = static_cast<std::uint32_t>(locals.size());
+		while (true)
+		{
+			if (not fuel.tick() or not fuel.enter()) { return fail(fuel.message()); }
+			const auto& callee = tree.Funcs[func];
+			std::string key{};
+			if (callee.Memo)
+			{
+				for (const auto& arg : args) { vm::AppendKey(key, arg); }
+				if (auto hit = memos[func].find(key))
+				{
+					out = *hit;
+					break;
+				}
+			}
+			locals.resize(base + callee.NumSlots);
+			for (std::size_t i{}; i < args.size(); i++) { locals[base + i] = std::move(args[i]); }
+
+			auto flow = exec(callee.Body);
+			if (flow == Flow::TailCall and not callee.Memo)
+			{
+				func = tailFunc;
+				args = std::move(tailArgs);
+				locals.resize(base);
+				continue;
+			}
+			if (flow == Flow::Exit or flow == Flow::Error) { return false; }
+			if (flow == Flow::TailCall)
+			{
+				if (not call(tailFunc, std::move(tailArgs), out)) { return false; }
+			}
+			else
+			{
+				out = flow == Flow::Return ? std::move(ret) : Value(0);
+			}
+			if (callee.Memo) { memos[func].insert(key, out); }
+			break;
+		}
+		locals.resize(base);
+		base = saved;
+		return true;
+	}
+
+	// ================
+	//       stmt
+	// ================
+
+	Flow exec(std::uint32_t idx)
+	{
+		const auto& node = at(idx);
+		switch (node.K) {
+		case Kind::Block:
+			for (std::uint32_t i{}; i < node.B; i++)
+			{
+				const auto flow = exec(item(node.A, i));
+				if (flow != Flow::Next) { return flow; }
+			}
+			return Flow::Next;
+		case Kind::Decl:
+		{
+			// evaluated aside first: a call in it may grow `locals`
+			Value val{};
+			if (not eval(node.B, val)) { return halt(); }
+			locals[base + node.A] = std::move(val);
+			return Flow::Next;
+		}
+		case Kind::Assign:
+		{
+			Value val{};
+			if (not eval(node.B, val)) { return halt(); }
+			auto& slot = locals[base + node.A];
+			if (slot.Type != val.Type)
+			{
+				fail(std::string("cannot assign ") + vm::TypeName(val.Type) + " to a " + vm::TypeName(slot.Type) + " variable");
+				return Flow::Error;
+			}
+			slot = std::move(val);
+			return Flow::Next;
+		}
+		case Kind::If:
+		{
+			Value cond{};
+			if (not eval(node.A, cond)) { return halt(); }
+			if (isTrue(cond)) { return exec(node.B); }
+			return node.C == NoNode ? Flow::Next : exec(node.C);
+		}
+		case Kind::While:
+			while (true)
+			{
+				if (not fuel.tick())
+				{
+					fail(fuel.message());
+					return Flow::Error;
+				}
+				Value cond{};
+				if (not eval(node.A, cond)) { return halt(); }
+				if (not isTrue(cond)) { return Flow::Next; }
+				const auto flow = exec(node.B);
+				if (flow == Flow::Break) { return Flow::Next; }
+				if (flow != Flow::Next and flow != Flow::Continue) { return flow; }
+			}
+		case Kind::For:
+			return execFor(node);
+		case Kind::Return:
+		{
+			// not into `ret` directly: a call in the expression overwrites it
+			Value val{};
+			if (not eval(node.A, val)) { return halt(); }
+			ret = std::move(val);
+			return Flow::Return;
+		}
+		case Kind::TailCall:
+		{
+			std::vector<Value> args(node.C);
+			for (std::uint32_t i{}; i < node.C; i++)
+			{
+				if (not eval(item(node.B, i), args[i])) { return halt(); }
+			}
+			tailFunc = node.A;
+			tailArgs = std::move(args);
+			return Flow::TailCall;
+		}
+		case Kind::Break:
+			return Flow::Break;
+		case Kind::Continue:
+			return Flow::Continue;
+		case Kind::Exit:
+			exited = true;
+			return Flow::Exit;
+		case Kind::Print:
+		{
+			Value val{};
+			if (not eval(node.A, val)) { return halt(); }
+			if (val.Type == vm::ValueType::Num) { std::cout << val.Num << '\n'; }
+			else if (val.Type == vm::ValueType::Str) { std::cout << *val.Str << '\n'; }
+			else
+			{
+				fail("cannot print a Tuple");
+				return Flow::Error;
+			}
+			return Flow::Next;
+		}
+		case Kind::ScanNum:
+		{
+			auto& slot = locals[base + node.A];
+			if (slot.Type != vm::ValueType::Num)
+			{
+				fail("scanNum expects a Num variable");
+				return Flow::Error;
+			}
+			std::cin >> slot.Num;
+			return Flow::Next;
+		}
+		case Kind::ScanStr:
+		{
+			auto& slot = locals[base + node.A];
+			if (slot.Type != vm::ValueType::Str)
+			{
+				fail("scanStr expects a Str variable");
+				return Flow::Error;
+			}
+			std::string tmp;
+			std::cin >> tmp;
+			slot.Str = std::make_shared<const std::string>(std::move(tmp));
+			return Flow::Next;
+		}
+		case Kind::Call:
+		{
+			Value val{};
+			return eval(idx, val) ? Flow::Next : halt();
+		}
+		default:
+			fail("illegal statement");
+			return Flow::Error;
+		}
+	}
+
+	Flow execFor(const Node& node)
+	{
+		const auto& range = at(node.A);
+		Value from{}, to{};
+		if (not eval(range.A, from) or not eval(range.B, to)) { return halt(); }
+		if (from.Type != vm::ValueType::Num or to.Type != vm::ValueType::Num)
+		{
+			fail(std::string("a range expects Num, got ") + vm::TypeName(from.Type) + " and " + vm::TypeName(to.Type));
+			return Flow::Error;
+		}
+		for (auto i = from.Num; i < to.Num; i++)
+		{
+			if (not fuel.tick())
+			{
+				fail(fuel.message());
+				return Flow::Error;
+			}
+			locals[base + node.C] = Value(i);
+			const auto flow = exec(node.B);
+			if (flow == Flow::Break) { break; }
+			if (flow != Flow::Next and flow != Flow::Continue) { return flow; }
+		}
+		return Flow::Next;
+	}
+
+public:
+	Eval(const Tree& tree, const EvalOption& option = EvalOption{})
+		: tree(tree), option(option), locals(), memos(), tailArgs(), fuel(option)
+	{
+		memos.reserve(tree.Funcs.size());
+		for (std::size_t i{}; i < tree.Funcs.size(); i++) { memos.emplace_back(option.MemoCapacity); }
+		if (not option.AutoPar) { return; }
+
+		auto threads = option.ParThreads ? option.ParThreads : std::thread::hardware_concurrency();
+		ownPar = std::make_unique<Par>(threads);
+		par = ownPar.get();
+		// about eight tasks per thread at the top of a balanced divide and conquer
+		for (std::size_t n = 1; n < par->Pool.size(); n *= 2) { par->MaxDepth++; }
+		if (par->MaxDepth > 0) { par->MaxDepth += 3; }
+		par->Fork.resize(tree.Nodes.size());
+		for (std::size_t i{}; i < tree.Nodes.size(); i++) { par->Fork[i] = isForkable(tree.Nodes[i]); }
+		par->Evals.push_back(this);
+		auto workerOption = option;
+		workerOption.AutoPar = false;
+		for (std::size_t i = 1; i < par->Pool.size(); i++)
+		{
+			par->Workers.push_back(std::make_unique<Eval>(tree, workerOption));
+			par->Workers.back()->par = par;
+			par->Workers.back()->fuel = fuel;
+			par->Evals.push_back(par->Workers.back().get());
+		}
+	}
+
+	const std::string& getError() const { return errorMsg; }
+
+	// Returns EXIT_SUCCESS, or EXIT_FAILURE (the limit's exit code if one was exceeded) with
+	// getError() set.
+	int run()
+	{
+		if (tree.Entry < 0) { return EXIT_SUCCESS; }
+		Value res{};
+		std::vector<Value> args{};
+		bool ok = true;
+		if (tree.Init >= 0)
+		{
+			// main takes the result of fn init
+			ok = call(static_cast<std::uint32_t>(tree.Init), {}, res);
+			args.push_back(std::move(res));
+		}
+		if (ok) { ok = call(static_cast<std::uint32_t>(tree.Entry), std::move(args), res); }
+		if (not ok and not exited)
+		{
+			std::cout << std::flush;
+			std::cerr << "runtime error: " << errorMsg << std::endl;
+			return fuel.exceeded() != limit::Reason::None ? fuel.exitCode() : EXIT_FAILURE;
+		}
+		std::cout << std::flush;
+		return EXIT_SUCCESS;
+	}
+};
+
+} // namespace flat
+} // namespace Noh
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "bytecode_noh.hpp"
+
+namespace Noh {
+namespace vm {
+
+// Replaces common instruction sequences with superinstructions (see OpCode).
+// The sequences are the ones --profile-ops reports most often on loop-heavy programs:
+//   Load; Load|PushNum; <op>; Store|ReStore   `cur = tmp + cur`, the for loop's counter
+//   Load; Load|PushNum; <cmp>; JumpIfFalse    while and for conditions
+//   Load; Load|PushNum; <op>                  operands of a larger expression
+//   <cmp>; JumpIfFalse                        any other condition
+// A sequence is only fused when no jump lands inside it.
+class Fuser {
+	const std::vector<Instr>& code;
+	std::vector<bool> target;
+
+	// code[pc, pc + len) exists and can only be entered at pc
+	bool plain(std::size_t pc, std::size_t len) const
+	{
+		if (pc + len > code.size()) { return false; }
+		for (auto i = pc + 1; i < pc + len; i++)
+		{
+			if (target[i]) { return false; }
+		}
+		return true;
+	}
+
+	OpCode op(std::size_t pc) const { return code[pc].Op; }
+
+	// Appends the superinstruction starting at pc to `out`; returns the number of instructions it replaces, or 0.
+	std::size_t match(std::size_t pc, std::vector<Instr>& out) const
+	{
+		if (op(pc) == OpCode::Load and plain(pc, 3) and (op(pc + 1) == OpCode::Load or op(pc + 1) == OpCode::PushNum)
+			and IsBinaryOp(op(pc + 2)))
+		{
+			const bool local = op(pc + 1) == OpCode::Load;
+			Instr ins{local ? OpCode::BinLL : OpCode::BinLK, op(pc + 2), code[pc].A, code[pc + 1].A};
+			std::size_t len = 3;
+			if (plain(pc, 4) and op(pc + 3) == OpCode::Store)
+			{
+				ins.Op = local ? OpCode::StoreLL : OpCode::StoreLK;
+				ins.C = code[pc + 3].A;
+				len = 4;
+			}
+			else if (plain(pc, 4) and op(pc + 3) == OpCode::ReStore)
+			{
+				ins.Op = local ? OpCode::ReStoreLL : OpCode::ReStoreLK;
+				ins.C = code[pc + 3].A;
+				len = 4;
+			}
+			else if (plain(pc, 4) and op(pc + 3) == OpCode::JumpIfFalse and IsCompareOp(op(pc + 2)))
+			{
+				ins.Op = local ? OpCode::CmpJumpLL : OpCode::CmpJumpLK;
+				ins.C = code[pc + 3].A;
+				len = 4;
+			}
+			out.push_back(ins);
+			return len;
+		}
+		if (IsCompareOp(op(pc)) and plain(pc, 2) and op(pc + 1) == OpCode::JumpIfFalse)
+		{
+			out.push_back(Instr{OpCode::CmpJump, op(pc), code[pc + 1].A});
+			return 2;
+		}
+		return 0;
+	}
+
+public:
+	Fuser(const std::vector<Instr>& code) : code(code), target(code.size() + 1, false)
+	{
+		for (const auto& ins : code)
+		{
+			if (ins.Op == OpCode::Jump or ins.Op == OpCode::JumpIfFalse or ins.Op == OpCode::JumpIfTrue) { target[ins.A] = true; }
+		}
+	}
+
+	std::vector<Instr> run() const
+	{
+		std::vector<Instr> res{};
+		std::vector<std::int32_t> newPc(code.size() + 1, 0);
+		for (std::size_t pc{}; pc < code.size();)
+		{
+			newPc[pc] = static_cast<std::int32_t>(res.size());
+			auto len = match(pc, res);
+			if (len == 0)
+			{
+				res.push_back(code[pc]);
+				len = 1;
+			}
+			pc += len;
+		}
+		newPc[code.size()] = static_cast<std::int32_t>(res.size());
+
+		for (auto& ins : res)
+		{
+			switch (ins.Op) {
+			case OpCode::Jump:
+			case OpCode::JumpIfFalse:
+			case OpCode::JumpIfTrue:
+			case OpCode::CmpJump:
+				ins.A = newPc[ins.A];
+				break;
+			case OpCode::CmpJumpLL:
+			case OpCode::CmpJumpLK:
+				ins.C = newPc[ins.C];
+				break;
+			default:
+				break;
+			}
+		}
+		return res;
+	}
+};
+
+inline void Fuse(Program& prog)
+{
+	for (auto& func : prog.Funcs) { func.Code = Fuser(func.Code).run(); }
+}
+
+} // namespace vm
+} // namespace Noh
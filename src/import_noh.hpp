@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_noh.hpp"
+#include "lazy_noh.hpp"
+#include "lru_noh.hpp"
+#include "opt_noh.hpp"
+#include "option_noh.hpp"
+
+namespace Noh {
+namespace imports {
+
+// Reads a .noh file whole; false with `error` set if it cannot be opened or is not a .noh file.
+inline bool ReadScript(const std::string& path, std::string& source, std::string& error)
+{
+	std::ifstream fIn(path);
+	if (not fIn.is_open())
+	{
+		error = "could not open the file: '" + path + "'";
+		return false;
+	}
+	if (std::filesystem::path(path).extension() != ".noh")
+	{
+		error = "invalid extension: '" + path + "'";
+		return false;
+	}
+	std::ostringstream text{};
+	text << fIn.rdbuf();
+	source = text.str();
+	return true;
+}
+
+// One module of a program: the script, or a file it imports directly or indirectly.
+struct Unit {
+	std::string Path; // as given for the script, "" if it has no file; joined to its importer's directory otherwise
+	std::string Source;
+};
+
+// Parsed modules keyed by their source, shared by every program that imports them
+// (--serve, --batch). Cached modules are never changed; programs get copies of their functions.
+using ParseCache = cache::Lru<std::shared_ptr<ast::ModuleAst>>;
+
+// Collects the script at `path` and everything it imports, transitively, once each by
+// canonical path, the script first and then in the order they are first imported. A relative
+// import is found from the directory of the module that imports it. A function defined in two
+// modules is an error here, since a call could not tell them apart.
+// False with `error` set. A module that does not skim is left for the parser to reject.
+inline bool Resolve(const std::string& path, std::string source, std::vector<Unit>& units, std::string& error)
+{
+	units.assign(1, Unit{path, std::move(source)});
+	// a script that imports nothing is parsed as it always was
+	if (units[0].Source.find("import") == std::string::npos) { return true; }
+
+	std::unordered_set<std::string> seen{};
+	if (not path.empty()) { seen.insert(std::filesystem::weakly_canonical(path).string()); }
+	std::unordered_map<std::string, std::size_t> defined{}; // function name -> unit
+	for (std::size_t i{}; i < units.size(); i++)
+	{
+		std::vector<lazy::FuncSpan> funcs{};
+		std::vector<std::string> found{};
+		if (not lazy::Skimmer(units[i].Source, i).run(funcs, found)) { return true; }
+		for (const auto& func : funcs)
+		{
+			auto [itr, added] = defined.emplace(func.Name, i);
+			if (not added and itr->second != i)
+			{
+				error = "fn " + func.Name + " is defined in both '" + units[itr->second].Path + "' and '" + units[i].Path + "'";
+				return false;
+			}
+		}
+		const auto dir = std::filesystem::path(units[i].Path).parent_path();
+		for (const auto& name : found)
+		{
+			const auto file = (dir / name).lexically_normal();
+			if (not seen.insert(std::filesystem::weakly_canonical(file).string()).second) { continue; }
+			Unit unit{file.string(), ""};
+			if (not ReadScript(unit.Path, unit.Source, error))
+			{
+				error += " (imported by '" + units[i].Path + "')";
+				return false;
+			}
+			units.push_back(std::move(unit));
+		}
+	}
+	return true;
+}
+
+// What a compiled program depends on: every module's path and source.
+inline std::string Key(const std::vector<Unit>& units)
+{
+	if (units.size() == 1) { return units[0].Source; }
+	std::string key{};
+	for (const auto& unit : units)
+	{
+		key += unit.Path;
+		key += '\0';
+		key += std::to_string(unit.Source.size());
+		key += '\0';
+		key += unit.Source;
+	}
+	return key;
+}
+
+inline ast::FuncAst* CloneFunc(ast::FuncAst* func)
+{
+	auto res = new ast::FuncAst(func->getName());
+	res->getParamNames() = func->getParamNames();
+	res->getIsMemo() = func->getIsMemo();
+	for (auto& stmt : func->getInst()) { res->getInst().push_back(opt::CloneStmt(stmt)); }
+	return res;
+}
+
+// Parses the units, on up to one thread per unit and through `cache` if given, and links them
+// into one module: the script's functions first, then each import's in order. With --lazy-parse
+// only the functions the run can reach are parsed, and the cache is not used.
+// nullptr if a module does not parse; `errors` names the module unless it is the script itself.
+inline ast::ModuleAst* Link(const std::vector<Unit>& units, const EvalOption& option, ParseCache* cache,
+	std::string& errors)
+{
+	if (option.LazyParse)
+	{
+		std::vector<const std::string*> sources{};
+		for (const auto& unit : units) { sources.push_back(&unit.Source); }
+		return lazy::Parse(sources, option);
+	}
+
+	std::vector<std::shared_ptr<ast::ModuleAst>> cached(units.size());
+	std::vector<ast::ModuleAst*> parsed(units.size());
+	std::vector<std::size_t> todo{};
+	for (std::size_t i{}; i < units.size(); i++)
+	{
+		if (cache) { cached[i] = cache->find(units[i].Source); }
+		if (not cached[i]) { todo.push_back(i); }
+	}
+	std::atomic<std::size_t> next{0};
+	auto work = [&]()
+	{
+		for (std::size_t k; (k = next++) < todo.size();) { parsed[todo[k]] = lazy::ParseModule(units[todo[k]].Source); }
+	};
+	const auto threads = std::min<std::size_t>(todo.size(), std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> workers{};
+	for (std::size_t i = 1; i < threads; i++) { workers.emplace_back(work); }
+	work();
+	for (auto& worker : workers) { worker.join(); }
+
+	for (const auto& i : todo)
+	{
+		if (parsed[i]) { continue; }
+		if (i > 0) { errors = "parse failed: '" + units[i].Path + "'\n"; }
+		for (auto& module : parsed) { delete module; }
+		return nullptr;
+	}
+	auto res = new ast::ModuleAst();
+	for (std::size_t i{}; i < units.size(); i++)
+	{
+		if (cache and parsed[i])
+		{
+			cached[i].reset(parsed[i]);
+			parsed[i] = nullptr;
+			cache->insert(units[i].Source, cached[i]);
+		}
+		if (cached[i])
+		{
+			for (auto& func : cached[i]->getFuncs()) { res->getFuncs().push_back(CloneFunc(func)); }
+			continue;
+		}
+		auto& funcs = parsed[i]->getFuncs();
+		res->getFuncs().insert(std::end(res->getFuncs()), std::begin(funcs), std::end(funcs));
+		funcs.clear();
+		delete parsed[i];
+	}
+	return res;
+}
+
+// Resolve() and Link(): the whole program as one module. nullptr with `errors` set, or with
+// `errors` empty if the script itself does not parse.
+inline ast::ModuleAst* Load(const std::string& path, std::string source, const EvalOption& option,
+	ParseCache* cache, std::string& errors)
+{
+	std::vector<Unit> units{};
+	if (not Resolve(path, std::move(source), units, errors))
+	{
+		errors += '\n';
+		return nullptr;
+	}
+	return Link(units, option, cache, errors);
+}
+
+} // namespace imports
+} // namespace Noh
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast_noh.hpp"
+
+namespace Noh {
+namespace infer {
+
+inline ast::ValType Join(ast::ValType lhs, ast::ValType rhs)
+{
+	if (lhs == ast::ValType::None) { return rhs; }
+	if (rhs == ast::ValType::None or lhs == rhs) { return lhs; }
+	return ast::ValType::Any;
+}
+
+// Whether running `stmts` always ends in a return.
+inline bool AlwaysReturns(std::vector<ast::BaseAst*>& stmts)
+{
+	if (stmts.empty()) { return false; }
+	auto last = stmts.back();
+	if (last->getID() == ast::BuiltinID) { return static_cast<ast::BuiltinAst*>(last)->getName() == "return"; }
+	if (last->getID() == ast::IfStmtID)
+	{
+		auto stmt = static_cast<ast::IfStmtAst*>(last);
+		return AlwaysReturns(stmt->getThenStmt()) and AlwaysReturns(stmt->getElseStmt());
+	}
+	return false;
+}
+
+// Infers the value type of every expression and records it with getType().
+// A variable keeps the type it is declared with, since reassigning another type is an error.
+// Parameters get the join of their arguments over all call sites and calls the join of the
+// callee's returns, iterated to a fixpoint. Linked calls (getCallee) are required.
+class TypeInfer {
+	std::unordered_map<ast::FuncAst*, std::vector<ast::ValType>> params{};
+	std::unordered_map<ast::FuncAst*, ast::ValType> rets{};
+	std::vector<std::unordered_map<std::string, ast::ValType>> scopes{};
+	ast::FuncAst* current = nullptr;
+	bool changed = false;
+
+	void update(ast::ValType& slot, ast::ValType type)
+	{
+		const auto res = Join(slot, type);
+		if (res != slot)
+		{
+			slot = res;
+			changed = true;
+		}
+	}
+
+	ast::ValType lookup(const std::string& name)
+	{
+		for (auto itr = std::rbegin(scopes); itr != std::rend(scopes); itr++)
+		{
+			if (auto found = itr->find(name); found != std::end(*itr)) { return found->second; }
+		}
+		return ast::ValType::Any;
+	}
+
+	ast::ValType inferExpr(ast::BaseAst* ast)
+	{
+		auto res = ast::ValType::Any;
+		switch (ast->getID()) {
+		case ast::NumberID:
+			res = ast::ValType::Num;
+			break;
+		case ast::StringID:
+			res = ast::ValType::Str;
+			break;
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { inferExpr(elm); }
+			res = ast::ValType::Tpl;
+			break;
+		case ast::IdentID:
+			res = lookup(static_cast<ast::IdentAst*>(ast)->getIdent());
+			break;
+		case ast::MonoExpID:
+			inferExpr(static_cast<ast::MonoExpAst*>(ast)->getLhs());
+			res = ast::ValType::Num;
+			break;
+		case ast::BinaryExpID:
+		{
+			// every operator yields a Num or fails; IdxAt yields the element, of any type
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			inferExpr(bin->getLhs());
+			inferExpr(bin->getRhs());
+			if (bin->getOp() != "IdxAt") { res = ast::ValType::Num; }
+			break;
+		}
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			auto callee = call->getCallee();
+			for (std::size_t i{}; i < call->getParams().size(); i++)
+			{
+				const auto type = inferExpr(call->getParams()[i]);
+				if (callee) { update(params[callee][i], type); }
+			}
+			if (callee) { res = rets[callee]; }
+			break;
+		}
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { inferExpr(arg); }
+			break;
+		default:
+			break;
+		}
+		ast->getType() = res;
+		return res;
+	}
+
+	void inferBlock(std::vector<ast::BaseAst*>& stmts)
+	{
+		scopes.emplace_back();
+		inferStmts(stmts);
+		scopes.pop_back();
+	}
+
+	void inferStmts(std::vector<ast::BaseAst*>& stmts)
+	{
+		for (auto& stmt : stmts)
+		{
+			switch (stmt->getID()) {
+			case ast::BuiltinID:
+			{
+				auto builtin = static_cast<ast::BuiltinAst*>(stmt);
+				for (auto& arg : builtin->getArgs())
+				{
+					const auto type = inferExpr(arg);
+					if (builtin->getName() == "return") { update(rets[current], type); }
+				}
+				break;
+			}
+			case ast::AssignID:
+			{
+				auto assign = static_cast<ast::AssignAst*>(stmt);
+				scopes.back()[assign->getName()] = inferExpr(assign->getVal());
+				break;
+			}
+			case ast::ReAssignID:
+				inferExpr(static_cast<ast::ReAssignAst*>(stmt)->getVal());
+				break;
+			case ast::CallID:
+			case ast::TaskID:
+				inferExpr(stmt);
+				break;
+			case ast::IfStmtID:
+			{
+				auto ifStmt = static_cast<ast::IfStmtAst*>(stmt);
+				inferExpr(ifStmt->getCond());
+				inferBlock(ifStmt->getThenStmt());
+				inferBlock(ifStmt->getElseStmt());
+				break;
+			}
+			case ast::WhileStmtID:
+			{
+				auto whileStmt = static_cast<ast::WhileStmtAst*>(stmt);
+				inferExpr(whileStmt->getCond());
+				inferBlock(whileStmt->getLoopStmt());
+				break;
+			}
+			case ast::ForStmtID:
+			{
+				auto forStmt = static_cast<ast::ForStmtAst*>(stmt);
+				inferExpr(forStmt->getRange()->getFrom());
+				inferExpr(forStmt->getRange()->getTo());
+				scopes.emplace_back();
+				scopes.back()[forStmt->getIdent()] = ast::ValType::Num;
+				inferStmts(forStmt->getStmts());
+				scopes.pop_back();
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+public:
+	void run(ast::ModuleAst* ast)
+	{
+		for (auto& func : ast->getFuncs())
+		{
+			params[func].assign(func->getParamNames().size(), ast::ValType::None);
+			rets[func] = ast::ValType::None;
+		}
+		do
+		{
+			changed = false;
+			for (auto& func : ast->getFuncs())
+			{
+				current = func;
+				scopes.assign(1, {});
+				for (std::size_t i{}; i < func->getParamNames().size(); i++)
+				{
+					scopes.back()[func->getParamNames()[i]] = params[func][i];
+				}
+				inferStmts(func->getInst());
+				// falling off the end returns 0
+				if (not AlwaysReturns(func->getInst())) { update(rets[func], ast::ValType::Num); }
+			}
+		} while (changed);
+	}
+
+	// None for a parameter no call site passes
+	ast::ValType getParamType(ast::FuncAst* func, std::size_t idx) { return params[func][idx]; }
+	ast::ValType getReturnType(ast::FuncAst* func) { return rets[func]; }
+};
+
+} // namespace infer
+} // namespace Noh
@@ -0,0 +1,779 @@
+#pragma once
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define NOH_JIT_SUPPORTED 1
+#else
+#define NOH_JIT_SUPPORTED 0
+#endif
+
+#include "ast_noh.hpp"
+#include "limit_noh.hpp"
+
+namespace Noh {
+namespace jit {
+
+// ================
+//    assembler
+// ================
+
+enum Reg : std::uint8_t {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// condition codes of jcc / setcc
+enum Cond : std::uint8_t {
+	CondB = 0x2, CondE = 0x4, CondNE = 0x5, CondL = 0xC, CondGE = 0xD, CondLE = 0xE, CondG = 0xF,
+};
+
+// why a compiled function stopped short of returning
+enum class Fault : int { None, Stack, DivZero };
+
+// opcodes of `op r/m64, r64`
+enum Alu : std::uint8_t {
+	AluAdd = 0x01, AluOr = 0x09, AluAnd = 0x21, AluSub = 0x29, AluXor = 0x31, AluCmp = 0x39, AluTest = 0x85,
+};
+
+// Encodes the handful of x86-64 instructions the JIT needs into a byte buffer.
+// Jumps and calls target labels, which are patched once every label is bound.
+class Assembler {
+	struct Fixup {
+		std::size_t At; // the rel32 field
+		int Label;
+	};
+	std::vector<std::int64_t> labels;
+	std::vector<Fixup> fixups;
+
+	void rex(int reg, int rm) { byte(0x48 | ((reg >> 3) << 2) | (rm >> 3)); }
+	void modrm(int mod, int reg, int rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+public:
+	std::vector<std::uint8_t> Code;
+
+	Assembler() : labels(), fixups(), Code() {}
+
+	std::size_t size() const { return Code.size(); }
+	void byte(int b) { Code.push_back(static_cast<std::uint8_t>(b)); }
+	void imm32(std::int32_t val)
+	{
+		for (int i{}; i < 4; i++) { byte((val >> (8 * i)) & 0xff); }
+	}
+	void imm64(std::int64_t val)
+	{
+		for (int i{}; i < 8; i++) { byte((val >> (8 * i)) & 0xff); }
+	}
+	void patch32(std::size_t at, std::int32_t val) { std::memcpy(&Code[at], &val, sizeof(val)); }
+
+	int newLabel()
+	{
+		labels.push_back(-1);
+		return static_cast<int>(labels.size() - 1);
+	}
+	void bind(int label) { labels[label] = static_cast<std::int64_t>(Code.size()); }
+	std::int64_t offsetOf(int label) const { return labels[label]; }
+
+	void rel32(int label)
+	{
+		fixups.push_back(Fixup{Code.size(), label});
+		imm32(0);
+	}
+
+	// Resolves every jump; false if one targets an unbound label.
+	bool resolve()
+	{
+		for (const auto& fix : fixups)
+		{
+			if (labels[fix.Label] < 0) { return false; }
+			patch32(fix.At, static_cast<std::int32_t>(labels[fix.Label] - static_cast<std::int64_t>(fix.At + 4)));
+		}
+		return true;
+	}
+
+	void mov(Reg dst, Reg src) { rex(src, dst); byte(0x89); modrm(3, src, dst); }
+	// dst = [rbp + disp]
+	void load(Reg dst, std::int32_t disp) { rex(dst, RBP); byte(0x8B); modrm(2, dst, RBP); imm32(disp); }
+	// [rbp + disp] = src
+	void store(std::int32_t disp, Reg src) { rex(src, RBP); byte(0x89); modrm(2, src, RBP); imm32(disp); }
+	// rax = [addr]
+	void loadAbs(const void* addr) { byte(0x48); byte(0xA1); imm64(static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(addr))); }
+	void movImm(Reg dst, std::int64_t val)
+	{
+		if (val >= INT32_MIN and val <= INT32_MAX)
+		{
+			rex(0, dst); byte(0xC7); modrm(3, 0, dst); imm32(static_cast<std::int32_t>(val));
+		}
+		else
+		{
+			rex(0, dst); byte(0xB8 + (dst & 7)); imm64(val);
+		}
+	}
+	void alu(Alu op, Reg dst, Reg src) { rex(src, dst); byte(op); modrm(3, src, dst); }
+	void imul(Reg dst, Reg src) { rex(dst, src); byte(0x0F); byte(0xAF); modrm(3, dst, src); }
+	void neg(Reg reg) { rex(0, reg); byte(0xF7); modrm(3, 3, reg); }
+	void bitNot(Reg reg) { rex(0, reg); byte(0xF7); modrm(3, 2, reg); }
+	// rdx:rax / reg, quotient in rax and remainder in rdx
+	void idiv(Reg reg) { byte(0x48); byte(0x99); rex(0, reg); byte(0xF7); modrm(3, 7, reg); }
+	// al / cl = condition
+	void setcc(Cond cc, Reg reg8) { byte(0x0F); byte(0x90 + cc); modrm(3, 0, reg8); }
+	void zeroExtendAl() { byte(0x0F); byte(0xB6); byte(0xC0); }
+	void push(Reg reg) { if (reg >= R8) { byte(0x41); } byte(0x50 + (reg & 7)); }
+	void pop(Reg reg) { if (reg >= R8) { byte(0x41); } byte(0x58 + (reg & 7)); }
+	void jmp(int label) { byte(0xE9); rel32(label); }
+	void jcc(Cond cc, int label) { byte(0x0F); byte(0x80 + cc); rel32(label); }
+	void call(int label) { byte(0xE8); rel32(label); }
+	void callAbs(const void* target) { movImm64(RAX, target); byte(0xFF); byte(0xD0); }
+	void jmpAbs(const void* target) { movImm64(RAX, target); byte(0xFF); byte(0xE0); }
+	void ret() { byte(0xC3); }
+	void movImm64(Reg dst, const void* target)
+	{
+		rex(0, dst); byte(0xB8 + (dst & 7)); imm64(static_cast<std::int64_t>(reinterpret_cast<std::uintptr_t>(target)));
+	}
+};
+
+// ================
+//       jit
+// ================
+
+// Compiles functions that only compute with Nums straight to x86-64 code.
+// A function qualifies when it is built from `var` / reassignment / if / while / for /
+// break / continue / return, Num literals, arithmetic and comparisons, and calls to
+// functions that qualify as well. Anything touching a Str, a Tuple or I/O is rejected
+// and the function keeps running on the tree-walker.
+//
+// Generated functions follow the System V calling convention with up to six Num arguments,
+// so compiled functions call each other directly. The first five variables live in the
+// callee-saved registers rbx and r12-r15, the rest in the frame. Every function starts by
+// comparing rsp with the stack floor; below it, or on a division by zero, the run longjmps
+// back out of invoke().
+class Jit {
+	static constexpr std::size_t MaxParams = 6;
+	static constexpr Reg ArgRegs[MaxParams] = {RDI, RSI, RDX, RCX, R8, R9};
+	static constexpr std::size_t NumVarRegs = 5;
+	static constexpr Reg VarRegs[NumVarRegs] = {RBX, R12, R13, R14, R15};
+	// bytes of the callee-saved registers pushed below rbp
+	static constexpr std::int32_t SavedSize = 8 * NumVarRegs;
+
+	struct Region {
+		void* Ptr;
+		std::size_t Size;
+	};
+	std::vector<Region> regions;
+	// read by the generated code, so a Jit must not move
+	std::intptr_t floor = 0;
+	std::jmp_buf trap;
+
+	// state of the group being compiled
+	Assembler as;
+	std::unordered_map<ast::FuncAst*, int> entries;
+	std::vector<ast::FuncAst*> pending;
+
+	// state of the function being compiled
+	ast::FuncAst* cur = nullptr;
+	std::vector<std::unordered_map<std::string, std::int32_t>> scopes;
+	std::int32_t nextSlot = 0, numSlots = 0;
+	int bodyLabel = 0, retLabel = 0;
+	int overflowLabel = 0, divZeroLabel = 0; // shared by the group
+
+	struct Loop {
+		int Continue;
+		int Break;
+	};
+	std::vector<Loop> loops;
+
+	// ================
+	//      slots
+	// ================
+
+	void pushScope() { scopes.emplace_back(); }
+	void popScope()
+	{
+		nextSlot -= static_cast<std::int32_t>(scopes.back().size());
+		scopes.pop_back();
+	}
+
+	std::int32_t newSlot()
+	{
+		const auto slot = nextSlot++;
+		if (nextSlot > numSlots) { numSlots = nextSlot; }
+		return slot;
+	}
+
+	bool declare(const std::string& name, std::int32_t& slot)
+	{
+		if (scopes.back().find(name) != std::end(scopes.back())) { return false; }
+		slot = newSlot();
+		scopes.back()[name] = slot;
+		return true;
+	}
+
+	std::int32_t hiddenSlot()
+	{
+		const auto slot = newSlot();
+		scopes.back()[" " + std::to_string(slot)] = slot;
+		return slot;
+	}
+
+	bool lookup(const std::string& name, std::int32_t& slot)
+	{
+		for (auto itr = scopes.rbegin(); itr != scopes.rend(); itr++)
+		{
+			if (auto found = itr->find(name); found != std::end(*itr))
+			{
+				slot = found->second;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	static std::int32_t slotDisp(std::int32_t slot)
+	{
+		return -SavedSize - 8 * (slot - static_cast<std::int32_t>(NumVarRegs) + 1);
+	}
+
+	void loadSlot(Reg dst, std::int32_t slot)
+	{
+		if (slot < static_cast<std::int32_t>(NumVarRegs)) { as.mov(dst, VarRegs[slot]); }
+		else { as.load(dst, slotDisp(slot)); }
+	}
+
+	void storeSlot(std::int32_t slot, Reg src)
+	{
+		if (slot < static_cast<std::int32_t>(NumVarRegs)) { as.mov(VarRegs[slot], src); }
+		else { as.store(slotDisp(slot), src); }
+	}
+
+	// ================
+	//       expr
+	// ================
+
+	// Calls that were already compiled jump straight into their code,
+	// the rest are compiled in the same group.
+	bool callTarget(ast::FuncAst* callee, int& label, const void*& native)
+	{
+		if (callee->Tier == ast::Spec::Fast)
+		{
+			// no label: the call goes to `native`
+			label = -1;
+			native = callee->Native;
+			return true;
+		}
+		if (callee->Tier == ast::Spec::Generic or callee->getParamNames().size() > MaxParams) { return false; }
+		if (entries.find(callee) == std::end(entries))
+		{
+			entries[callee] = as.newLabel();
+			pending.push_back(callee);
+		}
+		label = entries.at(callee);
+		native = nullptr;
+		return true;
+	}
+
+	// Evaluates the arguments of `call` into the argument registers.
+	bool compileArgs(ast::CallAst* call)
+	{
+		auto& params = call->getParams();
+		for (auto& param : params)
+		{
+			if (not compileExpr(param)) { return false; }
+			as.push(RAX);
+		}
+		for (std::size_t i = params.size(); i-- > 0;) { as.pop(ArgRegs[i]); }
+		return true;
+	}
+
+	// Leaves the result in rax.
+	bool compileExpr(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+			as.movImm(RAX, static_cast<ast::NumberAst*>(ast)->getVal());
+			return true;
+		case ast::IdentID:
+		{
+			std::int32_t slot;
+			if (not lookup(static_cast<ast::IdentAst*>(ast)->getIdent(), slot)) { return false; }
+			loadSlot(RAX, slot);
+			return true;
+		}
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			if (not compileExpr(mono->getLhs())) { return false; }
+			const auto& op = mono->getOp();
+			if (op == "!")
+			{
+				as.alu(AluTest, RAX, RAX);
+				as.setcc(CondE, RAX);
+				as.zeroExtendAl();
+			}
+			else if (op == "-") { as.neg(RAX); }
+			else if (op == "~") { as.bitNot(RAX); }
+			else { return false; }
+			return true;
+		}
+		case ast::BinaryExpID:
+			return compileBinary(static_cast<ast::BinaryExpAst*>(ast));
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			int label;
+			const void* native;
+			if (not call->getCallee() or not callTarget(call->getCallee(), label, native)) { return false; }
+			if (not compileArgs(call)) { return false; }
+			if (native) { as.callAbs(native); }
+			else { as.call(label); }
+			return true;
+		}
+		default:
+			// strings and tuples
+			return false;
+		}
+	}
+
+	// lhs in rax, rhs in rcx; a variable or literal rhs is loaded without spilling lhs
+	bool compileOperands(ast::BinaryExpAst* ast)
+	{
+		if (not compileExpr(ast->getLhs())) { return false; }
+		auto rhs = ast->getRhs();
+		std::int32_t slot;
+		if (rhs->getID() == ast::NumberID)
+		{
+			as.movImm(RCX, static_cast<ast::NumberAst*>(rhs)->getVal());
+		}
+		else if (rhs->getID() == ast::IdentID)
+		{
+			if (not lookup(static_cast<ast::IdentAst*>(rhs)->getIdent(), slot)) { return false; }
+			loadSlot(RCX, slot);
+		}
+		else
+		{
+			as.push(RAX);
+			if (not compileExpr(rhs)) { return false; }
+			as.mov(RCX, RAX);
+			as.pop(RAX);
+		}
+		return true;
+	}
+
+	static bool CompareCond(const std::string& op, Cond& cc)
+	{
+		if (op == "==") { cc = CondE; }
+		else if (op == "!=") { cc = CondNE; }
+		else if (op == "<") { cc = CondL; }
+		else if (op == ">") { cc = CondG; }
+		else if (op == "<=") { cc = CondLE; }
+		else if (op == ">=") { cc = CondGE; }
+		else { return false; }
+		return true;
+	}
+
+	// Jumps to `label` when `ast` is `when` and falls through otherwise. The rhs of && and ||
+	// only runs when the lhs does not decide the result; a comparison becomes cmp + jcc.
+	bool compileBranch(ast::BaseAst* ast, bool when, int label)
+	{
+		if (ast->getID() == ast::MonoExpID and static_cast<ast::MonoExpAst*>(ast)->getOp() == "!")
+		{
+			return compileBranch(static_cast<ast::MonoExpAst*>(ast)->getLhs(), not when, label);
+		}
+		if (ast->getID() == ast::BinaryExpID)
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			const auto& op = bin->getOp();
+			if (op == "&&" or op == "||")
+			{
+				// the lhs decides the result when it is false for &&, true for ||
+				const bool decides = op == "||";
+				if (when == decides)
+				{
+					return compileBranch(bin->getLhs(), when, label) and compileBranch(bin->getRhs(), when, label);
+				}
+				const auto skip = as.newLabel();
+				if (not compileBranch(bin->getLhs(), decides, skip) or not compileBranch(bin->getRhs(), when, label)) { return false; }
+				as.bind(skip);
+				return true;
+			}
+			Cond cc;
+			if (CompareCond(op, cc))
+			{
+				if (not compileOperands(bin)) { return false; }
+				as.alu(AluCmp, RAX, RCX);
+				// condition codes come in pairs that differ in the lowest bit
+				as.jcc(when ? cc : static_cast<Cond>(cc ^ 1), label);
+				return true;
+			}
+		}
+		if (not compileExpr(ast)) { return false; }
+		as.alu(AluTest, RAX, RAX);
+		as.jcc(when ? CondNE : CondE, label);
+		return true;
+	}
+
+	bool compileBinary(ast::BinaryExpAst* ast)
+	{
+		const auto& op = ast->getOp();
+		if (op == "IdxAt") { return false; }
+		if (op == "&&" or op == "||")
+		{
+			const auto falseLabel = as.newLabel(), endLabel = as.newLabel();
+			if (not compileBranch(ast, false, falseLabel)) { return false; }
+			as.movImm(RAX, 1);
+			as.jmp(endLabel);
+			as.bind(falseLabel);
+			as.movImm(RAX, 0);
+			as.bind(endLabel);
+			return true;
+		}
+		if (not compileOperands(ast)) { return false; }
+
+		Cond cc;
+		if (CompareCond(op, cc))
+		{
+			as.alu(AluCmp, RAX, RCX);
+			as.setcc(cc, RAX);
+			as.zeroExtendAl();
+		}
+		else if (op == "+") { as.alu(AluAdd, RAX, RCX); }
+		else if (op == "-") { as.alu(AluSub, RAX, RCX); }
+		else if (op == "*") { as.imul(RAX, RCX); }
+		else if (op == "/" or op == "%")
+		{
+			as.alu(AluTest, RCX, RCX);
+			as.jcc(CondE, divZeroLabel);
+			as.idiv(RCX);
+			if (op == "%") { as.mov(RAX, RDX); }
+		}
+		else { return false; }
+		return true;
+	}
+
+	// ================
+	//      stmts
+	// ================
+
+	bool compileStmts(std::vector<ast::BaseAst*>& stmts)
+	{
+		for (auto& stmt : stmts)
+		{
+			if (not compileStmt(stmt)) { return false; }
+		}
+		return true;
+	}
+
+	bool compileStmt(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+			return compileBuiltin(static_cast<ast::BuiltinAst*>(ast));
+		case ast::AssignID:
+		{
+			auto assign = static_cast<ast::AssignAst*>(ast);
+			std::int32_t slot;
+			if (not compileExpr(assign->getVal()) or not declare(assign->getName(), slot)) { return false; }
+			storeSlot(slot, RAX);
+			return true;
+		}
+		case ast::ReAssignID:
+		{
+			auto assign = static_cast<ast::ReAssignAst*>(ast);
+			std::int32_t slot;
+			if (not compileExpr(assign->getVal()) or not lookup(assign->getName(), slot)) { return false; }
+			storeSlot(slot, RAX);
+			return true;
+		}
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			const auto elseLabel = as.newLabel(), endLabel = as.newLabel();
+			if (not compileBranch(stmt->getCond(), false, elseLabel)) { return false; }
+			pushScope();
+			if (not compileStmts(stmt->getThenStmt())) { return false; }
+			popScope();
+			as.jmp(endLabel);
+			as.bind(elseLabel);
+			pushScope();
+			if (not compileStmts(stmt->getElseStmt())) { return false; }
+			popScope();
+			as.bind(endLabel);
+			return true;
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			const auto topLabel = as.newLabel(), endLabel = as.newLabel();
+			as.bind(topLabel);
+			if (not compileBranch(stmt->getCond(), false, endLabel)) { return false; }
+			pushScope();
+			loops.push_back(Loop{topLabel, endLabel});
+			if (not compileStmts(stmt->getLoopStmt())) { return false; }
+			loops.pop_back();
+			popScope();
+			as.jmp(topLabel);
+			as.bind(endLabel);
+			return true;
+		}
+		case ast::ForStmtID:
+			return compileFor(static_cast<ast::ForStmtAst*>(ast));
+		case ast::CallID:
+			return compileExpr(ast);
+		default:
+			return false;
+		}
+	}
+
+	bool compileFor(ast::ForStmtAst* stmt)
+	{
+		const auto topLabel = as.newLabel(), stepLabel = as.newLabel(), endLabel = as.newLabel();
+		pushScope();
+		// the counter and the bound are hidden: reassigning the variable does not change the iteration
+		const auto itr = hiddenSlot(), to = hiddenSlot();
+		if (not compileExpr(stmt->getRange()->getFrom())) { return false; }
+		storeSlot(itr, RAX);
+		if (not compileExpr(stmt->getRange()->getTo())) { return false; }
+		storeSlot(to, RAX);
+		std::int32_t var;
+		if (not declare(stmt->getIdent(), var)) { return false; }
+
+		as.bind(topLabel);
+		loadSlot(RAX, itr);
+		loadSlot(RCX, to);
+		as.alu(AluCmp, RAX, RCX);
+		as.jcc(CondGE, endLabel);
+		storeSlot(var, RAX);
+		pushScope();
+		loops.push_back(Loop{stepLabel, endLabel});
+		if (not compileStmts(stmt->getStmts())) { return false; }
+		loops.pop_back();
+		popScope();
+		as.bind(stepLabel);
+		loadSlot(RAX, itr);
+		as.movImm(RCX, 1);
+		as.alu(AluAdd, RAX, RCX);
+		storeSlot(itr, RAX);
+		as.jmp(topLabel);
+		as.bind(endLabel);
+		popScope();
+		return true;
+	}
+
+	bool compileBuiltin(ast::BuiltinAst* ast)
+	{
+		const auto& name = ast->getName();
+		if (name == "break" or name == "continue")
+		{
+			if (loops.empty()) { return false; }
+			as.jmp(name == "break" ? loops.back().Break : loops.back().Continue);
+			return true;
+		}
+		if (name != "return") { return false; }
+
+		auto retAst = ast->getArgs().front();
+		if (retAst->getID() != ast::CallID)
+		{
+			if (not compileExpr(retAst)) { return false; }
+			as.jmp(retLabel);
+			return true;
+		}
+
+		// tail call: runs in constant stack like on the tree-walker
+		auto call = static_cast<ast::CallAst*>(retAst);
+		int label;
+		const void* native;
+		if (not call->getCallee() or not callTarget(call->getCallee(), label, native)) { return false; }
+		if (not compileArgs(call)) { return false; }
+		if (call->getCallee() == cur)
+		{
+			as.jmp(bodyLabel);
+			return true;
+		}
+		emitLeave();
+		if (native) { as.jmpAbs(native); }
+		else { as.jmp(label); }
+		return true;
+	}
+
+	// ================
+	//       func
+	// ================
+
+	// Restores the caller's registers and stack; the return address is left on top.
+	void emitLeave()
+	{
+		// lea rsp, [rbp - SavedSize]
+		as.byte(0x48); as.byte(0x8D); as.byte(0x65); as.byte(static_cast<std::uint8_t>(-SavedSize));
+		for (std::size_t i = NumVarRegs; i-- > 0;) { as.pop(VarRegs[i]); }
+		as.pop(RBP);
+	}
+
+	bool compileFunc(ast::FuncAst* func)
+	{
+		cur = func;
+		scopes.clear();
+		loops.clear();
+		nextSlot = numSlots = 0;
+		bodyLabel = as.newLabel();
+		retLabel = as.newLabel();
+
+		as.bind(entries.at(func));
+		as.loadAbs(&floor);
+		as.alu(AluCmp, RSP, RAX);
+		as.jcc(CondB, overflowLabel);
+		as.push(RBP);
+		as.mov(RBP, RSP);
+		for (std::size_t i{}; i < NumVarRegs; i++) { as.push(VarRegs[i]); }
+		// sub rsp, frame; patched once the number of variables is known
+		as.byte(0x48); as.byte(0x81); as.byte(0xEC);
+		const auto frameAt = as.size();
+		as.imm32(0);
+
+		// arguments arrive in registers, also when a tail call jumps back to bodyLabel
+		pushScope();
+		as.bind(bodyLabel);
+		const auto& paramNames = func->getParamNames();
+		for (std::size_t i{}; i < paramNames.size(); i++)
+		{
+			std::int32_t slot;
+			if (not declare(paramNames[i], slot)) { return false; }
+			storeSlot(slot, ArgRegs[i]);
+		}
+		if (not compileStmts(func->getInst())) { return false; }
+
+		// falling off the end returns 0
+		as.alu(AluXor, RAX, RAX);
+		as.bind(retLabel);
+		emitLeave();
+		as.ret();
+
+		// keep rsp 16-byte aligned: rbp and the saved registers leave it 8 off
+		std::int32_t frame = 8 * std::max<std::int32_t>(0, numSlots - static_cast<std::int32_t>(NumVarRegs));
+		if (frame % 16 == 0) { frame += 8; }
+		as.patch32(frameAt, frame);
+		return true;
+	}
+
+	[[noreturn]] static void Trap(std::jmp_buf* buf, int fault) { std::longjmp(*buf, fault); }
+
+	// where a function that finds the stack below the floor or divides by zero goes; its frames
+	// hold nothing to clean up
+	void emitTraps()
+	{
+		const auto trapLabel = as.newLabel();
+		as.bind(overflowLabel);
+		as.movImm(RSI, static_cast<std::int64_t>(Fault::Stack));
+		as.jmp(trapLabel);
+		as.bind(divZeroLabel);
+		as.movImm(RSI, static_cast<std::int64_t>(Fault::DivZero));
+		as.bind(trapLabel);
+		// and rsp, -16
+		as.byte(0x48); as.byte(0x83); as.byte(0xE4); as.byte(0xF0);
+		as.movImm64(RDI, &trap);
+		as.callAbs(reinterpret_cast<const void*>(&Trap));
+	}
+
+	void* install(const std::vector<std::uint8_t>& code)
+	{
+#if NOH_JIT_SUPPORTED
+		const auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+		const auto size = (code.size() + page - 1) / page * page;
+		void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (ptr == MAP_FAILED) { return nullptr; }
+		std::memcpy(ptr, code.data(), code.size());
+		if (mprotect(ptr, size, PROT_READ | PROT_EXEC) != 0)
+		{
+			munmap(ptr, size);
+			return nullptr;
+		}
+		regions.push_back(Region{ptr, size});
+		return ptr;
+#else
+		return nullptr;
+#endif
+	}
+
+public:
+	Jit() : regions(), as(), entries(), pending(), scopes(), loops() {}
+	Jit(const Jit&) = delete;
+	Jit& operator=(const Jit&) = delete;
+	~Jit()
+	{
+#if NOH_JIT_SUPPORTED
+		for (auto& region : regions) { munmap(region.Ptr, region.Size); }
+#endif
+	}
+
+	static constexpr bool Supported = NOH_JIT_SUPPORTED;
+
+	// Compiles `func` together with the not yet compiled functions it calls.
+	// On success they all become Fast with Native set; otherwise `func` becomes Generic
+	// and the functions it calls are left to be tried on their own.
+	bool compile(ast::FuncAst* func)
+	{
+		as = Assembler();
+		entries.clear();
+		pending.clear();
+
+		bool ok = Supported and func->Tier == ast::Spec::Cold and func->getParamNames().size() <= MaxParams;
+		if (ok)
+		{
+			overflowLabel = as.newLabel();
+			divZeroLabel = as.newLabel();
+			entries[func] = as.newLabel();
+			pending.push_back(func);
+			for (std::size_t i{}; ok and i < pending.size(); i++) { ok = compileFunc(pending[i]); }
+			emitTraps();
+		}
+		void* base = ok and as.resolve() ? install(as.Code) : nullptr;
+		if (not base)
+		{
+			func->Tier = ast::Spec::Generic;
+			return false;
+		}
+		for (auto& [callee, label] : entries)
+		{
+			callee->Native = static_cast<std::uint8_t*>(base) + as.offsetOf(label);
+			callee->Tier = ast::Spec::Fast;
+		}
+		return true;
+	}
+
+	// Runs a compiled function on evaluated Num arguments; `res` is set when it returns Fault::None.
+	Fault invoke(ast::FuncAst* func, const std::vector<std::int64_t>& args, std::int_fast64_t& res)
+	{
+		floor = limit::StackFloor();
+		switch (setjmp(trap)) {
+		case 0: break;
+		case static_cast<int>(Fault::Stack): return Fault::Stack;
+		default: return Fault::DivZero;
+		}
+		res = Invoke(func, args);
+		return Fault::None;
+	}
+
+	static std::int_fast64_t Invoke(ast::FuncAst* func, const std::vector<std::int64_t>& args)
+	{
+		using I = std::int64_t;
+		const auto ptr = func->Native;
+		switch (args.size()) {
+		case 0: return reinterpret_cast<I (*)()>(ptr)();
+		case 1: return reinterpret_cast<I (*)(I)>(ptr)(args[0]);
+		case 2: return reinterpret_cast<I (*)(I, I)>(ptr)(args[0], args[1]);
+		case 3: return reinterpret_cast<I (*)(I, I, I)>(ptr)(args[0], args[1], args[2]);
+		case 4: return reinterpret_cast<I (*)(I, I, I, I)>(ptr)(args[0], args[1], args[2], args[3]);
+		case 5: return reinterpret_cast<I (*)(I, I, I, I, I)>(ptr)(args[0], args[1], args[2], args[3], args[4]);
+		default: return reinterpret_cast<I (*)(I, I, I, I, I, I)>(ptr)(args[0], args[1], args[2], args[3], args[4], args[5]);
+		}
+	}
+};
+
+} // namespace jit
+} // namespace Noh
@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "parser_noh.hpp"
+#include "option_noh.hpp"
+
+namespace Noh {
+namespace lazy {
+
+// A function as the skimmer saw it: its header and where its source ends, with the names
+// that are called in its body (any identifier followed by '(').
+struct FuncSpan {
+	std::size_t Module = 0; // which of the sources given to Parse()
+	std::string Name;
+	std::size_t NumParams = 0;
+	std::size_t Begin = 0;
+	std::size_t End = 0;
+	std::vector<std::string> Calls;
+};
+
+// ================
+//  skim
+// ================
+// Splits a module into functions and imports without parsing function bodies: only the
+// header is read, and the body is skipped by matching braces outside string literals.
+class Skimmer {
+	const std::string& src;
+	std::size_t module;
+	std::size_t pos = 0;
+
+	static bool identStart(char c) { return std::isalpha(static_cast<unsigned char>(c)) or c == '_'; }
+	static bool identChar(char c) { return std::isalnum(static_cast<unsigned char>(c)) or c == '_'; }
+
+	void skipSpace()
+	{
+		while (pos < src.size() and std::isspace(static_cast<unsigned char>(src[pos]))) { pos++; }
+	}
+
+	bool lit(const char* word)
+	{
+		skipSpace();
+		const auto len = std::char_traits<char>::length(word);
+		if (src.compare(pos, len, word) != 0) { return false; }
+		pos += len;
+		return true;
+	}
+
+	bool ident(std::string& name)
+	{
+		skipSpace();
+		if (pos == src.size() or not identStart(src[pos])) { return false; }
+		const auto from = pos;
+		while (pos < src.size() and identChar(src[pos])) { pos++; }
+		name.assign(src, from, pos - from);
+		return true;
+	}
+
+	// from just after '{' to just after the matching '}'
+	bool body(FuncSpan& func)
+	{
+		std::size_t depth = 1;
+		std::unordered_set<std::string> calls{};
+		while (pos < src.size())
+		{
+			const auto c = src[pos];
+			if (c == '"')
+			{
+				for (pos++; pos < src.size() and src[pos] != '"'; pos++)
+				{
+					if (src[pos] == '\\') { pos++; }
+				}
+				if (pos >= src.size()) { return false; }
+				pos++;
+			}
+			else if (identStart(c))
+			{
+				std::string name{};
+				ident(name);
+				skipSpace();
+				if (pos < src.size() and src[pos] == '(' and calls.insert(name).second) { func.Calls.push_back(name); }
+			}
+			else
+			{
+				pos++;
+				if (c == '{') { depth++; }
+				else if (c == '}' and --depth == 0) { return true; }
+			}
+		}
+		return false;
+	}
+
+public:
+	Skimmer(const std::string& src, std::size_t module = 0) : src(src), module(module) {}
+
+	// false if the module is not a sequence of imports and well-formed function headers and bodies
+	bool run(std::vector<FuncSpan>& funcs, std::vector<std::string>& imports)
+	{
+		while (true)
+		{
+			skipSpace();
+			if (pos == src.size()) { return true; }
+			if (lit("import"))
+			{
+				// as _String reads it: escapes are kept as written
+				if (not lit("\"")) { return false; }
+				const auto from = pos;
+				for (; pos < src.size() and src[pos] != '"'; pos++)
+				{
+					if (src[pos] == '\\') { pos++; }
+				}
+				if (pos >= src.size()) { return false; }
+				imports.emplace_back(src, from, pos - from);
+				pos++;
+				if (not lit(";")) { return false; }
+				continue;
+			}
+			FuncSpan func{};
+			func.Module = module;
+			func.Begin = pos;
+			const auto start = pos;
+			if (not (lit("memo") and lit("fn")))
+			{
+				pos = start;
+				if (not lit("fn")) { return false; }
+			}
+			if (not ident(func.Name) or not lit("(")) { return false; }
+			std::string param{};
+			if (ident(param))
+			{
+				func.NumParams++;
+				while (lit(","))
+				{
+					if (not ident(param)) { return false; }
+					func.NumParams++;
+				}
+			}
+			if (not lit(")") or not lit("{") or not body(func)) { return false; }
+			func.End = pos;
+			funcs.push_back(std::move(func));
+		}
+	}
+};
+
+// The functions a run can reach: main, fn init when main takes its result, the record function
+// of --each-line, or else the first function without parameters, and everything they call.
+// Every function of a reachable name is kept, so a duplicate is still reported.
+inline std::vector<bool> Reachable(const std::vector<FuncSpan>& funcs, const EvalOption& option)
+{
+	std::unordered_map<std::string, std::vector<std::size_t>> byName{};
+	for (std::size_t i{}; i < funcs.size(); i++) { byName[funcs[i].Name].push_back(i); }
+
+	std::vector<std::string> work{};
+	if (byName.count("main")) { work = {"main", "init"}; }
+	else
+	{
+		for (const auto& func : funcs)
+		{
+			if (func.NumParams == 0)
+			{
+				work.push_back(func.Name);
+				break;
+			}
+		}
+	}
+	if (option.EachRecord) { work.push_back(option.RecordFn); }
+
+	std::vector<bool> used(funcs.size());
+	std::unordered_set<std::string> seen(std::begin(work), std::end(work));
+	while (not work.empty())
+	{
+		const auto name = std::move(work.back());
+		work.pop_back();
+		auto itr = byName.find(name);
+		if (itr == std::end(byName)) { continue; }
+		for (const auto& idx : itr->second)
+		{
+			used[idx] = true;
+			for (const auto& callee : funcs[idx].Calls)
+			{
+				if (seen.insert(callee).second) { work.push_back(callee); }
+			}
+		}
+	}
+	return used;
+}
+
+// ================
+//  parse
+// ================
+inline ast::ModuleAst* ParseModule(std::string source)
+{
+	auto it = std::begin(source);
+	parser::Calc<std::string::iterator, qi::standard_wide::space_type> calc;
+	ast::ModuleAst* res = nullptr;
+	const bool success = qi::phrase_parse(it, std::end(source), calc, qi::standard_wide::space, res);
+	if (success and it == std::end(source)) { return res; }
+	delete res;
+	return nullptr;
+}
+
+// --lazy-parse: skims the modules, the script first and then its imports, and fully parses
+// only the functions the run can reach, in that order; the rest are never parsed, so a syntax
+// error in one of them goes unnoticed. Large inputs are split into chunks of whole functions
+// parsed on separate threads. nullptr if a module does not parse.
+inline ast::ModuleAst* Parse(const std::vector<const std::string*>& sources, const EvalOption& option)
+{
+	constexpr std::size_t ChunkBytes = 1 << 16; // smallest piece worth a thread
+
+	std::vector<FuncSpan> funcs{};
+	std::vector<std::string> imports{};
+	for (std::size_t i{}; i < sources.size(); i++)
+	{
+		if (not Skimmer(*sources[i], i).run(funcs, imports)) { return nullptr; }
+	}
+	const auto used = Reachable(funcs, option);
+	std::size_t total = 0;
+	for (std::size_t i{}; i < funcs.size(); i++)
+	{
+		if (used[i]) { total += funcs[i].End - funcs[i].Begin + 1; }
+	}
+
+	std::size_t threads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+	threads = std::max<std::size_t>(1, std::min(threads, total / ChunkBytes));
+	std::vector<std::string> chunks(1);
+	for (std::size_t i{}; i < funcs.size(); i++)
+	{
+		if (not used[i]) { continue; }
+		if (chunks.size() < threads and chunks.back().size() >= total / threads) { chunks.emplace_back(); }
+		chunks.back().append(*sources[funcs[i].Module], funcs[i].Begin, funcs[i].End - funcs[i].Begin);
+		chunks.back() += '\n';
+	}
+
+	std::vector<ast::ModuleAst*> parts(chunks.size());
+	std::vector<std::thread> workers{};
+	for (std::size_t i = 1; i < chunks.size(); i++)
+	{
+		workers.emplace_back([&, i]() { parts[i] = ParseModule(std::move(chunks[i])); });
+	}
+	parts[0] = ParseModule(std::move(chunks[0]));
+	for (auto& worker : workers) { worker.join(); }
+
+	const bool ok = std::all_of(std::begin(parts), std::end(parts), [](ast::ModuleAst* part) { return part; });
+	for (std::size_t i = 1; i < parts.size(); i++)
+	{
+		if (ok)
+		{
+			auto& from = parts[i]->getFuncs();
+			parts[0]->getFuncs().insert(std::end(parts[0]->getFuncs()), std::begin(from), std::end(from));
+			from.clear();
+		}
+		delete parts[i];
+	}
+	if (ok) { return parts[0]; }
+	delete parts[0];
+	return nullptr;
+}
+
+} // namespace lazy
+} // namespace Noh
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "option_noh.hpp"
+
+namespace Noh {
+namespace limit {
+
+enum class Reason : std::uint8_t { None, Steps, Time, Memory, Stack, Cancelled };
+
+// what a run stopped by a limit exits with, told apart from EXIT_FAILURE
+constexpr int StepsExitCode = 3;
+constexpr int TimeExitCode = 4;
+constexpr int MemoryExitCode = 5;
+
+inline bool Limited(const EvalOption& option)
+{
+	return option.MaxSteps or option.TimeoutMs or option.MaxMemoryMB;
+}
+
+// The resident size of the process in KB, read from /proc/self/statm (`statm` open on it).
+// Where there is no /proc, the peak resident size so far.
+inline long ResidentKB(int statm)
+{
+	char buf[64];
+	const auto len = statm >= 0 ? ::pread(statm, buf, sizeof(buf) - 1, 0) : -1;
+	long size = 0, pages = 0;
+	if (len > 0)
+	{
+		buf[len] = '\0';
+		if (std::sscanf(buf, "%ld %ld", &size, &pages) == 2) { return pages * (::sysconf(_SC_PAGESIZE) / 1024); }
+	}
+	rusage usage{};
+	// in KB on Linux
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+// The lowest address the native stack of this thread should grow to in a recursive engine:
+// the stack is measured from where it was on the first call on the thread, against its size
+// less a margin for what a call uses before the next check. The stack grows down.
+inline std::intptr_t StackFloor()
+{
+	static constexpr std::intptr_t Margin = 256 << 10;
+	char here;
+	thread_local const auto base = reinterpret_cast<std::intptr_t>(&here);
+	static const std::intptr_t budget = []()
+	{
+		rlimit limit{};
+		// threads get the soft limit as their stack size, or 2 MB when it is unlimited
+		std::intptr_t size = 2 << 20;
+		if (getrlimit(RLIMIT_STACK, &limit) == 0 and limit.rlim_cur != RLIM_INFINITY) { size = limit.rlim_cur; }
+		return std::max<std::intptr_t>(size - Margin, Margin);
+	}();
+	return base - budget;
+}
+
+// Whether the native stack of this thread has room for another call of a recursive engine.
+inline bool StackLeft()
+{
+	char here;
+	return reinterpret_cast<std::intptr_t>(&here) > StackFloor();
+}
+
+// The limits of one run, shared by every thread that runs part of it. The memory limit is on
+// how much the resident size grows from the start of the run, so that under --batch and
+// --serve memory that an earlier run used, and that the allocator keeps, does not count.
+struct Limits {
+	std::uint64_t MaxSteps;
+	std::size_t TimeoutMs;
+	std::chrono::steady_clock::time_point Deadline;
+	long MaxMemoryKB;
+	int Statm = -1;
+	long BaseKB = 0; // resident size at the start
+	std::atomic<std::uint64_t> Used{0}; // steps counted by every thread
+	std::atomic<Reason> Exceeded{Reason::None};
+
+	Limits(const EvalOption& option)
+		: MaxSteps(option.MaxSteps ? option.MaxSteps : std::numeric_limits<std::uint64_t>::max()),
+		TimeoutMs(option.TimeoutMs), Deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(option.TimeoutMs)),
+		MaxMemoryKB(static_cast<long>(option.MaxMemoryMB) * 1024)
+	{
+		if (MaxMemoryKB)
+		{
+			Statm = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+			BaseKB = ResidentKB(Statm);
+		}
+	}
+	~Limits()
+	{
+		if (Statm >= 0) { ::close(Statm); }
+	}
+	Limits(const Limits&) = delete;
+	Limits& operator=(const Limits&) = delete;
+};
+
+// --max-steps / --timeout-ms / --max-memory: the engines tick() at every loop iteration and
+// call. A tick is an increment and a compare; every CheckEvery steps, or when the step limit
+// is near, it adds its steps to the shared count and looks at the clock and the resident size.
+// An engine that copies values, like the tree walker copying tuples, also counts them by alloc().
+// Copies share the limits, so the threads of one run use them up together.
+class Fuel {
+	static constexpr std::uint64_t CheckEvery = 1 << 12;
+
+	std::shared_ptr<Limits> limits;
+	std::uint64_t steps = 0;
+	std::uint64_t flushed = 0; // steps already added to limits->Used
+	std::uint64_t nextCheck;   // steps at which tick() takes the slow path
+
+	bool check()
+	{
+		const auto used = limits->Used += steps - flushed;
+		flushed = steps;
+		if (limits->Exceeded != Reason::None)
+		{
+			nextCheck = steps;
+			return false;
+		}
+		if (used > limits->MaxSteps)
+		{
+			stop(Reason::Steps);
+			return false;
+		}
+		if (limits->TimeoutMs and std::chrono::steady_clock::now() >= limits->Deadline)
+		{
+			stop(Reason::Time);
+			return false;
+		}
+		if (limits->MaxMemoryKB and ResidentKB(limits->Statm) - limits->BaseKB > limits->MaxMemoryKB)
+		{
+			stop(Reason::Memory);
+			return false;
+		}
+		// the step that goes one over the limit takes the slow path; used is at least 1 here
+		nextCheck = steps + std::min(CheckEvery, limits->MaxSteps - used + 1);
+		return true;
+	}
+
+public:
+	// Stops the run as if `reason` had been found by a check; the first reason found is kept.
+	void stop(Reason reason)
+	{
+		auto none = Reason::None;
+		limits->Exceeded.compare_exchange_strong(none, reason);
+		nextCheck = steps;
+	}
+
+	Fuel(const EvalOption& option)
+		: limits(std::make_shared<Limits>(option))
+	{
+		nextCheck = Limited(option) ? 0 : std::numeric_limits<std::uint64_t>::max();
+	}
+
+	// false once a limit is exceeded; the run should stop with message() and exitCode()
+	bool tick() { return ++steps < nextCheck or check(); }
+
+	// Counts `n` values a run copies towards the next check, so that a run that allocates much
+	// in few steps is still checked about every CheckEvery values; false like tick().
+	bool alloc(std::uint64_t n) { return n < nextCheck - steps ? (nextCheck -= n, true) : check(); }
+
+	// At every call of a recursive engine: false, with the run stopped, once the native stack
+	// is nearly used up, so that deep recursion ends with a limit error rather than a crash.
+	bool enter()
+	{
+		if (StackLeft()) { return true; }
+		stop(Reason::Stack);
+		return false;
+	}
+
+	// Takes the slow path every CheckEvery steps even without limits, so that a cancel() is noticed.
+	void watch() { nextCheck = std::min(nextCheck, steps + CheckEvery); }
+
+	// Stops the run at its next check; any copy can do it, from any thread.
+	void cancel()
+	{
+		auto none = Reason::None;
+		limits->Exceeded.compare_exchange_strong(none, Reason::Cancelled);
+	}
+
+	Reason exceeded() const { return limits->Exceeded; }
+
+	int exitCode() const
+	{
+		switch (exceeded()) {
+		case Reason::Steps: return StepsExitCode;
+		case Reason::Time: return TimeExitCode;
+		case Reason::Memory:
+		case Reason::Stack: return MemoryExitCode;
+		default: return EXIT_FAILURE;
+		}
+	}
+
+	std::string message() const
+	{
+		switch (exceeded()) {
+		case Reason::Steps: return "step limit (" + std::to_string(limits->MaxSteps) + ") exceeded";
+		case Reason::Time: return "time limit (" + std::to_string(limits->TimeoutMs) + " ms) exceeded";
+		case Reason::Memory: return "memory limit (" + std::to_string(limits->MaxMemoryKB / 1024) + " MB) exceeded";
+		case Reason::Stack: return "stack limit exceeded: the recursion is too deep";
+		case Reason::Cancelled: return "cancelled";
+		default: return "";
+		}
+	}
+};
+
+} // namespace limit
+} // namespace Noh
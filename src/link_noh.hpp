@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_noh.hpp"
+#include "walk_noh.hpp"
+
+namespace Noh {
+namespace link {
+
+// Binds every CallAst to its FuncAst and turns `x(i)` on a variable into an IdxAt node,
+// so that no call looks anything up at run time. Unresolvable calls are reported here.
+class Linker {
+	std::unordered_map<std::string, ast::FuncAst*> funcs;
+	std::vector<std::string> errors;
+
+	void linkCall(ast::CallAst* call, std::vector<std::string>& funcErrors)
+	{
+		auto callee = funcs.at(call->getFuncName());
+		if (callee->getParamNames().size() != call->getParams().size())
+		{
+			funcErrors.push_back("'" + call->getFuncName() + "' takes " + std::to_string(callee->getParamNames().size())
+				+ " arguments, but " + std::to_string(call->getParams().size()) + " were given");
+			return;
+		}
+		call->getCallee() = callee;
+	}
+
+	void linkExpr(ast::BaseAst*& ast, const std::unordered_set<std::string>& vars, std::vector<std::string>& funcErrors)
+	{
+		switch (ast->getID()) {
+		case ast::MonoExpID:
+			linkExpr(static_cast<ast::MonoExpAst*>(ast)->getLhs(), vars, funcErrors);
+			break;
+		case ast::BinaryExpID:
+			linkExpr(static_cast<ast::BinaryExpAst*>(ast)->getLhs(), vars, funcErrors);
+			linkExpr(static_cast<ast::BinaryExpAst*>(ast)->getRhs(), vars, funcErrors);
+			break;
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { linkExpr(elm, vars, funcErrors); }
+			break;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			for (auto& param : call->getParams()) { linkExpr(param, vars, funcErrors); }
+			const auto& name = call->getFuncName();
+			if (funcs.find(name) != std::end(funcs))
+			{
+				linkCall(call, funcErrors);
+			}
+			else if (call->getParams().size() == 1 and vars.find(name) != std::end(vars))
+			{
+				ast = new ast::BinaryExpAst(std::string("IdxAt"), new ast::IdentAst(name), call->getParams().front());
+				call->getParams().clear();
+				delete call;
+			}
+			else
+			{
+				funcErrors.push_back("unknown function '" + name + "'");
+			}
+			break;
+		}
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { linkExpr(arg, vars, funcErrors); }
+			break;
+		default:
+			break;
+		}
+	}
+
+public:
+	Linker() : funcs(), errors() {}
+
+	// Returns false if some call could not be linked; see getErrors().
+	bool run(ast::ModuleAst* ast)
+	{
+		for (auto& func : ast->getFuncs()) { funcs[func->getName()] = func; }
+		for (auto& func : ast->getFuncs())
+		{
+			std::unordered_set<std::string> vars(std::begin(func->getParamNames()), std::end(func->getParamNames()));
+			ast::ForEachStmt(func->getInst(), [&](ast::BaseAst* stmt)
+			{
+				if (stmt->getID() == ast::AssignID) { vars.insert(static_cast<ast::AssignAst*>(stmt)->getName()); }
+				else if (stmt->getID() == ast::ForStmtID) { vars.insert(static_cast<ast::ForStmtAst*>(stmt)->getIdent()); }
+			});
+
+			std::vector<std::string> funcErrors{};
+			ast::ForEachStmt(func->getInst(), [&](ast::BaseAst* stmt)
+			{
+				if (stmt->getID() != ast::CallID) { return; }
+				auto call = static_cast<ast::CallAst*>(stmt);
+				if (funcs.find(call->getFuncName()) == std::end(funcs))
+				{
+					funcErrors.push_back("'" + call->getFuncName() + "' is not a function");
+					return;
+				}
+				linkCall(call, funcErrors);
+			});
+			ast::ForEachExpr(func->getInst(), [&](ast::BaseAst*& expr, bool)
+			{
+				linkExpr(expr, vars, funcErrors);
+			});
+			for (auto& err : funcErrors) { errors.push_back("fn " + func->getName() + ": " + err); }
+		}
+		return errors.empty();
+	}
+
+	// "fn <name>: <message>" per unresolvable call
+	const std::vector<std::string>& getErrors() const { return errors; }
+};
+
+} // namespace link
+} // namespace Noh
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <iterator>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Noh {
+namespace cache {
+
+// Values keyed by a hash of their source text, compared in full on a hit; the least recently
+// used is evicted first. `Ptr` is a shared pointer, so a value stays alive while it is in use,
+// even once evicted.
+template <typename Ptr>
+class Lru {
+	struct Entry {
+		std::size_t Hash;
+		std::string Source;
+		Ptr Val;
+	};
+
+	std::size_t capacity;
+	std::mutex m;
+	std::list<Entry> order; // most recently used first
+	std::unordered_multimap<std::size_t, typename std::list<Entry>::iterator> table;
+
+public:
+	Lru(std::size_t capacity) : capacity(capacity), m(), order(), table() {}
+
+	// nullptr if not cached
+	Ptr find(const std::string& source)
+	{
+		const auto hash = std::hash<std::string>{}(source);
+		std::lock_guard<std::mutex> lock(m);
+		auto [first, last] = table.equal_range(hash);
+		for (; first != last; ++first)
+		{
+			auto entry = first->second;
+			if (entry->Source != source) { continue; }
+			order.splice(std::begin(order), order, entry);
+			return entry->Val;
+		}
+		return nullptr;
+	}
+
+	void insert(const std::string& source, Ptr val)
+	{
+		if (capacity == 0) { return; }
+		const auto hash = std::hash<std::string>{}(source);
+		std::lock_guard<std::mutex> lock(m);
+		auto [first, last] = table.equal_range(hash);
+		for (; first != last; ++first)
+		{
+			// another thread added it meanwhile
+			if (first->second->Source == source) { return; }
+		}
+		if (order.size() >= capacity)
+		{
+			auto [oldFirst, oldLast] = table.equal_range(order.back().Hash);
+			for (; oldFirst != oldLast; ++oldFirst)
+			{
+				if (oldFirst->second == std::prev(std::end(order)))
+				{
+					table.erase(oldFirst);
+					break;
+				}
+			}
+			order.pop_back();
+		}
+		order.push_front(Entry{hash, source, std::move(val)});
+		table.emplace(hash, std::begin(order));
+	}
+};
+
+} // namespace cache
+} // namespace Noh
@@ -5,7 +5,22 @@
 #include <boost/program_options.hpp>
 
 #include "parser_noh.hpp"
+#include "import_noh.hpp"
+#include "aot_noh.hpp"
 #include "eval_noh.hpp"
+#include "link_noh.hpp"
+#include "compile_noh.hpp"
+#include "fuse_noh.hpp"
+#include "vm_noh.hpp"
+#include "record_noh.hpp"
+#include "repl_noh.hpp"
+#include "serve_noh.hpp"
+#include "batch_noh.hpp"
+#include "snapshot_noh.hpp"
+#include "flateval_noh.hpp"
+#include "opt_noh.hpp"
+#include "dump_noh.hpp"
+#include "walk_noh.hpp"
 #include "version_noh.hpp"
 
 int main(int argc, const char* argv[])
@@ -19,7 +34,44 @@ int main(int argc, const char* argv[])
 	desc.add_options()
 		("help,h", "Show this help message.")
 		("version,v", "Show version information.")
-		("input,i", po::value<std::string>(), "Input file path.");
+		("input,i", po::value<std::string>(), "Input file path.")
+		("opt,O", po::value<int>()->default_value(0), "Optimization level. -O1 folds constants and removes dead code, -O2 also inlines small functions and optimizes loops.")
+		("dump-ast", "Print the program as Noh source after optimization instead of running it.")
+		("emit-cpp", po::value<std::string>(), "Translate the program to a standalone C++ file instead of running it.")
+		("build", po::value<std::string>(), "Translate the program to C++ and compile it into this executable with $CXX (default g++).")
+		("inline-threshold", po::value<std::size_t>(), "Largest function body, in AST nodes, that -O2 inlines.")
+		("inline-report", "Report each call site -O2 inlined or kept.")
+		("memo", "Memoize every pure function, not only the ones declared with `memo fn`.")
+		("memo-size", po::value<std::size_t>(), "Maximum number of cached results per memoized function.")
+		("stackless", "Run on the bytecode machine, whose call stack lives on the heap.")
+		("flat", "Run on the flat tree evaluator, whose nodes are stored in one array and dispatched by tag.")
+		("auto-par", "Run on the flat tree evaluator and evaluate independent calls to pure functions in parallel.")
+		("par-threshold", po::value<std::size_t>(), "Smallest function body, in flat nodes, that --auto-par runs as a task even without loops or recursion.")
+		("par-threads", po::value<std::size_t>(), "Number of threads for --auto-par (default: one per hardware thread).")
+		("no-fuse", "Do not fuse common instruction sequences into superinstructions in --stackless mode.")
+		("profile-ops", "Run in --stackless mode and report the most executed instructions and instruction sequences.")
+		("max-depth", po::value<std::size_t>(), "Maximum Noh call depth in --stackless mode.")
+		("workers", po::value<std::size_t>(), "Number of threads that run spawned tasks (default: one per hardware thread).")
+		("each-line", "Call the record function once for every line of standard input instead of running main.")
+		("each-record", po::value<std::string>(), "Like --each-line, with records ended by the given separator (\\n, \\t, \\0 and \\\\ are unescaped).")
+		("record-fn", po::value<std::string>(), "Function that --each-line / --each-record calls for each record (default: row).")
+		("record-threads", po::value<std::size_t>(), "Number of threads for --each-line / --each-record; output keeps the input order (default: 1, 0: one per hardware thread).")
+		("serve", po::value<std::string>(), "Serve scripts sent by --connect on the given Unix domain socket, keeping compiled modules cached.")
+		("connect", po::value<std::string>(), "Run the script on the --serve server at the given socket, sending it standard input.")
+		("serve-threads", po::value<std::size_t>(), "Number of requests --serve runs at once (default: one per hardware thread).")
+		("cache-size", po::value<std::size_t>(), "Number of compiled modules --serve and --batch keep (default: 64).")
+		("batch", po::value<std::vector<std::string>>()->multitoken(), "Run every given script in this one process, each with its own state and output, and report their timings.")
+		("manifest", po::value<std::string>(), "Like --batch, with the scripts listed one per line in the given file.")
+		("batch-threads", po::value<std::size_t>(), "Number of scripts --batch runs at once; output keeps the given order (default: 1, 0: one per hardware thread).")
+		("max-steps", po::value<std::uint64_t>(), "Stop with exit code 3 after this many loop iterations and calls.")
+		("timeout-ms", po::value<std::size_t>(), "Stop with exit code 4 once the program has run this many milliseconds.")
+		("max-memory", po::value<std::size_t>(), "Stop with exit code 5 once the process has used this many MB of memory.")
+		("snapshot", po::value<std::string>(), "Run fn init and save the compiled program and its result to the given file instead of running main.")
+		("from-snapshot", po::value<std::string>(), "Load a file saved by --snapshot and run main on the saved result of fn init, on the bytecode machine.")
+		("repl", "Read statements and functions interactively, keeping the functions and top-level variables entered so far, and time each input.")
+		("lazy-parse", "Parse only the functions that main (or the record function) can reach; the others are skimmed and skipped.")
+		("no-jit", "Never compile functions to machine code.")
+		("jit-threshold", po::value<std::size_t>(), "Number of calls after which a numeric function is compiled to machine code.");
 	po::positional_options_description pos_desc;
 	pos_desc.add("input", 1);
 	
@@ -45,6 +97,132 @@ int main(int argc, const char* argv[])
 	{
 		std::cout << "Noh version " << NOH_VERSION_STRING << std::endl;
 	}
+
+	Noh::EvalOption option{};
+	option.MemoAll = vm.count("memo");
+	if (vm.count("memo-size"))
+	{
+		option.MemoCapacity = vm["memo-size"].as<std::size_t>();
+	}
+	if (vm.count("max-depth"))
+	{
+		option.MaxDepth = vm["max-depth"].as<std::size_t>();
+	}
+	if (vm.count("inline-threshold"))
+	{
+		option.InlineThreshold = vm["inline-threshold"].as<std::size_t>();
+	}
+	option.InlineReport = vm.count("inline-report");
+	option.Jit = not vm.count("no-jit");
+	option.Fuse = not vm.count("no-fuse");
+	option.ProfileOps = vm.count("profile-ops");
+	option.AutoPar = vm.count("auto-par");
+	if (vm.count("par-threshold"))
+	{
+		option.ParThreshold = vm["par-threshold"].as<std::size_t>();
+	}
+	if (vm.count("par-threads"))
+	{
+		option.ParThreads = vm["par-threads"].as<std::size_t>();
+	}
+	if (vm.count("jit-threshold"))
+	{
+		option.JitThreshold = vm["jit-threshold"].as<std::size_t>();
+	}
+	if (vm.count("workers"))
+	{
+		option.Workers = vm["workers"].as<std::size_t>();
+	}
+	option.EachRecord = vm.count("each-line") or vm.count("each-record");
+	if (vm.count("each-record"))
+	{
+		option.RecordSep = Noh::record::Unescape(vm["each-record"].as<std::string>());
+		if (option.RecordSep.empty())
+		{
+			std::cerr << "the record separator must not be empty" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	if (vm.count("record-fn"))
+	{
+		option.RecordFn = vm["record-fn"].as<std::string>();
+	}
+	if (vm.count("record-threads"))
+	{
+		option.RecordThreads = vm["record-threads"].as<std::size_t>();
+	}
+
+	if (vm.count("cache-size"))
+	{
+		option.CacheSize = vm["cache-size"].as<std::size_t>();
+	}
+	if (vm.count("serve-threads"))
+	{
+		option.ServeThreads = vm["serve-threads"].as<std::size_t>();
+	}
+	if (vm.count("batch-threads"))
+	{
+		option.BatchThreads = vm["batch-threads"].as<std::size_t>();
+	}
+	if (vm.count("max-steps"))
+	{
+		option.MaxSteps = vm["max-steps"].as<std::uint64_t>();
+	}
+	if (vm.count("timeout-ms"))
+	{
+		option.TimeoutMs = vm["timeout-ms"].as<std::size_t>();
+	}
+	if (vm.count("max-memory"))
+	{
+		option.MaxMemoryMB = vm["max-memory"].as<std::size_t>();
+	}
+	option.LazyParse = vm.count("lazy-parse");
+
+	if (vm.count("serve"))
+	{
+		return Noh::serve::Server(vm["serve"].as<std::string>(), vm["opt"].as<int>(), option).run();
+	}
+	if (vm.count("batch") or vm.count("manifest"))
+	{
+		std::vector<std::string> scripts{};
+		if (vm.count("batch"))
+		{
+			scripts = vm["batch"].as<std::vector<std::string>>();
+		}
+		if (vm.count("manifest") and not Noh::batch::ReadManifest(vm["manifest"].as<std::string>(), scripts))
+		{
+			std::cerr << "could not open the file: '" << vm["manifest"].as<std::string>() << "'" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return Noh::batch::Runner(scripts, vm["opt"].as<int>(), option).run();
+	}
+	if (vm.count("repl"))
+	{
+		return Noh::repl::Repl(option).run();
+	}
+	if (vm.count("from-snapshot"))
+	{
+		Noh::vm::Program prog{};
+		Noh::vm::Value state{};
+		std::string error{};
+		if (not Noh::snapshot::Read(vm["from-snapshot"].as<std::string>(), prog, state, error))
+		{
+			std::cerr << error << std::endl;
+			return EXIT_FAILURE;
+		}
+		Noh::vm::Machine machine(prog, option);
+		machine.setState(std::move(state));
+		return machine.run();
+	}
+	if (vm.count("connect"))
+	{
+		if (not vm.count("input"))
+		{
+			std::cerr << "--connect needs a script to run" << std::endl;
+			return EXIT_FAILURE;
+		}
+		return Noh::serve::Connect(vm["connect"].as<std::string>(), vm["input"].as<std::string>());
+	}
 	if (vm.count("input"))
 	{
 		try
@@ -70,20 +248,157 @@ int main(int argc, const char* argv[])
 			}
 			fIn.close();
 
-			auto it = std::begin(input);
-			Noh::parser::Calc<std::string::iterator, qi::standard_wide::space_type> calc;
-			Noh::ast::ModuleAst* res = nullptr;
-			bool success = qi::phrase_parse(
-				it,
-				std::end(input),
-				calc,
-				qi::standard_wide::space,
-				res
-			);
+			// the script and everything it imports, as one module
+			std::string errors{};
+			Noh::ast::ModuleAst* res = Noh::imports::Load(fName, std::move(input), option, nullptr, errors);
+			if (not res and not errors.empty())
+			{
+				std::cerr << errors << std::flush;
+				return EXIT_FAILURE;
+			}
 
-			if (success and it == std::end(input))
+			if (res)
 			{
-				Noh::eval::AstEval asteval(res);
+				Noh::opt::Optimizer(vm["opt"].as<int>(), option).run(res);
+				if (vm.count("dump-ast"))
+				{
+					Noh::dump::Dumper().dumpModule(res);
+					return EXIT_SUCCESS;
+				}
+
+				// spawn / await / channels run on the bytecode machine only
+				bool tasks = false;
+				for (auto& func : res->getFuncs()) { tasks = tasks or Noh::ast::UsesTasks(func->getInst()); }
+				if (tasks and (vm.count("emit-cpp") or vm.count("build") or vm.count("flat") or option.AutoPar))
+				{
+					std::cerr << "tasks and channels are not supported with --emit-cpp, --build, --flat or --auto-par" << std::endl;
+					return EXIT_FAILURE;
+				}
+
+				// every engine runs on the linked module, so they all report the same load-time errors
+				Noh::link::Linker linker{};
+				if (not linker.run(res))
+				{
+					for (const auto& err : linker.getErrors())
+					{
+						std::cerr << "link error: " << err << std::endl;
+					}
+					return EXIT_FAILURE;
+				}
+
+				if (vm.count("emit-cpp") or vm.count("build"))
+				{
+					Noh::aot::Translator translator(option);
+					std::ostringstream cpp{};
+					if (not translator.translate(res, fName, cpp))
+					{
+						for (const auto& err : translator.getErrors())
+						{
+							std::cerr << "compile error: " << err << std::endl;
+						}
+						return EXIT_FAILURE;
+					}
+					// --build without --emit-cpp keeps the C++ next to the executable
+					const std::string cppName = vm.count("emit-cpp") ? vm["emit-cpp"].as<std::string>()
+						: vm["build"].as<std::string>() + ".cpp";
+					std::ofstream fOut(cppName);
+					if (not (fOut << cpp.str()))
+					{
+						std::cerr << "could not write the file: '" << cppName << "'" << std::endl;
+						return EXIT_FAILURE;
+					}
+					fOut.close();
+					if (vm.count("build"))
+					{
+						return Noh::aot::Build(cppName, vm["build"].as<std::string>());
+					}
+					return EXIT_SUCCESS;
+				}
+
+				// records run on the bytecode machine, compiled once
+				if (option.EachRecord)
+				{
+					Noh::vm::Program prog{};
+					Noh::vm::Compiler compiler(prog, option);
+					if (not compiler.compile(res))
+					{
+						for (const auto& err : compiler.getErrors())
+						{
+							std::cerr << "compile error: " << err << std::endl;
+						}
+						return EXIT_FAILURE;
+					}
+					if (option.Fuse)
+					{
+						Noh::vm::Fuse(prog);
+					}
+					return Noh::record::Runner(prog, option).run();
+				}
+				if (vm.count("stackless") or vm.count("profile-ops") or tasks or vm.count("snapshot"))
+				{
+					Noh::vm::Program prog{};
+					Noh::vm::Compiler compiler(prog, option);
+					if (not compiler.compile(res))
+					{
+						for (const auto& err : compiler.getErrors())
+						{
+							std::cerr << "compile error: " << err << std::endl;
+						}
+						return EXIT_FAILURE;
+					}
+					if (option.Fuse)
+					{
+						Noh::vm::Fuse(prog);
+					}
+					Noh::vm::Machine machine(prog, option);
+					if (vm.count("snapshot"))
+					{
+						if (prog.Init < 0)
+						{
+							std::cerr << "--snapshot needs fn init() and fn main(state) to take its result" << std::endl;
+							return EXIT_FAILURE;
+						}
+						Noh::vm::Value state{};
+						bool exited = false;
+						if (not machine.call(prog.Init, {}, state, exited))
+						{
+							std::cout << std::flush;
+							std::cerr << "runtime error: " << machine.getError() << std::endl;
+							return machine.failureCode();
+						}
+						std::cout << std::flush;
+						std::string error{};
+						if (exited)
+						{
+							std::cerr << "fn init ran exit; no snapshot was saved" << std::endl;
+							return EXIT_FAILURE;
+						}
+						if (not Noh::snapshot::Write(vm["snapshot"].as<std::string>(), prog, state, error))
+						{
+							std::cerr << error << std::endl;
+							return EXIT_FAILURE;
+						}
+						return EXIT_SUCCESS;
+					}
+					return machine.run();
+				}
+				if (vm.count("flat") or option.AutoPar)
+				{
+					Noh::flat::Tree tree{};
+					Noh::flat::Flattener flattener(tree, option);
+					if (not flattener.flatten(res))
+					{
+						for (const auto& err : flattener.getErrors())
+						{
+							std::cerr << "compile error: " << err << std::endl;
+						}
+						return EXIT_FAILURE;
+					}
+					Noh::flat::Eval eval(tree, option);
+					return eval.run();
+				}
+				Noh::eval::AstEval asteval(res, option);
+				return asteval.ExitCode;
 			}
 			else
 			{
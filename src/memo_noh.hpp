@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ast_noh.hpp"
+
+namespace Noh {
+namespace memo {
+
+// ================
+//      purity
+// ================
+
+// A function is pure when it never reaches print / scanNum / scanStr / exit
+// and only calls functions that are pure themselves.
+// Every function starts as pure and is demoted until nothing changes,
+// so (mutually) recursive functions can stay pure.
+class Purity {
+	const std::unordered_map<std::string, ast::FuncAst*>& funcs;
+	std::unordered_set<const ast::FuncAst*> impure;
+
+	bool isPureExpr(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+		case ast::StringID:
+		case ast::IdentID:
+			return true;
+		case ast::MonoExpID:
+			return isPureExpr(static_cast<ast::MonoExpAst*>(ast)->getLhs());
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			return isPureExpr(bin->getLhs()) and isPureExpr(bin->getRhs());
+		}
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary)
+			{
+				if (not isPureExpr(elm)) { return false; }
+			}
+			return true;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			auto itr = funcs.find(call->getFuncName());
+			if (itr == std::end(funcs))
+			{
+				// indexing into a tuple: `x(i)`
+				if (call->getParams().size() != 1) { return false; }
+			}
+			else if (impure.count(itr->second))
+			{
+				return false;
+			}
+			for (auto& param : call->getParams())
+			{
+				if (not isPureExpr(param)) { return false; }
+			}
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	bool isPureStmts(std::vector<ast::BaseAst*>& stmts)
+	{
+		for (auto& stmt : stmts)
+		{
+			if (not isPureStmt(stmt)) { return false; }
+		}
+		return true;
+	}
+
+	bool isPureStmt(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+		{
+			auto builtin = static_cast<ast::BuiltinAst*>(ast);
+			const auto& name = builtin->getName();
+			if (name == "print" or name == "scanNum" or name == "scanStr" or name == "exit") { return false; }
+			for (auto& arg : builtin->getArgs())
+			{
+				if (not isPureExpr(arg)) { return false; }
+			}
+			return true;
+		}
+		case ast::AssignID:
+			return isPureExpr(static_cast<ast::AssignAst*>(ast)->getVal());
+		case ast::ReAssignID:
+			return isPureExpr(static_cast<ast::ReAssignAst*>(ast)->getVal());
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			return isPureExpr(stmt->getCond()) and isPureStmts(stmt->getThenStmt()) and isPureStmts(stmt->getElseStmt());
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			return isPureExpr(stmt->getCond()) and isPureStmts(stmt->getLoopStmt());
+		}
+		case ast::ForStmtID:
+		{
+			auto stmt = static_cast<ast::ForStmtAst*>(ast);
+			return isPureExpr(stmt->getRange()->getFrom()) and isPureExpr(stmt->getRange()->getTo())
+				and isPureStmts(stmt->getStmts());
+		}
+		case ast::CallID:
+			return isPureExpr(ast);
+		default:
+			return false;
+		}
+	}
+
+public:
+	Purity(const std::unordered_map<std::string, ast::FuncAst*>& funcs) : funcs(funcs), impure()
+	{
+		for (bool changed = true; changed;)
+		{
+			changed = false;
+			for (auto& [name, func] : funcs)
+			{
+				if (impure.count(func)) { continue; }
+				if (not isPureStmts(func->getInst()))
+				{
+					impure.insert(func);
+					changed = true;
+				}
+			}
+		}
+	}
+
+	bool isPure(const ast::FuncAst* func) const { return impure.count(func) == 0; }
+};
+
+// ================
+//       table
+// ================
+
+// Appends an evaluated value (NumberAst / StringAst / TupleAst) to a cache key.
+inline void AppendKey(std::string& key, ast::BaseAst* val)
+{
+	switch (val->getID()) {
+	case ast::NumberID:
+	{
+		const auto num = static_cast<ast::NumberAst*>(val)->getVal();
+		char buf[sizeof(num)];
+		std::memcpy(buf, &num, sizeof(num));
+		key += 'n';
+		key.append(buf, sizeof(num));
+		break;
+	}
+	case ast::StringID:
+	{
+		const auto str = static_cast<ast::StringAst*>(val)->getVal();
+		key += 's';
+		key += std::to_string(str.size());
+		key += ':';
+		key += str;
+		break;
+	}
+	case ast::TupleID:
+	{
+		auto& ary = static_cast<ast::TupleAst*>(val)->Ary;
+		key += 't';
+		key += std::to_string(ary.size());
+		key += ':';
+		for (auto& elm : ary) { AppendKey(key, elm); }
+		break;
+	}
+	default:
+		assert(0 && "unknown type");
+	}
+}
+
+// Frees a value a MemoTable drops. Values of the bytecode machine and the flat evaluator own
+// nothing; the tree walker's are nodes the table took over.
+template<class Val>
+void Release(Val&) {}
+
+inline void Release(ast::BaseAst*& val)
+{
+	delete val;
+	val = nullptr;
+}
+
+// Bounded argument -> result cache; the oldest entry is evicted first.
+// The table owns its values and releases them when they are evicted and when it is destroyed.
+template<class Val>
+class MemoTable {
+	std::size_t capacity;
+	std::unordered_map<std::string, Val> table;
+	std::deque<std::string> order;
+public:
+	MemoTable(std::size_t capacity) : capacity(capacity), table(), order() {}
+	~MemoTable()
+	{
+		for (auto& [key, val] : table) { Release(val); }
+	}
+	MemoTable(const MemoTable&) = delete;
+	MemoTable& operator=(const MemoTable&) = delete;
+	MemoTable(MemoTable&& other) : capacity(other.capacity), table(std::move(other.table)), order(std::move(other.order))
+	{
+		other.table.clear();
+		other.order.clear();
+	}
+
+	const Val* find(const std::string& key) const
+	{
+		auto itr = table.find(key);
+		return itr == std::end(table) ? nullptr : &itr->second;
+	}
+
+	// Whether insert(key, ...) would keep the value, so that a caller copies a result only then.
+	bool keeps(const std::string& key) const
+	{
+		return capacity != 0 and table.find(key) == std::end(table);
+	}
+
+	// The table takes over `val`; one it does not keep is released.
+	void insert(const std::string& key, Val val)
+	{
+		if (not keeps(key))
+		{
+			Release(val);
+			return;
+		}
+		if (table.size() >= capacity)
+		{
+			auto oldest = table.find(order.front());
+			Release(oldest->second);
+			table.erase(oldest);
+			order.pop_front();
+		}
+		table.emplace(key, std::move(val));
+		order.push_back(key);
+	}
+};
+
+} // namespace memo
+} // namespace Noh
@@ -0,0 +1,1504 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_noh.hpp"
+#include "dump_noh.hpp"
+#include "infer_noh.hpp"
+#include "walk_noh.hpp"
+
+namespace Noh {
+namespace opt {
+
+using ast::ForEachExpr;
+using ast::ForEachStmt;
+
+inline bool IsNumber(ast::BaseAst* ast) { return ast->getID() == ast::NumberID; }
+inline bool IsNumber(ast::BaseAst* ast, std::int_fast64_t val)
+{
+	return IsNumber(ast) and static_cast<ast::NumberAst*>(ast)->getVal() == val;
+}
+inline std::int_fast64_t NumOf(ast::BaseAst* ast) { return static_cast<ast::NumberAst*>(ast)->getVal(); }
+
+// Shapes the evaluator accepts wherever it asks CanCastInNum, e.g. as an if condition.
+inline bool IsNumShaped(ast::BaseAst* ast)
+{
+	const auto id = ast->getID();
+	return id == ast::NumberID or id == ast::BinaryExpID or id == ast::MonoExpID;
+}
+
+// Evaluating the expression neither calls anything nor has side effects.
+inline bool IsPureExpr(ast::BaseAst* ast)
+{
+	switch (ast->getID()) {
+	case ast::NumberID:
+	case ast::StringID:
+	case ast::IdentID:
+		return true;
+	case ast::MonoExpID:
+		return IsPureExpr(static_cast<ast::MonoExpAst*>(ast)->getLhs());
+	case ast::BinaryExpID:
+	{
+		auto bin = static_cast<ast::BinaryExpAst*>(ast);
+		return IsPureExpr(bin->getLhs()) and IsPureExpr(bin->getRhs());
+	}
+	case ast::TupleID:
+		for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary)
+		{
+			if (not IsPureExpr(elm)) { return false; }
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+// The expression is known to be a Num: arithmetic yields one or fails, and variables take
+// the type infer::TypeInfer recorded. Calls and parameters are not known before linking.
+inline bool IsNum(ast::BaseAst* ast)
+{
+	if (ast->getID() == ast::BinaryExpID) { return static_cast<ast::BinaryExpAst*>(ast)->getOp() != "IdxAt"; }
+	return IsNumShaped(ast) or ast->getType() == ast::ValType::Num;
+}
+
+// Evaluating the expression cannot fail: arithmetic only sees Nums, divides only by nonzero
+// constants other than -1, and nothing is indexed or called.
+inline bool CannotTrap(ast::BaseAst* ast)
+{
+	switch (ast->getID()) {
+	case ast::NumberID:
+	case ast::StringID:
+	case ast::IdentID:
+		return true;
+	case ast::MonoExpID:
+	{
+		auto lhs = static_cast<ast::MonoExpAst*>(ast)->getLhs();
+		return IsNum(lhs) and CannotTrap(lhs);
+	}
+	case ast::BinaryExpID:
+	{
+		auto bin = static_cast<ast::BinaryExpAst*>(ast);
+		const auto& op = bin->getOp();
+		auto lhs = bin->getLhs(), rhs = bin->getRhs();
+		if (op == "IdxAt") { return false; }
+		if ((op == "/" or op == "%") and (not IsNumber(rhs) or IsNumber(rhs, 0) or IsNumber(rhs, -1))) { return false; }
+		return IsNum(lhs) and IsNum(rhs) and CannotTrap(lhs) and CannotTrap(rhs);
+	}
+	case ast::TupleID:
+		for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary)
+		{
+			if (not CannotTrap(elm)) { return false; }
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+inline bool IsTerminator(ast::BaseAst* ast)
+{
+	if (ast->getID() != ast::BuiltinID) { return false; }
+	const auto& name = static_cast<ast::BuiltinAst*>(ast)->getName();
+	return name == "return" or name == "break" or name == "continue" or name == "exit";
+}
+
+// Deep copy of an expression.
+inline ast::BaseAst* CloneExpr(ast::BaseAst* ast)
+{
+	switch (ast->getID()) {
+	case ast::NumberID:
+		return new ast::NumberAst(static_cast<ast::NumberAst*>(ast)->getVal());
+	case ast::StringID:
+	{
+		auto res = new ast::StringAst("");
+		res->getVal() = static_cast<ast::StringAst*>(ast)->getVal();
+		return res;
+	}
+	case ast::IdentID:
+	{
+		// the copy reads the same variable, so it keeps its inferred type
+		auto res = new ast::IdentAst(static_cast<ast::IdentAst*>(ast)->getIdent());
+		res->getType() = ast->getType();
+		return res;
+	}
+	case ast::MonoExpID:
+	{
+		auto mono = static_cast<ast::MonoExpAst*>(ast);
+		return new ast::MonoExpAst(mono->getOp(), CloneExpr(mono->getLhs()));
+	}
+	case ast::BinaryExpID:
+	{
+		auto bin = static_cast<ast::BinaryExpAst*>(ast);
+		return new ast::BinaryExpAst(bin->getOp(), CloneExpr(bin->getLhs()), CloneExpr(bin->getRhs()));
+	}
+	case ast::TupleID:
+	{
+		std::vector<ast::BaseAst*> ary{};
+		for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { ary.push_back(CloneExpr(elm)); }
+		return new ast::TupleAst(ary);
+	}
+	case ast::CallID:
+	{
+		auto call = static_cast<ast::CallAst*>(ast);
+		auto res = new ast::CallAst(call->getFuncName());
+		for (auto& param : call->getParams()) { res->getParams().push_back(CloneExpr(param)); }
+		return res;
+	}
+	case ast::TaskID:
+	{
+		auto task = static_cast<ast::TaskAst*>(ast);
+		auto res = new ast::TaskAst(task->getOp(), CloneExpr(task->getArgs().front()));
+		for (std::size_t i = 1; i < task->getArgs().size(); i++) { res->getArgs().push_back(CloneExpr(task->getArgs()[i])); }
+		return res;
+	}
+	default:
+		return nullptr;
+	}
+}
+
+// Structural key of an expression, e.g. to find repeated subexpressions.
+inline std::string ExprKey(ast::BaseAst* ast)
+{
+	std::ostringstream out;
+	dump::Dumper(out).dumpExpr(ast);
+	return out.str();
+}
+
+// Computes `lhs op rhs` like evalNumBinaryExpAst; false when it must stay a run-time operation.
+inline bool FoldBinary(const std::string& op, std::int_fast64_t lhs, std::int_fast64_t rhs, std::int_fast64_t& res)
+{
+	if (op == "+") { res = lhs + rhs; }
+	else if (op == "-") { res = lhs - rhs; }
+	else if (op == "*") { res = lhs * rhs; }
+	else if (op == "/" or op == "%")
+	{
+		if (rhs == 0 or (rhs == -1 and lhs == std::numeric_limits<std::int_fast64_t>::min())) { return false; }
+		res = op == "/" ? lhs / rhs : lhs % rhs;
+	}
+	else if (op == "==") { res = lhs == rhs; }
+	else if (op == "!=") { res = lhs != rhs; }
+	else if (op == "<") { res = lhs < rhs; }
+	else if (op == ">") { res = lhs > rhs; }
+	else if (op == "<=") { res = lhs <= rhs; }
+	else if (op == ">=") { res = lhs >= rhs; }
+	else if (op == "&&") { res = lhs && rhs; }
+	else if (op == "||") { res = lhs || rhs; }
+	else { return false; }
+	return true;
+}
+
+// ================
+//  constant fold
+// ================
+
+// Folds constant BinaryExpAst / MonoExpAst subtrees into NumberAst, applies algebraic
+// identities, drops branches and loops that can never run, and drops statements after
+// return / break / continue / exit.
+class Folder {
+public:
+	// Returns the replacement of `ast`; replaced nodes are deleted.
+	// Conditions pass `anyShape = false`, since the evaluator only takes IsNumShaped nodes there.
+	ast::BaseAst* foldExpr(ast::BaseAst* ast, bool anyShape = true)
+	{
+		switch (ast->getID()) {
+		case ast::MonoExpID:
+			return foldMono(static_cast<ast::MonoExpAst*>(ast), anyShape);
+		case ast::BinaryExpID:
+			return foldBinary(static_cast<ast::BinaryExpAst*>(ast), anyShape);
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { elm = foldExpr(elm); }
+			return ast;
+		case ast::CallID:
+			for (auto& param : static_cast<ast::CallAst*>(ast)->getParams()) { param = foldExpr(param); }
+			return ast;
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { arg = foldExpr(arg); }
+			return ast;
+		default:
+			return ast;
+		}
+	}
+
+private:
+	ast::BaseAst* foldMono(ast::MonoExpAst* ast, bool anyShape)
+	{
+		ast->getLhs() = foldExpr(ast->getLhs());
+		auto lhs = ast->getLhs();
+		const auto& op = ast->getOp();
+		if (IsNumber(lhs))
+		{
+			const auto val = NumOf(lhs);
+			const std::int_fast64_t res = op == "!" ? static_cast<std::int_fast64_t>(not val) : op == "-" ? -val : ~val;
+			delete ast;
+			return new ast::NumberAst(res);
+		}
+		// -(-x) and ~(~x) are x
+		if (lhs->getID() == ast::MonoExpID and op != "!" and static_cast<ast::MonoExpAst*>(lhs)->getOp() == op)
+		{
+			auto inner = static_cast<ast::MonoExpAst*>(lhs);
+			if (IsNum(inner->getLhs()) and (anyShape or IsNumShaped(inner->getLhs())))
+			{
+				return detach(ast, inner->getLhs());
+			}
+		}
+		return ast;
+	}
+
+	ast::BaseAst* foldBinary(ast::BinaryExpAst* ast, bool anyShape)
+	{
+		const auto& op = ast->getOp();
+		ast->getLhs() = foldExpr(ast->getLhs());
+		ast->getRhs() = foldExpr(ast->getRhs());
+		if (op == "IdxAt") { return ast; }
+
+		auto lhs = ast->getLhs(), rhs = ast->getRhs();
+		if (IsNumber(lhs) and IsNumber(rhs))
+		{
+			std::int_fast64_t res;
+			if (FoldBinary(op, NumOf(lhs), NumOf(rhs), res))
+			{
+				delete ast;
+				return new ast::NumberAst(res);
+			}
+			return ast;
+		}
+
+		// x + 0, 0 + x, x - 0, x * 1, 1 * x, x / 1 are x when x is a Num; on anything else they fail
+		ast::BaseAst* keep = nullptr;
+		if ((op == "+" and IsNumber(rhs, 0)) or (op == "-" and IsNumber(rhs, 0))
+			or (op == "*" and IsNumber(rhs, 1)) or (op == "/" and IsNumber(rhs, 1)))
+		{
+			keep = lhs;
+		}
+		else if ((op == "+" and IsNumber(lhs, 0)) or (op == "*" and IsNumber(lhs, 1)))
+		{
+			keep = rhs;
+		}
+		if (keep and IsNum(keep) and (anyShape or IsNumShaped(keep)))
+		{
+			return detach(ast, keep);
+		}
+
+		// x * 0, x && 0 are 0 and x || 1 is 1 when x is a Num that cannot fail;
+		// 0 && x and 1 || x never evaluate x, so x may be anything there
+		auto absorb = [&](ast::BaseAst* constant, ast::BaseAst* other) -> ast::BaseAst*
+		{
+			const bool skipped = other == rhs and (op == "&&" or op == "||");
+			if (not IsNumber(constant) or not (skipped or (IsNum(other) and CannotTrap(other)))) { return nullptr; }
+			const auto val = NumOf(constant);
+			if ((op == "*" or op == "&&") and val == 0) { return new ast::NumberAst(0); }
+			if (op == "||" and val != 0) { return new ast::NumberAst(1); }
+			return nullptr;
+		};
+		auto res = absorb(rhs, lhs);
+		if (not res) { res = absorb(lhs, rhs); }
+		if (res)
+		{
+			delete ast;
+			return res;
+		}
+		return ast;
+	}
+
+	// Deletes an operator node but keeps one of its operands.
+	ast::BaseAst* detach(ast::BaseAst* ast, ast::BaseAst* keep)
+	{
+		if (ast->getID() == ast::MonoExpID)
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			auto inner = static_cast<ast::MonoExpAst*>(mono->getLhs());
+			inner->getLhs() = nullptr;
+		}
+		else
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			if (bin->getLhs() == keep) { bin->getLhs() = nullptr; }
+			if (bin->getRhs() == keep) { bin->getRhs() = nullptr; }
+		}
+		delete ast;
+		return keep;
+	}
+
+	static bool declaresVar(const std::vector<ast::BaseAst*>& stmts)
+	{
+		for (auto& stmt : stmts)
+		{
+			if (stmt->getID() == ast::AssignID) { return true; }
+		}
+		return false;
+	}
+
+	// Appends the folded form of `ast` (zero or more statements) to `res`.
+	void foldStmt(ast::BaseAst* ast, std::vector<ast::BaseAst*>& res)
+	{
+		switch (ast->getID()) {
+		case ast::BuiltinID:
+			for (auto& arg : static_cast<ast::BuiltinAst*>(ast)->getArgs()) { arg = foldExpr(arg); }
+			break;
+		case ast::AssignID:
+		{
+			auto assign = static_cast<ast::AssignAst*>(ast);
+			assign->getVal() = foldExpr(assign->getVal());
+			break;
+		}
+		case ast::ReAssignID:
+		{
+			auto assign = static_cast<ast::ReAssignAst*>(ast);
+			assign->getVal() = foldExpr(assign->getVal());
+			break;
+		}
+		case ast::CallID:
+		case ast::TaskID:
+			foldExpr(ast);
+			break;
+		case ast::IfStmtID:
+		{
+			auto stmt = static_cast<ast::IfStmtAst*>(ast);
+			stmt->getCond() = foldExpr(stmt->getCond(), false);
+			foldStmts(stmt->getThenStmt());
+			foldStmts(stmt->getElseStmt());
+			if (not IsNumber(stmt->getCond()))
+			{
+				if (stmt->getThenStmt().empty() and stmt->getElseStmt().empty() and IsNum(stmt->getCond()) and CannotTrap(stmt->getCond()))
+				{
+					delete ast;
+					return;
+				}
+				break;
+			}
+			auto& taken = NumOf(stmt->getCond()) ? stmt->getThenStmt() : stmt->getElseStmt();
+			auto& dropped = NumOf(stmt->getCond()) ? stmt->getElseStmt() : stmt->getThenStmt();
+			for (auto& s : dropped) { delete s; }
+			dropped.clear();
+			if (taken.empty())
+			{
+				delete ast;
+				return;
+			}
+			if (not declaresVar(taken))
+			{
+				// no variable would leave the block, so its statements can join the parent
+				res.insert(std::end(res), std::begin(taken), std::end(taken));
+				taken.clear();
+				delete ast;
+				return;
+			}
+			// keep the block for its scope
+			if (&taken != &stmt->getThenStmt()) { std::swap(stmt->getThenStmt(), stmt->getElseStmt()); }
+			delete stmt->getCond();
+			stmt->getCond() = new ast::NumberAst(1);
+			break;
+		}
+		case ast::WhileStmtID:
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+			stmt->getCond() = foldExpr(stmt->getCond(), false);
+			foldStmts(stmt->getLoopStmt());
+			if (IsNumber(stmt->getCond(), 0))
+			{
+				delete ast;
+				return;
+			}
+			break;
+		}
+		case ast::ForStmtID:
+		{
+			auto stmt = static_cast<ast::ForStmtAst*>(ast);
+			auto range = stmt->getRange();
+			range->getFrom() = foldExpr(range->getFrom());
+			range->getTo() = foldExpr(range->getTo());
+			foldStmts(stmt->getStmts());
+			if (IsNumber(range->getFrom()) and IsNumber(range->getTo()) and NumOf(range->getFrom()) >= NumOf(range->getTo()))
+			{
+				delete ast;
+				return;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		res.push_back(ast);
+	}
+
+public:
+	void foldStmts(std::vector<ast::BaseAst*>& stmts)
+	{
+		std::vector<ast::BaseAst*> res{};
+		std::size_t i{};
+		for (; i < stmts.size(); i++)
+		{
+			foldStmt(stmts[i], res);
+			if (not res.empty() and IsTerminator(res.back())) { i++; break; }
+		}
+		// unreachable
+		for (; i < stmts.size(); i++) { delete stmts[i]; }
+		stmts = std::move(res);
+	}
+
+	void run(ast::ModuleAst* ast)
+	{
+		// IsNum reads the types
+		infer::TypeInfer().run(ast);
+		for (auto& func : ast->getFuncs()) { foldStmts(func->getInst()); }
+	}
+};
+
+// ================
+//       loop
+// ================
+
+// Adds every variable `stmts` declares or assigns to `names`.
+inline void CollectWritten(std::vector<ast::BaseAst*>& stmts, std::unordered_set<std::string>& names)
+{
+	for (auto& stmt : stmts)
+	{
+		switch (stmt->getID()) {
+		case ast::BuiltinID:
+		{
+			auto builtin = static_cast<ast::BuiltinAst*>(stmt);
+			if (builtin->getName() != "scanNum" and builtin->getName() != "scanStr") { break; }
+			for (auto& arg : builtin->getArgs())
+			{
+				if (arg->getID() == ast::IdentID) { names.insert(static_cast<ast::IdentAst*>(arg)->getIdent()); }
+			}
+			break;
+		}
+		case ast::AssignID:
+			names.insert(static_cast<ast::AssignAst*>(stmt)->getName());
+			break;
+		case ast::ReAssignID:
+			names.insert(static_cast<ast::ReAssignAst*>(stmt)->getName());
+			break;
+		case ast::IfStmtID:
+			CollectWritten(static_cast<ast::IfStmtAst*>(stmt)->getThenStmt(), names);
+			CollectWritten(static_cast<ast::IfStmtAst*>(stmt)->getElseStmt(), names);
+			break;
+		case ast::WhileStmtID:
+			CollectWritten(static_cast<ast::WhileStmtAst*>(stmt)->getLoopStmt(), names);
+			break;
+		case ast::ForStmtID:
+			names.insert(static_cast<ast::ForStmtAst*>(stmt)->getIdent());
+			CollectWritten(static_cast<ast::ForStmtAst*>(stmt)->getStmts(), names);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Adds every identifier read in `ast` to `names`.
+inline void CollectRead(ast::BaseAst* ast, std::unordered_set<std::string>& names)
+{
+	switch (ast->getID()) {
+	case ast::IdentID:
+		names.insert(static_cast<ast::IdentAst*>(ast)->getIdent());
+		break;
+	case ast::MonoExpID:
+		CollectRead(static_cast<ast::MonoExpAst*>(ast)->getLhs(), names);
+		break;
+	case ast::BinaryExpID:
+		CollectRead(static_cast<ast::BinaryExpAst*>(ast)->getLhs(), names);
+		CollectRead(static_cast<ast::BinaryExpAst*>(ast)->getRhs(), names);
+		break;
+	case ast::TupleID:
+		for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { CollectRead(elm, names); }
+		break;
+	case ast::CallID:
+		for (auto& param : static_cast<ast::CallAst*>(ast)->getParams()) { CollectRead(param, names); }
+		break;
+	case ast::TaskID:
+		for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { CollectRead(arg, names); }
+		break;
+	default:
+		break;
+	}
+}
+
+// Hands out identifiers that do not occur in a function yet.
+class FreshNames {
+	std::unordered_set<std::string> used{};
+	std::size_t counter{};
+public:
+	void reset(ast::FuncAst* func)
+	{
+		used.clear();
+		used.insert(std::begin(func->getParamNames()), std::end(func->getParamNames()));
+		CollectWritten(func->getInst(), used);
+		ForEachExpr(func->getInst(), [&](ast::BaseAst*& expr, bool) { CollectRead(expr, used); });
+	}
+
+	std::string operator()(const std::string& prefix)
+	{
+		std::string name{};
+		do { name = prefix + std::to_string(counter++); } while (used.count(name));
+		used.insert(name);
+		return name;
+	}
+};
+
+// Moves arithmetic that does not change inside a loop in front of it, and strength-reduces
+// `i * c` in for loops into a variable that steps by c each iteration.
+// Hoisted expressions run even when the loop body would not, so only what CannotTrap is hoisted,
+// and a step must be known to be a Num.
+class LoopOptimizer {
+	FreshNames fresh{};
+
+	// state of the loop being optimized
+	std::unordered_set<std::string> written{};
+	std::unordered_map<std::string, std::string> hoisted{};
+	std::vector<ast::BaseAst*>* pre = nullptr;
+
+	// A temporary holds arithmetic, so it is a Num wherever an outer loop looks at it.
+	static ast::BaseAst* numIdent(const std::string& name)
+	{
+		auto res = new ast::IdentAst(name);
+		res->getType() = ast::ValType::Num;
+		return res;
+	}
+
+	bool isInvariant(ast::BaseAst* ast)
+	{
+		switch (ast->getID()) {
+		case ast::NumberID:
+			return true;
+		case ast::IdentID:
+			return not written.count(static_cast<ast::IdentAst*>(ast)->getIdent());
+		case ast::MonoExpID:
+			return isInvariant(static_cast<ast::MonoExpAst*>(ast)->getLhs());
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			const auto& op = bin->getOp();
+			if (op == "IdxAt") { return false; }
+			return isInvariant(bin->getLhs()) and isInvariant(bin->getRhs());
+		}
+		default:
+			return false;
+		}
+	}
+
+	// Replaces the largest invariant subtrees of `ast` with variables declared in `pre`.
+	ast::BaseAst* hoistExpr(ast::BaseAst* ast, bool anyShape)
+	{
+		const auto id = ast->getID();
+		if (anyShape and (id == ast::MonoExpID or id == ast::BinaryExpID) and isInvariant(ast) and CannotTrap(ast))
+		{
+			auto key = ExprKey(ast);
+			if (auto itr = hoisted.find(key); itr != std::end(hoisted))
+			{
+				delete ast;
+				return numIdent(itr->second);
+			}
+			auto name = fresh("_licm");
+			auto decl = new ast::AssignAst(name);
+			decl->getVal() = ast;
+			pre->push_back(decl);
+			hoisted.emplace(std::move(key), name);
+			return numIdent(name);
+		}
+		switch (id) {
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			mono->getLhs() = hoistExpr(mono->getLhs(), true);
+			break;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			bin->getLhs() = hoistExpr(bin->getLhs(), true);
+			bin->getRhs() = hoistExpr(bin->getRhs(), true);
+			break;
+		}
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { elm = hoistExpr(elm, true); }
+			break;
+		case ast::CallID:
+			for (auto& param : static_cast<ast::CallAst*>(ast)->getParams()) { param = hoistExpr(param, true); }
+			break;
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { arg = hoistExpr(arg, true); }
+			break;
+		default:
+			break;
+		}
+		return ast;
+	}
+
+	void hoist(ast::BaseAst* loop, std::vector<ast::BaseAst*>& res)
+	{
+		written.clear();
+		hoisted.clear();
+		pre = &res;
+		if (loop->getID() == ast::WhileStmtID)
+		{
+			auto stmt = static_cast<ast::WhileStmtAst*>(loop);
+			CollectWritten(stmt->getLoopStmt(), written);
+			stmt->getCond() = hoistExpr(stmt->getCond(), false);
+			ForEachExpr(stmt->getLoopStmt(), [&](ast::BaseAst*& expr, bool isCond) { expr = hoistExpr(expr, not isCond); });
+		}
+		else
+		{
+			auto stmt = static_cast<ast::ForStmtAst*>(loop);
+			written.insert(stmt->getIdent());
+			CollectWritten(stmt->getStmts(), written);
+			ForEachExpr(stmt->getStmts(), [&](ast::BaseAst*& expr, bool isCond) { expr = hoistExpr(expr, not isCond); });
+		}
+	}
+
+	// Replaces `i * c` (or `c * i`) with a variable that the loop steps by c.
+	ast::BaseAst* reduceExpr(ast::ForStmtAst* loop, ast::BaseAst* ast, bool anyShape, std::vector<ast::BaseAst*>& steps)
+	{
+		auto isInduction = [&](ast::BaseAst* e)
+		{
+			return e->getID() == ast::IdentID and static_cast<ast::IdentAst*>(e)->getIdent() == loop->getIdent();
+		};
+		auto isStep = [&](ast::BaseAst* e)
+		{
+			return IsNumber(e) or (e->getID() == ast::IdentID and IsNum(e) and not written.count(static_cast<ast::IdentAst*>(e)->getIdent()));
+		};
+		switch (ast->getID()) {
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			mono->getLhs() = reduceExpr(loop, mono->getLhs(), true, steps);
+			break;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			ast::BaseAst* step = nullptr;
+			if (bin->getOp() == "*" and anyShape)
+			{
+				if (isInduction(bin->getLhs()) and isStep(bin->getRhs())) { step = bin->getRhs(); }
+				else if (isInduction(bin->getRhs()) and isStep(bin->getLhs())) { step = bin->getLhs(); }
+			}
+			if (not step)
+			{
+				bin->getLhs() = reduceExpr(loop, bin->getLhs(), true, steps);
+				bin->getRhs() = reduceExpr(loop, bin->getRhs(), true, steps);
+				break;
+			}
+			auto key = ExprKey(step);
+			auto itr = hoisted.find(key);
+			if (itr == std::end(hoisted))
+			{
+				// var d = from * c - c; and d = d + c; on entry to each iteration
+				auto name = fresh("_sr");
+				auto init = new ast::BinaryExpAst("-",
+					new ast::BinaryExpAst("*", CloneExpr(loop->getRange()->getFrom()), CloneExpr(step)), CloneExpr(step));
+				auto decl = new ast::AssignAst(name);
+				decl->getVal() = Folder().foldExpr(init);
+				pre->push_back(decl);
+				auto bump = new ast::ReAssignAst(name);
+				bump->getVal() = new ast::BinaryExpAst("+", new ast::IdentAst(name), CloneExpr(step));
+				steps.push_back(bump);
+				itr = hoisted.emplace(std::move(key), name).first;
+			}
+			delete ast;
+			return numIdent(itr->second);
+		}
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { elm = reduceExpr(loop, elm, true, steps); }
+			break;
+		case ast::CallID:
+			for (auto& param : static_cast<ast::CallAst*>(ast)->getParams()) { param = reduceExpr(loop, param, true, steps); }
+			break;
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { arg = reduceExpr(loop, arg, true, steps); }
+			break;
+		default:
+			break;
+		}
+		return ast;
+	}
+
+	void reduce(ast::ForStmtAst* loop, std::vector<ast::BaseAst*>& res)
+	{
+		written.clear();
+		hoisted.clear();
+		pre = &res;
+		CollectWritten(loop->getStmts(), written);
+		// the body must neither assign nor shadow the induction variable, and `from` is evaluated once more,
+		// before the loop checks it
+		auto from = loop->getRange()->getFrom();
+		if (written.count(loop->getIdent()) or not IsNum(from) or not CannotTrap(from)) { return; }
+		written.insert(loop->getIdent());
+		std::vector<ast::BaseAst*> steps{};
+		ForEachExpr(loop->getStmts(), [&](ast::BaseAst*& expr, bool isCond) { expr = reduceExpr(loop, expr, not isCond, steps); });
+		auto& body = loop->getStmts();
+		body.insert(std::begin(body), std::begin(steps), std::end(steps));
+	}
+
+	void optimizeStmts(std::vector<ast::BaseAst*>& stmts)
+	{
+		std::vector<ast::BaseAst*> res{};
+		for (auto& stmt : stmts)
+		{
+			switch (stmt->getID()) {
+			case ast::IfStmtID:
+				optimizeStmts(static_cast<ast::IfStmtAst*>(stmt)->getThenStmt());
+				optimizeStmts(static_cast<ast::IfStmtAst*>(stmt)->getElseStmt());
+				break;
+			case ast::WhileStmtID:
+				optimizeStmts(static_cast<ast::WhileStmtAst*>(stmt)->getLoopStmt());
+				hoist(stmt, res);
+				break;
+			case ast::ForStmtID:
+				// inner loops first, so what they hoist can move further out
+				optimizeStmts(static_cast<ast::ForStmtAst*>(stmt)->getStmts());
+				hoist(stmt, res);
+				reduce(static_cast<ast::ForStmtAst*>(stmt), res);
+				break;
+			default:
+				break;
+			}
+			res.push_back(stmt);
+		}
+		stmts = std::move(res);
+	}
+
+public:
+	void run(ast::ModuleAst* ast)
+	{
+		// CannotTrap reads the types
+		infer::TypeInfer().run(ast);
+		for (auto& func : ast->getFuncs())
+		{
+			fresh.reset(func);
+			optimizeStmts(func->getInst());
+		}
+	}
+};
+
+// ================
+//      inline
+// ================
+
+inline std::size_t ExprSize(ast::BaseAst* ast)
+{
+	std::size_t res = 1;
+	switch (ast->getID()) {
+	case ast::MonoExpID:
+		res += ExprSize(static_cast<ast::MonoExpAst*>(ast)->getLhs());
+		break;
+	case ast::BinaryExpID:
+		res += ExprSize(static_cast<ast::BinaryExpAst*>(ast)->getLhs());
+		res += ExprSize(static_cast<ast::BinaryExpAst*>(ast)->getRhs());
+		break;
+	case ast::TupleID:
+		for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { res += ExprSize(elm); }
+		break;
+	case ast::CallID:
+		for (auto& param : static_cast<ast::CallAst*>(ast)->getParams()) { res += ExprSize(param); }
+		break;
+	case ast::TaskID:
+		for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { res += ExprSize(arg); }
+		break;
+	default:
+		break;
+	}
+	return res;
+}
+
+// Number of statements and expression nodes in `stmts`.
+inline std::size_t StmtsSize(std::vector<ast::BaseAst*>& stmts)
+{
+	std::size_t res{};
+	ForEachStmt(stmts, [&](ast::BaseAst*) { res++; });
+	ForEachExpr(stmts, [&](ast::BaseAst*& expr, bool) { res += ExprSize(expr); });
+	return res;
+}
+
+inline ast::BaseAst* CloneStmt(ast::BaseAst* ast)
+{
+	auto cloneStmts = [](std::vector<ast::BaseAst*>& from, std::vector<ast::BaseAst*>& to)
+	{
+		for (auto& stmt : from) { to.push_back(CloneStmt(stmt)); }
+	};
+	switch (ast->getID()) {
+	case ast::BuiltinID:
+	{
+		auto builtin = static_cast<ast::BuiltinAst*>(ast);
+		auto res = new ast::BuiltinAst(builtin->getName());
+		for (auto& arg : builtin->getArgs()) { res->getArgs().push_back(CloneExpr(arg)); }
+		return res;
+	}
+	case ast::AssignID:
+	{
+		auto assign = static_cast<ast::AssignAst*>(ast);
+		auto res = new ast::AssignAst(assign->getName());
+		res->getVal() = CloneExpr(assign->getVal());
+		return res;
+	}
+	case ast::ReAssignID:
+	{
+		auto assign = static_cast<ast::ReAssignAst*>(ast);
+		auto res = new ast::ReAssignAst(assign->getName());
+		res->getVal() = CloneExpr(assign->getVal());
+		return res;
+	}
+	case ast::IfStmtID:
+	{
+		auto stmt = static_cast<ast::IfStmtAst*>(ast);
+		auto res = new ast::IfStmtAst();
+		res->getCond() = CloneExpr(stmt->getCond());
+		cloneStmts(stmt->getThenStmt(), res->getThenStmt());
+		cloneStmts(stmt->getElseStmt(), res->getElseStmt());
+		return res;
+	}
+	case ast::WhileStmtID:
+	{
+		auto stmt = static_cast<ast::WhileStmtAst*>(ast);
+		auto res = new ast::WhileStmtAst();
+		res->getCond() = CloneExpr(stmt->getCond());
+		cloneStmts(stmt->getLoopStmt(), res->getLoopStmt());
+		return res;
+	}
+	case ast::ForStmtID:
+	{
+		auto stmt = static_cast<ast::ForStmtAst*>(ast);
+		auto res = new ast::ForStmtAst();
+		res->getIdent() = stmt->getIdent();
+		res->Range = new ast::RangeAst();
+		res->Range->getFrom() = CloneExpr(stmt->getRange()->getFrom());
+		res->Range->getTo() = CloneExpr(stmt->getRange()->getTo());
+		cloneStmts(stmt->getStmts(), res->getStmts());
+		return res;
+	}
+	default:
+		return CloneExpr(ast);
+	}
+}
+
+// Substitutes inlined functions' bodies for calls to them.
+// A function whose body is `return E;` is inlined into any expression, with its parameters
+// replaced by the arguments; a call statement `f(a, b);` of a larger function becomes
+// `if 1 { var p = a; var q = b; ... }` with the body's variables renamed apart.
+// Recursive and memoized functions are never inlined, nor bodies above the size threshold.
+class Inliner {
+	EvalOption option;
+	std::unordered_map<std::string, ast::FuncAst*> funcs{};
+	std::unordered_set<ast::FuncAst*> recursive{};
+	FreshNames fresh{};
+	ast::FuncAst* current = nullptr;
+
+	void note(const std::string& msg)
+	{
+		if (option.InlineReport) { std::cerr << "inline: fn " << current->getName() << ": " << msg << std::endl; }
+	}
+
+	bool isFunc(const std::string& name) const { return funcs.find(name) != std::end(funcs); }
+
+	// Adds the functions called in `ast` to `names`.
+	void collectCalls(ast::BaseAst* ast, std::unordered_set<std::string>& names)
+	{
+		switch (ast->getID()) {
+		case ast::MonoExpID:
+			collectCalls(static_cast<ast::MonoExpAst*>(ast)->getLhs(), names);
+			break;
+		case ast::BinaryExpID:
+			collectCalls(static_cast<ast::BinaryExpAst*>(ast)->getLhs(), names);
+			collectCalls(static_cast<ast::BinaryExpAst*>(ast)->getRhs(), names);
+			break;
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { collectCalls(elm, names); }
+			break;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			if (isFunc(call->getFuncName())) { names.insert(call->getFuncName()); }
+			for (auto& param : call->getParams()) { collectCalls(param, names); }
+			break;
+		}
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { collectCalls(arg, names); }
+			break;
+		default:
+			break;
+		}
+	}
+
+	std::unordered_set<std::string> callees(ast::FuncAst* func)
+	{
+		std::unordered_set<std::string> res{};
+		ForEachStmt(func->getInst(), [&](ast::BaseAst* stmt)
+		{
+			if (stmt->getID() == ast::CallID and isFunc(static_cast<ast::CallAst*>(stmt)->getFuncName()))
+			{
+				res.insert(static_cast<ast::CallAst*>(stmt)->getFuncName());
+			}
+		});
+		ForEachExpr(func->getInst(), [&](ast::BaseAst*& expr, bool) { collectCalls(expr, res); });
+		return res;
+	}
+
+	// Functions in callee-first order; functions on a call cycle go to `recursive`.
+	std::vector<ast::FuncAst*> order(ast::ModuleAst* ast)
+	{
+		std::unordered_map<ast::FuncAst*, std::unordered_set<std::string>> graph{};
+		for (auto& func : ast->getFuncs()) { graph[func] = callees(func); }
+		for (auto& func : ast->getFuncs())
+		{
+			// func is recursive when it can reach itself
+			std::unordered_set<ast::FuncAst*> seen{};
+			std::vector<ast::FuncAst*> todo{func};
+			while (not todo.empty() and not recursive.count(func))
+			{
+				auto cur = todo.back();
+				todo.pop_back();
+				for (const auto& name : graph[cur])
+				{
+					auto next = funcs[name];
+					if (next == func) { recursive.insert(func); }
+					if (seen.insert(next).second) { todo.push_back(next); }
+				}
+			}
+		}
+		std::vector<ast::FuncAst*> res{};
+		std::unordered_set<ast::FuncAst*> done{};
+		auto visit = [&](auto& self, ast::FuncAst* func) -> void
+		{
+			if (not done.insert(func).second) { return; }
+			for (const auto& name : graph[func]) { self(self, funcs[name]); }
+			res.push_back(func);
+		};
+		for (auto& func : ast->getFuncs()) { visit(visit, func); }
+		return res;
+	}
+
+	// The callee of `call` when it may be inlined at all.
+	ast::FuncAst* candidate(ast::CallAst* call)
+	{
+		auto itr = funcs.find(call->getFuncName());
+		if (itr == std::end(funcs)) { return nullptr; }
+		auto callee = itr->second;
+		if (callee == current or recursive.count(callee))
+		{
+			note(callee->getName() + " not inlined (recursive)");
+			return nullptr;
+		}
+		if (callee->getIsMemo() or option.MemoAll)
+		{
+			note(callee->getName() + " not inlined (memoized)");
+			return nullptr;
+		}
+		if (callee->getParamNames().size() != call->getParams().size()) { return nullptr; }
+		return callee;
+	}
+
+	// Whether every variable `ast` reads is in `names`.
+	bool readsOnly(ast::BaseAst* ast, const std::unordered_set<std::string>& names)
+	{
+		switch (ast->getID()) {
+		case ast::IdentID:
+			return names.count(static_cast<ast::IdentAst*>(ast)->getIdent());
+		case ast::MonoExpID:
+			return readsOnly(static_cast<ast::MonoExpAst*>(ast)->getLhs(), names);
+		case ast::BinaryExpID:
+			return readsOnly(static_cast<ast::BinaryExpAst*>(ast)->getLhs(), names)
+				and readsOnly(static_cast<ast::BinaryExpAst*>(ast)->getRhs(), names);
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary)
+			{
+				if (not readsOnly(elm, names)) { return false; }
+			}
+			return true;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			// x(i) indexes the variable x
+			if (not isFunc(call->getFuncName()) and not names.count(call->getFuncName())) { return false; }
+			for (auto& param : call->getParams())
+			{
+				if (not readsOnly(param, names)) { return false; }
+			}
+			return true;
+		}
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs())
+			{
+				if (not readsOnly(arg, names)) { return false; }
+			}
+			return true;
+		default:
+			return true;
+		}
+	}
+
+	// Whether every evaluation of `ast` reads `name`; the rhs of && and || may be skipped.
+	static bool alwaysReads(ast::BaseAst* ast, const std::string& name)
+	{
+		switch (ast->getID()) {
+		case ast::IdentID:
+			return static_cast<ast::IdentAst*>(ast)->getIdent() == name;
+		case ast::MonoExpID:
+			return alwaysReads(static_cast<ast::MonoExpAst*>(ast)->getLhs(), name);
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			if (alwaysReads(bin->getLhs(), name)) { return true; }
+			return bin->getOp() != "&&" and bin->getOp() != "||" and alwaysReads(bin->getRhs(), name);
+		}
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary)
+			{
+				if (alwaysReads(elm, name)) { return true; }
+			}
+			return false;
+		default:
+			return false;
+		}
+	}
+
+	// Copy of `ast` with parameters replaced by arguments.
+	ast::BaseAst* substitute(ast::BaseAst* ast, const std::unordered_map<std::string, ast::BaseAst*>& args)
+	{
+		switch (ast->getID()) {
+		case ast::IdentID:
+			if (auto itr = args.find(static_cast<ast::IdentAst*>(ast)->getIdent()); itr != std::end(args))
+			{
+				return CloneExpr(itr->second);
+			}
+			return CloneExpr(ast);
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			return new ast::MonoExpAst(mono->getOp(), substitute(mono->getLhs(), args));
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			return new ast::BinaryExpAst(bin->getOp(), substitute(bin->getLhs(), args), substitute(bin->getRhs(), args));
+		}
+		case ast::TupleID:
+		{
+			std::vector<ast::BaseAst*> ary{};
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { ary.push_back(substitute(elm, args)); }
+			return new ast::TupleAst(ary);
+		}
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			auto res = new ast::CallAst(call->getFuncName());
+			if (auto itr = args.find(call->getFuncName()); itr != std::end(args) and not isFunc(call->getFuncName()))
+			{
+				res->getFuncName() = static_cast<ast::IdentAst*>(itr->second)->getIdent();
+			}
+			for (auto& param : call->getParams()) { res->getParams().push_back(substitute(param, args)); }
+			return res;
+		}
+		case ast::TaskID:
+		{
+			auto task = static_cast<ast::TaskAst*>(ast);
+			auto res = new ast::TaskAst(task->getOp(), substitute(task->getArgs().front(), args));
+			for (std::size_t i = 1; i < task->getArgs().size(); i++) { res->getArgs().push_back(substitute(task->getArgs()[i], args)); }
+			return res;
+		}
+		default:
+			return CloneExpr(ast);
+		}
+	}
+
+	// Number of times `ast` reads `name`; `asTuple` is set when it is indexed.
+	std::size_t uses(ast::BaseAst* ast, const std::string& name, bool& asTuple)
+	{
+		std::size_t res{};
+		switch (ast->getID()) {
+		case ast::IdentID:
+			return static_cast<ast::IdentAst*>(ast)->getIdent() == name;
+		case ast::MonoExpID:
+			return uses(static_cast<ast::MonoExpAst*>(ast)->getLhs(), name, asTuple);
+		case ast::BinaryExpID:
+			return uses(static_cast<ast::BinaryExpAst*>(ast)->getLhs(), name, asTuple)
+				+ uses(static_cast<ast::BinaryExpAst*>(ast)->getRhs(), name, asTuple);
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { res += uses(elm, name, asTuple); }
+			return res;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			if (call->getFuncName() == name and not isFunc(name))
+			{
+				asTuple = true;
+				res++;
+			}
+			for (auto& param : call->getParams()) { res += uses(param, name, asTuple); }
+			return res;
+		}
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { res += uses(arg, name, asTuple); }
+			return res;
+		default:
+			return 0;
+		}
+	}
+
+	// The inlined form of an expression call, or nullptr.
+	ast::BaseAst* inlineCall(ast::CallAst* call, bool anyShape)
+	{
+		auto callee = candidate(call);
+		if (not callee) { return nullptr; }
+		auto& body = callee->getInst();
+		if (body.size() != 1 or body.front()->getID() != ast::BuiltinID
+			or static_cast<ast::BuiltinAst*>(body.front())->getName() != "return")
+		{
+			note(callee->getName() + " not inlined into an expression (body is not a single return)");
+			return nullptr;
+		}
+		auto ret = static_cast<ast::BuiltinAst*>(body.front())->getArgs().front();
+		const auto size = ExprSize(ret);
+		if (size > option.InlineThreshold)
+		{
+			note(callee->getName() + " not inlined (size " + std::to_string(size) + " > " + std::to_string(option.InlineThreshold) + ")");
+			return nullptr;
+		}
+		const auto& paramNames = callee->getParamNames();
+		if (not readsOnly(ret, std::unordered_set<std::string>(std::begin(paramNames), std::end(paramNames)))) { return nullptr; }
+
+		std::unordered_map<std::string, ast::BaseAst*> args{};
+		for (std::size_t i{}; i < paramNames.size(); i++)
+		{
+			auto arg = call->getParams()[i];
+			bool asTuple = false;
+			const auto count = uses(ret, paramNames[i], asTuple);
+			const bool atom = arg->getID() == ast::NumberID or arg->getID() == ast::StringID or arg->getID() == ast::IdentID;
+			// arguments are evaluated exactly once by a call; a substituted one as often as it is used,
+			// so one that may fail must be read every time, with no call that could print before it
+			const char* why = not IsPureExpr(arg) ? "has calls"
+				: asTuple and arg->getID() != ast::IdentID ? "is indexed"
+				: not atom and count > 1 ? "is used more than once"
+				: not CannotTrap(arg) and not (IsPureExpr(ret) and alwaysReads(ret, paramNames[i])) ? "may fail"
+				: nullptr;
+			if (why)
+			{
+				note(callee->getName() + " not inlined (argument " + std::to_string(i + 1) + ' ' + why + ")");
+				return nullptr;
+			}
+			args.emplace(paramNames[i], arg);
+		}
+		auto res = substitute(ret, args);
+		if (not anyShape and not IsNumShaped(res))
+		{
+			delete res;
+			return nullptr;
+		}
+		note(callee->getName() + " inlined (size " + std::to_string(size) + ")");
+		delete call;
+		return res;
+	}
+
+	ast::BaseAst* inlineExpr(ast::BaseAst* ast, bool anyShape)
+	{
+		switch (ast->getID()) {
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			mono->getLhs() = inlineExpr(mono->getLhs(), true);
+			break;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			bin->getLhs() = inlineExpr(bin->getLhs(), true);
+			bin->getRhs() = inlineExpr(bin->getRhs(), true);
+			break;
+		}
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { elm = inlineExpr(elm, true); }
+			break;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			for (auto& param : call->getParams()) { param = inlineExpr(param, true); }
+			if (auto res = inlineCall(call, anyShape)) { return res; }
+			break;
+		}
+		case ast::TaskID:
+		{
+			auto task = static_cast<ast::TaskAst*>(ast);
+			if (task->getOp() != "spawn")
+			{
+				for (auto& arg : task->getArgs()) { arg = inlineExpr(arg, true); }
+				break;
+			}
+			// the spawned call itself has to stay a call
+			for (auto& param : static_cast<ast::CallAst*>(task->getArgs().front())->getParams()) { param = inlineExpr(param, true); }
+			break;
+		}
+		default:
+			break;
+		}
+		return ast;
+	}
+
+	// break / continue outside of a loop, or return before the end of the body
+	static bool leavesEarly(std::vector<ast::BaseAst*>& stmts, bool inLoop)
+	{
+		for (auto& stmt : stmts)
+		{
+			switch (stmt->getID()) {
+			case ast::BuiltinID:
+			{
+				const auto& name = static_cast<ast::BuiltinAst*>(stmt)->getName();
+				if (name == "return" or (not inLoop and (name == "break" or name == "continue"))) { return true; }
+				break;
+			}
+			case ast::IfStmtID:
+				if (leavesEarly(static_cast<ast::IfStmtAst*>(stmt)->getThenStmt(), inLoop)
+					or leavesEarly(static_cast<ast::IfStmtAst*>(stmt)->getElseStmt(), inLoop))
+				{
+					return true;
+				}
+				break;
+			case ast::WhileStmtID:
+				if (leavesEarly(static_cast<ast::WhileStmtAst*>(stmt)->getLoopStmt(), true)) { return true; }
+				break;
+			case ast::ForStmtID:
+				if (leavesEarly(static_cast<ast::ForStmtAst*>(stmt)->getStmts(), true)) { return true; }
+				break;
+			default:
+				break;
+			}
+		}
+		return false;
+	}
+
+	void rename(ast::BaseAst*& ast, const std::unordered_map<std::string, std::string>& names)
+	{
+		auto renamed = [&](std::string& name)
+		{
+			if (auto itr = names.find(name); itr != std::end(names)) { name = itr->second; }
+		};
+		switch (ast->getID()) {
+		case ast::IdentID:
+			renamed(static_cast<ast::IdentAst*>(ast)->getIdent());
+			break;
+		case ast::MonoExpID:
+			rename(static_cast<ast::MonoExpAst*>(ast)->getLhs(), names);
+			break;
+		case ast::BinaryExpID:
+			rename(static_cast<ast::BinaryExpAst*>(ast)->getLhs(), names);
+			rename(static_cast<ast::BinaryExpAst*>(ast)->getRhs(), names);
+			break;
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { rename(elm, names); }
+			break;
+		case ast::CallID:
+		{
+			auto call = static_cast<ast::CallAst*>(ast);
+			if (not isFunc(call->getFuncName())) { renamed(call->getFuncName()); }
+			for (auto& param : call->getParams()) { rename(param, names); }
+			break;
+		}
+		case ast::TaskID:
+			for (auto& arg : static_cast<ast::TaskAst*>(ast)->getArgs()) { rename(arg, names); }
+			break;
+		default:
+			break;
+		}
+	}
+
+	void renameStmts(std::vector<ast::BaseAst*>& stmts, const std::unordered_map<std::string, std::string>& names)
+	{
+		auto renamed = [&](std::string& name)
+		{
+			if (auto itr = names.find(name); itr != std::end(names)) { name = itr->second; }
+		};
+		ForEachStmt(stmts, [&](ast::BaseAst* stmt)
+		{
+			switch (stmt->getID()) {
+			case ast::AssignID:
+				renamed(static_cast<ast::AssignAst*>(stmt)->getName());
+				break;
+			case ast::ReAssignID:
+				renamed(static_cast<ast::ReAssignAst*>(stmt)->getName());
+				break;
+			case ast::ForStmtID:
+				renamed(static_cast<ast::ForStmtAst*>(stmt)->getIdent());
+				break;
+			case ast::BuiltinID:
+			{
+				// ForEachExpr leaves out the variables of scanNum / scanStr
+				auto builtin = static_cast<ast::BuiltinAst*>(stmt);
+				if (builtin->getName() != "scanNum" and builtin->getName() != "scanStr") { break; }
+				for (auto& arg : builtin->getArgs()) { rename(arg, names); }
+				break;
+			}
+			case ast::CallID:
+				if (not isFunc(static_cast<ast::CallAst*>(stmt)->getFuncName())) { renamed(static_cast<ast::CallAst*>(stmt)->getFuncName()); }
+				break;
+			default:
+				break;
+			}
+		});
+		ForEachExpr(stmts, [&](ast::BaseAst*& expr, bool) { rename(expr, names); });
+	}
+
+	// The inlined form of a call statement, or nullptr.
+	ast::BaseAst* inlineCallStmt(ast::CallAst* call)
+	{
+		auto callee = candidate(call);
+		if (not callee) { return nullptr; }
+		auto& body = callee->getInst();
+		const auto size = StmtsSize(body);
+		if (size > option.InlineThreshold)
+		{
+			note(callee->getName() + " not inlined (size " + std::to_string(size) + " > " + std::to_string(option.InlineThreshold) + ")");
+			return nullptr;
+		}
+		auto end = std::end(body);
+		ast::BaseAst* ret = nullptr;
+		if (not body.empty() and body.back()->getID() == ast::BuiltinID and static_cast<ast::BuiltinAst*>(body.back())->getName() == "return")
+		{
+			ret = static_cast<ast::BuiltinAst*>(body.back())->getArgs().front();
+			end--;
+		}
+		std::vector<ast::BaseAst*> stmts(std::begin(body), end);
+		// the result is dropped, so only a final call has to stay
+		if ((ret and not IsPureExpr(ret) and ret->getID() != ast::CallID) or leavesEarly(stmts, false))
+		{
+			note(callee->getName() + " not inlined (returns early)");
+			return nullptr;
+		}
+
+		// the body's own variables are renamed apart from the caller's
+		std::unordered_set<std::string> own(std::begin(callee->getParamNames()), std::end(callee->getParamNames()));
+		ForEachStmt(stmts, [&](ast::BaseAst* stmt)
+		{
+			if (stmt->getID() == ast::AssignID) { own.insert(static_cast<ast::AssignAst*>(stmt)->getName()); }
+			if (stmt->getID() == ast::ForStmtID) { own.insert(static_cast<ast::ForStmtAst*>(stmt)->getIdent()); }
+		});
+		std::unordered_set<std::string> touched{};
+		CollectWritten(stmts, touched);
+		bool closed = true;
+		for (const auto& name : touched) { closed = closed and own.count(name); }
+		ForEachExpr(stmts, [&](ast::BaseAst*& expr, bool) { closed = closed and readsOnly(expr, own); });
+		if (not closed) { return nullptr; }
+
+		std::unordered_map<std::string, std::string> names{};
+		for (const auto& name : own) { names.emplace(name, fresh("_" + name)); }
+		auto block = new ast::IfStmtAst();
+		block->getCond() = new ast::NumberAst(1);
+		auto& res = block->getThenStmt();
+		for (std::size_t i{}; i < call->getParams().size(); i++)
+		{
+			auto param = new ast::AssignAst(names.at(callee->getParamNames()[i]));
+			param->getVal() = call->getParams()[i];
+			res.push_back(param);
+		}
+		call->getParams().clear();
+		for (auto& stmt : stmts) { res.push_back(CloneStmt(stmt)); }
+		if (ret and ret->getID() == ast::CallID) { res.push_back(CloneExpr(ret)); }
+		else if (ret and not CannotTrap(ret))
+		{
+			// the result is unused, but evaluating it may fail
+			auto keep = new ast::AssignAst(fresh("_ret"));
+			keep->getVal() = CloneExpr(ret);
+			res.push_back(keep);
+		}
+
+		std::vector<ast::BaseAst*> copied(std::begin(res) + callee->getParamNames().size(), std::end(res));
+		renameStmts(copied, names);
+		note(callee->getName() + " inlined as a block (size " + std::to_string(size) + ")");
+		delete call;
+		return block;
+	}
+
+	void inlineStmts(std::vector<ast::BaseAst*>& stmts)
+	{
+		for (auto& stmt : stmts)
+		{
+			switch (stmt->getID()) {
+			case ast::CallID:
+			{
+				auto call = static_cast<ast::CallAst*>(stmt);
+				for (auto& param : call->getParams()) { param = inlineExpr(param, true); }
+				if (auto res = inlineCallStmt(call)) { stmt = res; }
+				break;
+			}
+			case ast::IfStmtID:
+			{
+				auto ifStmt = static_cast<ast::IfStmtAst*>(stmt);
+				ifStmt->getCond() = inlineExpr(ifStmt->getCond(), false);
+				inlineStmts(ifStmt->getThenStmt());
+				inlineStmts(ifStmt->getElseStmt());
+				break;
+			}
+			case ast::WhileStmtID:
+			{
+				auto whileStmt = static_cast<ast::WhileStmtAst*>(stmt);
+				whileStmt->getCond() = inlineExpr(whileStmt->getCond(), false);
+				inlineStmts(whileStmt->getLoopStmt());
+				break;
+			}
+			case ast::ForStmtID:
+			{
+				auto forStmt = static_cast<ast::ForStmtAst*>(stmt);
+				forStmt->getRange()->getFrom() = inlineExpr(forStmt->getRange()->getFrom(), true);
+				forStmt->getRange()->getTo() = inlineExpr(forStmt->getRange()->getTo(), true);
+				inlineStmts(forStmt->getStmts());
+				break;
+			}
+			default:
+			{
+				// the remaining statements hold expressions only at the top
+				std::vector<ast::BaseAst*> single{stmt};
+				ForEachExpr(single, [&](ast::BaseAst*& expr, bool) { expr = inlineExpr(expr, true); });
+				break;
+			}
+			}
+		}
+	}
+
+public:
+	Inliner(const EvalOption& option) : option(option) {}
+
+	void run(ast::ModuleAst* ast)
+	{
+		// CannotTrap reads the types
+		infer::TypeInfer().run(ast);
+		for (auto& func : ast->getFuncs()) { funcs.emplace(func->getName(), func); }
+		for (auto& func : order(ast))
+		{
+			current = func;
+			fresh.reset(func);
+			inlineStmts(func->getInst());
+		}
+	}
+};
+
+// ================
+//     pipeline
+// ================
+
+// -O1: constant folding and dead-code elimination
+// -O2: -O1, inlining and loop optimizations
+class Optimizer {
+	int level;
+	EvalOption option;
+public:
+	Optimizer(int level, const EvalOption& option = EvalOption{}) : level(level), option(option) {}
+
+	void run(ast::ModuleAst* ast)
+	{
+		if (level >= 1) { Folder().run(ast); }
+		if (level >= 2)
+		{
+			Inliner(option).run(ast);
+			// arguments substituted into bodies may fold further
+			Folder().run(ast);
+			LoopOptimizer().run(ast);
+		}
+	}
+};
+
+} // namespace opt
+} // namespace Noh
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Noh {
+
+struct EvalOption {
+	bool MemoAll = false;
+	std::size_t MemoCapacity = 1 << 16;
+	std::size_t MaxDepth = 1 << 20;
+	std::size_t InlineThreshold = 24;
+	bool InlineReport = false;
+	bool Jit = true;
+	std::size_t JitThreshold = 64;
+	bool Fuse = true;
+	bool ProfileOps = false;
+	bool AutoPar = false;
+	std::size_t ParThreshold = 32;
+	std::size_t ParThreads = 0; // 0: one per hardware thread
+	std::size_t Workers = 0; // threads running tasks; 0: one per hardware thread
+	bool EachRecord = false;
+	std::string RecordSep = "\n";
+	std::string RecordFn = "row";
+	std::size_t RecordThreads = 1; // 0: one per hardware thread
+	std::size_t ServeThreads = 0; // 0: one per hardware thread
+	std::size_t CacheSize = 64; // compiled modules kept by --serve and --batch
+	std::size_t BatchThreads = 1; // 0: one per hardware thread
+	bool LazyParse = false; // parse only the functions the run can reach
+	// 0: no limit
+	std::uint64_t MaxSteps = 0;
+	std::size_t TimeoutMs = 0;
+	std::size_t MaxMemoryMB = 0;
+};
+
+} // namespace Noh
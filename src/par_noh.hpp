@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Noh {
+namespace par {
+
+// A fork-join pool with work stealing. Every thread owns a deque: it pushes and pops its own
+// tasks at the back, and a thread that runs out of work steals the oldest task of another.
+// Thread 0 is the one that created the pool; it takes part whenever it waits in join().
+class Pool {
+public:
+	// gets the index of the thread that runs it
+	using Fn = std::function<void(std::size_t)>;
+
+	struct Task {
+		Fn Run;
+		std::atomic<bool> Done{false};
+	};
+
+private:
+	struct Queue {
+		std::mutex M;
+		std::deque<std::shared_ptr<Task>> Tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> threads;
+	std::atomic<std::size_t> queued{0};
+	std::atomic<bool> stopping{false};
+	std::mutex idleM;
+	std::condition_variable idle;
+
+	static std::size_t& self()
+	{
+		static thread_local std::size_t idx = 0;
+		return idx;
+	}
+
+	std::shared_ptr<Task> take(std::size_t me)
+	{
+		{
+			auto& own = *queues[me];
+			std::lock_guard<std::mutex> lock(own.M);
+			if (not own.Tasks.empty())
+			{
+				auto task = std::move(own.Tasks.back());
+				own.Tasks.pop_back();
+				return task;
+			}
+		}
+		for (std::size_t k = 1; k < queues.size(); k++)
+		{
+			auto& other = *queues[(me + k) % queues.size()];
+			std::lock_guard<std::mutex> lock(other.M);
+			if (not other.Tasks.empty())
+			{
+				auto task = std::move(other.Tasks.front());
+				other.Tasks.pop_front();
+				return task;
+			}
+		}
+		return nullptr;
+	}
+
+	// Runs one queued task on this thread; false if there was none.
+	bool runOne(std::size_t me)
+	{
+		auto task = take(me);
+		if (not task) { return false; }
+		queued--;
+		task->Run(me);
+		task->Done.store(true, std::memory_order_release);
+		return true;
+	}
+
+	void work(std::size_t me)
+	{
+		self() = me;
+		while (not stopping)
+		{
+			if (runOne(me)) { continue; }
+			std::unique_lock<std::mutex> lock(idleM);
+			idle.wait_for(lock, std::chrono::milliseconds(1), [&]() { return stopping or queued > 0; });
+		}
+	}
+
+public:
+	// `size` threads in all, the calling one included
+	Pool(std::size_t size)
+	{
+		if (size == 0) { size = 1; }
+		for (std::size_t i{}; i < size; i++) { queues.push_back(std::make_unique<Queue>()); }
+		self() = 0;
+		for (std::size_t i = 1; i < size; i++) { threads.emplace_back([this, i]() { work(i); }); }
+	}
+
+	~Pool()
+	{
+		stopping = true;
+		idle.notify_all();
+		for (auto& thread : threads) { thread.join(); }
+	}
+
+	std::size_t size() const { return queues.size(); }
+
+	// tasks spawned but not started yet
+	std::size_t pending() const { return queued.load(std::memory_order_relaxed); }
+
+	std::shared_ptr<Task> spawn(Fn fn)
+	{
+		auto task = std::make_shared<Task>();
+		task->Run = std::move(fn);
+		{
+			auto& own = *queues[self()];
+			std::lock_guard<std::mutex> lock(own.M);
+			own.Tasks.push_back(task);
+		}
+		queued++;
+		idle.notify_one();
+		return task;
+	}
+
+	// Waits for `task`, running queued tasks meanwhile; usually the first one is `task` itself.
+	void join(const Task& task)
+	{
+		const auto me = self();
+		while (not task.Done.load(std::memory_order_acquire))
+		{
+			if (not runOne(me)) { std::this_thread::yield(); }
+		}
+	}
+};
+
+} // namespace par
+} // namespace Noh
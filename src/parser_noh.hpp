@@ -19,6 +19,7 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 	qi::rule <Iterator, std::string()> _String;
 	qi::rule <Iterator, ast::BaseAst*(), Skipper> StrExpr;
 	qi::rule <Iterator, ast::FuncAst*(), Skipper> Func;
+	qi::rule <Iterator, std::string(), Skipper> Import;
 	qi::rule <Iterator, ast::CallAst*(), Skipper> Call;
 	qi::rule <Iterator, ast::ModuleAst*(), Skipper> Module;
 	qi::rule <Iterator, ast::BaseAst*(), Skipper> Stmt;
@@ -30,6 +31,8 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 	qi::rule <Iterator, ast::RangeAst*(), Skipper> Range;
 	qi::rule <Iterator, ast::ForStmtAst*(), Skipper> ForStmt;
 	qi::rule <Iterator, std::vector<ast::BaseAst*>(), Skipper> Stmts;
+	qi::rule <Iterator> WordEnd;
+	qi::rule <Iterator, ast::TaskAst*(), Skipper> Task;
 	qi::rule <Iterator, ast::BaseAst*(), Skipper> Factor;
 	qi::rule <Iterator, ast::BaseAst*(), Skipper> NumExpr, E1, E2, E3, E4, E5;
 	qi::rule <Iterator, std::vector<ast::BaseAst*>(), Skipper> _TupleExpr;
@@ -38,7 +41,10 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 
 	Calc() : Calc::base_type(Module)
 	{
-		Module = qi::eps[_val = ph::new_<ast::ModuleAst>()] >> *(Func[ph::push_back(ph::at_c<0>(*_val), _1)]);
+		Module = qi::eps[_val = ph::new_<ast::ModuleAst>()]
+			>> *(Func[ph::push_back(ph::at_c<0>(*_val), _1)] | Import[ph::push_back(ph::at_c<1>(*_val), _1)]);
+
+		Import = qi::lexeme["import" >> WordEnd] >> _String[_val = _1] >> ';';
 
 		Ident = qi::lexeme[(qi::alpha | qi::char_('_'))[_val = _1] >> *((qi::alnum | qi::char_('_'))[_val += _1])];
 
@@ -56,7 +62,8 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 
 		Range = Expr[_val = ph::new_<ast::RangeAst>(), ph::at_c<0>(*_val) = _1] >> ".." >> Expr[ph::at_c<1>(*_val) = _1];
 
-		Func = "fn" >> Ident[_val = ph::new_<ast::FuncAst>(_1)]
+		Func = (("memo" >> qi::lit("fn") >> Ident[_val = ph::new_<ast::FuncAst>(_1), ph::at_c<3>(*_val) = true])
+				| ("fn" >> Ident[_val = ph::new_<ast::FuncAst>(_1)]))
 			>> '(' >> -(Ident[ph::push_back(ph::at_c<1>(*_val), _1)] >> *(',' >> Ident[ph::push_back(ph::at_c<1>(*_val), _1)])) >> ')'
 			>> '{' >> *Stmt[ph::push_back(ph::at_c<2>(*_val), _1)] >> '}';
 
@@ -64,7 +71,18 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 			>> '(' >> -(Expr[ph::push_back(ph::at_c<1>(*_val), _1)]
 			>> *(',' >> Expr[ph::push_back(ph::at_c<1>(*_val), _1)])) >> ')';
 
-		Stmt = Builtin | IfStmt | WhileStmt | ForStmt | Assign | ReAssign | (Call >> ';');
+		Stmt = Builtin | IfStmt | WhileStmt | ForStmt | Assign | ReAssign | (Task >> ';') | (Call >> ';');
+
+		// keeps keywords from matching the start of a longer identifier
+		WordEnd = !(qi::alnum | qi::char_('_'));
+
+		Task =
+			 (qi::lexeme["spawn" >> WordEnd] >> Call[_val = ph::new_<ast::TaskAst>("spawn", _1)])
+			| (qi::lexeme["await" >> WordEnd] >> Factor[_val = ph::new_<ast::TaskAst>("await", _1)])
+			| (qi::lexeme["chan" >> WordEnd] >> '(' >> Expr[_val = ph::new_<ast::TaskAst>("chan", _1)] >> ')')
+			| (qi::lexeme["recv" >> WordEnd] >> '(' >> Expr[_val = ph::new_<ast::TaskAst>("recv", _1)] >> ')')
+			| (qi::lexeme["send" >> WordEnd] >> '(' >> Expr[_val = ph::new_<ast::TaskAst>("send", _1)]
+				>> ',' >> Expr[ph::push_back(ph::at_c<1>(*_val), _1)] >> ')');
 
 		Builtin =
 			 (("break" >> qi::eps[_val = ph::new_<ast::BuiltinAst>("break")])
@@ -97,6 +115,7 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 			>> '{' >> *Stmt[ph::push_back(ph::at_c<2>(*_val), _1)] >> '}';
 
 		Factor = qi::int_[_val = ph::new_<ast::NumberAst>(_1)]
+			| Task[_val = _1]
 			| Call[_val = _1]
 			| Ident[_val = ph::new_<ast::IdentAst>(_1)]
 			| '(' >> NumExpr[_val = _1] >> ')';
@@ -132,5 +151,21 @@ struct Calc : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
 	}
 };
 
+// One input of --repl: its top-level statements, in order, as the body of the first function,
+// which has no name, followed by the functions it defines.
+template<class Iterator, class Skipper>
+struct Line : qi::grammar<Iterator, ast::ModuleAst*(), Skipper> {
+	Calc<Iterator, Skipper> calc;
+	qi::rule <Iterator, ast::ModuleAst*(), Skipper> Input;
+
+	Line() : Line::base_type(Input)
+	{
+		Input = qi::eps[_val = ph::new_<ast::ModuleAst>(), ph::push_back(ph::at_c<0>(*_val), ph::new_<ast::FuncAst>(std::string()))]
+			>> *(calc.Func[ph::push_back(ph::at_c<0>(*_val), _1)]
+				| calc.Import[ph::push_back(ph::at_c<1>(*_val), _1)]
+				| calc.Stmt[ph::push_back(ph::at_c<2>(*ph::front(ph::at_c<0>(*_val))), _1)]);
+	}
+};
+
 } // namespace parser
 } // namespace Noh
\ No newline at end of file
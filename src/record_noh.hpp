@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bytecode_noh.hpp"
+#include "option_noh.hpp"
+#include "par_noh.hpp"
+#include "vm_noh.hpp"
+
+namespace Noh {
+namespace record {
+
+// Replaces the escapes \n, \t, \0 and \\ of a separator given on the command line.
+inline std::string Unescape(const std::string& str)
+{
+	std::string res{};
+	for (std::size_t i{}; i < str.size(); i++)
+	{
+		if (str[i] != '\\' or i + 1 == str.size())
+		{
+			res += str[i];
+			continue;
+		}
+		switch (str[++i]) {
+		case 'n': res += '\n'; break;
+		case 't': res += '\t'; break;
+		case '0': res += '\0'; break;
+		default: res += str[i];
+		}
+	}
+	return res;
+}
+
+// Splits standard input into records, read in large blocks.
+class Reader {
+	std::string sep;
+	std::string buf{};
+	std::size_t pos = 0;
+	bool eof = false;
+
+	void fill()
+	{
+		buf.erase(0, pos);
+		pos = 0;
+		char block[1 << 16];
+		const auto len = std::fread(block, 1, sizeof(block), stdin);
+		if (len == 0) { eof = true; }
+		buf.append(block, len);
+	}
+
+public:
+	Reader(const std::string& sep) : sep(sep) {}
+
+	// false once the input is exhausted; a last record without a separator still counts
+	bool next(std::string& rec)
+	{
+		while (true)
+		{
+			const auto at = buf.find(sep, pos);
+			if (at != std::string::npos)
+			{
+				rec.assign(buf, pos, at - pos);
+				pos = at + sep.size();
+				return true;
+			}
+			if (eof)
+			{
+				if (pos == buf.size()) { return false; }
+				rec.assign(buf, pos, std::string::npos);
+				pos = buf.size();
+				return true;
+			}
+			fill();
+		}
+	}
+};
+
+// --each-line / --each-record: calls the record function, `fn row(line)` or
+// `fn row(line, nr)`, for every record of standard input, on a program compiled once.
+// With several threads records are taken in batches, each thread runs a contiguous slice
+// into its own buffer, and the buffers are written out in input order.
+class Runner {
+	const vm::Program& prog;
+	EvalOption option;
+	std::int32_t func = -1;
+	std::string errorMsg;
+
+	static constexpr std::size_t BatchSize = 1 << 12; // records per batch with several threads
+
+	// What one slice of a batch did: the index of the record that failed or ran exit, if any.
+	struct Slice {
+		std::size_t Stop = 0; // records run, the stopping one included
+		bool Failed = false;
+		int Code = EXIT_SUCCESS; // when Failed
+		bool Exited = false;
+		std::string Error;
+		std::ostringstream Out;
+
+		void reset()
+		{
+			Stop = 0;
+			Failed = Exited = false;
+			Code = EXIT_SUCCESS;
+			Error.clear();
+			Out.str("");
+		}
+	};
+
+	void runSlice(vm::Machine& machine, const std::vector<std::string>& recs, std::size_t from, std::size_t to,
+		std::size_t firstNr, Slice& slice)
+	{
+		std::vector<vm::Value> args(prog.Funcs[func].NumParams);
+		for (std::size_t i = from; i < to; i++)
+		{
+			args[0] = vm::Value(std::make_shared<const std::string>(recs[i]));
+			if (args.size() == 2) { args[1] = vm::Value(static_cast<std::int_fast64_t>(firstNr + i)); }
+			bool exited = false;
+			vm::Value res{};
+			slice.Stop = i - from + 1;
+			if (not machine.call(func, args, res, exited))
+			{
+				slice.Failed = true;
+				slice.Code = machine.failureCode();
+				slice.Error = "record " + std::to_string(firstNr + i) + ": " + machine.getError();
+				return;
+			}
+			if (exited)
+			{
+				slice.Exited = true;
+				return;
+			}
+		}
+	}
+
+	int fail(const std::string& msg, int code = EXIT_FAILURE)
+	{
+		std::cout << std::flush;
+		errorMsg = msg;
+		std::cerr << "runtime error: " << msg << std::endl;
+		return code;
+	}
+
+	int runSerial(Reader& reader)
+	{
+		vm::Machine machine(prog, option);
+		std::vector<std::string> rec(1);
+		Slice slice{};
+		for (std::size_t nr = 1; reader.next(rec[0]); nr++)
+		{
+			runSlice(machine, rec, 0, 1, nr, slice);
+			if (slice.Failed) { return fail(slice.Error, slice.Code); }
+			if (slice.Exited) { break; }
+		}
+		std::cout << std::flush;
+		return EXIT_SUCCESS;
+	}
+
+	int runParallel(Reader& reader, std::size_t threads)
+	{
+		par::Pool pool(threads);
+		std::vector<std::unique_ptr<vm::Machine>> machines{};
+		std::vector<Slice> slices(threads);
+		for (std::size_t i{}; i < threads; i++)
+		{
+			machines.emplace_back(std::make_unique<vm::Machine>(prog, option));
+			machines.back()->setOutput(slices[i].Out);
+			machines.back()->shareLimits(*machines.front());
+		}
+		std::vector<std::string> recs{};
+		std::string rec{};
+		std::size_t firstNr = 1;
+		while (true)
+		{
+			recs.clear();
+			while (recs.size() < BatchSize and reader.next(rec)) { recs.push_back(std::move(rec)); }
+			if (recs.empty()) { break; }
+
+			// slice k of the batch runs on machine k, whichever pool thread picks it up
+			const auto per = (recs.size() + threads - 1) / threads;
+			std::vector<std::shared_ptr<par::Pool::Task>> tasks{};
+			for (std::size_t k{}; k < threads; k++)
+			{
+				slices[k].reset();
+				const auto from = std::min(recs.size(), k * per), to = std::min(recs.size(), from + per);
+				auto run = [&, k, from, to](std::size_t) { runSlice(*machines[k], recs, from, to, firstNr, slices[k]); };
+				if (k + 1 < threads) { tasks.push_back(pool.spawn(run)); }
+				else { run(0); }
+			}
+			for (auto& task : tasks) { pool.join(*task); }
+
+			// in input order, up to the first record that failed or ran exit
+			for (auto& slice : slices)
+			{
+				std::cout << slice.Out.str();
+				if (slice.Failed) { return fail(slice.Error, slice.Code); }
+				if (slice.Exited)
+				{
+					std::cout << std::flush;
+					return EXIT_SUCCESS;
+				}
+			}
+			firstNr += recs.size();
+		}
+		std::cout << std::flush;
+		return EXIT_SUCCESS;
+	}
+
+public:
+	Runner(const vm::Program& prog, const EvalOption& option) : prog(prog), option(option) {}
+
+	const std::string& getError() const { return errorMsg; }
+
+	// Returns EXIT_SUCCESS, or EXIT_FAILURE with the error reported.
+	int run()
+	{
+		for (std::size_t i{}; i < prog.Funcs.size(); i++)
+		{
+			if (prog.Funcs[i].Name == option.RecordFn) { func = static_cast<std::int32_t>(i); }
+		}
+		if (func < 0) { return fail("no fn " + option.RecordFn + " to call for each record"); }
+		if (prog.Funcs[func].NumParams != 1 and prog.Funcs[func].NumParams != 2)
+		{
+			return fail("fn " + option.RecordFn + " must take the record, and optionally its number");
+		}
+		if (prog.UsesTasks) { return fail("tasks and channels cannot be used with --each-line / --each-record"); }
+
+		std::ios::sync_with_stdio(false);
+		Reader reader(option.RecordSep);
+		const auto threads = option.RecordThreads ? option.RecordThreads : std::thread::hardware_concurrency();
+		return threads <= 1 ? runSerial(reader) : runParallel(reader, threads);
+	}
+};
+
+} // namespace record
+} // namespace Noh
@@ -0,0 +1,446 @@
+#pragma once
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ast_noh.hpp"
+#include "eval_noh.hpp"
+#include "import_noh.hpp"
+#include "infer_noh.hpp"
+#include "link_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+#include "parser_noh.hpp"
+#include "walk_noh.hpp"
+
+namespace Noh {
+namespace repl {
+
+// Whether `text` closes every (, [ and { it opens outside string literals, so that it can be parsed.
+inline bool Complete(const std::string& text)
+{
+	long depth = 0;
+	for (std::size_t i{}; i < text.size(); i++)
+	{
+		const auto c = text[i];
+		if (c == '"')
+		{
+			for (i++; i < text.size() and text[i] != '"'; i++)
+			{
+				if (text[i] == '\\') { i++; }
+			}
+			if (i >= text.size()) { return false; }
+		}
+		else if (c == '(' or c == '[' or c == '{') { depth++; }
+		else if (c == ')' or c == ']' or c == '}') { depth--; }
+	}
+	return depth <= 0;
+}
+
+// --repl: reads statements and functions one input at a time and runs them on a single tree
+// walker, whose functions and top-level variables live on between inputs. Only the new input is
+// parsed and run; linking and type inference go over the whole program again, since a new call
+// can widen the parameter types of functions entered before. Top-level statements are kept in
+// one function that is never called, so that they are linked and inferred with the rest.
+// A function cannot be redefined: calls are bound to it, and it may be compiled already.
+class Repl {
+	using Clock = std::chrono::steady_clock;
+
+	EvalOption option;
+	eval::AstEval eval;
+	parser::Line<std::string::iterator, qi::standard_wide::space_type> line;
+	ast::ModuleAst program; // every function entered, top first
+	ast::FuncAst* top;
+	std::unordered_set<std::string> imported; // canonical paths of the modules imported so far
+	// variable names with the type each was declared with, innermost scope last
+	std::vector<std::unordered_map<std::string, ast::ValType>> scopes;
+	std::unordered_map<std::string, ast::ValType> globals; // the top-level variables
+	std::vector<std::string> errors;
+
+	static double millis(Clock::time_point from, Clock::time_point to)
+	{
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+
+	static const char* typeName(ast::ValType type)
+	{
+		switch (type) {
+		case ast::ValType::Num: return "number";
+		case ast::ValType::Str: return "string";
+		default: return "tuple";
+		}
+	}
+
+	static bool known(ast::ValType type)
+	{
+		return type == ast::ValType::Num or type == ast::ValType::Str or type == ast::ValType::Tpl;
+	}
+
+	const ast::ValType* lookup(const std::string& name) const
+	{
+		for (auto itr = std::rbegin(scopes); itr != std::rend(scopes); itr++)
+		{
+			if (auto found = itr->find(name); found != std::end(*itr)) { return &found->second; }
+		}
+		return nullptr;
+	}
+
+	// ================
+	//      check
+	// ================
+	// What the tree walker would only find out by failing an assertion, which would end the session,
+	// or by a RuntimeError after the statements before it in the input have run.
+
+	void checkNum(ast::BaseAst* ast, const std::string& where, const std::string& what)
+	{
+		const auto type = ast->getType();
+		if (known(type) and type != ast::ValType::Num)
+		{
+			errors.push_back(where + what + " expects a number, got a " + typeName(type));
+		}
+	}
+
+	void checkExpr(ast::BaseAst* ast, const std::string& where)
+	{
+		switch (ast->getID()) {
+		case ast::IdentID:
+		{
+			const auto& name = static_cast<ast::IdentAst*>(ast)->getIdent();
+			if (not lookup(name)) { errors.push_back(where + "unknown ident '" + name + "'"); }
+			break;
+		}
+		case ast::MonoExpID:
+		{
+			auto mono = static_cast<ast::MonoExpAst*>(ast);
+			checkExpr(mono->getLhs(), where);
+			checkNum(mono->getLhs(), where, "operator " + mono->getOp());
+			break;
+		}
+		case ast::BinaryExpID:
+		{
+			auto bin = static_cast<ast::BinaryExpAst*>(ast);
+			checkExpr(bin->getLhs(), where);
+			checkExpr(bin->getRhs(), where);
+			if (bin->getOp() == "IdxAt")
+			{
+				const auto type = bin->getLhs()->getType();
+				if (known(type) and type != ast::ValType::Tpl) { errors.push_back(where + "a " + typeName(type) + " cannot be indexed"); }
+				checkNum(bin->getRhs(), where, "a tuple index");
+			}
+			else
+			{
+				checkNum(bin->getLhs(), where, "operator " + bin->getOp());
+				checkNum(bin->getRhs(), where, "operator " + bin->getOp());
+			}
+			break;
+		}
+		case ast::TupleID:
+			for (auto& elm : static_cast<ast::TupleAst*>(ast)->Ary) { checkExpr(elm, where); }
+			break;
+		case ast::CallID:
+			for (auto& param : static_cast<ast::CallAst*>(ast)->getParams()) { checkExpr(param, where); }
+			break;
+		default:
+			break;
+		}
+	}
+
+	void checkBlock(std::vector<ast::BaseAst*>& stmts, const std::string& where)
+	{
+		scopes.emplace_back();
+		checkStmts(stmts, where);
+		scopes.pop_back();
+	}
+
+	void checkStmts(std::vector<ast::BaseAst*>& stmts, const std::string& where)
+	{
+		for (auto& stmt : stmts)
+		{
+			switch (stmt->getID()) {
+			case ast::BuiltinID:
+			{
+				auto builtin = static_cast<ast::BuiltinAst*>(stmt);
+				if (builtin->getName() == "return" and where.empty())
+				{
+					errors.push_back("return outside a function");
+				}
+				for (auto& arg : builtin->getArgs())
+				{
+					checkExpr(arg, where);
+					if (builtin->getName() == "print" and arg->getType() == ast::ValType::Tpl)
+					{
+						errors.push_back(where + "a tuple cannot be printed");
+					}
+				}
+				break;
+			}
+			case ast::AssignID:
+			{
+				auto assign = static_cast<ast::AssignAst*>(stmt);
+				checkExpr(assign->getVal(), where);
+				if (scopes.back().count(assign->getName()))
+				{
+					errors.push_back(where + "redefinition of variable '" + assign->getName() + "'");
+				}
+				scopes.back()[assign->getName()] = assign->getVal()->getType();
+				break;
+			}
+			case ast::ReAssignID:
+			{
+				auto reAssign = static_cast<ast::ReAssignAst*>(stmt);
+				checkExpr(reAssign->getVal(), where);
+				const auto declared = lookup(reAssign->getName());
+				const auto type = reAssign->getVal()->getType();
+				if (not declared) { errors.push_back(where + "unknown ident '" + reAssign->getName() + "'"); }
+				else if (known(*declared) and known(type) and *declared != type)
+				{
+					errors.push_back(where + "cannot assign a " + typeName(type) + " to the " + typeName(*declared)
+						+ " '" + reAssign->getName() + "'");
+				}
+				break;
+			}
+			case ast::CallID:
+				checkExpr(stmt, where);
+				break;
+			case ast::IfStmtID:
+			{
+				auto ifStmt = static_cast<ast::IfStmtAst*>(stmt);
+				checkExpr(ifStmt->getCond(), where);
+				checkBlock(ifStmt->getThenStmt(), where);
+				checkBlock(ifStmt->getElseStmt(), where);
+				break;
+			}
+			case ast::WhileStmtID:
+			{
+				auto whileStmt = static_cast<ast::WhileStmtAst*>(stmt);
+				checkExpr(whileStmt->getCond(), where);
+				checkBlock(whileStmt->getLoopStmt(), where);
+				break;
+			}
+			case ast::ForStmtID:
+			{
+				auto forStmt = static_cast<ast::ForStmtAst*>(stmt);
+				checkExpr(forStmt->getRange()->getFrom(), where);
+				checkExpr(forStmt->getRange()->getTo(), where);
+				scopes.emplace_back();
+				scopes.back()[forStmt->getIdent()] = ast::ValType::Num;
+				checkStmts(forStmt->getStmts(), where);
+				scopes.pop_back();
+				break;
+			}
+			default:
+				break;
+			}
+		}
+	}
+
+	// ================
+	//      input
+	// ================
+
+	// Adds the functions of the modules `input` imports to it. False with `errors` set.
+	bool load(ast::ModuleAst* input)
+	{
+		for (const auto& path : input->getImports())
+		{
+			std::string source{}, error{};
+			if (imported.count(std::filesystem::weakly_canonical(path).string())) { continue; }
+			std::vector<imports::Unit> units{};
+			if (not imports::ReadScript(path, source, error) or not imports::Resolve(path, std::move(source), units, error))
+			{
+				errors.push_back(error);
+				return false;
+			}
+			std::vector<imports::Unit> todo{};
+			for (auto& unit : units)
+			{
+				if (not imported.count(std::filesystem::weakly_canonical(unit.Path).string())) { todo.push_back(std::move(unit)); }
+			}
+			auto linkOption = option;
+			linkOption.LazyParse = false;
+			std::unique_ptr<ast::ModuleAst> module(imports::Link(todo, linkOption, nullptr, error));
+			if (not module)
+			{
+				errors.push_back(error.empty() ? "parse failed: '" + todo.front().Path + "'" : error.substr(0, error.size() - 1));
+				return false;
+			}
+			for (const auto& unit : todo) { imported.insert(std::filesystem::weakly_canonical(unit.Path).string()); }
+			auto& funcs = module->getFuncs();
+			input->getFuncs().insert(std::end(input->getFuncs()), std::begin(funcs), std::end(funcs));
+			funcs.clear();
+		}
+		return true;
+	}
+
+	// Undoes the input whose functions start at `numFuncs` in the program and statements at `numStmts` in top.
+	void rollback(std::size_t numFuncs, std::size_t numStmts)
+	{
+		auto& funcs = program.getFuncs();
+		for (auto i = numFuncs; i < funcs.size(); i++) { delete funcs[i]; }
+		funcs.resize(numFuncs);
+		for (auto i = numStmts; i < top->getInst().size(); i++) { delete top->getInst()[i]; }
+		top->getInst().resize(numStmts);
+		infer::TypeInfer().run(&program);
+	}
+
+	// Adds the input to the program: false, with `errors` set and the program as it was, if it is rejected.
+	bool add(ast::ModuleAst* input)
+	{
+		if (not load(input)) { return false; }
+		auto& inputFuncs = input->getFuncs();
+		std::unordered_set<std::string> names{};
+		for (std::size_t i = 1; i < inputFuncs.size(); i++)
+		{
+			const auto& name = inputFuncs[i]->getName();
+			if (eval.funcs.count(name) or not names.insert(name).second) { errors.push_back("fn " + name + " is already defined"); }
+			else if (eval.builtin.count(name)) { errors.push_back("fn " + name + ": '" + name + "' is a keyword"); }
+			if (ast::UsesTasks(inputFuncs[i]->getInst())) { errors.push_back("fn " + name + ": tasks and channels are not supported in --repl"); }
+		}
+		if (ast::UsesTasks(inputFuncs[0]->getInst())) { errors.push_back("tasks and channels are not supported in --repl"); }
+		if (not errors.empty()) { return false; }
+
+		const auto numFuncs = program.getFuncs().size(), numStmts = top->getInst().size();
+		auto& stmts = inputFuncs[0]->getInst();
+		top->getInst().insert(std::end(top->getInst()), std::begin(stmts), std::end(stmts));
+		stmts.clear();
+		program.getFuncs().insert(std::end(program.getFuncs()), std::begin(inputFuncs) + 1, std::end(inputFuncs));
+		inputFuncs.resize(1);
+
+		link::Linker linker{};
+		if (not linker.run(&program))
+		{
+			for (const auto& err : linker.getErrors()) { errors.push_back("link error: " + err); }
+			rollback(numFuncs, numStmts);
+			return false;
+		}
+		infer::TypeInfer().run(&program);
+
+		for (auto i = numFuncs; i < program.getFuncs().size(); i++)
+		{
+			auto func = program.getFuncs()[i];
+			scopes.assign(1, {});
+			for (const auto& param : func->getParamNames()) { scopes.back()[param] = ast::ValType::Any; }
+			checkStmts(func->getInst(), "fn " + func->getName() + ": ");
+		}
+		scopes.assign(1, globals);
+		std::vector<ast::BaseAst*> added(std::begin(top->getInst()) + numStmts, std::end(top->getInst()));
+		checkStmts(added, "");
+		if (not errors.empty())
+		{
+			rollback(numFuncs, numStmts);
+			return false;
+		}
+		globals = std::move(scopes.front());
+
+		for (auto i = numFuncs; i < program.getFuncs().size(); i++) { eval.funcs[program.getFuncs()[i]->getName()] = program.getFuncs()[i]; }
+		memo::Purity purity(eval.funcs);
+		for (auto i = numFuncs; i < program.getFuncs().size(); i++) { eval.addMemo(purity, program.getFuncs()[i]); }
+		return true;
+	}
+
+	// Parses, adds and runs one input; false once the program has run exit or hit a limit.
+	bool run(std::string text)
+	{
+		const auto start = Clock::now();
+		auto it = std::begin(text);
+		ast::ModuleAst* parsed = nullptr;
+		const bool success = qi::phrase_parse(it, std::end(text), line, qi::standard_wide::space, parsed);
+		std::unique_ptr<ast::ModuleAst> input(parsed);
+		if (not success or it != std::end(text))
+		{
+			std::cerr << "parse failed" << std::endl;
+			return true;
+		}
+		const auto parsedAt = Clock::now();
+
+		errors.clear();
+		const auto numStmts = top->getInst().size();
+		const auto before = globals;
+		if (not add(input.get()))
+		{
+			for (const auto& err : errors) { std::cerr << err << std::endl; }
+			return true;
+		}
+		const auto linkedAt = Clock::now();
+
+		auto i = numStmts;
+		auto mark = eval.mark();
+		try
+		{
+			for (; i < top->getInst().size(); i++)
+			{
+				mark = eval.mark();
+				eval.evalStmts(top->getInst()[i]);
+				// outside a loop break and continue do nothing
+				eval.BreakFlag = eval.ContinueFlag = false;
+				if (eval.ExitFlag) { break; }
+			}
+		}
+		catch (const eval::RuntimeError& err)
+		{
+			// the statements before the one that failed stay, with their variables; the input's functions stay
+			std::cout << std::flush;
+			std::cerr << "runtime error: " << err.what() << std::endl;
+			eval.rewind(mark);
+			rollback(program.getFuncs().size(), i);
+			scopes.assign(1, before);
+			std::vector<ast::BaseAst*> kept(std::begin(top->getInst()) + numStmts, std::end(top->getInst()));
+			errors.clear();
+			checkStmts(kept, "");
+			globals = std::move(scopes.front());
+		}
+		std::cout << std::flush;
+		std::cerr << std::fixed << std::setprecision(3) << "parse " << millis(start, parsedAt) << "ms, link "
+			<< millis(parsedAt, linkedAt) << "ms, run " << millis(linkedAt, Clock::now()) << "ms" << std::endl;
+		return not eval.ExitFlag;
+	}
+
+public:
+	Repl(const EvalOption& option) : option(option), eval(option), line(), program(), top(new ast::FuncAst("<repl>"))
+	{
+		program.getFuncs().push_back(top);
+		// the scope of the top-level variables
+		eval.pushScope();
+	}
+
+	// Returns the exit code of the program, EXIT_SUCCESS if the input ends without exit.
+	int run()
+	{
+		const bool prompt = ::isatty(STDIN_FILENO);
+		std::string text{}, s;
+		while (true)
+		{
+			if (prompt) { std::cout << (text.empty() ? "noh> " : "...> ") << std::flush; }
+			if (not std::getline(std::cin, s))
+			{
+				if (prompt) { std::cout << std::endl; }
+				if (text.find_first_not_of(" \t\r\n") != std::string::npos) { run(std::move(text)); }
+				break;
+			}
+			text += s;
+			text += '\n';
+			if (text.find_first_not_of(" \t\r\n") == std::string::npos)
+			{
+				text.clear();
+				continue;
+			}
+			if (not Complete(text)) { continue; }
+			if (not run(std::move(text))) { break; }
+			text.clear();
+		}
+		return eval.ExitCode;
+	}
+};
+
+} // namespace repl
+} // namespace Noh
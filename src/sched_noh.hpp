@@ -0,0 +1,152 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "bytecode_noh.hpp"
+
+namespace Noh {
+namespace vm {
+
+// One Noh call. Locals live in the shared value stack from Base on.
+struct Frame {
+	std::uint32_t Func;
+	std::uint32_t Pc;
+	std::uint32_t Base;
+	std::int32_t Memo; // index into memoKeys, or -1
+};
+
+struct Task;
+
+using TaskQueue = std::deque<std::shared_ptr<Task>>;
+
+// State shared by the tasks that use a task handle or a channel. Every change bumps Version
+// under M and wakes the tasks it may unblock; a task that found nothing to do at Version
+// waits only if Version has not moved since.
+struct Object {
+	std::mutex M;
+	std::uint64_t Version = 0;
+
+	virtual ~Object() = default;
+};
+
+// A stackless coroutine: the machine's stack, frames and memo keys while it is not running.
+struct Task : Object {
+	std::vector<Value> Stack;
+	std::vector<Frame> Frames;
+	std::vector<std::string> MemoKeys;
+	std::uint32_t Func = 0;
+	bool Started = false;
+	// guarded by M; finishing wakes every awaiter
+	bool Done = false;
+	Value Result;
+	TaskQueue Awaiters;
+};
+
+// A bounded FIFO of values. Each send wakes one receiver and each receive one sender, so a
+// full channel with many blocked senders costs one resume per value.
+struct Channel : Object {
+	std::size_t Cap;
+	std::deque<Value> Buf;
+	TaskQueue Senders;
+	TaskQueue Receivers;
+
+	Channel(std::size_t cap) : Cap(cap), Buf() {}
+};
+
+// The ready queue the worker threads take tasks from. Running counts the tasks taken and not
+// handed back yet; when nothing is ready and nothing runs, every task waits: a deadlock.
+class Scheduler {
+	std::mutex m;
+	std::condition_variable cv;
+	std::deque<std::shared_ptr<Task>> ready;
+	std::size_t running = 0;
+	bool stopped = false;
+	std::string error;
+
+public:
+	// memo tables and the input and output streams are shared by every worker
+	std::mutex MemoM;
+	std::mutex IoM;
+
+	void push(std::shared_ptr<Task> task)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			ready.push_back(std::move(task));
+		}
+		cv.notify_one();
+	}
+
+	void wake(TaskQueue& tasks)
+	{
+		if (tasks.empty()) { return; }
+		{
+			std::lock_guard<std::mutex> lock(m);
+			for (auto& task : tasks) { ready.push_back(std::move(task)); }
+		}
+		tasks.clear();
+		cv.notify_all();
+	}
+
+	// Puts `task` into `queue` of `obj` unless obj changed after the task saw it at `version`.
+	void park(std::shared_ptr<Task> task, Object& obj, TaskQueue& queue, std::uint64_t version)
+	{
+		{
+			std::lock_guard<std::mutex> lock(obj.M);
+			if (obj.Version == version)
+			{
+				queue.push_back(std::move(task));
+				return;
+			}
+		}
+		push(std::move(task));
+	}
+
+	// The next task to run, or nullptr once the program is over.
+	std::shared_ptr<Task> pop()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		cv.wait(lock, [&]() { return stopped or not ready.empty() or running == 0; });
+		if (stopped) { return nullptr; }
+		if (ready.empty())
+		{
+			stopped = true;
+			error = "deadlock: every task is waiting";
+			cv.notify_all();
+			return nullptr;
+		}
+		auto task = std::move(ready.front());
+		ready.pop_front();
+		running++;
+		return task;
+	}
+
+	// the task taken by pop() has been resumed and handed back
+	void release()
+	{
+		std::lock_guard<std::mutex> lock(m);
+		if (--running == 0) { cv.notify_all(); }
+	}
+
+	// Ends the program; the first error wins.
+	void stop(const std::string& msg = "")
+	{
+		{
+			std::lock_guard<std::mutex> lock(m);
+			if (not stopped and error.empty()) { error = msg; }
+			stopped = true;
+		}
+		cv.notify_all();
+	}
+
+	const std::string& getError() const { return error; }
+};
+
+} // namespace vm
+} // namespace Noh
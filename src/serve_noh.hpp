@@ -0,0 +1,431 @@
+#pragma once
+
+#include <cerrno>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cache_noh.hpp"
+#include "limit_noh.hpp"
+#include "option_noh.hpp"
+#include "vm_noh.hpp"
+
+namespace Noh {
+namespace serve {
+
+// ================
+//  protocol
+// ================
+// Both sides send messages: a kind byte, the payload length as a native uint32, the payload.
+// A request is one Path or Source message, an optional Input message and a Run message; the
+// server answers with an Out message for every line the program prints, an Err message if
+// anything was reported, and an Exit message holding the exit code, then closes the connection.
+// The client sends nothing after Run; closing the connection cancels the run.
+enum class Kind : char {
+	Path = 'P',   // the script to run, read by the server
+	Source = 'S', // the script itself
+	Input = 'I',  // everything scanNum / scanStr read
+	Run = 'R',
+	Out = 'O',
+	Err = 'E',
+	Exit = 'X',
+};
+
+constexpr std::uint32_t MaxMessage = 1u << 30;
+
+inline bool WriteAll(int fd, const char* data, std::size_t len)
+{
+	while (len > 0)
+	{
+		const auto n = ::send(fd, data, len, MSG_NOSIGNAL);
+		if (n < 0 and errno == EINTR) { continue; }
+		if (n <= 0) { return false; }
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+inline bool ReadAll(int fd, char* data, std::size_t len)
+{
+	while (len > 0)
+	{
+		const auto n = ::read(fd, data, len);
+		if (n < 0 and errno == EINTR) { continue; }
+		if (n <= 0) { return false; }
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+inline bool SendMessage(int fd, Kind kind, const char* data, std::size_t len)
+{
+	char head[5];
+	head[0] = static_cast<char>(kind);
+	const auto size = static_cast<std::uint32_t>(len);
+	std::memcpy(head + 1, &size, sizeof(size));
+	return WriteAll(fd, head, sizeof(head)) and WriteAll(fd, data, len);
+}
+
+inline bool SendMessage(int fd, Kind kind, const std::string& payload)
+{
+	return SendMessage(fd, kind, payload.data(), payload.size());
+}
+
+inline bool RecvMessage(int fd, Kind& kind, std::string& payload)
+{
+	char head[5];
+	if (not ReadAll(fd, head, sizeof(head))) { return false; }
+	kind = static_cast<Kind>(head[0]);
+	std::uint32_t size;
+	std::memcpy(&size, head + 1, sizeof(size));
+	if (size > MaxMessage) { return false; }
+	payload.resize(size);
+	return ReadAll(fd, payload.data(), size);
+}
+
+// An output stream buffer that sends what the program prints as Out messages, one per line
+// (or per MaxChunk bytes of a long one). Once the client has gone the rest is dropped and the
+// run is cancelled.
+class OutBuf : public std::streambuf {
+	static constexpr std::size_t MaxChunk = 1 << 14;
+
+	int fd;
+	limit::Fuel run;
+	std::string pending;
+	bool broken = false;
+
+	bool drain()
+	{
+		if (not pending.empty() and not broken)
+		{
+			broken = not SendMessage(fd, Kind::Out, pending);
+			if (broken) { run.cancel(); }
+		}
+		pending.clear();
+		return not broken;
+	}
+
+protected:
+	// there is no put area, so every write comes here or to xsputn
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof())) { return traits_type::not_eof(ch); }
+		pending += traits_type::to_char_type(ch);
+		if (traits_type::to_char_type(ch) == '\n' or pending.size() >= MaxChunk) { drain(); }
+		return ch;
+	}
+
+	std::streamsize xsputn(const char* data, std::streamsize len) override
+	{
+		pending.append(data, len);
+		if (std::memchr(data, '\n', len) or pending.size() >= MaxChunk) { drain(); }
+		return len;
+	}
+
+	int sync() override { return drain() ? 0 : -1; }
+
+public:
+	OutBuf(int fd, limit::Fuel run) : fd(fd), run(std::move(run)) {}
+};
+
+// ================
+//  server
+// ================
+// --serve: accepts requests on a Unix domain socket and runs them on a fixed set of threads,
+// each on a fresh bytecode machine over a cached program. Requests are read on a thread of
+// their own, so a client that is slow to send one does not hold up the runs; one that sends
+// nothing (or reads nothing) for RequestTimeout seconds is dropped.
+class Server {
+	static constexpr long RequestTimeout = 10;
+
+	// a request read in full, waiting for a thread to run it
+	struct Request {
+		int Fd;
+		std::string ScriptPath; // "" for a Source message
+		std::string Source;
+		std::string Input;
+	};
+
+	std::string path;
+	int level;
+	EvalOption option;
+	cache::ModuleCache cache;
+	imports::ParseCache parsed; // modules, so a library imported by many scripts is parsed once
+	std::mutex m;
+	std::condition_variable cv;
+	std::deque<Request> requests;
+
+	static std::string& socketPath()
+	{
+		static std::string path{};
+		return path;
+	}
+
+	static void onSignal(int)
+	{
+		::unlink(socketPath().c_str());
+		std::_Exit(EXIT_SUCCESS);
+	}
+
+	// what the server reports before the program runs; Err then Exit
+	static void reject(int fd, const std::string& msg)
+	{
+		SendMessage(fd, Kind::Err, msg);
+		const std::uint32_t code = EXIT_FAILURE;
+		SendMessage(fd, Kind::Exit, reinterpret_cast<const char*>(&code), sizeof(code));
+	}
+
+	// Reads the request on `req.Fd`; false if it was rejected or the client went away.
+	static bool receive(Request& req)
+	{
+		const auto fd = req.Fd;
+		const timeval timeout{RequestTimeout, 0};
+		::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		std::string payload{};
+		Kind kind{};
+		bool hasScript = false;
+		while (true)
+		{
+			if (not RecvMessage(fd, kind, payload)) { return false; }
+			if (kind == Kind::Run) { break; }
+			switch (kind) {
+			case Kind::Path:
+			{
+				std::string error{};
+				if (not imports::ReadScript(payload, req.Source, error))
+				{
+					reject(fd, error + "\n");
+					return false;
+				}
+				req.ScriptPath = std::move(payload);
+				hasScript = true;
+				break;
+			}
+			case Kind::Source:
+				// imports are found from the server's working directory
+				req.Source = std::move(payload);
+				req.ScriptPath.clear();
+				hasScript = true;
+				break;
+			case Kind::Input:
+				req.Input = std::move(payload);
+				break;
+			default:
+				reject(fd, std::string("unexpected message '") + static_cast<char>(kind) + "'\n");
+				return false;
+			}
+		}
+		if (not hasScript)
+		{
+			reject(fd, "no script to run\n");
+			return false;
+		}
+		return true;
+	}
+
+	// on a thread of its own per connection
+	void accept(int fd)
+	{
+		Request req{fd, "", "", ""};
+		if (not receive(req))
+		{
+			::close(fd);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m);
+			requests.push_back(std::move(req));
+		}
+		cv.notify_one();
+	}
+
+	// Cancels `run` if the client hangs up (or sends anything after Run) before `stop` is readable.
+	static void watch(int fd, int stop, limit::Fuel run)
+	{
+		pollfd fds[2] = {{fd, POLLIN, 0}, {stop, POLLIN, 0}};
+		while (::poll(fds, 2, -1) < 0 and errno == EINTR) {}
+		if (fds[0].revents and not fds[1].revents) { run.cancel(); }
+	}
+
+	void handle(Request& req)
+	{
+		const auto fd = req.Fd;
+		std::vector<imports::Unit> units{};
+		std::string errors{};
+		if (not imports::Resolve(req.ScriptPath, std::move(req.Source), units, errors)) { return reject(fd, errors + "\n"); }
+		const auto key = imports::Key(units);
+		auto prog = cache.find(key);
+		if (not prog)
+		{
+			prog = cache::Compile(units, level, option, &parsed, errors);
+			if (not prog) { return reject(fd, errors); }
+			cache.insert(key, prog);
+		}
+
+		std::istringstream in(std::move(req.Input));
+		std::ostringstream err{};
+		vm::Machine machine(*prog, option);
+		const auto run = machine.canceller();
+		OutBuf outBuf(fd, run);
+		std::ostream out(&outBuf);
+		machine.setInput(in);
+		machine.setOutput(out);
+		machine.setErrors(err);
+
+		int stop[2];
+		if (::pipe(stop) < 0) { return reject(fd, std::string("could not run the script: ") + std::strerror(errno) + "\n"); }
+		std::thread watcher([&]() { watch(fd, stop[0], run); });
+		const std::uint32_t code = machine.run();
+		const char done = 0;
+		while (::write(stop[1], &done, 1) < 0 and errno == EINTR) {}
+		watcher.join();
+		::close(stop[0]);
+		::close(stop[1]);
+
+		out.flush();
+		if (not err.str().empty()) { SendMessage(fd, Kind::Err, err.str()); }
+		SendMessage(fd, Kind::Exit, reinterpret_cast<const char*>(&code), sizeof(code));
+	}
+
+	void work()
+	{
+		while (true)
+		{
+			std::unique_lock<std::mutex> lock(m);
+			cv.wait(lock, [&]() { return not requests.empty(); });
+			auto req = std::move(requests.front());
+			requests.pop_front();
+			lock.unlock();
+			handle(req);
+			::close(req.Fd);
+		}
+	}
+
+public:
+	Server(const std::string& path, int level, const EvalOption& option)
+		: path(path), level(level), option(option), cache(option.CacheSize), parsed(option.CacheSize), m(), cv(), requests()
+	{}
+
+	// Serves until killed; returns EXIT_FAILURE only if the socket cannot be set up.
+	int run()
+	{
+		sockaddr_un addr{};
+		addr.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(addr.sun_path))
+		{
+			std::cerr << "socket path too long: '" << path << "'" << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+		const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		::unlink(path.c_str()); // left behind by a server that did not shut down cleanly
+		if (listener < 0 or ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+			or ::listen(listener, SOMAXCONN) < 0)
+		{
+			std::cerr << "could not listen on '" << path << "': " << std::strerror(errno) << std::endl;
+			return EXIT_FAILURE;
+		}
+		socketPath() = path;
+		std::signal(SIGINT, onSignal);
+		std::signal(SIGTERM, onSignal);
+
+		std::size_t count = option.ServeThreads ? option.ServeThreads : std::thread::hardware_concurrency();
+		if (count == 0) { count = 1; }
+		std::vector<std::thread> threads{};
+		for (std::size_t i{}; i < count; i++) { threads.emplace_back([this]() { work(); }); }
+
+		while (true)
+		{
+			const int fd = ::accept(listener, nullptr, nullptr);
+			if (fd < 0) { continue; }
+			std::thread([this, fd]() { accept(fd); }).detach();
+		}
+	}
+};
+
+// --connect: sends `script`, and standard input unless it is a terminal, to the server at
+// `path`, and relays what the program prints. Returns the program's exit code.
+inline int Connect(const std::string& path, const std::string& script)
+{
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+	{
+		std::cerr << "socket path too long: '" << path << "'" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+	const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 or ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+	{
+		std::cerr << "could not connect to '" << path << "': " << std::strerror(errno) << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::string input{};
+	if (not ::isatty(STDIN_FILENO))
+	{
+		char block[1 << 16];
+		std::size_t len;
+		while ((len = std::fread(block, 1, sizeof(block), stdin)) > 0) { input.append(block, len); }
+	}
+	// a server that rejects the script answers without reading the rest
+	const auto abs = std::filesystem::absolute(script).string();
+	SendMessage(fd, Kind::Path, abs) and SendMessage(fd, Kind::Input, input) and SendMessage(fd, Kind::Run, "");
+
+	Kind kind{};
+	std::string payload{};
+	while (RecvMessage(fd, kind, payload))
+	{
+		switch (kind) {
+		case Kind::Out:
+			std::fwrite(payload.data(), 1, payload.size(), stdout);
+			std::fflush(stdout);
+			break;
+		case Kind::Err:
+			std::fflush(stdout);
+			std::fwrite(payload.data(), 1, payload.size(), stderr);
+			break;
+		case Kind::Exit:
+		{
+			std::uint32_t code = EXIT_FAILURE;
+			if (payload.size() == sizeof(code)) { std::memcpy(&code, payload.data(), sizeof(code)); }
+			std::fflush(stdout);
+			::close(fd);
+			return static_cast<int>(code);
+		}
+		default:
+			break;
+		}
+	}
+	std::fflush(stdout);
+	std::cerr << "lost the connection to '" << path << "'" << std::endl;
+	::close(fd);
+	return EXIT_FAILURE;
+}
+
+} // namespace serve
+} // namespace Noh
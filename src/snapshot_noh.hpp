@@ -0,0 +1,363 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode_noh.hpp"
+#include "version_noh.hpp"
+
+namespace Noh {
+namespace snapshot {
+
+// ================
+//  format
+// ================
+// A snapshot is the compiled program and the result of fn init, in native byte order:
+//   magic, format version, NOH_VERSION_STRING, sizeof(Instr)
+//   Entry, Init, UsesTasks
+//   Nums
+//   the string table: Strs first, then the strings of the state, each stored once
+//   Funcs: Name, NumParams, NumSlots, Memo, Code as raw Instr
+//   the state: a tag, then a Num, an index into the string table or a tuple's elements
+// It is only read back by the build that wrote it.
+constexpr char Magic[8] = {'N', 'O', 'H', 'S', 'N', 'A', 'P', '\0'};
+constexpr std::uint32_t FormatVersion = 1;
+
+static_assert(std::is_trivially_copyable_v<vm::Instr>, "instructions are stored as raw bytes");
+
+class Writer {
+	std::string buf{};
+	std::unordered_map<std::string, std::uint32_t> strIdx{};
+	std::vector<std::string> strs{}; // the string table
+
+	template <typename T>
+	void put(T val)
+	{
+		buf.append(reinterpret_cast<const char*>(&val), sizeof(val));
+	}
+
+	void putStr(const std::string& str)
+	{
+		put(static_cast<std::uint32_t>(str.size()));
+		buf += str;
+	}
+
+	void intern(const std::string& str)
+	{
+		if (strIdx.emplace(str, static_cast<std::uint32_t>(strs.size())).second) { strs.push_back(str); }
+	}
+
+	// the strings of `val` go into the table before anything refers to them
+	bool collect(const vm::Value& val, std::string& error)
+	{
+		switch (val.Type) {
+		case vm::ValueType::Num: return true;
+		case vm::ValueType::Str: intern(*val.Str); return true;
+		case vm::ValueType::Tpl:
+			for (const auto& elm : *val.Tpl)
+			{
+				if (not collect(elm, error)) { return false; }
+			}
+			return true;
+		default:
+			error = std::string("the result of fn init holds a ") + vm::TypeName(val.Type) + ", which cannot be saved";
+			return false;
+		}
+	}
+
+	void putValue(const vm::Value& val)
+	{
+		put(static_cast<std::uint8_t>(val.Type));
+		switch (val.Type) {
+		case vm::ValueType::Num: put(static_cast<std::int64_t>(val.Num)); break;
+		case vm::ValueType::Str: put(strIdx.at(*val.Str)); break;
+		case vm::ValueType::Tpl:
+			put(static_cast<std::uint32_t>(val.Tpl->size()));
+			for (const auto& elm : *val.Tpl) { putValue(elm); }
+			break;
+		default: break;
+		}
+	}
+
+public:
+	// false with `error` set if the state holds a task or a channel
+	bool write(const vm::Program& prog, const vm::Value& state, std::string& error)
+	{
+		buf.append(Magic, sizeof(Magic));
+		put(FormatVersion);
+		putStr(NOH_VERSION_STRING);
+		put(static_cast<std::uint32_t>(sizeof(vm::Instr)));
+		put(prog.Entry);
+		put(prog.Init);
+		put(static_cast<std::uint8_t>(prog.UsesTasks));
+
+		put(static_cast<std::uint32_t>(prog.Nums.size()));
+		for (const auto& num : prog.Nums) { put(static_cast<std::int64_t>(num)); }
+
+		// the program's strings keep their indices, even equal ones; the state's come after
+		for (const auto& str : prog.Strs)
+		{
+			strIdx.emplace(*str, static_cast<std::uint32_t>(strs.size()));
+			strs.push_back(*str);
+		}
+		if (not collect(state, error)) { return false; }
+		put(static_cast<std::uint32_t>(strs.size()));
+		put(static_cast<std::uint32_t>(prog.Strs.size()));
+		for (const auto& str : strs) { putStr(str); }
+
+		put(static_cast<std::uint32_t>(prog.Funcs.size()));
+		for (const auto& func : prog.Funcs)
+		{
+			putStr(func.Name);
+			put(func.NumParams);
+			put(func.NumSlots);
+			put(static_cast<std::uint8_t>(func.Memo));
+			put(static_cast<std::uint32_t>(func.Code.size()));
+			buf.append(reinterpret_cast<const char*>(func.Code.data()), func.Code.size() * sizeof(vm::Instr));
+		}
+		putValue(state);
+		return true;
+	}
+
+	const std::string& bytes() const { return buf; }
+};
+
+// Saves `prog` and `state` to `path`; false with `error` set if it cannot.
+inline bool Write(const std::string& path, const vm::Program& prog, const vm::Value& state, std::string& error)
+{
+	Writer writer{};
+	if (not writer.write(prog, state, error)) { return false; }
+	std::ofstream fOut(path, std::ios::binary);
+	if (not (fOut << writer.bytes()))
+	{
+		error = "could not write the file: '" + path + "'";
+		return false;
+	}
+	return true;
+}
+
+// ================
+//  loading
+// ================
+// Parses a mapped snapshot. Every read is bounds-checked and every operand that indexes the
+// program is range-checked, so a truncated file or one from another build is an error. Like
+// the executable itself, the code is otherwise trusted: its stack use is not verified.
+class Reader {
+	const char* cur;
+	const char* end;
+	vm::Program& prog;
+	std::vector<std::shared_ptr<const std::string>> table{};
+
+	template <typename T>
+	bool get(T& val)
+	{
+		if (static_cast<std::size_t>(end - cur) < sizeof(val)) { return false; }
+		std::memcpy(&val, cur, sizeof(val));
+		cur += sizeof(val);
+		return true;
+	}
+
+	bool getStr(std::string& str)
+	{
+		std::uint32_t len;
+		if (not get(len) or static_cast<std::size_t>(end - cur) < len) { return false; }
+		str.assign(cur, len);
+		cur += len;
+		return true;
+	}
+
+	bool getValue(vm::Value& val)
+	{
+		std::uint8_t tag;
+		if (not get(tag)) { return false; }
+		switch (static_cast<vm::ValueType>(tag)) {
+		case vm::ValueType::Num:
+		{
+			std::int64_t num;
+			if (not get(num)) { return false; }
+			val = vm::Value(static_cast<std::int_fast64_t>(num));
+			return true;
+		}
+		case vm::ValueType::Str:
+		{
+			std::uint32_t idx;
+			if (not get(idx) or idx >= table.size()) { return false; }
+			val = vm::Value(table[idx]);
+			return true;
+		}
+		case vm::ValueType::Tpl:
+		{
+			std::uint32_t len;
+			// every element takes at least its tag byte
+			if (not get(len) or static_cast<std::size_t>(end - cur) < len) { return false; }
+			auto tpl = std::make_shared<vm::Tuple>(len);
+			for (auto& elm : *tpl)
+			{
+				if (not getValue(elm)) { return false; }
+			}
+			val = vm::Value(std::shared_ptr<const vm::Tuple>(std::move(tpl)));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	bool validOp(vm::OpCode op) const { return op <= vm::OpCode::CmpJumpLK; }
+
+	bool validInstr(const vm::FuncCode& func, const vm::Instr& ins) const
+	{
+		if (not validOp(ins.Op) or not validOp(ins.Sub)) { return false; }
+		auto slot = [&](std::int32_t idx) { return idx >= 0 and static_cast<std::uint32_t>(idx) < func.NumSlots; };
+		auto num = [&](std::int32_t idx) { return idx >= 0 and static_cast<std::size_t>(idx) < prog.Nums.size(); };
+		auto pc = [&](std::int32_t idx) { return idx >= 0 and static_cast<std::size_t>(idx) <= func.Code.size(); };
+		switch (ins.Op) {
+		case vm::OpCode::PushNum: return num(ins.A);
+		case vm::OpCode::PushStr: return ins.A >= 0 and static_cast<std::size_t>(ins.A) < prog.Strs.size();
+		case vm::OpCode::MakeTuple: return ins.A >= 0;
+		case vm::OpCode::Load:
+		case vm::OpCode::Store:
+		case vm::OpCode::ReStore:
+		case vm::OpCode::ScanNum:
+		case vm::OpCode::ScanStr: return slot(ins.A);
+		case vm::OpCode::Jump:
+		case vm::OpCode::JumpIfFalse:
+		case vm::OpCode::JumpIfTrue:
+		case vm::OpCode::CmpJump: return pc(ins.A);
+		case vm::OpCode::Call:
+		case vm::OpCode::TailCall:
+		case vm::OpCode::Spawn:
+			return ins.A >= 0 and static_cast<std::size_t>(ins.A) < prog.Funcs.size()
+				and static_cast<std::uint32_t>(ins.B) == prog.Funcs[ins.A].NumParams;
+		case vm::OpCode::BinLL: return slot(ins.A) and slot(ins.B);
+		case vm::OpCode::BinLK: return slot(ins.A) and num(ins.B);
+		case vm::OpCode::StoreLL:
+		case vm::OpCode::ReStoreLL: return slot(ins.A) and slot(ins.B) and slot(ins.C);
+		case vm::OpCode::StoreLK:
+		case vm::OpCode::ReStoreLK: return slot(ins.A) and num(ins.B) and slot(ins.C);
+		case vm::OpCode::CmpJumpLL: return slot(ins.A) and slot(ins.B) and pc(ins.C);
+		case vm::OpCode::CmpJumpLK: return slot(ins.A) and num(ins.B) and pc(ins.C);
+		default: return true;
+		}
+	}
+
+	bool validFunc(std::int32_t idx, std::size_t params) const
+	{
+		return idx >= 0 and static_cast<std::size_t>(idx) < prog.Funcs.size() and prog.Funcs[idx].NumParams == params;
+	}
+
+public:
+	Reader(const char* data, std::size_t len, vm::Program& prog) : cur(data), end(data + len), prog(prog) {}
+
+	// false with `error` set if the data is not a snapshot this build can load
+	bool read(vm::Value& state, std::string& error)
+	{
+		char magic[sizeof(Magic)];
+		std::uint32_t format, instrSize;
+		std::string version{};
+		if (not get(magic) or std::memcmp(magic, Magic, sizeof(Magic)) != 0)
+		{
+			error = "not a snapshot";
+			return false;
+		}
+		if (not get(format) or format != FormatVersion or not getStr(version) or version != NOH_VERSION_STRING
+			or not get(instrSize) or instrSize != sizeof(vm::Instr))
+		{
+			error = "the snapshot was written by another version of NohEval";
+			return false;
+		}
+		error = "corrupt snapshot";
+
+		std::uint8_t usesTasks;
+		std::uint32_t count;
+		if (not get(prog.Entry) or not get(prog.Init) or not get(usesTasks) or not get(count)) { return false; }
+		prog.UsesTasks = usesTasks;
+		if (static_cast<std::size_t>(end - cur) / sizeof(std::int64_t) < count) { return false; }
+		prog.Nums.resize(count);
+		for (auto& num : prog.Nums)
+		{
+			std::int64_t val;
+			if (not get(val)) { return false; }
+			num = val;
+		}
+
+		std::uint32_t progStrs;
+		if (not get(count) or not get(progStrs) or progStrs > count) { return false; }
+		for (std::uint32_t i{}; i < count; i++)
+		{
+			std::string str{};
+			if (not getStr(str)) { return false; }
+			table.push_back(std::make_shared<const std::string>(std::move(str)));
+		}
+		prog.Strs.assign(std::begin(table), std::begin(table) + progStrs);
+
+		if (not get(count)) { return false; }
+		prog.Funcs.resize(count);
+		for (auto& func : prog.Funcs)
+		{
+			std::uint8_t memo;
+			std::uint32_t len;
+			if (not getStr(func.Name) or not get(func.NumParams) or not get(func.NumSlots) or not get(memo)
+				or not get(len) or static_cast<std::size_t>(end - cur) / sizeof(vm::Instr) < len)
+			{
+				return false;
+			}
+			func.Memo = memo;
+			func.Code.resize(len);
+			std::memcpy(func.Code.data(), cur, len * sizeof(vm::Instr));
+			cur += len * sizeof(vm::Instr);
+		}
+		for (const auto& func : prog.Funcs)
+		{
+			if (func.NumParams > func.NumSlots) { return false; }
+			for (const auto& ins : func.Code)
+			{
+				if (not validInstr(func, ins)) { return false; }
+			}
+		}
+		if (not validFunc(prog.Entry, 1) or not validFunc(prog.Init, 0)) { return false; }
+		if (not getValue(state) or cur != end) { return false; }
+		error.clear();
+		return true;
+	}
+};
+
+// Loads a snapshot saved by Write(): the file is mapped and the program and state are copied
+// out of it. False with `error` set if it cannot be read.
+inline bool Read(const std::string& path, vm::Program& prog, vm::Value& state, std::string& error)
+{
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	struct stat st{};
+	if (fd < 0 or ::fstat(fd, &st) < 0)
+	{
+		if (fd >= 0) { ::close(fd); }
+		error = "could not open the file: '" + path + "'";
+		return false;
+	}
+	const auto len = static_cast<std::size_t>(st.st_size);
+	void* data = len ? ::mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	::close(fd);
+	if (data == MAP_FAILED)
+	{
+		error = "'" + path + "' is not a snapshot";
+		return false;
+	}
+	const bool ok = Reader(static_cast<const char*>(data), len, prog).read(state, error);
+	::munmap(data, len);
+	if (not ok) { error = "'" + path + "': " + error; }
+	return ok;
+}
+
+} // namespace snapshot
+} // namespace Noh
@@ -0,0 +1,806 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bytecode_noh.hpp"
+#include "limit_noh.hpp"
+#include "memo_noh.hpp"
+#include "option_noh.hpp"
+#include "sched_noh.hpp"
+
+// computed goto is a GCC/Clang extension; elsewhere the machine dispatches with a switch
+#if defined(__GNUC__) and not defined(NOH_VM_THREADED)
+#define NOH_VM_THREADED 1
+#endif
+
+namespace Noh {
+namespace vm {
+
+// Runs a Program without nesting C++ calls per Noh call:
+// the Noh call stack is the heap-allocated `frames` array.
+// A program that spawns tasks runs on one Machine per worker thread; each swaps the stack,
+// frames and memo keys of the task it resumes in and out.
+class Machine {
+	const Program& prog;
+	EvalOption option;
+	std::vector<Value> stack;
+	std::vector<Frame> frames;
+	std::vector<memo::MemoTable<Value>> ownMemos;
+	std::vector<memo::MemoTable<Value>>& memos;
+	std::vector<std::string> memoKeys;
+	std::string errorMsg;
+	std::istream* in = &std::cin;
+	std::ostream* out = &std::cout;
+	std::ostream* err = &std::cerr;
+	limit::Fuel fuel;
+	Value state;            // main's argument when it takes the result of fn init
+	bool hasState = false;  // state came from a snapshot instead
+
+	// tasks only: why execute() returned, and what a blocked task waits on
+	enum class Halt : std::uint8_t { Run, Yield, Block, Exit };
+	static constexpr std::uint32_t SliceLength = 1 << 12; // jumps and calls before a task yields
+	Scheduler* sched = nullptr;
+	Halt halt = Halt::Run;
+	std::uint32_t budget = 0;
+	std::shared_ptr<Object> blockedOn;
+	TaskQueue* blockedQueue = nullptr;
+	std::uint64_t blockedVersion = 0;
+
+	// --profile-ops: executions per opcode, and per sequence of 2 to 4 opcodes
+	struct OpProfile {
+		std::vector<std::uint64_t> Ops = std::vector<std::uint64_t>(256);
+		std::unordered_map<std::uint64_t, std::uint64_t> Seqs; // length << 32 | one byte per opcode, the last lowest
+		std::uint64_t Prev[3] = {};
+		int Last = 0;
+	} profile;
+
+	bool fail(const std::string& msg)
+	{
+		errorMsg = msg;
+		return false;
+	}
+
+	static bool isTrue(const Value& val) { return val.Type != ValueType::Num or val.Num != 0; }
+
+	bool checkNum(const Value& lhs, const Value& rhs, OpCode op)
+	{
+		if (lhs.Type == ValueType::Num and rhs.Type == ValueType::Num) { return true; }
+		return fail(std::string("operator ") + OpName(op) + " expects Num, got "
+			+ TypeName(lhs.Type) + " and " + TypeName(rhs.Type));
+	}
+
+	std::string memoKey(std::uint32_t base, std::uint32_t argc) const
+	{
+		std::string key{};
+		for (std::uint32_t i{}; i < argc; i++) { AppendKey(key, stack[base + i]); }
+		return key;
+	}
+
+	// Pushes a frame for Funcs[func] whose arguments are stack[base, base + argc).
+	// Returns false on error; a memo hit leaves the result on the stack without a frame.
+	bool enter(std::uint32_t func, std::uint32_t base)
+	{
+		const auto& callee = prog.Funcs[func];
+		if (frames.size() >= option.MaxDepth)
+		{
+			return fail("maximum recursion depth (" + std::to_string(option.MaxDepth) + ") exceeded in fn " + callee.Name);
+		}
+		std::int32_t memoIdx = -1;
+		if (callee.Memo)
+		{
+			auto key = memoKey(base, callee.NumParams);
+			Value val{};
+			bool found = false;
+			{
+				std::unique_lock<std::mutex> lock{};
+				if (sched) { lock = std::unique_lock<std::mutex>(sched->MemoM); }
+				if (auto hit = memos[func].find(key))
+				{
+					val = *hit;
+					found = true;
+				}
+			}
+			if (found)
+			{
+				stack.resize(base);
+				stack.push_back(std::move(val));
+				return true;
+			}
+			memoKeys.push_back(std::move(key));
+			memoIdx = static_cast<std::int32_t>(memoKeys.size() - 1);
+		}
+		stack.resize(base + callee.NumSlots);
+		frames.push_back(Frame{func, 0, base, memoIdx});
+		return true;
+	}
+
+	// a worker of runTasks(), sharing the memo tables and the limits of `parent`
+	Machine(Machine& parent, Scheduler& sched)
+		: prog(parent.prog), option(parent.option), stack(), frames(), ownMemos(), memos(parent.memos), memoKeys(),
+		in(parent.in), out(parent.out), err(parent.err), fuel(parent.fuel), sched(&sched)
+	{}
+
+	// Suspends the running task at the current instruction, to wait in `queue` of `obj`.
+	bool block(const std::shared_ptr<Object>& obj, TaskQueue& queue, std::uint64_t version, std::uint32_t pc)
+	{
+		frames.back().Pc = pc - 1;
+		blockedOn = obj;
+		blockedQueue = &queue;
+		blockedVersion = version;
+		halt = Halt::Block;
+		return true;
+	}
+
+	// Runs `task` for one time slice, then requeues, parks or finishes it.
+	void resume(const std::shared_ptr<Task>& task, const Task* mainTask)
+	{
+		std::swap(stack, task->Stack);
+		std::swap(frames, task->Frames);
+		std::swap(memoKeys, task->MemoKeys);
+		halt = Halt::Run;
+		budget = SliceLength;
+		bool ok = true;
+		if (not task->Started)
+		{
+			// the arguments are already on the stack
+			task->Started = true;
+			ok = enter(task->Func, 0);
+		}
+		if (ok and not frames.empty()) { ok = option.ProfileOps ? execute<true, true>() : execute<false, true>(); }
+		std::swap(stack, task->Stack);
+		std::swap(frames, task->Frames);
+		std::swap(memoKeys, task->MemoKeys);
+
+		if (not ok)
+		{
+			sched->stop(errorMsg);
+			return;
+		}
+		switch (halt) {
+		case Halt::Exit:
+			sched->stop();
+			return;
+		case Halt::Yield:
+			sched->push(task);
+			return;
+		case Halt::Block:
+			sched->park(task, *blockedOn, *blockedQueue, blockedVersion);
+			blockedOn.reset();
+			return;
+		case Halt::Run:
+			break;
+		}
+		TaskQueue waiters{};
+		{
+			std::lock_guard<std::mutex> lock(task->M);
+			task->Done = true;
+			task->Result = std::move(task->Stack.back());
+			task->Version++;
+			waiters.swap(task->Awaiters);
+		}
+		task->Stack.clear();
+		sched->wake(waiters);
+		// the program ends with main, whatever the other tasks are doing
+		if (task.get() == mainTask) { sched->stop(); }
+	}
+
+	void work(const Task* mainTask)
+	{
+		while (auto task = sched->pop())
+		{
+			resume(task, mainTask);
+			sched->release();
+		}
+	}
+
+	// Runs Funcs[func] as the main task on option.Workers worker threads; see call().
+	bool runTasks(std::int32_t func, std::vector<Value> args, Value& result, bool& exited)
+	{
+		Scheduler scheduler{};
+		auto mainTask = std::make_shared<Task>();
+		mainTask->Func = func;
+		mainTask->Stack = std::move(args);
+		scheduler.push(mainTask);
+
+		std::size_t count = option.Workers ? option.Workers : std::thread::hardware_concurrency();
+		if (count == 0) { count = 1; }
+		std::vector<std::unique_ptr<Machine>> workers{};
+		std::vector<std::thread> threads{};
+		for (std::size_t i{}; i < count; i++)
+		{
+			workers.emplace_back(new Machine(*this, scheduler));
+			threads.emplace_back([&, worker = workers.back().get()]() { worker->work(mainTask.get()); });
+		}
+		for (auto& thread : threads) { thread.join(); }
+
+		if (option.ProfileOps)
+		{
+			for (auto& worker : workers)
+			{
+				for (std::size_t i{}; i < profile.Ops.size(); i++) { profile.Ops[i] += worker->profile.Ops[i]; }
+				for (const auto& [key, cnt] : worker->profile.Seqs) { profile.Seqs[key] += cnt; }
+			}
+		}
+		if (not scheduler.getError().empty()) { return fail(scheduler.getError()); }
+		// the program ends either when main returns or at an exit
+		exited = not mainTask->Done;
+		if (not exited) { result = std::move(mainTask->Result); }
+		return true;
+	}
+
+public:
+	Machine(const Program& prog, const EvalOption& option = EvalOption{})
+		: prog(prog), option(option), stack(), frames(), ownMemos(), memos(ownMemos), memoKeys(), fuel(option)
+	{
+		memos.reserve(prog.Funcs.size());
+		for (std::size_t i{}; i < prog.Funcs.size(); i++) { memos.emplace_back(option.MemoCapacity); }
+	}
+
+	const std::string& getError() const { return errorMsg; }
+
+	// what a failed run exits with: EXIT_FAILURE, or the code of the limit it exceeded
+	int failureCode() const { return fuel.exceeded() != limit::Reason::None ? fuel.exitCode() : EXIT_FAILURE; }
+
+	// Runs fn init if main takes its result, then main.
+	// Returns EXIT_SUCCESS, or failureCode() with getError() set.
+	int run()
+	{
+		if (prog.Entry < 0) { return EXIT_SUCCESS; }
+		bool ok = true, exited = false;
+		if (prog.Init >= 0 and not hasState)
+		{
+			ok = call(prog.Init, {}, state, exited);
+			hasState = true;
+		}
+		std::vector<Value> args{};
+		if (prog.Init >= 0) { args.push_back(state); }
+		Value res{};
+		if (ok and not exited) { ok = call(prog.Entry, std::move(args), res, exited); }
+		if (option.ProfileOps) { reportProfile(*err); }
+		*out << std::flush;
+		if (not ok)
+		{
+			*err << "runtime error: " << errorMsg << std::endl;
+			return failureCode();
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// main's argument in place of the result of fn init, which run() then does not call
+	void setState(Value val)
+	{
+		state = std::move(val);
+		hasState = true;
+	}
+
+	// where scanNum / scanStr read, print writes and run() reports errors; std::cin, std::cout
+	// and std::cerr by default
+	void setInput(std::istream& stream) { in = &stream; }
+	void setOutput(std::ostream& stream) { out = &stream; }
+	void setErrors(std::ostream& stream) { err = &stream; }
+
+	// makes this machine use up the same --max-steps / --timeout-ms / --max-memory as `other`
+	void shareLimits(const Machine& other) { fuel = other.fuel; }
+
+	// A copy of the limits whose cancel() stops this machine's run within a few thousand steps.
+	limit::Fuel canceller()
+	{
+		fuel.watch();
+		return fuel;
+	}
+
+	// Runs Funcs[func] on `args` to completion, on the task scheduler if the program uses
+	// tasks, and leaves the machine ready for the next call. False on error; otherwise `result`
+	// is what it returned, or `exited` is set when it ran exit.
+	bool call(std::int32_t func, std::vector<Value> args, Value& result, bool& exited)
+	{
+		exited = false;
+		if (prog.UsesTasks) { return runTasks(func, std::move(args), result, exited); }
+		stack = std::move(args);
+		const bool ok = enter(func, 0)
+			and (frames.empty() or (option.ProfileOps ? execute<true, false>() : execute<false, false>()));
+		exited = ok and not frames.empty();
+		if (ok and not exited) { result = std::move(stack.back()); }
+		stack.clear();
+		frames.clear();
+		memoKeys.clear();
+		return ok;
+	}
+
+private:
+	// Applies a binary operator to two Nums; false (with the error set) on division by zero.
+	bool arith(OpCode op, std::int_fast64_t l, std::int_fast64_t r, std::int_fast64_t& res)
+	{
+		switch (op) {
+		case OpCode::Add: res = l + r; break;
+		case OpCode::Sub: res = l - r; break;
+		case OpCode::Mul: res = l * r; break;
+		case OpCode::Div:
+			if (r == 0) { return fail("division by zero"); }
+			res = l / r;
+			break;
+		case OpCode::Mod:
+			if (r == 0) { return fail("division by zero"); }
+			res = l % r;
+			break;
+		case OpCode::Eq: res = l == r; break;
+		case OpCode::Ne: res = l != r; break;
+		case OpCode::Lt: res = l < r; break;
+		case OpCode::Gt: res = l > r; break;
+		case OpCode::Le: res = l <= r; break;
+		case OpCode::Ge: res = l >= r; break;
+		case OpCode::And: res = l && r; break;
+		case OpCode::Or: res = l || r; break;
+		default: break;
+		}
+		return true;
+	}
+
+	// the operands of a superinstruction: local A and local B, or local A and Nums[B]
+	bool fusedOperands(const Instr& ins, std::uint32_t base, bool local, std::int_fast64_t& res)
+	{
+		const auto& lhs = stack[base + ins.A];
+		if (local)
+		{
+			const auto& rhs = stack[base + ins.B];
+			return checkNum(lhs, rhs, ins.Sub) and arith(ins.Sub, lhs.Num, rhs.Num, res);
+		}
+		return checkNum(lhs, Value(prog.Nums[ins.B]), ins.Sub) and arith(ins.Sub, lhs.Num, prog.Nums[ins.B], res);
+	}
+
+	// ================
+	//  I/O and tasks
+	// ================
+	// Kept out of execute(): a computed goto out of a handler skips the destructors of its
+	// locals, and these hold locks and shared objects. Workers take turns on the input and
+	// output streams.
+
+	bool print(const Value& val)
+	{
+		std::unique_lock<std::mutex> io{};
+		if (sched) { io = std::unique_lock<std::mutex>(sched->IoM); }
+		if (val.Type == ValueType::Num) { *out << val.Num << '\n'; }
+		else if (val.Type == ValueType::Str) { *out << *val.Str << '\n'; }
+		else { return fail(std::string("cannot print a ") + TypeName(val.Type)); }
+		return true;
+	}
+
+	// reads into a Num or Str variable
+	void scan(Value& slot)
+	{
+		std::unique_lock<std::mutex> io{};
+		if (sched) { io = std::unique_lock<std::mutex>(sched->IoM); }
+		if (slot.Type == ValueType::Num)
+		{
+			*in >> slot.Num;
+			return;
+		}
+		std::string tmp;
+		*in >> tmp;
+		slot.Str = std::make_shared<const std::string>(std::move(tmp));
+	}
+
+	void spawn(const Instr& ins)
+	{
+		auto task = std::make_shared<Task>();
+		task->Func = ins.A;
+		task->Stack.assign(std::make_move_iterator(std::end(stack) - ins.B), std::make_move_iterator(std::end(stack)));
+		stack.resize(stack.size() - ins.B);
+		sched->push(task);
+		stack.emplace_back(ValueType::Task, std::move(task));
+	}
+
+	// Await / MakeChan / Send / Recv at pc - 1. False on error; sets `halt` to Block when the
+	// task has to wait, leaving the stack as it was so the instruction runs again on resume.
+	bool taskOp(OpCode op, std::uint32_t pc)
+	{
+		if (op == OpCode::MakeChan)
+		{
+			auto& val = stack.back();
+			if (val.Type != ValueType::Num) { return fail(std::string("chan expects a Num capacity, got ") + TypeName(val.Type)); }
+			if (val.Num < 1) { return fail("channel capacity must be at least 1, got " + std::to_string(val.Num)); }
+			val = Value(ValueType::Chan, std::make_shared<Channel>(static_cast<std::size_t>(val.Num)));
+			return true;
+		}
+		if (op == OpCode::Await)
+		{
+			auto& val = stack.back();
+			if (val.Type != ValueType::Task) { return fail(std::string("await expects a Task, got ") + TypeName(val.Type)); }
+			auto& task = static_cast<Task&>(*val.Obj);
+			std::unique_lock<std::mutex> lock(task.M);
+			if (not task.Done) { return block(val.Obj, task.Awaiters, task.Version, pc); }
+			Value res = task.Result;
+			lock.unlock();
+			val = std::move(res);
+			return true;
+		}
+		// the channel is below the value for Send, on top for Recv
+		auto& val = stack[stack.size() - (op == OpCode::Send ? 2 : 1)];
+		if (val.Type != ValueType::Chan)
+		{
+			return fail(std::string(op == OpCode::Send ? "send" : "recv") + " expects a Chan, got " + TypeName(val.Type));
+		}
+		auto& chan = static_cast<Channel&>(*val.Obj);
+		TaskQueue waiters{};
+		Value res{};
+		{
+			std::lock_guard<std::mutex> lock(chan.M);
+			if (op == OpCode::Send)
+			{
+				if (chan.Buf.size() >= chan.Cap) { return block(val.Obj, chan.Senders, chan.Version, pc); }
+				chan.Buf.push_back(std::move(stack.back()));
+			}
+			else
+			{
+				if (chan.Buf.empty()) { return block(val.Obj, chan.Receivers, chan.Version, pc); }
+				res = std::move(chan.Buf.front());
+				chan.Buf.pop_front();
+			}
+			chan.Version++;
+			// a value for one receiver, or room for one sender
+			auto& other = op == OpCode::Send ? chan.Receivers : chan.Senders;
+			if (not other.empty())
+			{
+				waiters.push_back(std::move(other.front()));
+				other.pop_front();
+			}
+		}
+		sched->wake(waiters);
+		if (op == OpCode::Send) { stack.pop_back(); }
+		stack.back() = std::move(res);
+		return true;
+	}
+
+	void count(OpCode op)
+	{
+		const std::uint64_t cur = static_cast<std::uint8_t>(op);
+		profile.Ops[cur]++;
+		std::uint64_t seq = cur;
+		for (int len = 2; len <= 4 and len <= profile.Last + 1; len++)
+		{
+			seq |= profile.Prev[len - 2] << (8 * (len - 1));
+			profile.Seqs[static_cast<std::uint64_t>(len) << 32 | seq]++;
+		}
+		profile.Prev[2] = profile.Prev[1];
+		profile.Prev[1] = profile.Prev[0];
+		profile.Prev[0] = cur;
+		if (profile.Last < 3) { profile.Last++; }
+	}
+
+	void reportProfile(std::ostream& out) const
+	{
+		auto top = [&](std::vector<std::pair<std::uint64_t, std::uint64_t>> items, const char* title, bool seq)
+		{
+			std::sort(std::begin(items), std::end(items), [](const auto& l, const auto& r) { return l.second > r.second; });
+			out << title << '\n';
+			for (std::size_t i{}; i < items.size() and i < 10; i++)
+			{
+				out << '\t' << items[i].second << '\t';
+				const int len = seq ? static_cast<int>(items[i].first >> 32) : 1;
+				for (int k = len - 1; k >= 0; k--)
+				{
+					out << OpName(static_cast<OpCode>((items[i].first >> (8 * k)) & 0xff)) << (k ? "; " : "\n");
+				}
+			}
+		};
+		std::vector<std::pair<std::uint64_t, std::uint64_t>> ops{}, seqs{};
+		for (std::size_t i{}; i < profile.Ops.size(); i++)
+		{
+			if (profile.Ops[i]) { ops.emplace_back(i, profile.Ops[i]); }
+		}
+		top(ops, "most executed instructions:", false);
+		for (int len = 2; len <= 4; len++)
+		{
+			seqs.clear();
+			for (const auto& [key, cnt] : profile.Seqs)
+			{
+				if (static_cast<int>(key >> 32) == len) { seqs.emplace_back(key, cnt); }
+			}
+			top(seqs, ("most executed sequences of " + std::to_string(len) + ":").c_str(), true);
+		}
+	}
+
+	// With NOH_VM_THREADED every handler jumps straight to the next one through a label table
+	// (GCC/Clang computed goto); otherwise the same handlers are the cases of a switch.
+	// With Tasks it runs the current task from frames.back().Pc until it finishes, blocks,
+	// exits or has used up its time slice; see `halt`.
+	template<bool Profile, bool Tasks>
+	bool execute()
+	{
+		const Instr* code = prog.Funcs[frames.back().Func].Code.data();
+		std::uint32_t pc = frames.back().Pc;
+		std::uint32_t base = frames.back().Base;
+		const Instr* ins = nullptr;
+
+		auto reload = [&]()
+		{
+			code = prog.Funcs[frames.back().Func].Code.data();
+			pc = frames.back().Pc;
+			base = frames.back().Base;
+		};
+
+// a point where a task may use up its time slice; pc and the frames are consistent here
+// a loop back edge or a call: --max-steps / --timeout-ms / --max-memory are checked here
+#define NOH_TICK() do { if (not fuel.tick()) { return fail(fuel.message()); } } while (false)
+#define NOH_SLICE() do { if constexpr (Tasks) { if (--budget == 0) { frames.back().Pc = pc; halt = Halt::Yield; return true; } } } while (false)
+#if NOH_VM_THREADED
+		// in OpCode order
+		static const void* const labels[] = {
+			&&L_PushNum, &&L_PushStr, &&L_MakeTuple, &&L_Load, &&L_Store, &&L_ReStore, &&L_Pop,
+			&&L_Add, &&L_Sub, &&L_Mul, &&L_Div, &&L_Mod,
+			&&L_Eq, &&L_Ne, &&L_Lt, &&L_Gt, &&L_Le, &&L_Ge,
+			&&L_And, &&L_Or,
+			&&L_Not, &&L_Neg, &&L_BitNot,
+			&&L_IdxAt,
+			&&L_Jump, &&L_JumpIfFalse, &&L_JumpIfTrue,
+			&&L_Call, &&L_TailCall, &&L_Ret,
+			&&L_Print, &&L_ScanNum, &&L_ScanStr, &&L_Exit,
+			&&L_Spawn, &&L_Await, &&L_MakeChan, &&L_Send, &&L_Recv,
+			&&L_BinLL, &&L_BinLK, &&L_StoreLL, &&L_StoreLK, &&L_ReStoreLL, &&L_ReStoreLK,
+			&&L_CmpJump, &&L_CmpJumpLL, &&L_CmpJumpLK,
+		};
+		static_assert(std::size(labels) == static_cast<std::size_t>(OpCode::CmpJumpLK) + 1, "one label per OpCode");
+#define NOH_OP(name) L_##name:
+#define NOH_NEXT() do { ins = &code[pc++]; if constexpr (Profile) { count(ins->Op); } goto *labels[static_cast<std::uint8_t>(ins->Op)]; } while (false)
+		NOH_NEXT();
+#else
+#define NOH_OP(name) case OpCode::name:
+#define NOH_NEXT() continue
+		while (true)
+		{
+			ins = &code[pc++];
+			if constexpr (Profile) { count(ins->Op); }
+			switch (ins->Op) {
+#endif
+			NOH_OP(PushNum)
+				stack.emplace_back(prog.Nums[ins->A]);
+				NOH_NEXT();
+			NOH_OP(PushStr)
+				stack.emplace_back(prog.Strs[ins->A]);
+				NOH_NEXT();
+			NOH_OP(MakeTuple)
+			{
+				auto tpl = std::make_shared<Tuple>(
+					std::make_move_iterator(std::end(stack) - ins->A),
+					std::make_move_iterator(std::end(stack)));
+				stack.resize(stack.size() - ins->A);
+				stack.emplace_back(std::shared_ptr<const Tuple>(std::move(tpl)));
+				NOH_NEXT();
+			}
+			NOH_OP(Load)
+				stack.push_back(stack[base + ins->A]);
+				NOH_NEXT();
+			NOH_OP(Store)
+				stack[base + ins->A] = std::move(stack.back());
+				stack.pop_back();
+				NOH_NEXT();
+			NOH_OP(ReStore)
+			{
+				auto& slot = stack[base + ins->A];
+				if (slot.Type != stack.back().Type)
+				{
+					return fail(std::string("cannot assign ") + TypeName(stack.back().Type) + " to a " + TypeName(slot.Type) + " variable");
+				}
+				slot = std::move(stack.back());
+				stack.pop_back();
+				NOH_NEXT();
+			}
+			NOH_OP(Pop)
+				stack.pop_back();
+				NOH_NEXT();
+
+			NOH_OP(Add) NOH_OP(Sub) NOH_OP(Mul) NOH_OP(Div) NOH_OP(Mod)
+			NOH_OP(Eq) NOH_OP(Ne) NOH_OP(Lt) NOH_OP(Gt) NOH_OP(Le) NOH_OP(Ge)
+			NOH_OP(And) NOH_OP(Or)
+			{
+				const auto& rhs = stack.back();
+				auto& lhs = stack[stack.size() - 2];
+				std::int_fast64_t res = 0;
+				if (not checkNum(lhs, rhs, ins->Op) or not arith(ins->Op, lhs.Num, rhs.Num, res)) { return false; }
+				stack.pop_back();
+				stack.back() = Value(res);
+				NOH_NEXT();
+			}
+			NOH_OP(Not) NOH_OP(Neg) NOH_OP(BitNot)
+			{
+				auto& val = stack.back();
+				if (val.Type != ValueType::Num)
+				{
+					return fail(std::string("operator ") + OpName(ins->Op) + " expects Num, got " + TypeName(val.Type));
+				}
+				val.Num = ins->Op == OpCode::Not ? static_cast<std::int_fast64_t>(not val.Num)
+					: ins->Op == OpCode::Neg ? -val.Num : ~val.Num;
+				NOH_NEXT();
+			}
+			NOH_OP(IdxAt)
+			{
+				const auto& idx = stack.back();
+				const auto& tpl = stack[stack.size() - 2];
+				if (tpl.Type != ValueType::Tpl or idx.Type != ValueType::Num)
+				{
+					return fail(std::string("cannot index ") + TypeName(tpl.Type) + " with " + TypeName(idx.Type));
+				}
+				if (idx.Num < 0 or static_cast<std::size_t>(idx.Num) >= tpl.Tpl->size())
+				{
+					return fail("tuple index " + std::to_string(idx.Num) + " out of range");
+				}
+				Value elm = (*tpl.Tpl)[idx.Num];
+				stack.pop_back();
+				stack.back() = std::move(elm);
+				NOH_NEXT();
+			}
+
+			NOH_OP(Jump)
+				pc = ins->A;
+				NOH_TICK();
+				NOH_SLICE();
+				NOH_NEXT();
+			NOH_OP(JumpIfFalse)
+			{
+				const bool cond = isTrue(stack.back());
+				stack.pop_back();
+				if (not cond) { pc = ins->A; }
+				NOH_NEXT();
+			}
+			NOH_OP(JumpIfTrue)
+			{
+				const bool cond = isTrue(stack.back());
+				stack.pop_back();
+				if (cond) { pc = ins->A; }
+				NOH_NEXT();
+			}
+
+			NOH_OP(Call)
+			{
+				NOH_TICK();
+				frames.back().Pc = pc;
+				const auto argBase = static_cast<std::uint32_t>(stack.size() - ins->B);
+				const auto depth = frames.size();
+				if (not enter(ins->A, argBase)) { return false; }
+				if (frames.size() != depth) { reload(); }
+				NOH_SLICE();
+				NOH_NEXT();
+			}
+			NOH_OP(TailCall)
+			{
+				NOH_TICK();
+				if (frames.back().Memo >= 0)
+				{
+					// the result still has to be cached for this frame: call normally, the next Ret returns it
+					frames.back().Pc = pc;
+					const auto argBase = static_cast<std::uint32_t>(stack.size() - ins->B);
+					const auto depth = frames.size();
+					if (not enter(ins->A, argBase)) { return false; }
+					if (frames.size() != depth) { reload(); }
+					NOH_NEXT();
+				}
+				const auto argBase = stack.size() - ins->B;
+				for (std::int32_t i{}; i < ins->B; i++)
+				{
+					stack[base + i] = std::move(stack[argBase + i]);
+				}
+				stack.resize(base + ins->B);
+				frames.pop_back();
+				const auto depth = frames.size();
+				if (not enter(ins->A, base)) { return false; }
+				// on a memo hit the callee's result is this frame's result
+				if (frames.size() == depth and frames.empty()) { return true; }
+				reload();
+				NOH_SLICE();
+				NOH_NEXT();
+			}
+			NOH_OP(Ret)
+			{
+				Value ret = std::move(stack.back());
+				const Frame frame = frames.back();
+				frames.pop_back();
+				if (frame.Memo >= 0)
+				{
+					std::unique_lock<std::mutex> lock{};
+					if constexpr (Tasks) { lock = std::unique_lock<std::mutex>(sched->MemoM); }
+					memos[frame.Func].insert(memoKeys[frame.Memo], ret);
+					memoKeys.pop_back();
+				}
+				stack.resize(frame.Base);
+				stack.push_back(std::move(ret));
+				if (frames.empty()) { return true; }
+				reload();
+				NOH_NEXT();
+			}
+
+			NOH_OP(Print)
+				if (not print(stack.back())) { return false; }
+				stack.pop_back();
+				NOH_NEXT();
+			NOH_OP(ScanNum)
+			{
+				auto& slot = stack[base + ins->A];
+				if (slot.Type != ValueType::Num) { return fail("scanNum expects a Num variable"); }
+				scan(slot);
+				NOH_NEXT();
+			}
+			NOH_OP(ScanStr)
+			{
+				auto& slot = stack[base + ins->A];
+				if (slot.Type != ValueType::Str) { return fail("scanStr expects a Str variable"); }
+				scan(slot);
+				NOH_NEXT();
+			}
+			NOH_OP(Exit)
+				if constexpr (Tasks) { halt = Halt::Exit; }
+				return true;
+
+			NOH_OP(Spawn)
+				spawn(*ins);
+				NOH_NEXT();
+			NOH_OP(Await) NOH_OP(MakeChan) NOH_OP(Send) NOH_OP(Recv)
+				if (not taskOp(ins->Op, pc)) { return false; }
+				if (halt == Halt::Block) { return true; }
+				NOH_NEXT();
+
+			NOH_OP(BinLL) NOH_OP(BinLK)
+			{
+				std::int_fast64_t res = 0;
+				if (not fusedOperands(*ins, base, ins->Op == OpCode::BinLL, res)) { return false; }
+				stack.emplace_back(res);
+				NOH_NEXT();
+			}
+			NOH_OP(StoreLL) NOH_OP(StoreLK)
+			{
+				std::int_fast64_t res = 0;
+				if (not fusedOperands(*ins, base, ins->Op == OpCode::StoreLL, res)) { return false; }
+				stack[base + ins->C] = Value(res);
+				NOH_NEXT();
+			}
+			NOH_OP(ReStoreLL) NOH_OP(ReStoreLK)
+			{
+				std::int_fast64_t res = 0;
+				if (not fusedOperands(*ins, base, ins->Op == OpCode::ReStoreLL, res)) { return false; }
+				auto& slot = stack[base + ins->C];
+				if (slot.Type != ValueType::Num)
+				{
+					return fail(std::string("cannot assign Num to a ") + TypeName(slot.Type) + " variable");
+				}
+				slot.Num = res;
+				NOH_NEXT();
+			}
+			NOH_OP(CmpJump)
+			{
+				const auto& rhs = stack.back();
+				const auto& lhs = stack[stack.size() - 2];
+				std::int_fast64_t res = 0;
+				if (not checkNum(lhs, rhs, ins->Sub) or not arith(ins->Sub, lhs.Num, rhs.Num, res)) { return false; }
+				stack.resize(stack.size() - 2);
+				if (not res) { pc = ins->A; }
+				NOH_NEXT();
+			}
+			NOH_OP(CmpJumpLL) NOH_OP(CmpJumpLK)
+			{
+				std::int_fast64_t res = 0;
+				if (not fusedOperands(*ins, base, ins->Op == OpCode::CmpJumpLL, res)) { return false; }
+				if (not res) { pc = ins->C; }
+				NOH_NEXT();
+			}
+#if not NOH_VM_THREADED
+			}
+		}
+#endif
+#undef NOH_TICK
+#undef NOH_SLICE
+#undef NOH_OP
+#undef NOH_NEXT
+	}
+};
+
+} // namespace vm
+} // namespace Noh
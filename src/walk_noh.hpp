@@ -0,0 +1,124 @@
+#pragma once
+
+#include <vector>
+
+#include "ast_noh.hpp"
+
+namespace Noh {
+namespace ast {
+
+// Calls `fn(stmt)` on every statement of `stmts`, nested blocks included.
+template<class Fn>
+void ForEachStmt(std::vector<BaseAst*>& stmts, Fn&& fn)
+{
+	for (auto& stmt : stmts)
+	{
+		fn(stmt);
+		switch (stmt->getID()) {
+		case IfStmtID:
+			ForEachStmt(static_cast<IfStmtAst*>(stmt)->getThenStmt(), fn);
+			ForEachStmt(static_cast<IfStmtAst*>(stmt)->getElseStmt(), fn);
+			break;
+		case WhileStmtID:
+			ForEachStmt(static_cast<WhileStmtAst*>(stmt)->getLoopStmt(), fn);
+			break;
+		case ForStmtID:
+			ForEachStmt(static_cast<ForStmtAst*>(stmt)->getStmts(), fn);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Calls `fn(expr, isCond)` on every expression slot of `stmts`, nested blocks included.
+// `isCond` marks if / while conditions, where the evaluator only takes numeric expressions.
+// A task statement such as `send(c, v);` is itself the slot.
+template<class Fn>
+void ForEachExpr(std::vector<BaseAst*>& stmts, Fn&& fn)
+{
+	for (auto& stmt : stmts)
+	{
+		switch (stmt->getID()) {
+		case BuiltinID:
+		{
+			auto builtin = static_cast<BuiltinAst*>(stmt);
+			// scanNum / scanStr take variables, not values
+			if (builtin->getName() == "scanNum" or builtin->getName() == "scanStr") { break; }
+			for (auto& arg : builtin->getArgs()) { fn(arg, false); }
+			break;
+		}
+		case AssignID:
+			fn(static_cast<AssignAst*>(stmt)->getVal(), false);
+			break;
+		case ReAssignID:
+			fn(static_cast<ReAssignAst*>(stmt)->getVal(), false);
+			break;
+		case CallID:
+			for (auto& param : static_cast<CallAst*>(stmt)->getParams()) { fn(param, false); }
+			break;
+		case TaskID:
+			fn(stmt, false);
+			break;
+		case IfStmtID:
+		{
+			auto ifStmt = static_cast<IfStmtAst*>(stmt);
+			fn(ifStmt->getCond(), true);
+			ForEachExpr(ifStmt->getThenStmt(), fn);
+			ForEachExpr(ifStmt->getElseStmt(), fn);
+			break;
+		}
+		case WhileStmtID:
+		{
+			auto whileStmt = static_cast<WhileStmtAst*>(stmt);
+			fn(whileStmt->getCond(), true);
+			ForEachExpr(whileStmt->getLoopStmt(), fn);
+			break;
+		}
+		case ForStmtID:
+		{
+			auto forStmt = static_cast<ForStmtAst*>(stmt);
+			fn(forStmt->getRange()->getFrom(), false);
+			fn(forStmt->getRange()->getTo(), false);
+			ForEachExpr(forStmt->getStmts(), fn);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+// Whether `stmts` contain a task or channel operation.
+inline bool UsesTasks(std::vector<BaseAst*>& stmts)
+{
+	bool res = false;
+	auto visit = [&](auto& self, BaseAst* ast) -> void
+	{
+		switch (ast->getID()) {
+		case TaskID:
+			res = true;
+			break;
+		case MonoExpID:
+			self(self, static_cast<MonoExpAst*>(ast)->getLhs());
+			break;
+		case BinaryExpID:
+			self(self, static_cast<BinaryExpAst*>(ast)->getLhs());
+			self(self, static_cast<BinaryExpAst*>(ast)->getRhs());
+			break;
+		case TupleID:
+			for (auto& elm : static_cast<TupleAst*>(ast)->Ary) { self(self, elm); }
+			break;
+		case CallID:
+			for (auto& param : static_cast<CallAst*>(ast)->getParams()) { self(self, param); }
+			break;
+		default:
+			break;
+		}
+	};
+	ForEachExpr(stmts, [&](BaseAst*& expr, bool) { visit(visit, expr); });
+	return res;
+}
+
+} // namespace ast
+} // namespace Noh
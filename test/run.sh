@@ -0,0 +1,31 @@
+# Runs every test/*.noh with ./NohEval and compares its output with the .out file next to it.
+# Options are passed to NohEval, e.g. `sh test/run.sh --stackless`; without them the tree walker runs.
+# A test can have a .args file with options of its own, added after those (its -O replaces a given one), and a .status file with
+# the exit code it expects (default 0). A test whose .args has --repl is a session: its .noh is the input.
+failed=0
+for src in test/*.noh; do
+	base="${src%.noh}"
+	args=""
+	input=/dev/null
+	status=0
+	if [ -f "$base.args" ]; then args=$(cat "$base.args"); fi
+	if [ -f "$base.status" ]; then status=$(cat "$base.status"); fi
+	given="$*"
+	case " $args " in
+	*" --repl "*) input="$src" ;;
+	*" -O"*|*" --opt"*)
+		# the test's own optimization level replaces the one given
+		given=$(echo " $*" | sed -e 's/ -O *[0-9]*//g' -e 's/ --opt[= ]*[0-9]*//g') ;;
+	esac
+	# the options are split into words on purpose
+	./NohEval $given $args "$src" < "$input" 2> /dev/null > "$base.actual"
+	code=$?
+	if [ "$code" -eq "$status" ] && cmp -s "$base.actual" "$base.out"; then
+		echo "ok   $src"
+	else
+		echo "FAIL $src (exit $code)"
+		failed=1
+	fi
+	rm -f "$base.actual"
+done
+exit $failed